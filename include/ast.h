@@ -134,7 +134,18 @@ void print_decl(decl* decl, int tab_level);
      *  kind = STMT_BLOCK \
      *  body = enclosed statements \
      * */ \
-    X(STMT_BLOCK, "BLOCK")
+    X(STMT_BLOCK, "BLOCK") \
+    /* A counted loop folding the values of an expression over arrays into a \
+     * variable, which codegen runs a vector of iterations at a time. It is \
+     * made by `vectorize_program()` in front of the loop it was found in, \
+     * which finishes what's left, such that: \
+     *  kind = STMT_VECTOR \
+     *  init_expr = index, counting up by 1 \
+     *  expr = limit the index stops short of \
+     *  next_expr = `acc op value`, with `op` one of `+` or `-` for a sum, \
+     *      or `<` (`>`) for a minimum (maximum) \
+     * */ \
+    X(STMT_VECTOR, "VECTOR")
 
 typedef enum {
     #define X(a, b) a,
@@ -224,6 +235,7 @@ void print_stmt(stmt* stmt, int tab_level);
     X(EXPR_IDENT, "ID") \
     X(EXPR_INDEX, "INDEX") \
     X(EXPR_FUN_CALL, "CALL") \
+    X(EXPR_ARG, "ARG") \
     X(EXPR_BOOL_LIT, "BOOL_LIT") \
     X(EXPR_CHAR_LIT, "CHAR_LIT") \
     X(EXPR_INT_LIT, "INT_LIT") \
@@ -242,6 +254,9 @@ __attribute__((unused)) static char* expr_t_str[] = {
     #undef X
 };
 
+/* The arguments of an EXPR_FUN_CALL (`right`) and the items of an EXPR_ARRAY
+ * (`left`) are lists of EXPR_ARG, each holding one in `left` and the rest of
+ * the list in `right`. */
 struct expr {
     expr_t kind;
     expr* left;
@@ -252,6 +267,9 @@ struct expr {
     /* Points to the symbol represented by this expression, if EXPR_IDENT. */
     symbol* symbol;
     int reg;
+    /* For EXPR_INDEX, set if the index is checked against the length of the
+     * array when the program runs (see `range_program()`). */
+    bool checked;
 };
 
 /* Function to create an expr. Not recommended to call this function directly.
@@ -271,8 +289,12 @@ expr* expr_int_lit(int value);
 expr* expr_bool_lit(bool value);
 expr* expr_char_lit(char value);
 expr* expr_str_lit(const char* value);
+/* true if evaluating `e` has no side effects (assignments, calls, etc.) */
+bool expr_is_pure(expr* e);
 /* for displaying the AST: */
 void print_expr(expr* expr, int tab_level);
+/* writes `e` to `f` as B-Minor source, for messages */
+void fprint_expr(FILE* f, expr* e);
 
 /**********************************************************************
  *                                TYPES                               *
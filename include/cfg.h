@@ -32,6 +32,11 @@ typedef struct {
     expr* condition;
     cfg_node* true_branch;
     cfg_node* false_branch;
+    /* set for the condition of a loop, whose `true_branch` leads back here */
+    bool loop;
+    /* set by codegen if the branch is generated as a conditional move, in
+     * which case both sides are single blocks sharing the same `next` */
+    bool select;
 } cfg_branch;
 
 /* differentiates between linear and branching nodes */
@@ -52,6 +57,12 @@ struct cfg_node {
     cfg_node_t kind;
     cfg_node* prev;
     union cfg_node_u value;
+    /* jump label of the node in generated code (-1 until one is needed) */
+    int label;
+    /* bookkeeping for walks over the graph: the last pass to visit the
+     * node, and whether the walk is still inside it */
+    int mark;
+    bool on_stack;
 };
 
 union cfg_u {
@@ -73,6 +84,10 @@ struct cfg {
     cfg* next;
 };
 
+/* the last pass number handed out for `cfg_node.mark` (take the next one
+ * with `++cfg_pass_count` to start a walk of your own) */
+extern int cfg_pass_count;
+
 /**********************************************************************
  *                              FUNCTIONS                             *
  **********************************************************************/
@@ -85,6 +100,8 @@ cfg_node* cfg_return_node();
 int cfg_set_true(cfg_node* node, cfg_node* true_branch);
 int cfg_set_false(cfg_node* node, cfg_node* false_branch);
 void cfg_push_back(cfg_node* branch, cfg_node* back);
+/* fills `succ` with the nodes control can flow to next, returning how many */
+int cfg_successors(cfg_node* node, cfg_node* succ[2]);
 
 /* construction */
 
@@ -97,4 +114,35 @@ void cfg_dead_code(stmt* s);
 cfg_node* cfg_for_loop(stmt* s);
 cfg_node* cfg_if_else(stmt* s);
 
+/* traversal */
+
+/* Returns every node reachable from `entry` (in depth-first order) as an
+ * array of `count` nodes. */
+cfg_node** cfg_nodes(cfg_node* entry, int* count);
+void cfg_collect(
+    cfg_node* node,
+    int pass,
+    cfg_node*** nodes,
+    int* count,
+    int* capacity
+);
+
+/* layout */
+
+/* Orders the nodes of a function for codegen, such that each node's most
+ * likely successor follows it wherever possible. Loops are rotated so that
+ * their condition sits at the bottom, and paths ending in an early `return`
+ * are moved out of the way. Returns an array of `count` nodes. */
+cfg_node** cfg_layout(cfg_node* entry, int* count);
+
+/* true if `node` leads straight to the end of the function */
+bool cfg_returns(cfg_node* node);
+void cfg_place(
+    cfg_node* node,
+    int pass,
+    cfg_node*** order,
+    int* count,
+    int* capacity
+);
+
 #endif
\ No newline at end of file
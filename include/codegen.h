@@ -6,7 +6,7 @@
  * flow graph and generates x86_64 Assembly.
  * 
  * Implementation of this header is separated into `codegen/codegen.c`,
- * `codegen/print.c`, and `codegen/utility.c`
+ * `codegen/print.c`, `codegen/utility.c`, and `codegen/vector.c`
  */
 #ifndef CODEGEN_H
 #define CODEGEN_H
@@ -21,16 +21,46 @@
  **********************************************************************/
 typedef struct {
     const char* name;
+    /* name of the low byte, for `SETcc` */
+    const char* byte_name;
     bool used;
+    /* whether functions using it have to save it for their caller */
+    bool callee_saved;
+    /* whether the function being generated has used it yet */
+    bool touched;
 } reg;
 
 typedef struct data_entry data_entry;
 
 struct data_entry {
-    const char* entry;
+    char* entry;
     data_entry* next;
 };
 
+/* arrays of zeros up to this many items are cleared with unrolled vector
+ * stores, rather than `REP STOSQ` */
+#define ARRAY_UNROLL_LIMIT 32
+
+/* in data, runs of at least this many of the same value are written with a
+ * repeat count, and otherwise this many values go on one line */
+#define DATA_REPEAT_MIN 4
+#define DATA_PER_LINE 8
+
+/* powers up to this constant are multiplied out without a loop */
+#define EXP_UNROLL_LIMIT 1024
+
+/* passed in place of a jump label to fall through to the next instruction */
+#define LABEL_FALLTHROUGH (-1)
+
+/* slots below `%rsp` a function that calls nothing may keep its locals and
+ * saved registers in, untouched by signal handlers (128 bytes) */
+#define RED_ZONE_SLOTS 16
+/* the most callee-saved scratch registers a function can need to save */
+#define MAX_SAVED 5
+
+/* `%xmm0` through `%xmm15` (or `%ymm`) */
+#define NUM_VECTOR 16
+
 /**********************************************************************
  *                              FUNCTIONS                             *
  **********************************************************************/
@@ -39,43 +69,199 @@ const char* symbol_address(symbol* s);
 
 /* for strings: */
 
-int add_str(const char* s, bool newline);
+/* adds string `s` to the data section, returning its label; like every
+ * string value, the label points at NUL-terminated characters preceded by
+ * their length (as a quadword) */
+int add_str(const char* s);
 const char* str_label(int label);
 
+/* for globals: */
+
+/* adds `size` bytes of zeros to `.bss` under `label`, which costs nothing in
+ * the object file */
+void add_bss(const char* label, int size, int align);
+
+/* for arrays: */
+
+/* Arrays can't be changed once created, so an array of constants is only
+ * ever stored once, in `.rodata`, and used from there. Others are built in
+ * the frame of the function creating them (see `array_storage()`). */
+
+/* adds `length` items of `array` (or zeros, for NULL) to `.rodata`,
+ * returning its label */
+int add_array(expr* array, int length);
+/* as `add_array()`, under `label`; items not known until runtime are 0 */
+void array_data(const char* label, expr* array, int length);
+const char* array_label(int label);
+/* the number of items in `array` with those left to be zero filled */
+int array_length(expr* array);
+/* true if every item of `array` is known at compile time: a literal, or a
+ * string literal, whose characters are (see `add_str()`) */
+bool array_is_constant(expr* array);
+/* true if every item of `array` is a literal zero */
+bool array_is_zero(expr* array);
+/* true if global `s` can be stored initialized to `value` (NULL if none)
+ * before the program runs, or else reports why not; shared by codegen and
+ * the VM */
+bool global_is_constant(symbol* s, expr* value);
+/* true for boolean, character and integer literals */
+bool is_literal(expr* e);
+
 /* for register allocation: */
 
 int scratch_alloc();
 void scratch_free(int r);
 const char* scratch_name(int r);
+const char* scratch_byte_name(int r);
 
 /* for jump labels: */
 
 int create_label();
 const char* label_name(int label);
+/* returns the label of a CFG node, creating it if it has none yet */
+int node_label(cfg_node* node);
+/* the condition code suffix (`Jcc`, `SETcc`, `CMOVcc`) for comparison `kind`
+ * holding (or not) */
+const char* condition_code(expr_t kind, bool negate);
 
 /* codegen: */
 
-void codegen(cfg* cfg);
+/* writes the assembly for the program `cfg` to `out` */
+void codegen(cfg* cfg, FILE* out);
 
 void cfg_codegen(cfg* cfg);
 
-void expr_bool_codegen(expr* e, const char* instruction, int true_label);
-void bool_val_codegen(expr* e, const char* instruction);
+/* jumps to `true_label` or `false_label` depending on boolean `e`, either of
+ * which may be `LABEL_FALLTHROUGH` */
+void cond_codegen(expr* e, int true_label, int false_label);
+void jump_codegen(expr_t kind, int true_label, int false_label);
+/* sets the flags on comparison `e`, returning the comparison the condition
+ * codes should test for (which differs from `e->kind` for strings) */
+expr_t compare_codegen(expr* e);
+void bool_val_codegen(expr* e);
+void bool_branch_codegen(expr* e);
+/* true if `e` is cheap and safe to evaluate even when its result is unused */
+bool expr_is_cheap(expr* e);
+/* true if branch `node` has the shape `if (c) x = a; else x = b;` (or no
+ * `else`) with cheap values, which `select_codegen()` generates as `CMOVcc` */
+bool is_select(cfg_node* node);
+void select_codegen(cfg_node* node);
+
+/* adds global `s`, with initial value `value` (or none), to the data */
+void global_codegen(symbol* s, expr* value);
 
 void decl_codegen(decl* d);
+/* gives each array built at runtime in `func` its slots in the frame, after
+ * the first `*frame_size`, which it increases to include them */
+void array_storage(cfg* func, int* frame_size);
+void array_storage_stmt(stmt* s, int* frame_size);
+void array_storage_expr(expr* e, int* frame_size);
+/* builds array `e`, which has items only known at runtime, in its slots */
+void array_init_codegen(expr* e);
 
+/* Saves only the callee-saved registers the body used, which are known
+ * once it's generated, so the body is generated first (see `tail_codegen()`
+ * for tail calls, which leave from the middle of it). A leaf function
+ * small enough keeps everything in the red zone, without a frame. */
 void func_codegen(cfg* func_decl);
+/* true if `func` makes no calls, so nothing else can use the stack below
+ * it while it runs */
+bool func_is_leaf(cfg* func);
+/* Whether `func` makes a call, going by `is_call`, which says whether an
+ * expression does (not counting its operands). Printing always calls into
+ * the runtime. */
+bool func_calls(cfg* func, bool (*is_call)(expr* e));
+bool stmt_calls(stmt* s, bool (*is_call)(expr* e));
+bool expr_calls(expr* e, bool (*is_call)(expr* e));
+/* `is_call` for any call: to a function, or into the runtime */
+bool expr_is_call(expr* e);
+/* copies the parameters of `func` into their slots */
+void params_codegen(cfg* func);
+/* restores the callee-saved registers and the caller's frame */
+void func_exit_codegen();
+/* Before a call, pushes the caller-saved scratch registers holding values
+ * (other than those in mask `dead`, which the call consumes), and pads the
+ * stack so it's aligned once `stack_args` arguments are pushed too.
+ * Returns the mask of registers pushed. */
+int caller_save_codegen(int dead, int stack_args);
+/* after the call, pops its `stack_args` arguments and undoes
+ * `caller_save_codegen()`, given what it returned */
+void caller_restore_codegen(int saved, int stack_args);
+/* jumps to `callee` from the end of the current function, through an exit
+ * generated after its body */
+void tail_codegen(const char* func_name, const char* callee);
 void func_body_codegen(const char* func_name, cfg_node* node);
+/* generates `node`, given the node laid out after it (or NULL if last) */
+void node_codegen(const char* func_name, cfg_node* node, cfg_node* next);
+/* jumps to `target` (NULL for the epilogue) unless it is `next` anyway */
+void goto_codegen(const char* func_name, cfg_node* target, cfg_node* next);
 
 void stmt_codegen(stmt* s, const char* func_name);
 void expr_codegen(expr* e);
+/* stops the program unless the index of checked EXPR_INDEX `e` (already in
+ * its register) is within the array */
+void bounds_check_codegen(expr* e);
+/* division (or modulo) by a constant, as a multiply by its reciprocal, or
+ * shifts for a power of 2, rather than `IDIV` */
+void div_const_codegen(expr* e);
+/* the magic number and shift of `div_const_codegen()` for divisor `d`,
+ * which is at least 3 and not a power of 2 */
+void div_magic(unsigned long long d, long long* magic, int* shift);
+/* `left ^ right` by square-and-multiply, in O(log right) multiplications */
+void exp_codegen(expr* e);
+/* as `exp_codegen()`, for a constant power from 0 to `EXP_UNROLL_LIMIT` */
+void exp_const_codegen(expr* e);
+/* evaluates the arguments of a call left to right and loads them,
+ * returning how many were left on the stack */
+int args_codegen(expr* args);
+/* true if `return e;` can jump to the function called by `e` rather than
+ * calling it, leaving the callee to return to our caller */
+bool is_tail_call(expr* e);
 
 /* print: */
 
+/* calls print routine `routine` of the runtime with the value in `reg` */
+void print_call_codegen(const char* routine, int reg);
 void print_bool(int reg);
 void print_char(int reg);
 void print_str_codegen(int reg);
 void print_str_lit_codegen(const char* s);
 void print_i_to_a(int reg);
 
+/* vectors: */
+
+/* runs the iterations of STMT_VECTOR `s` a vector at a time, for as long as
+ * a whole vector of them is left */
+void vector_codegen(stmt* s);
+/* true if `e` differs from one index to the next, false for what's put in
+ * every lane once up front */
+bool vector_varies(expr* e, symbol* index);
+/* puts every part of `e` that doesn't vary in a vector register of its own */
+void vector_leaves(expr* e, symbol* index);
+/* loads the address of every array `e` reads into a scratch register */
+void vector_bases(expr* e, symbol* index);
+/* frees the registers of `vector_leaves()` and `vector_bases()` */
+void vector_release(expr* e, symbol* index);
+/* computes `e` for the indexes from the one in scratch register `i` on,
+ * returning its vector register */
+int vector_expr(expr* e, symbol* index, int i);
+/* `dst = x * y`, lane by lane, where `dst` may be `x` */
+void vector_mul(int x, int y, int dst);
+/* folds `v` into `acc` as STMT_VECTOR reduction `kind` */
+void vector_combine(expr_t kind, int v, int acc);
+/* sets each lane of `mask` to all ones where `a > b`, else zero */
+void vector_greater(int a, int b, int mask);
+/* `acc = mask ? v : acc`, lane by lane, overwriting `v` (and `mask`) */
+void vector_select(int mask, int v, int acc);
+/* `dst = a op src` */
+void vector_op(const char* op, const char* src, int a, int dst);
+void vector_move(int src, int dst);
+/* `PSHUFD`, picking the 32-bit pieces of `src` by `order` */
+void vector_shuffle(int order, int src, int dst);
+/* copies scratch register `r` into every lane of `dst` */
+void vector_broadcast(int r, int dst);
+int vector_alloc();
+void vector_free(int r);
+const char* vector_name(int r);
+
 #endif
\ No newline at end of file
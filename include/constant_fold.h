@@ -10,13 +10,21 @@
 #define CONSTANT_FOLD_H
 
 #include "ast.h"
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 bool is_constant(expr* e);
-int pow_int(int a, int b);
+/* `a ^ b`, with the same (64-bit) results as `exp_codegen()` */
+int64_t pow_int(int a, int b);
 
 decl* constant_fold_decl(decl* d);
 stmt* constant_fold_stmt(stmt* s);
+/* merges the items of print list `s` that are constants into one string */
+void constant_fold_print(stmt* s);
+/* the text printed for constant `e`, or NULL if it isn't one */
+char* constant_text(expr* e);
 expr* constant_fold_expr(expr* e);
 
 #endif
\ No newline at end of file
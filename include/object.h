@@ -0,0 +1,391 @@
+/**********************************************************************
+ *                              OBJECT.H                              *
+ **********************************************************************
+ * This header defines types and functions for turning the assembly
+ * codegen generates into machine code without an outside assembler or
+ * linker: an ELF64 relocatable object, a static executable linked with
+ * the runtime, or the same loaded into memory and run in-process.
+ *
+ * Only the subset of AT&T syntax codegen itself generates is understood,
+ * and it is encoded exactly as the GNU assembler would encode it, so the
+ * two can be compared byte for byte (see `check_encoding()`).
+ *
+ * This is a text-level assembler: codegen still formats every instruction
+ * as text, which `assemble()` parses back. What it saves is running `as`
+ * and `ld` (and their temporary files), not the formatting and parsing,
+ * which are still paid on every compile.
+ *
+ * Implementation of this header is separated into `object/assemble.c`,
+ * `object/encode.c`, `object/elf.c`, `object/link.c`, `object/run.c`,
+ * and `object/check.c`
+ */
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include "hash.h"
+#include <elf.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**********************************************************************
+ *                               OBJECTS                              *
+ **********************************************************************/
+
+/* a place in a section to be filled in with a symbol's address */
+typedef struct {
+    uint64_t offset;
+    /* `R_X86_64_*` */
+    int type;
+    /* index into the object's symbols */
+    int symbol;
+    int64_t addend;
+} relocation;
+
+typedef struct {
+    char* name;
+    /* `SHT_PROGBITS`, `SHT_NOBITS`, ... */
+    int type;
+    /* `SHF_*` */
+    int flags;
+    int align;
+    /* the contents, or NULL for `SHT_NOBITS` */
+    unsigned char* bytes;
+    uint64_t size;
+    relocation* relocs;
+    int reloc_count;
+    /* the address the linker placed it at */
+    uint64_t address;
+} section;
+
+/* the section of symbols not defined in the object */
+#define SECTION_UNDEF (-1)
+/* the section of symbols whose value is an address itself */
+#define SECTION_ABS (-2)
+
+typedef struct {
+    char* name;
+    /* index into the object's sections, or `SECTION_UNDEF`/`SECTION_ABS` */
+    int section;
+    uint64_t value;
+    bool global;
+    /* the symbol of a section itself, which relocations against local
+     * symbols go through (as with the GNU assembler) */
+    bool is_section;
+} object_symbol;
+
+typedef struct {
+    /* the file it was read from, for messages */
+    const char* name;
+    section* sections;
+    int section_count;
+    object_symbol* symbols;
+    int symbol_count;
+} object;
+
+object* object_create(const char* name);
+void object_destroy(object* obj);
+/* returns the index of the section named `name`, adding it if there's none */
+int object_section(object* obj, const char* name, int type, int flags);
+int object_add_symbol(object* obj, const char* name, int section);
+void object_add_reloc(object* obj, int s, relocation r);
+/* grows section `s` by `length` bytes (copied from `bytes`, if not NULL and
+ * the section has contents) */
+void object_append(object* obj, int s, const void* bytes, uint64_t length);
+
+/**********************************************************************
+ *                              ASSEMBLER                             *
+ **********************************************************************/
+
+typedef enum {
+    OPERAND_REG,
+    OPERAND_VECTOR,
+    OPERAND_IMM,
+    OPERAND_MEM,
+    /* a jump or call target */
+    OPERAND_LABEL,
+} operand_t;
+
+typedef struct {
+    operand_t kind;
+    /* the register number (0-15), for `OPERAND_REG` and `OPERAND_VECTOR` */
+    int reg;
+    /* the register's size in bytes (1, 4, 8, 16 or 32) */
+    int size;
+    /* the immediate, or displacement of an `OPERAND_MEM` */
+    int64_t value;
+    /* for `OPERAND_MEM`, the registers (or -1), and the scale of `index` */
+    int base;
+    int index;
+    int scale;
+    bool rip;
+    /* the symbol of an `OPERAND_LABEL`, or added to a displacement */
+    const char* symbol;
+} operand;
+
+typedef enum {
+    /* the address of the symbol relative to the end of the field, less
+     * `trailing` bytes of immediate after it */
+    FIXUP_PC32,
+    /* as `FIXUP_PC32`, for a call (through the PLT if it's global) */
+    FIXUP_CALL,
+    /* the address itself, sign-extended */
+    FIXUP_ABS32S,
+    FIXUP_ABS64,
+} fixup_t;
+
+typedef struct {
+    fixup_t kind;
+    /* where the field starts in the encoding */
+    int at;
+    const char* symbol;
+    int64_t addend;
+} fixup;
+
+/* the longest x86-64 instruction */
+#define MAX_ENCODING 15
+
+typedef enum {
+    JUMP_NONE,
+    JUMP_ALWAYS,
+    JUMP_CONDITION,
+} jump_t;
+
+/* one instruction, encoded */
+typedef struct {
+    unsigned char bytes[MAX_ENCODING];
+    int length;
+    /* a symbol the instruction refers to, if `has_fixup` */
+    bool has_fixup;
+    fixup fix;
+    /* a jump is laid out by `assemble()` instead, as it's shorter when its
+     * target is near (`condition` being the `Jcc` condition code) */
+    jump_t jump;
+    int condition;
+    const char* target;
+} encoding;
+
+/* a line of assembly (or a label or piece of data), laid out in its
+ * section */
+typedef struct {
+    int section;
+    unsigned char* bytes;
+    int length;
+    fixup* fixups;
+    int fixup_count;
+    jump_t jump;
+    int condition;
+    const char* target;
+    /* for a jump, whether it's taken the 32-bit displacement yet */
+    bool far;
+    /* for `.balign`, the alignment (and `length` the padding) */
+    int align;
+    uint64_t offset;
+    /* where it came from, for messages */
+    int line;
+    const char* text;
+} asm_item;
+
+typedef struct {
+    object* obj;
+    asm_item* items;
+    int item_count;
+    int item_capacity;
+    /* the section being assembled into */
+    int section;
+    /* each symbol's index in `obj`, plus 1 (as values can't be NULL) */
+    ht* symbols;
+    /* for each symbol, the item it comes before (or -1 if undefined) */
+    int* defined_at;
+    int line;
+    int errors;
+} assembler;
+
+/* Assembles `text` (as codegen formats it) into a new object, or returns
+ * NULL having reported any errors. If `items` isn't NULL, the laid out
+ * lines are left there (and their count in `count`) for
+ * `check_encoding()`. */
+object* assemble(const char* text, const char* name, asm_item** items, int* count);
+void assemble_line(assembler* as, char* line);
+void assemble_directive(assembler* as, char* directive, char* args);
+void assemble_data(assembler* as, const void* bytes, int length);
+void assemble_label(assembler* as, const char* name);
+/* returns the index of symbol `name` in the object, adding it undefined */
+int assemble_symbol(assembler* as, const char* name);
+/* adds an item to the current section, returning it */
+asm_item* assemble_item(assembler* as);
+/* Lays out every item, starting from short jumps and lengthening those
+ * whose targets turn out to be too far (which only ever moves the others
+ * further apart), until none change. */
+void assemble_layout(assembler* as);
+/* writes the laid-out items to their sections, resolving the fixups that
+ * can be and turning the rest into relocations */
+bool assemble_emit(assembler* as);
+void assemble_fixup(assembler* as, asm_item* item, fixup* f, unsigned char* at);
+/* adds a relocation of `type` against symbol `sym` (through its section's
+ * symbol, if it's local) */
+void assemble_reloc(
+    assembler* as,
+    asm_item* item,
+    int at,
+    int type,
+    int sym,
+    int64_t addend
+);
+/* reports an error on the line being assembled */
+void assemble_error(assembler* as, const char* message, const char* what);
+/* the bytes of the string literal at `s` (escapes decoded), with its NUL */
+int assemble_string(const char* s, unsigned char* out);
+
+/**********************************************************************
+ *                               ENCODER                              *
+ **********************************************************************/
+
+/* Encodes instruction `mnemonic` with its (AT&T-ordered) operands `args`
+ * into `enc`, which refers to symbols in `args`. Returns false, having reported the error, if it isn't one
+ * codegen generates. */
+bool encode_instruction(const char* mnemonic, char* args, encoding* enc);
+/* splits comma-separated operands (outside of parentheses), in place */
+int encode_operands(char* args, operand* ops, int max);
+bool encode_operand(char* text, operand* op);
+/* the number and size of register `name` (without `%`), or -1 */
+int encode_register(const char* name, int* size, bool* vector);
+/* the condition code of suffix `cc` (`e`, `ne`, `l`, ...), or -1 */
+int encode_condition(const char* cc);
+
+void encode_byte(encoding* enc, int byte);
+void encode_imm(encoding* enc, int64_t value, int bytes);
+/* a REX prefix, if any of its bits are needed */
+void encode_rex(encoding* enc, bool w, int reg, operand* rm);
+/* ModRM (and SIB and displacement) for register field `reg` and operand
+ * `rm`, with `trailing` bytes of immediate still to follow */
+void encode_modrm(encoding* enc, int reg, operand* rm, int trailing);
+/* a legacy (non-VEX) instruction: `prefix` (or 0), REX, then `opcode` (of
+ * `length` bytes), then ModRM */
+void encode_op(
+    encoding* enc,
+    int prefix,
+    bool w,
+    const unsigned char* opcode,
+    int length,
+    int reg,
+    operand* rm,
+    int trailing
+);
+/* A VEX-encoded instruction: `pp` is its implied prefix (0 none, 1 `66`,
+ * 2 `F3`, 3 `F2`), `map` its opcode map (1 `0F`, 2 `0F38`, 3 `0F3A`), and
+ * `vvvv` the extra register operand (0 for none). The shorter two-byte
+ * form is used whenever it can be. */
+void encode_vex(
+    encoding* enc,
+    int pp,
+    int map,
+    bool w,
+    bool wide,
+    int vvvv,
+    int opcode,
+    int reg,
+    operand* rm,
+    int trailing
+);
+bool encode_fits8(int64_t value);
+bool encode_fits32(int64_t value);
+
+/**********************************************************************
+ *                                 ELF                                *
+ **********************************************************************/
+
+/* writes `obj` as an ELF64 relocatable object */
+bool elf_write(object* obj, FILE* out);
+/* reads the ELF64 relocatable object at `path`, or returns NULL having
+ * reported why not */
+object* elf_read(const char* path);
+
+/**********************************************************************
+ *                                LINKER                              *
+ **********************************************************************/
+
+/* where a static executable is loaded */
+#define LINK_BASE 0x400000
+#define LINK_PAGE 0x1000
+
+/* the segments sections are gathered into, in order */
+typedef enum {
+    SEGMENT_TEXT,
+    SEGMENT_RODATA,
+    SEGMENT_DATA,
+    SEGMENT_BSS,
+    NUM_SEGMENTS,
+} segment_t;
+
+/* Links `objects` into a static executable at `path`, starting at
+ * `_start`. Only sections loaded at runtime are kept (not even
+ * `.eh_frame`, with nothing to unwind the stack). */
+bool link_executable(object** objects, int count, const char* path);
+/* gives each section an address relative to the start of its segment,
+ * returning the size and alignment of every segment */
+void link_layout(
+    object** objects,
+    int count,
+    uint64_t* sizes,
+    uint64_t* aligns
+);
+/* moves the sections of each segment to start at `addresses[segment]` */
+void link_place(object** objects, int count, const uint64_t* addresses);
+/* fills in every relocation, now the sections are placed, returning the
+ * addresses of the global symbols by name (see `link_free()`), or NULL
+ * having reported what couldn't be resolved */
+ht* link_resolve(object** objects, int count);
+void link_free(ht* globals);
+/* the segment section `s` goes in, or -1 if it's left out */
+int link_segment(section* s);
+/* the address of symbol `i` of object `obj`, looking those it doesn't
+ * define up in `globals` (names to addresses) */
+bool link_address(ht* globals, object* obj, int i, uint64_t* address);
+/* fills in the relocations of section `s` of `obj`, now it's placed */
+bool link_relocate(ht* globals, object* obj, section* s);
+
+/**********************************************************************
+ *                               RUNNING                              *
+ **********************************************************************/
+
+/* a program linked into this process's memory */
+typedef struct {
+    unsigned char* memory;
+    size_t size;
+    /* the program's `main()`, and the runtime's `bm_flush()` to write out
+     * what it printed */
+    long (*main)(void);
+    void (*flush)(void);
+} run_image;
+
+/* Links `objects` into memory mapped for the purpose, in the low 2 GiB
+ * since code addresses its data absolutely. Code is made executable only
+ * once it has been written and is no longer writable. */
+bool run_load(object** objects, int count, run_image* image);
+/* as `run_load()`, but returning the address of every global symbol (to be
+ * freed with `link_free()`), or NULL if it couldn't be loaded, rather than
+ * looking for `main()` */
+ht* run_link(object** objects, int count, run_image* image);
+void run_unload(run_image* image);
+/* the time, in milliseconds from some fixed point */
+double run_clock(void);
+
+/**********************************************************************
+ *                            CROSS-CHECK                             *
+ **********************************************************************/
+
+/* Assembles `text` both with `assemble()` and with `as`, and compares the
+ * sections and relocations of the two, reporting the lines encoded
+ * differently. Returns true if they match. */
+bool check_encoding(const char* text, const char* name);
+bool check_section(object* ours, object* theirs, int s, asm_item* items, int count);
+/* what relocation `r` of `obj` refers to, as a symbol name and an offset
+ * from it, the same however the object names local symbols */
+void check_target(object* obj, relocation* r, const char** name, int64_t* offset);
+/* the item of section `s` covering `offset` */
+asm_item* check_item(asm_item* items, int count, int s, uint64_t offset);
+
+#endif
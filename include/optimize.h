@@ -0,0 +1,512 @@
+/**********************************************************************
+ *                             OPTIMIZE.H                             *
+ **********************************************************************
+ * This header defines types and functions for optimizations performed
+ * on the CFG after it has been constructed, before codegen. Unlike
+ * constant folding, which works on expressions alone, these work across
+ * whole functions or the whole program.
+ *
+ * Implementation of this header is separated by optimization into the
+ * files of `optimize/`. Each of them reports what it changed on stderr
+ * as `note:`s.
+ */
+#ifndef OPTIMIZE_H
+#define OPTIMIZE_H
+
+#include "ast.h"
+#include "cfg.h"
+#include "hash.h"
+#include "symbol.h"
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**********************************************************************
+ *                             CALL GRAPH                             *
+ **********************************************************************/
+
+typedef struct call_node call_node;
+typedef struct call_edge call_edge;
+typedef struct global_use global_use;
+
+/* a call from one function to another */
+struct call_edge {
+    call_node* callee;
+    /* the `EXPR_FUN_CALL` making the call */
+    expr* site;
+    call_edge* next;
+};
+
+/* a global variable read or written by a function */
+struct global_use {
+    symbol* symbol;
+    global_use* next;
+};
+
+/* A function in the call graph. The graph itself is the list of these
+ * linked through `next`, in the order the functions appear in the CFG. */
+struct call_node {
+    symbol* symbol;
+    cfg* func;
+    call_edge* calls;
+    global_use* globals;
+    /* number of call sites anywhere in the program calling this function */
+    int num_callers;
+    bool reachable;
+    /* strongly connected component (set of mutually recursive functions)
+     * the function belongs to, and bookkeeping for finding it */
+    int scc;
+    int index;
+    int lowlink;
+    bool on_stack;
+    call_node* next;
+};
+
+/* Builds the call graph of every function in `program`. */
+call_node* callgraph_construct(cfg* program);
+void callgraph_stmt(ht* funcs, call_node* caller, stmt* s);
+void callgraph_expr(ht* funcs, call_node* caller, expr* e);
+/* marks every function reachable through calls from `node` */
+void callgraph_reach(call_node* node);
+
+/* Removes functions that can never be called starting from `main`, and
+ * global variables no remaining function uses, from the CFG. Programs
+ * without a `main` are left as they are. Returns the new head of the CFG. */
+cfg* callgraph_prune(cfg* program, call_node* graph);
+
+/**********************************************************************
+ *                              INLINING                              *
+ **********************************************************************/
+
+/* Functions at most this size (see `inline_size()`) are always inlined. */
+#define INLINE_TINY 16
+/* Functions called from only one place are inlined up to this size. */
+#define INLINE_SINGLE_CALLER 256
+
+/* Inlines calls to small functions and functions with a single caller,
+ * working bottom-up over the strongly connected components of the call
+ * graph so callees are already inlined into by the time they're copied.
+ * Calls within a component (recursion) are never inlined. The call graph
+ * is out of date afterwards. */
+void inline_program(call_node* graph);
+void inline_scc(call_node* node, call_node*** stack, int* depth, int* index);
+void inline_func(call_node* caller, ht* funcs);
+
+/* rough cost of a function: the number of nodes, statements, and
+ * expressions in its body */
+int inline_size(cfg_node* entry);
+int inline_stmt_size(stmt* s);
+int inline_expr_size(expr* e);
+
+/* the callee of `call` if it may be inlined into `caller`, else NULL */
+call_node* inline_candidate(call_node* caller, ht* funcs, expr* call);
+
+/* Calls to functions whose whole body is `return <expr>;` are replaced by
+ * the expression itself, with arguments substituted for parameters. */
+void inline_exprs(call_node* caller, ht* funcs, expr* e);
+bool inline_expr_call(expr* call, call_node* callee);
+expr* inline_substitute(expr* e, ht* args);
+int inline_param_uses(expr* e, symbol* param, bool* assigned);
+
+/* Other calls are inlined by splitting the block containing them, and
+ * copying the callee's CFG in between with its parameters and locals
+ * turned into new locals of the caller. Returns the block holding the
+ * rest of the split block, or NULL if `block` had nothing to inline. */
+cfg_node* inline_block(call_node* caller, ht* funcs, cfg_node* block);
+/* the first call `s` makes, or NULL if there is none or if it can't be
+ * moved in front of the rest of the statement */
+expr* inline_first_call(stmt* s);
+expr* inline_find_call(expr* e, bool* safe, bool conditional);
+cfg_node* inline_clone(
+    call_node* callee,
+    symbol* caller,
+    ht* symbols,
+    symbol* result,
+    cfg_node* rest
+);
+stmt* inline_clone_stmt(stmt* s, symbol* caller, ht* symbols, symbol* result);
+expr* inline_clone_expr(expr* e, symbol* caller, ht* symbols);
+/* the local of `caller` standing in for `s` from the callee */
+symbol* inline_symbol(symbol* s, symbol* caller, ht* symbols);
+symbol* inline_local(symbol* caller, type* type, const char* name);
+/* a key identifying a pointer in a `ht` */
+const char* ptr_key(const void* p);
+
+/**********************************************************************
+ *                           TAIL RECURSION                           *
+ **********************************************************************/
+
+/* what a `return` does with recursion */
+typedef enum {
+    /* nothing */
+    TAIL_NONE,
+    /* `return f(...)`, calling the function it's in */
+    TAIL_CALL,
+    /* `return x op f(...)` (or `f(...) op x`) with `op` one of `+`, `*` */
+    TAIL_ACCUMULATE,
+    /* anything else recursive, like `return f(a) + f(b)` */
+    TAIL_BLOCKED
+} tail_t;
+
+typedef struct {
+    cfg_node* block;
+    /* the statement before the `return` in `block`, if any */
+    stmt* prev;
+    stmt* ret;
+    tail_t kind;
+    /* the recursive call, and for `TAIL_ACCUMULATE` the other operand */
+    expr* call;
+    expr* rest;
+} tail_return;
+
+/* Turns tail calls a function makes to itself into jumps back to its start
+ * after reassigning the parameters, so it runs in constant stack space.
+ * Simple linear recursions like `return n * f(n - 1);` are first rewritten
+ * to carry their result in an accumulator, making the call a tail call.
+ * Tail calls to other functions are left to codegen (see `is_tail_call()`),
+ * which reuses the caller's frame for them. */
+void tail_program(cfg* program);
+void tail_func(cfg* func);
+tail_t tail_classify(cfg* func, expr* e, expr** call, expr** rest);
+/* true if `call` calls `func` */
+bool tail_is_self(cfg* func, expr* call);
+/* true if `e` makes any call to `func` */
+bool tail_calls_self(cfg* func, expr* e);
+/* true if `e` only reads locals, so nothing a call does can change it */
+bool tail_is_local(expr* e);
+/* the statements setting `func`'s parameters to `args` as if passed */
+stmt* tail_assign_params(cfg* func, expr* args);
+bool tail_reads(expr* e, symbol* s);
+/* an identifier already resolved to `s` */
+expr* tail_ident(symbol* s);
+
+/**********************************************************************
+ *                        VALUE RANGE ANALYSIS                        *
+ **********************************************************************/
+
+/* a node's values are widened after growing this many times, so that loops
+ * settle without going around once per value a variable takes */
+#define RANGE_WIDEN 3
+/* rounds of narrowing after widening, to win back loop bounds */
+#define RANGE_NARROW 2
+
+/* the values an integer may have, from `lo` to `hi` inclusive */
+typedef struct {
+    long long lo;
+    long long hi;
+} range;
+
+typedef struct {
+    cfg* func;
+    /* the slot of each integer local and parameter in an array of ranges,
+     * keyed by `ptr_key()` */
+    ht* vars;
+    int count;
+    /* the index of each node in `in`, keyed by `ptr_key()` */
+    ht* nodes;
+    /* the ranges at the start of each node, NULL while it's unreached */
+    range** in;
+    /* set for the headers of loops, the only nodes whose ranges are
+     * widened, and the number of times each node's ranges have grown */
+    bool* header;
+    int* grown;
+    bool widen;
+    bool changed;
+    /* the node being run, and whether it sends its ranges only along the
+     * edges going back (-1) or forward (1) in the order nodes are run, or
+     * along every edge (0) */
+    int current;
+    int edges;
+    /* set for the last walk, which decides which indexes are checked */
+    bool mark;
+} range_state;
+
+/* Inserts bounds checks on array indexing (see `expr.checked`), leaving out
+ * those the index is proven to pass. The proof comes from the ranges of the
+ * integer locals and parameters at each point in a function, which are
+ * found by dataflow over the CFG: assignments set them, arithmetic carries
+ * them, and the comparisons branches test narrow them on each side, so an
+ * `i` counting up from 0 while `i < 10` is known to be in [0, 9] inside the
+ * loop. Only arrays declared with a length can be checked. */
+void range_program(cfg* program);
+void range_func(cfg* func);
+/* puts the nodes reachable from `node` in reverse postorder, filling `order`
+ * backwards from before `*first` */
+void range_order(cfg_node* node, int pass, cfg_node** order, int* first);
+/* numbers the integer locals and parameters `e` uses */
+void range_vars_stmt(stmt* s, range_state* state);
+void range_vars_expr(expr* e, range_state* state);
+/* the slot of `s` in an array of ranges, or -1 if it isn't tracked */
+int range_slot(symbol* s, range_state* state);
+/* runs `node` on `vars`, handing the result to its successors */
+void range_node(cfg_node* node, range* vars, range_state* state);
+/* joins `vars` into the ranges at the start of `target` */
+void range_send(cfg_node* target, range* vars, range_state* state);
+void range_stmt(stmt* s, range* vars, range_state* state);
+/* the range of `e`, applying its assignments to `vars` */
+range range_expr(expr* e, range* vars, range_state* state);
+/* narrows `vars` to where `cond` has value `sense`, returning false if it
+ * never can */
+bool range_refine(expr* cond, bool sense, range* vars, range_state* state);
+/* narrows the variable `e` to values `op` relates to `r` */
+bool range_constrain(
+    expr* e,
+    expr_t op,
+    range r,
+    range* vars,
+    range_state* state
+);
+/* decides whether `index` needs checking, given the range of its index */
+void range_check(expr* index, range r, range_state* state);
+
+range range_full();
+range range_join(range a, range b);
+range range_add(range a, range b);
+range range_sub(range a, range b);
+range range_mul(range a, range b);
+range range_div(range a, range b);
+range range_mod(range a, range b);
+/* a copy of the `count` ranges in `vars`, all unknown if NULL */
+range* range_copy(range* vars, int count);
+
+/**********************************************************************
+ *                      LOOP-INVARIANT CODE MOTION                    *
+ **********************************************************************/
+
+typedef struct loop loop;
+
+/* a natural loop: a header, and every node that can get back to it */
+struct loop {
+    cfg_node* header;
+    /* the nodes in the loop (including the header), keyed by `ptr_key()` */
+    ht* body;
+    int size;
+    /* the block before the header that code is hoisted into, if any */
+    cfg_node* preheader;
+    loop* next;
+};
+
+typedef struct {
+    cfg* func;
+    /* symbols assigned anywhere in the loop */
+    ht* written;
+    /* whether the loop makes any calls, which may write any global */
+    bool calls;
+    /* assignments of hoisted expressions to their temporaries */
+    stmt* hoisted;
+    stmt** tail;
+} licm_state;
+
+/* Moves expressions whose value can't change while a loop runs out of it,
+ * into a preheader block computing them once before the loop. Only pure
+ * arithmetic and comparisons of constants and variables the loop never
+ * writes are moved, since the preheader runs even if the loop doesn't. */
+void licm_program(cfg* program);
+void licm_func(cfg* func);
+/* finds back edges depth-first, adding the loop each one closes */
+void licm_find_loops(
+    cfg_node* node,
+    int pass,
+    cfg_node** nodes,
+    int count,
+    loop** loops
+);
+void licm_add_loop(
+    loop** loops,
+    cfg_node* header,
+    cfg_node* latch,
+    cfg_node** nodes,
+    int count
+);
+/* hoists what it can out of loop `l`, numbered `number` for messages */
+void licm_loop(cfg* func, loop* l, loop* loops, int number);
+/* the nodes of `l` as an array of `count` nodes */
+cfg_node** licm_body(cfg* func, loop* l, int* count);
+/* inserts a preheader before `l`, redirecting edges from outside to it */
+cfg_node* licm_preheader(cfg* func, loop* l, loop* loops);
+void licm_writes_stmt(stmt* s, ht* written, bool* calls);
+void licm_writes_expr(expr* e, ht* written, bool* calls);
+bool licm_invariant(expr* e, licm_state* state);
+void licm_hoist_stmt(stmt* s, licm_state* state);
+void licm_hoist(expr* e, licm_state* state);
+
+/**********************************************************************
+ *                           VECTORIZATION                            *
+ **********************************************************************/
+
+/* the most arrays a vectorized loop may read, each kept in a register */
+#define VECTORIZE_MAX_LOADS 4
+/* the most operators and operands in the value a vectorized loop folds,
+ * so that it fits in the vector registers */
+#define VECTORIZE_MAX_SIZE 12
+
+/* Finds loops that only fold a value computed from the elements of arrays
+ * at the loop's index into a variable:
+ *
+ *     for (i = a; i < b; i++) s = s + x[i] * y[i];
+ *     for (i = a; i < b; i++) if (x[i] < m) m = x[i];
+ *
+ * with nothing else happening in them, and puts a STMT_VECTOR in front of
+ * each, which runs as many of the iterations as it can a vector at a time.
+ * The loop itself is left to run the rest. Values may add, subtract, and
+ * multiply elements and anything the loop doesn't change; a sum may also
+ * subtract them from the variable, and `>` makes a maximum. Integers wrap
+ * around, so adding them up in a different order gives the same sum. */
+void vectorize_program(cfg* program);
+void vectorize_func(cfg* func);
+bool vectorize_loop(cfg* func, loop* l, loop* loops, int number);
+/* the STMT_VECTOR for the loop of `count` nodes headed by `header`, whose
+ * `latch` goes back to it, if the loop has the right shape, else NULL */
+stmt* vectorize_match(
+    cfg_node* header,
+    cfg_node* latch,
+    int count,
+    licm_state* invariant
+);
+/* `acc op value` if `s` folds a value into `acc` as a sum, else NULL */
+expr* vectorize_sum(stmt* s, symbol* index, licm_state* invariant);
+/* `acc op value` if `body` keeps the minimum or maximum of a value in a
+ * variable, going on to `latch` either way, else NULL */
+expr* vectorize_extreme(
+    cfg_node* body,
+    cfg_node* latch,
+    symbol* index,
+    licm_state* invariant
+);
+/* the limit `i` stops short of while `cond` holds, or NULL */
+expr* vectorize_limit(expr* cond, symbol* index, licm_state* invariant);
+/* true if codegen can compute `e` a vector of indexes at a time, counting
+ * its array loads into `loads` and everything into `size` */
+bool vectorize_value(
+    expr* e,
+    symbol* index,
+    licm_state* invariant,
+    int* loads,
+    int* size
+);
+/* true if `a` and `b` are the same expression */
+bool vectorize_same(expr* a, expr* b);
+/* a copy of `e` */
+expr* vectorize_copy(expr* e);
+
+/**********************************************************************
+ *                        INDUCTION VARIABLES                         *
+ **********************************************************************/
+
+typedef struct derived derived;
+
+/* A variable kept equal to `scale` times a basic induction variable (plus
+ * the address of `array`, if any) as the loop goes. Pointers into arrays
+ * keep the array's type, so `p[0]` reads the element `p` points at. */
+struct derived {
+    symbol* symbol;
+    symbol* array;
+    int scale;
+    derived* next;
+};
+
+typedef struct {
+    cfg* func;
+    /* what the loop writes, for `licm_invariant()` */
+    licm_state* invariant;
+    /* the basic induction variable, changed only by `update` adding `step` */
+    symbol* base;
+    int step;
+    stmt* update;
+    derived* derived;
+} iv_state;
+
+/* Finds basic induction variables (locals a loop only ever steps by a
+ * constant) and replaces multiplications of them by constants, and indexing
+ * of arrays by them, with variables stepped alongside them: `a[i]` becomes
+ * a pointer moving 8 bytes at a time. The loop test is then rewritten in
+ * terms of a derived variable if it can be (linear function test
+ * replacement), and the basic variable removed if nothing else needs it. */
+void iv_program(cfg* program);
+void iv_func(cfg* func);
+void iv_loop(cfg* func, loop* l, loop* loops, int number);
+/* the variable `s` steps by `step` if it's an update of a basic induction
+ * variable, else NULL */
+symbol* iv_basic(stmt* s, int* step);
+/* counts the assignments to each symbol in `writes` */
+void iv_writes_stmt(stmt* s, ht* writes, bool* calls);
+void iv_writes_expr(expr* e, ht* writes, bool* calls);
+void iv_write(ht* writes, symbol* s);
+
+void iv_reduce_node(cfg_node* node, iv_state* state);
+void iv_reduce_stmt(stmt* s, iv_state* state);
+void iv_reduce(expr* e, iv_state* state);
+bool iv_is_base(expr* e, iv_state* state);
+/* the derived variable for `array` (or NULL) and `scale`, creating it if
+ * there isn't one yet */
+derived* iv_derive(iv_state* state, symbol* array, int scale);
+/* the value of `d` when the basic variable has value `base` */
+expr* iv_value(derived* d, expr* base);
+/* initializes and steps the derived variables, then tries to replace the
+ * loop test and remove the basic variable */
+void iv_finish(
+    loop* l,
+    loop* loops,
+    cfg_node** nodes,
+    int count,
+    iv_state* state,
+    int number
+);
+bool iv_replace_test(loop* l, iv_state* state, stmt** init);
+bool iv_reads_node(cfg_node* node, iv_state* state);
+bool iv_reads_stmt(stmt* s, symbol* base);
+bool iv_reads(expr* e, symbol* base);
+bool iv_live(cfg_node* node, int pass, iv_state* state);
+
+/**********************************************************************
+ *                       LOCAL VALUE NUMBERING                        *
+ **********************************************************************/
+
+typedef struct {
+    int vn;
+    /* for an expression, where it was first computed (NULL if that was
+     * only conditionally) */
+    expr* first;
+    /* for a variable, the variable itself; for an expression, the
+     * temporary its first result is kept in once it's needed again */
+    symbol* symbol;
+} lvn_value;
+
+typedef struct {
+    cfg* func;
+    /* the current value of each variable, keyed by `ptr_key()` */
+    ht* vars;
+    /* the value of each expression seen, keyed by its operator and the
+     * value numbers of its operands */
+    ht* exprs;
+    int next_vn;
+} lvn_state;
+
+/* Numbers the values computed in each block, such that expressions with
+ * the same number are sure to compute the same thing. An expression
+ * repeating an earlier one is replaced by a temporary the earlier one's
+ * result is saved to. Assignments and increments give a variable a new
+ * number, as calls do for every global. Blocks are numbered separately;
+ * with no SSA form there's nothing to carry values across joins with. */
+void lvn_program(cfg* program);
+void lvn_func(cfg* func);
+/* destroys a table, along with its values */
+void lvn_clear(ht* table);
+void lvn_stmt(stmt* s, lvn_state* state);
+/* numbers `e`, returning its number; nothing first computed while
+ * `conditional` is reused */
+int lvn_expr(expr* e, lvn_state* state, bool conditional);
+lvn_value* lvn_number(
+    const char* key,
+    expr* first,
+    lvn_state* state,
+    bool conditional
+);
+lvn_value* lvn_var(symbol* s, lvn_state* state);
+int lvn_assign(symbol* s, lvn_state* state);
+/* the type of the temporary to keep `e` in */
+type* lvn_type(expr* e);
+
+#endif
@@ -0,0 +1,93 @@
+/**********************************************************************
+ *                             RUNTIME.H                              *
+ **********************************************************************
+ * This header declares the runtime library that compiled B-Minor programs
+ * are linked against (`build/runtime.o`, see `make runtime`). It provides
+ * the program entry point, the routines `print` statements call, and the
+ * error bounds checks stop the program with.
+ *
+ * Output goes through one buffer of `BM_BUFFER_SIZE` bytes, which is only
+ * written out when it fills up and when `main()` returns, so a program
+ * printing many small values makes a handful of `write` calls rather than
+ * one (or more) per value.
+ *
+ * A string value points at NUL-terminated characters, which are preceded by
+ * their length as a 64-bit integer (see `BM_STR_LENGTH()`), so nothing ever
+ * has to look for the end of a string. Strings are compared a vector at a
+ * time: 16 bytes with SSE2, or 32 when the runtime is built with `-mavx2`.
+ *
+ * The runtime is freestanding: it doesn't use the C library, and makes the
+ * system calls it needs itself. Every routine follows the System V calling
+ * convention, with B-Minor values passed as 64-bit integers.
+ *
+ * Implementation of this header is in `runtime/runtime.c`.
+ */
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <immintrin.h>
+#include <stdbool.h>
+
+#define BM_BUFFER_SIZE (64 * 1024)
+/* the longest a printed integer can be, `-9223372036854775808` */
+#define BM_INT_MAX_LENGTH 20
+
+/* the number of characters in string `s`, from the length before them */
+#define BM_STR_LENGTH(s) (((const long*)(s))[-1])
+
+#ifdef __AVX2__
+typedef __m256i bm_vector;
+#define BM_VECTOR_SIZE 32
+#else
+typedef __m128i bm_vector;
+#define BM_VECTOR_SIZE 16
+#endif
+
+/* Routines called from generated code may find the stack at any alignment,
+ * so they realign it themselves. */
+#define BM_ENTRY __attribute__((force_align_arg_pointer))
+
+/**********************************************************************
+ *                              FUNCTIONS                             *
+ **********************************************************************/
+
+/* one `write` system call to file descriptor `fd`, returning its result */
+long bm_write(int fd, const char* s, long length);
+/* writes all of `s` to `fd`, retrying partial and interrupted writes */
+void bm_write_all(int fd, const char* s, long length);
+
+/* the number of decimal digits in `n` */
+int bm_count_digits(unsigned long n);
+/* `n / 100`, without a division instruction */
+unsigned long bm_div100(unsigned long n);
+
+/* writes out whatever is in the buffer */
+BM_ENTRY void bm_flush(void);
+/* flushes the buffer and exits the process with status `code` */
+BM_ENTRY void bm_exit(long code);
+
+/* print: */
+
+BM_ENTRY void bm_print_bytes(const char* s, long length);
+/* prints `n` in decimal, straight into the buffer */
+BM_ENTRY void bm_print_int(long n);
+BM_ENTRY void bm_print_char(long c);
+/* prints `1` for true and `0` for false */
+BM_ENTRY void bm_print_bool(long b);
+
+/* Reports an array index out of bounds on stderr, after flushing what the
+ * program printed so far, and exits with status 1. Called by the bounds
+ * checks of `bmcc --bounds-check`. */
+BM_ENTRY void bm_bounds_error(long index, long length);
+
+/* strings: */
+
+void bm_copy(char* dest, const char* src, long length);
+/* 1 if strings `a` and `b` hold the same characters, otherwise 0 */
+BM_ENTRY long bm_str_equal(const char* a, const char* b);
+
+bm_vector bm_vector_load(const char* p);
+void bm_vector_store(char* p, bm_vector v);
+bool bm_vector_equal(bm_vector a, bm_vector b);
+
+#endif
@@ -32,6 +32,7 @@ struct symbol {
     const char* name;
     int which;
     int stack_size; // num of params and locals in function
+    bool prototype; // function declared without its body (yet)
 };
 
 /**********************************************************************
@@ -0,0 +1,444 @@
+/**********************************************************************
+ *                                VM.H                                *
+ **********************************************************************
+ * This header defines types and functions for running a program without
+ * generating any machine code: the CFG is lowered to bytecode for a
+ * register machine, which an interpreter loop runs.
+ *
+ * Every value is a 64-bit word, as in generated code, and arrays and
+ * strings are pointers to the same layout (see `runtime.h`), so pointers
+ * made by strength reduction work unchanged. Each function has a frame of
+ * registers: its parameters and locals first, numbered as codegen numbers
+ * their slots, then the arrays it builds, then temporaries. Frames are
+ * kept in one contiguous stack of words, a callee's starting at the
+ * registers its caller put the arguments in, and the return addresses in
+ * another alongside it.
+ *
+ * The interpreter dispatches with computed gotos: before the first run,
+ * each instruction's opcode is replaced by the address of the code for it
+ * (direct threading), so going from one instruction to the next is one
+ * indirect jump.
+ *
+ * With tiering, functions the program spends its time in are compiled to
+ * machine code while it runs, and called there from then on.
+ *
+ * Implementation of this header is separated into `vm/lower.c`,
+ * `vm/vm.c`, and `vm/tier.c`
+ */
+#ifndef VM_H
+#define VM_H
+
+#include "ast.h"
+#include "cfg.h"
+#include "hash.h"
+#include "object.h"
+#include "optimize.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**********************************************************************
+ *                              BYTECODE                              *
+ **********************************************************************/
+
+/* Operands are `a` and `b`, registers unless said otherwise, and `c`, a
+ * register, an immediate, a jump target, or a function. Comparisons and
+ * conditional jumps are in the order of their `expr_t`s, from EXPR_EQ. */
+#define X_VM_OP \
+    /* r[a] = r[b] */ \
+    X(VM_MOVE, "move") \
+    /* r[a] = c */ \
+    X(VM_LOADI, "loadi") \
+    /* r[a] = the global at address c, or the reverse */ \
+    X(VM_LOADG, "loadg") \
+    X(VM_STOREG, "storeg") \
+    /* r[a] = the address of r[b], for an array built in the frame */ \
+    X(VM_FRAME, "frame") \
+    /* r[a] = r[b] op r[c], wrapping around */ \
+    X(VM_ADD, "add") \
+    X(VM_SUB, "sub") \
+    X(VM_MUL, "mul") \
+    X(VM_DIV, "div") \
+    X(VM_MOD, "mod") \
+    X(VM_EXP, "exp") \
+    X(VM_AND, "and") \
+    X(VM_OR, "or") \
+    /* r[a] = r[b] op c */ \
+    X(VM_ADDI, "addi") \
+    X(VM_MULI, "muli") \
+    /* r[a] = !r[b] */ \
+    X(VM_NOT, "not") \
+    /* r[a] = r[b] op r[c], as 1 or 0 */ \
+    X(VM_EQ, "eq") \
+    X(VM_NE, "ne") \
+    X(VM_LT, "lt") \
+    X(VM_LE, "le") \
+    X(VM_GT, "gt") \
+    X(VM_GE, "ge") \
+    /* r[a] = whether strings r[b] and r[c] hold the same characters */ \
+    X(VM_STREQ, "streq") \
+    /* r[a] = item r[c] (or c) of array r[b] */ \
+    X(VM_INDEX, "index") \
+    X(VM_INDEXI, "indexi") \
+    /* stops the program unless 0 <= r[a] < c */ \
+    X(VM_CHECK, "check") \
+    /* jumps to c (unless conditional, if r[a] op r[b], or op b) */ \
+    X(VM_JMP, "jmp") \
+    X(VM_JEQ, "jeq") \
+    X(VM_JNE, "jne") \
+    X(VM_JLT, "jlt") \
+    X(VM_JLE, "jle") \
+    X(VM_JGT, "jgt") \
+    X(VM_JGE, "jge") \
+    X(VM_JEQI, "jeqi") \
+    X(VM_JNEI, "jnei") \
+    X(VM_JLTI, "jlti") \
+    X(VM_JLEI, "jlei") \
+    X(VM_JGTI, "jgti") \
+    X(VM_JGEI, "jgei") \
+    /* calls function c with its frame at r[a], where its arguments are, \
+     * and where it leaves its result */ \
+    X(VM_CALL, "call") \
+    /* moves the b arguments at r[a] to the start of the frame, and goes \
+     * on to function c in it */ \
+    X(VM_TAILCALL, "tailcall") \
+    /* returns r[a] (or c) */ \
+    X(VM_RET, "ret") \
+    X(VM_RETI, "reti") \
+    /* as `VM_CALL` and `VM_TAILCALL`, once function c has been compiled, \
+     * calling its machine code */ \
+    X(VM_NATIVE, "native") \
+    X(VM_TAILNATIVE, "tailnative") \
+    /* counts a call to function c, or a trip around one of its loops (as \
+     * a is `VM_CALLS` or `VM_TRIPS`), for tiering */ \
+    X(VM_COUNT, "count") \
+    /* prints r[a] */ \
+    X(VM_PRINTI, "printi") \
+    X(VM_PRINTC, "printc") \
+    X(VM_PRINTB, "printb") \
+    X(VM_PRINTS, "prints")
+
+typedef enum {
+    #define X(a, b) a,
+        X_VM_OP
+    #undef X
+} vm_op_t;
+
+/* not actually unused, but marking as such to make gcc quieter: */
+__attribute__((unused)) static char* vm_op_t_str[] = {
+    #define X(a, b) b,
+        X_VM_OP
+    #undef X
+};
+
+typedef struct {
+    /* the opcode, until `vm_thread()` replaces it with the address of the
+     * code carrying it out */
+    union {
+        vm_op_t op;
+        const void* handler;
+    };
+    int32_t a;
+    int32_t b;
+    /* for a jump, the index of the instruction jumped to, until threaded
+     * into its address; for a call, the `vm_func` called */
+    int64_t c;
+} vm_instr;
+
+/* what `VM_COUNT` counts */
+enum {VM_CALLS, VM_TRIPS, VM_NUM_COUNTS};
+
+typedef struct tier_unit tier_unit;
+typedef struct tier_state tier_state;
+
+/* a compiled function, called with its arguments in registers */
+typedef long (*tier_code)(long, long, long, long, long, long);
+
+typedef struct {
+    const char* name;
+    vm_instr* code;
+    int length;
+    int capacity;
+    /* the number of registers in a frame */
+    int size;
+    int params;
+    /* with tiering, the calls and trips counted so far, and how many more
+     * are counted before `tier_count()` looks at it again */
+    int64_t counts[VM_NUM_COUNTS];
+    int64_t budget;
+    /* its machine code, once compiled, and the unit it was compiled in */
+    tier_code native;
+    tier_unit* unit;
+} vm_func;
+
+typedef struct {
+    vm_func* funcs;
+    int func_count;
+    vm_func* main;
+    /* memory for strings and arrays, freed with the program */
+    void** blocks;
+    int block_count;
+    /* Globals are mapped in the low 2 GiB, as compiled code addresses them
+     * absolutely, and found by name in `globals`. */
+    unsigned char* statics;
+    size_t statics_size;
+    size_t statics_used;
+    ht* globals;
+    bool threaded;
+    /* NULL unless tiered */
+    tier_state* tier;
+} vm_program;
+
+/* the frames of the functions running, in words of registers, and how
+ * deep calls may go */
+#define VM_STACK_SIZE (1 << 20)
+#define VM_MAX_DEPTH (1 << 18)
+
+/* output is written out when this much has been printed, and at the end */
+#define VM_BUFFER_SIZE (64 * 1024)
+
+/**********************************************************************
+ *                              LOWERING                              *
+ **********************************************************************/
+
+typedef struct {
+    vm_program* program;
+    vm_func* func;
+    /* functions by name, and the addresses of globals by name */
+    ht* funcs;
+    ht* globals;
+    /* the label of each node, and the first register of each array built
+     * in the frame, keyed by `ptr_key()` */
+    ht* nodes;
+    ht* arrays;
+    /* the instruction each label is bound to, -1 until it is */
+    int* labels;
+    int label_count;
+    /* temporaries are numbered from `temp_base`, and those from `temps` on
+     * are free */
+    int temp_base;
+    int temps;
+    /* the first instruction a label may be bound to, before which none is
+     * changed after the fact (see `lower_into()`) */
+    int barrier;
+    /* whether to count calls and trips for tiering, and the nodes a trip
+     * around a loop goes back to, keyed by `ptr_key()` */
+    bool counters;
+    ht* loops;
+    bool ok;
+} lower_state;
+
+/* passed in place of a label to fall through to the next instruction */
+#define LOWER_FALLTHROUGH (-1)
+
+/* Lowers every function of `program` to bytecode, and lays its globals out
+ * in memory, with `VM_COUNT`s if `counters`. Returns NULL, having said
+ * why, if there's something it can't run (like a program without
+ * `main()`). Leaves `program` as it was, to be compiled as well. */
+vm_program* lower_program(cfg* program, bool counters);
+/* the bytes global `global` takes */
+size_t lower_global_size(cfg* global);
+void lower_global(lower_state* state, cfg* global);
+void lower_func(lower_state* state, cfg* func);
+/* finds the nodes laid out at or before a node jumping to them, where
+ * trips around a loop are counted */
+void lower_loops(lower_state* state, cfg_node** order, int count);
+/* gives each array `func` builds at runtime its registers, after the
+ * parameters and locals */
+void lower_arrays_stmt(lower_state* state, stmt* s);
+void lower_arrays_expr(lower_state* state, expr* e);
+/* lowers `node`, given the node laid out after it (or NULL if last) */
+void lower_node(lower_state* state, cfg_node* node, cfg_node* next);
+/* jumps to `target` (NULL for the end of the function) unless it is
+ * `next` anyway */
+void lower_goto(lower_state* state, cfg_node* target, cfg_node* next);
+void lower_stmt(lower_state* state, stmt* s);
+void lower_print(lower_state* state, expr* e);
+/* lowers `e`, returning the register holding its value: a variable's own,
+ * or a temporary (see `lower_release()`) */
+int lower_expr(lower_state* state, expr* e);
+/* lowers `e` into register `dest` */
+void lower_into(lower_state* state, expr* e, int dest);
+/* lowers the operands of binary `e`, copying the left one if the right one
+ * could change it before it's used */
+void lower_operands(lower_state* state, expr* e, int* left, int* right);
+/* lowers call `e`, returning the register its result is left in */
+int lower_call(lower_state* state, expr* e, bool tail);
+/* lowers an array built at runtime, returning a register with its address */
+int lower_array(lower_state* state, expr* e);
+/* jumps to label `true_label` or `false_label` depending on boolean `e`,
+ * either of which may be `LOWER_FALLTHROUGH` */
+void lower_cond(lower_state* state, expr* e, int true_label, int false_label);
+/* as `lower_cond()`, for comparison `kind` of registers `a` and `b` (or of
+ * `a` and immediate `b`) */
+void lower_jump(
+    lower_state* state,
+    expr_t kind,
+    int a,
+    int b,
+    bool immediate,
+    int true_label,
+    int false_label
+);
+/* the comparison holding where `kind` doesn't */
+expr_t lower_negate(expr_t kind);
+/* true if `e` is a literal that fits in an instruction's `b` */
+bool lower_is_small(expr* e);
+
+/* adds an instruction to the current function, returning its index */
+int lower_emit(lower_state* state, vm_op_t op, int a, int b, int64_t c);
+int lower_temp(lower_state* state);
+/* frees temporary `r` (doing nothing for a variable's register) */
+void lower_release(lower_state* state, int r);
+int lower_label(lower_state* state);
+/* binds `label` to the next instruction */
+void lower_bind(lower_state* state, int label);
+int lower_node_label(lower_state* state, cfg_node* node);
+/* the register of local or parameter `s` */
+int lower_local(symbol* s);
+
+/* memory owned by `program`, of `size` bytes of zeros */
+void* lower_alloc(vm_program* program, size_t size);
+/* as `lower_alloc()`, in the memory for globals */
+void* lower_static(vm_program* program, size_t size);
+/* a string value holding `s`, preceded by its length (see `runtime.h`) */
+const char* lower_string(vm_program* program, const char* s);
+/* the `length` items of constant `array` (or zeros, for NULL) */
+int64_t* lower_constant_array(vm_program* program, expr* array, int length);
+/* writes the items of `lower_constant_array()` to `items` */
+void lower_items(
+    vm_program* program,
+    int64_t* items,
+    expr* array,
+    int length
+);
+
+/**********************************************************************
+ *                            INTERPRETER                             *
+ **********************************************************************/
+
+/* where a caller goes on from once the function it called returns */
+typedef struct {
+    const vm_instr* pc;
+    int64_t* fp;
+} vm_frame;
+
+/* Runs `program` from `main()`, putting its result in `result`. Returns
+ * false, having said why, if it's stopped by an error (a failed bounds
+ * check, division by zero, or running out of stack). */
+bool vm_run(vm_program* program, int64_t* result);
+/* replaces opcodes with the addresses in `handlers`, and jump targets with
+ * the addresses of the instructions they jump to */
+void vm_thread(vm_program* program, const void* const* handlers);
+/* true if `op` jumps to the instruction at `c` */
+bool vm_is_jump(vm_op_t op);
+/* true if `op` sets `r[a]` and does nothing else */
+bool vm_is_pure(vm_op_t op);
+void vm_destroy(vm_program* program);
+
+/* `base ^ power`, as generated code computes it (see `exp_codegen()`) */
+int64_t vm_exp(int64_t base, int64_t power);
+/* true if strings `a` and `b` hold the same characters */
+bool vm_str_equal(const char* a, const char* b);
+
+/* print: */
+
+/* writes out whatever is in the buffer */
+void vm_flush();
+void vm_print_bytes(const char* s, long length);
+/* prints `n` in decimal, straight into the buffer */
+void vm_print_int(int64_t n);
+void vm_print_char(char c);
+
+/**********************************************************************
+ *                              TIERING                               *
+ **********************************************************************/
+
+/* A function is hot once it has counted this many calls and trips around
+ * its loops together. It's then compiled, along with every function it
+ * can call, on a thread of its own while the program goes on in the
+ * interpreter, and calls to it are patched to call the machine code once
+ * that's loaded. There's no replacing a frame already running, so those
+ * go on interpreted (`main()` always does). */
+#define TIER_THRESHOLD 1000
+/* how many more counts a hot function makes before looking again whether
+ * its code is ready */
+#define TIER_POLL 256
+/* Compiled code is entered with its arguments in registers, so functions
+ * taking more stay interpreted (though compiled code calls them). */
+#define TIER_MAX_PARAMS 6
+
+/* functions compiled together, loaded with a runtime of their own */
+struct tier_unit {
+    run_image image;
+    /* the hot function's code */
+    tier_code code;
+    /* whether they print (or can fail a bounds check, which does), so
+     * output has to be written out around calls to keep it in order */
+    bool prints;
+};
+
+struct tier_state {
+    /* the program, and its call graph by function name */
+    cfg* program;
+    call_node* graph;
+    ht* funcs;
+    const char* runtime_path;
+    vm_program* vm;
+    /* the function being compiled, if any, and what it had counted when
+     * it got hot */
+    vm_func* pending;
+    int64_t counts[VM_NUM_COUNTS];
+    pthread_t thread;
+    /* Set by the compiling thread once `result` (NULL if it couldn't be
+     * compiled) is ready, along with how many functions it holds and how
+     * long they took. The rest is only touched while it isn't running. */
+    atomic_bool done;
+    tier_unit* result;
+    int result_count;
+    double result_time;
+    /* units loaded so far, unloaded with the program */
+    tier_unit** units;
+    int unit_count;
+};
+
+/* Sets `vm` up to compile `program`'s hot functions, linked with the
+ * runtime at `runtime_path`. `vm` must have been lowered with counters. */
+tier_state* tier_create(
+    vm_program* vm,
+    cfg* program,
+    const char* runtime_path
+);
+/* waits for any compile still running, and unloads what was compiled */
+void tier_destroy(tier_state* tier);
+/* Called from `VM_COUNT` once `f`'s budget runs out: patches in any code
+ * that's ready (with `handlers`, see `vm_thread()`), and starts `f`
+ * compiling if it's hot and nothing else is. */
+void tier_count(vm_program* program, vm_func* f, const void* const* handlers);
+/* starts compiling `f`, returning false if it can't be */
+bool tier_start(tier_state* tier, vm_func* f);
+/* compiles `tier->pending` on the thread `tier_start()` starts */
+void* tier_compile(void* tier);
+/* the unit of `f` and every function it can call, or NULL */
+tier_unit* tier_unit_compile(tier_state* tier, vm_func* f, int* count);
+/* an object defining each global at the address the interpreter keeps it
+ * at, and `main` (which the runtime's `_start` refers to, though it's
+ * never run) unless `has_main` */
+object* tier_externs(tier_state* tier, bool has_main);
+/* once a compile has finished, joins its thread, and patches calls to the
+ * function compiled (if it was) */
+void tier_finish(vm_program* program, const void* const* handlers);
+/* makes every call to `f` call `f->native` instead */
+void tier_patch(vm_program* program, vm_func* f, const void* const* handlers);
+/* calls `f->native` with the `f->params` arguments at `args` */
+int64_t tier_call(const vm_func* f, const int64_t* args);
+/* true if `func` prints, or can fail a bounds check */
+bool tier_prints(cfg* func);
+/* `is_call` for `func_calls()`, for the calls into the runtime that print */
+bool tier_prints_expr(expr* e);
+
+#endif
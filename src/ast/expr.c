@@ -15,6 +15,9 @@ expr* expr_create(
     e->name = name;
     e->value = value;
     e->str_value = str_value;
+    e->symbol = NULL;
+    e->reg = 0;
+    e->checked = false;
     return e;
 }
 
@@ -39,13 +42,28 @@ expr* expr_bool_lit(bool value) {
 }
 
 expr* expr_char_lit(char value) {
-    return expr_create(EXPR_CHAR_LIT, 0, 0, 0, atoi(&value), 0);
+    return expr_create(EXPR_CHAR_LIT, 0, 0, 0, value, 0);
 }
 
 expr* expr_str_lit(const char* value) {
     return expr_create(EXPR_STR_LIT, 0, 0, 0, 0, value);
 }
 
+bool expr_is_pure(expr* e) {
+    if (!e) return true;
+
+    switch (e->kind) {
+        case EXPR_ASSIGN:   __attribute__((fallthrough));
+        case EXPR_INC:      __attribute__((fallthrough));
+        case EXPR_DEC:      __attribute__((fallthrough));
+        case EXPR_FUN_CALL: __attribute__((fallthrough));
+        case EXPR_ARRAY:
+            return false;
+        default:
+            return expr_is_pure(e->left) && expr_is_pure(e->right);
+    }
+}
+
 void print_expr(expr* expr, int tab_level) {
     char tabs[MAX_INDENT] = { '\0' };
     char* tabs_ptr = tabs;
@@ -89,3 +107,91 @@ void print_expr(expr* expr, int tab_level) {
 
     printf("%s}\n", tabs);
 }
+
+void fprint_expr(FILE* f, expr* e) {
+    if (!e) return;
+
+    const char* op = NULL;
+    switch (e->kind) {
+        case EXPR_ADD:      op = "+";   break;
+        case EXPR_SUB:      op = "-";   break;
+        case EXPR_MUL:      op = "*";   break;
+        case EXPR_EXP:      op = "^";   break;
+        case EXPR_DIV:      op = "/";   break;
+        case EXPR_MOD:      op = "%";   break;
+        case EXPR_AND:      op = "&&";  break;
+        case EXPR_OR:       op = "||";  break;
+        case EXPR_EQ:       op = "==";  break;
+        case EXPR_N_EQ:     op = "!=";  break;
+        case EXPR_LESS:     op = "<";   break;
+        case EXPR_L_EQ:     op = "<=";  break;
+        case EXPR_GREATER:  op = ">";   break;
+        case EXPR_G_EQ:     op = ">=";  break;
+        case EXPR_ASSIGN:   op = "=";   break;
+        default:                        break;
+    }
+    if (op) {
+        if (!e->left) {
+            /* negation is parsed as subtraction from nothing */
+            fprintf(f, "%s", op);
+            fprint_expr(f, e->right);
+            return;
+        }
+        fprintf(f, "(");
+        fprint_expr(f, e->left);
+        fprintf(f, " %s ", op);
+        fprint_expr(f, e->right);
+        fprintf(f, ")");
+        return;
+    }
+
+    switch (e->kind) {
+        case EXPR_INC:
+            fprint_expr(f, e->left);
+            fprintf(f, "++");
+            break;
+        case EXPR_DEC:
+            fprint_expr(f, e->left);
+            fprintf(f, "--");
+            break;
+        case EXPR_NOT:
+            fprintf(f, "!");
+            fprint_expr(f, e->left);
+            break;
+        case EXPR_IDENT:
+            fprintf(f, "%s", e->name);
+            break;
+        case EXPR_INDEX:
+            fprint_expr(f, e->left);
+            fprintf(f, "[");
+            fprint_expr(f, e->right);
+            fprintf(f, "]");
+            break;
+        case EXPR_FUN_CALL:
+            fprint_expr(f, e->left);
+            fprintf(f, "(");
+            for (expr* arg = e->right; arg != NULL; arg = arg->right) {
+                fprint_expr(f, arg->left);
+                if (arg->right) fprintf(f, ", ");
+            }
+            fprintf(f, ")");
+            break;
+        case EXPR_ARRAY:
+            fprintf(f, "{...}");
+            break;
+        case EXPR_BOOL_LIT:
+            fprintf(f, "%s", e->value ? "true" : "false");
+            break;
+        case EXPR_CHAR_LIT:
+            fprintf(f, "'%c'", e->value);
+            break;
+        case EXPR_INT_LIT:
+            fprintf(f, "%d", e->value);
+            break;
+        case EXPR_STR_LIT:
+            fprintf(f, "\"%s\"", e->str_value);
+            break;
+        default:
+            break;
+    }
+}
@@ -128,6 +128,16 @@ void print_stmt(stmt* stmt, int tab_level) {
         case STMT_BLOCK:
             print_stmt(stmt->body, tab_level + 1);
             break;
+        case STMT_VECTOR:
+            printf("%s\tindex:\n", tabs);
+            print_expr(stmt->init_expr, tab_level + 2);
+
+            printf("%s\tlimit:\n", tabs);
+            print_expr(stmt->expr, tab_level + 2);
+
+            printf("%s\treduction:\n", tabs);
+            print_expr(stmt->next_expr, tab_level + 2);
+            break;
     }
 
     if (stmt->next != 0) {
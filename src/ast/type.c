@@ -10,7 +10,7 @@ type* type_create(
     t->kind = kind;
     t->subtype = subtype;
     t->params = params;
-    t->size;
+    t->size = size;
     return t;
 }
 
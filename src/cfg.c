@@ -1,5 +1,7 @@
 #include "cfg.h"
 
+int cfg_pass_count = 0;
+
 /**********************************************************************
  *                          CFG UTILITY FUNCTIONS                     *
  **********************************************************************/
@@ -11,14 +13,25 @@ cfg_node* cfg_block_node(stmt* stmt) {
     node->value.block->stmt = stmt;
     node->value.block->next = NULL;
     node->prev = NULL;
+    node->label = -1;
+    node->mark = 0;
+    node->on_stack = false;
     return node;
 }
 
 cfg_node* cfg_branch_node(expr* exp) {
     cfg_node* node = malloc(sizeof(*node));
     node->kind = CFG_BRANCH;
+    node->value.branch = malloc(sizeof(cfg_branch));
     node->value.branch->condition = exp;
+    node->value.branch->true_branch = NULL;
+    node->value.branch->false_branch = NULL;
+    node->value.branch->loop = false;
+    node->value.branch->select = false;
     node->prev = NULL;
+    node->label = -1;
+    node->mark = 0;
+    node->on_stack = false;
     return node;
 }
 
@@ -26,6 +39,9 @@ cfg_node* cfg_return_node() {
     cfg_node* node = malloc(sizeof(*node));
     node->kind = CFG_RETURN;
     node->prev = NULL;
+    node->label = -1;
+    node->mark = 0;
+    node->on_stack = false;
     return node;
 }
 
@@ -58,17 +74,24 @@ int cfg_set_false(cfg_node* node, cfg_node* false_branch) {
 }
 
 void cfg_push_back(cfg_node* node, cfg_node* back) {
+    if (!back) return;
+
     switch (node->kind) {
         case CFG_BLOCK:
             if (node->value.block->next == NULL) {
                 node->value.block->next = back;
                 back->prev = node;
-            } else {
+            } else if (node->value.block->next != back) {
+                /* (branches that rejoin reach the same blocks twice) */
                 cfg_push_back(node->value.block->next, back);
             }
             break;
         case CFG_BRANCH:
-            cfg_push_back(node->value.branch->true_branch, back);
+            /* the body of a loop leads back to its condition, so only its
+             * exit can be appended to: */
+            if (!node->value.branch->loop) {
+                cfg_push_back(node->value.branch->true_branch, back);
+            }
             cfg_push_back(node->value.branch->false_branch, back);
             break;
         case CFG_RETURN:
@@ -76,6 +99,26 @@ void cfg_push_back(cfg_node* node, cfg_node* back) {
     }
 }
 
+int cfg_successors(cfg_node* node, cfg_node* succ[2]) {
+    switch (node->kind) {
+        case CFG_BLOCK:
+            succ[0] = node->value.block->next;
+            return succ[0] ? 1 : 0;
+        case CFG_BRANCH:
+            if (node->value.branch->select) {
+                /* both arms are folded into the branch itself */
+                succ[0] = node->value.branch->true_branch->value.block->next;
+                return succ[0] ? 1 : 0;
+            }
+            succ[0] = node->value.branch->true_branch;
+            succ[1] = node->value.branch->false_branch;
+            return 2;
+        case CFG_RETURN:
+            return 0;
+    }
+    return 0;
+}
+
 /**********************************************************************
  *                              CONSTRUCTION                          *
  **********************************************************************/
@@ -85,7 +128,8 @@ cfg* cfg_construct(decl* d) {
 
     cfg* cfg = malloc(sizeof(*cfg));
 
-    if (d->value) {
+    if (d->value || d->type->kind != TYPE_FUNCTION) {
+        /* (a variable without a value starts out as zero) */
         cfg->kind = VAR;
         cfg->symbol = d->symbol;
         cfg->value.exp = d->value;
@@ -93,10 +137,15 @@ cfg* cfg_construct(decl* d) {
         cfg->kind = FUNC;
         cfg->symbol = d->symbol;
         cfg->value.cfg_node = cfg_construct_block(d->code);
-        if (d->type->subtype == TYPE_VOID) {
+        if (!cfg->value.cfg_node) cfg->value.cfg_node = cfg_block_node(NULL);
+        if (d->type->subtype->kind == TYPE_VOID) {
             cfg_push_back(cfg->value.cfg_node, cfg_return_node());
         }
-    } else return d->next;
+    } else {
+        /* prototypes have nothing to generate */
+        free(cfg);
+        return cfg_construct(d->next);
+    }
 
     cfg->next = cfg_construct(d->next);
     return cfg;
@@ -110,15 +159,33 @@ cfg_node* cfg_construct_block(stmt* s) {
     stmt* q = s; /* follower */
     while (p != NULL) {
         switch(p->kind) {
+            case STMT_BLOCK:
+                /* names are already resolved, so nested blocks can be
+                 * spliced into the enclosing list: */
+                stmt* inner = p->body;
+                if (inner) {
+                    stmt* tail = inner;
+                    while (tail->next != NULL) {
+                        tail = tail->next;
+                    }
+                    tail->next = p->next;
+                } else {
+                    inner = p->next;
+                }
+                if (p == s) {
+                    s = q = inner;
+                } else {
+                    q->next = inner;
+                }
+                p = inner;
+                if (!s) return NULL;
+                break;
             case STMT_FOR:
                 if (q != p) q->next = NULL;
-                node = cfg_block_node(s);
+                node = q != p ? cfg_block_node(s) : NULL;
 
                 cfg_node* loop_node = cfg_for_loop(p);
-                cfg_push_back(
-                    loop_node->value.branch->false_branch,
-                    cfg_construct_block(p->next)
-                );
+                cfg_push_back(loop_node, cfg_construct_block(p->next));
 
                 if (node) {
                     cfg_push_back(node, loop_node);
@@ -126,7 +193,7 @@ cfg_node* cfg_construct_block(stmt* s) {
                 } else return loop_node;
             case STMT_IF_ELSE:
                 if (q != p) q->next = NULL;
-                node = cfg_block_node(s);
+                node = q != p ? cfg_block_node(s) : NULL;
 
                 cfg_node* if_node = cfg_if_else(p);
                 cfg_push_back(if_node, cfg_construct_block(p->next));
@@ -134,7 +201,7 @@ cfg_node* cfg_construct_block(stmt* s) {
                 if (node) {
                     cfg_push_back(node, if_node);
                     return node;
-                } else return loop_node;
+                } else return if_node;
             case STMT_RETURN:
                 stmt* dead = p->next;
                 p->next = NULL;
@@ -170,6 +237,7 @@ cfg_node* cfg_for_loop(stmt* s) {
     cfg_node* init = cfg_block_node(stmt_expr(s->init_expr, NULL));
 
     cfg_node* comp = cfg_branch_node(s->expr);
+    comp->value.branch->loop = true;
     /* append `next_expr` to end of loop body: */
     stmt* p_body = s->body;
     while (p_body->next != NULL) {
@@ -178,11 +246,11 @@ cfg_node* cfg_for_loop(stmt* s) {
     p_body->next = stmt_expr(s->next_expr, NULL);
 
     /* set branches (false branch just exits loop): */
+    cfg_set_false(comp, cfg_block_node(NULL));
+
     cfg_set_true(comp, cfg_construct_block(s->body));
     cfg_push_back(comp->value.branch->true_branch, comp);
 
-    cfg_set_false(comp, cfg_block_node(NULL));
-
     cfg_push_back(init, comp);
     return init;
 }
@@ -190,14 +258,125 @@ cfg_node* cfg_for_loop(stmt* s) {
 cfg_node* cfg_if_else(stmt* s) {
     cfg_node* node = cfg_branch_node(s->expr);
 
-    cfg_node* true_branch = s->body ?
-        cfg_construct_block(s->body) : cfg_block_node(NULL);
+    /* empty bodies still need a node for the branch to point at: */
+    cfg_node* true_branch = cfg_construct_block(s->body);
+    if (!true_branch) true_branch = cfg_block_node(NULL);
 
-    cfg_node* false_branch = s->else_body ?
-        cfg_construct_block(s->else_body) : cfg_block_node(NULL);
+    cfg_node* false_branch = cfg_construct_block(s->else_body);
+    if (!false_branch) false_branch = cfg_block_node(NULL);
 
     cfg_set_true(node, true_branch);
     cfg_set_false(node, false_branch);
 
     return node;
+}
+
+/**********************************************************************
+ *                              TRAVERSAL                             *
+ **********************************************************************/
+
+cfg_node** cfg_nodes(cfg_node* entry, int* count) {
+    int capacity = 16;
+    cfg_node** nodes = malloc(sizeof(*nodes) * capacity);
+    *count = 0;
+
+    cfg_collect(entry, ++cfg_pass_count, &nodes, count, &capacity);
+
+    return nodes;
+}
+
+void cfg_collect(
+    cfg_node* node,
+    int pass,
+    cfg_node*** nodes,
+    int* count,
+    int* capacity
+) {
+    if (!node || node->mark == pass) return;
+
+    node->mark = pass;
+    if (*count == *capacity) {
+        *capacity *= 2;
+        *nodes = realloc(*nodes, sizeof(**nodes) * *capacity);
+    }
+    (*nodes)[(*count)++] = node;
+
+    cfg_node* succ[2];
+    int n = cfg_successors(node, succ);
+    for (int i = 0; i < n; i++) {
+        cfg_collect(succ[i], pass, nodes, count, capacity);
+    }
+}
+
+/**********************************************************************
+ *                              LAYOUT                                *
+ **********************************************************************/
+
+cfg_node** cfg_layout(cfg_node* entry, int* count) {
+    int capacity = 16;
+    cfg_node** order = malloc(sizeof(*order) * capacity);
+    *count = 0;
+
+    cfg_place(entry, ++cfg_pass_count, &order, count, &capacity);
+
+    return order;
+}
+
+bool cfg_returns(cfg_node* node) {
+    /* follow straight-line code only, watching out for it going in circles
+     * (a block leading back to itself, as an infinite recursion turned into
+     * a loop does) with a second pointer moving at twice the speed: */
+    cfg_node* fast = node;
+    while (node && node->kind == CFG_BLOCK) {
+        node = node->value.block->next;
+        for (int i = 0; i < 2 && fast && fast->kind == CFG_BLOCK; i++) {
+            fast = fast->value.block->next;
+        }
+        if (node && node == fast && node->kind == CFG_BLOCK) return false;
+    }
+    return !node || node->kind == CFG_RETURN;
+}
+
+void cfg_place(
+    cfg_node* node,
+    int pass,
+    cfg_node*** order,
+    int* count,
+    int* capacity
+) {
+    if (!node || node->mark == pass) return;
+
+    if (
+        node->kind == CFG_BRANCH
+        && node->value.branch->loop
+        && !node->on_stack
+    ) {
+        /* rotate the loop: lay out the body first, so the condition ends
+         * up at the bottom, right after the block that jumps back to it */
+        node->on_stack = true;
+        cfg_place(node->value.branch->true_branch, pass, order, count, capacity);
+        cfg_place(node, pass, order, count, capacity);
+        node->on_stack = false;
+        return;
+    }
+
+    node->mark = pass;
+    if (*count == *capacity) {
+        *capacity *= 2;
+        *order = realloc(*order, sizeof(**order) * *capacity);
+    }
+    (*order)[(*count)++] = node;
+
+    cfg_node* succ[2];
+    int n = cfg_successors(node, succ);
+    if (n == 2 && cfg_returns(succ[0]) && !cfg_returns(succ[1])) {
+        /* early returns are unlikely, so fall through into the other side
+         * and leave the return for later */
+        cfg_node* tmp = succ[0];
+        succ[0] = succ[1];
+        succ[1] = tmp;
+    }
+    for (int i = 0; i < n; i++) {
+        cfg_place(succ[i], pass, order, count, capacity);
+    }
 }
\ No newline at end of file
@@ -1,101 +1,78 @@
 #include "codegen.h"
 #include "symbol.h"
 
+/* where the assembly goes (see `codegen()`) */
+FILE* codegen_out;
+
 int label_count = 0;
 int str_count = 0;
+int array_count = 0;
 
 const int NUM_SCRATCH = 7;
 
 reg scratch[] = {
-    { .name = "%rbx", .used = false },
-    { .name = "%r10", .used = false },
-    { .name = "%r11", .used = false },
-    { .name = "%r12", .used = false },
-    { .name = "%r13", .used = false },
-    { .name = "%r14", .used = false },
-    { .name = "%r15", .used = false },
+    { .name = "%rbx", .byte_name = "%bl",   .callee_saved = true },
+    { .name = "%r10", .byte_name = "%r10b", .callee_saved = false },
+    { .name = "%r11", .byte_name = "%r11b", .callee_saved = false },
+    { .name = "%r12", .byte_name = "%r12b", .callee_saved = true },
+    { .name = "%r13", .byte_name = "%r13b", .callee_saved = true },
+    { .name = "%r14", .byte_name = "%r14b", .callee_saved = true },
+    { .name = "%r15", .byte_name = "%r15b", .callee_saved = true },
 };
 
 const char* ARG_REGS[] = {"%rdi", "%rsi", "%rdx", "%rcx", "%r8", "%r9"};
 
+/* what the current function addresses its slots from: `%rbp`, or `%rsp`
+ * if it keeps them in the red zone */
+const char* frame_reg = "%rbp";
+/* the size of the current function's frame, in slots, and whether it
+ * has one (with `%rbp` pointing into it) at all */
+int frame_slots;
+bool frame_pushed;
+/* whether the current function makes no calls (see `func_is_leaf()`) */
+bool func_leaf;
+/* the callees of the current function's tail calls, by number */
+const char** tail_callees;
+int tail_count;
+
 data_entry* data;
+/* (for what never changes: string literals and arrays) */
+data_entry* rodata;
+/* (for globals starting out as zero) */
+data_entry* bss;
 
 /**********************************************************************
  *                              CODEGEN                               *
  **********************************************************************/
 
-void codegen(cfg* cfg) {
-    printf("section .text\n");
+void codegen(cfg* cfg, FILE* out) {
+    codegen_out = out;
+    fprintf(codegen_out, ".text\n");
     cfg_codegen(cfg);
-    printf("section .data\n");
+    fprintf(codegen_out, ".data\n");
     while (data != NULL) {
-        printf("%s", data->entry);
+        fprintf(codegen_out, "%s", data->entry);
         data = data->next;
     }
+    fprintf(codegen_out, ".section .rodata\n");
+    while (rodata != NULL) {
+        fprintf(codegen_out, "%s", rodata->entry);
+        rodata = rodata->next;
+    }
+    fprintf(codegen_out, ".bss\n");
+    while (bss != NULL) {
+        fprintf(codegen_out, "%s", bss->entry);
+        bss = bss->next;
+    }
+    /* (the stack needn't be executable) */
+    fprintf(codegen_out, ".section .note.GNU-stack,\"\",@progbits\n");
 }
 
 void cfg_codegen(cfg* cfg) {
     if (!cfg) return;
 
     if (cfg->kind == VAR) {
-        data_entry* entry = malloc(sizeof(*entry));
-        switch (cfg->symbol->type->kind) {
-            case TYPE_BOOLEAN:   __attribute__((fallthrough));
-            case TYPE_CHARACTER: __attribute__((fallthrough));
-            case TYPE_INTEGER:
-                if (0 > asprintf(
-                    &entry->entry,
-                    "%s: $%d\n",
-                    cfg->symbol->name,
-                    cfg->value.exp->value
-                )) {
-                    fprintf(
-                        stderr,
-                        "error: failed to allocate global variable\n"
-                    );
-                }
-                entry->next = data;
-                data = entry;
-                break;
-            case TYPE_STRING:
-                if (0 > asprintf(
-                    &entry->entry,
-                    "%s: \"%s\"\n",
-                    cfg->symbol->name,
-                    cfg->value.exp->str_value
-                )) {
-                    fprintf(
-                        stderr,
-                        "error: failed to allocate global variable\n"
-                    );
-                }
-                entry->next = data;
-                data = entry;
-                break;
-            case TYPE_ARRAY:
-                if (0 > asprintf(&entry->entry, "%s: ", cfg->symbol->name)) {
-                    fprintf(
-                        stderr,
-                        "error: failed to allocate global variable\n"
-                    );
-                }
-                expr* item = cfg->value.exp;
-                while (item != NULL) {
-                    const char* item_txt;
-                    if (0 > asprintf(&item_txt, "%d, ", item->value)) {
-                        fprintf(
-                            stderr,
-                            "error: failed to allocate global variable\n"
-                        );
-                    }
-                    strcat(entry->entry, item_txt);
-                    item = item->right;
-                }
-                strcat(entry->entry, "\n");
-                entry->next = data;
-                data = entry;
-                break;
-        }
+        global_codegen(cfg->symbol, cfg->value.exp);
     } else {
         func_codegen(cfg);
     }
@@ -103,185 +80,874 @@ void cfg_codegen(cfg* cfg) {
     cfg_codegen(cfg->next);
 }
 
-void expr_bool_codegen(
-    expr* e,
-    const char* instruction,
-    int true_label
-) {
+void global_codegen(symbol* s, expr* value) {
+    if (!global_is_constant(s, value)) return;
+
+    char* text;
+    switch (s->type->kind) {
+        case TYPE_BOOLEAN:   __attribute__((fallthrough));
+        case TYPE_CHARACTER: __attribute__((fallthrough));
+        case TYPE_INTEGER:
+            if (!value || value->value == 0) {
+                add_bss(s->name, 8, 8);
+                return;
+            }
+            if (0 > asprintf(
+                &text,
+                ".balign 8\n%s: .quad %d\n",
+                s->name,
+                value->value
+            )) text = NULL;
+            break;
+        case TYPE_STRING:
+            /* (a pointer to the characters, like any string value; one
+             * without a value is empty rather than NULL) */
+            if (0 > asprintf(
+                &text,
+                ".balign 8\n%s: .quad %s\n",
+                s->name,
+                str_label(add_str(value ? value->str_value : ""))
+            )) text = NULL;
+            break;
+        case TYPE_ARRAY: {
+            /* (never changed, so read-only unless it's all zeros) */
+            int length = value ? array_length(value) : s->type->size;
+            if (!value || array_is_zero(value)) {
+                add_bss(s->name, 8 * length, 16);
+            } else {
+                array_data(s->name, value, length);
+            }
+            return;
+        }
+        default:
+            return;
+    }
+    if (!text) {
+        fprintf(stderr, "error: failed to allocate global variable\n");
+        return;
+    }
+
+    data_entry* entry = malloc(sizeof(*entry));
+    entry->entry = text;
+    entry->next = data;
+    data = entry;
+}
+
+void cond_codegen(expr* e, int true_label, int false_label) {
+    int skip_label;
+    switch (e->kind) {
+        case EXPR_EQ:       __attribute__((fallthrough));
+        case EXPR_N_EQ:     __attribute__((fallthrough));
+        case EXPR_LESS:     __attribute__((fallthrough));
+        case EXPR_L_EQ:     __attribute__((fallthrough));
+        case EXPR_GREATER:  __attribute__((fallthrough));
+        case EXPR_G_EQ:
+            jump_codegen(compare_codegen(e), true_label, false_label);
+            break;
+        case EXPR_AND:
+            /* `left` being false decides the whole expression: */
+            skip_label = false_label == LABEL_FALLTHROUGH ?
+                create_label() : false_label;
+            cond_codegen(e->left, LABEL_FALLTHROUGH, skip_label);
+            cond_codegen(e->right, true_label, false_label);
+            if (false_label == LABEL_FALLTHROUGH) {
+                fprintf(codegen_out, "%s:\n", label_name(skip_label));
+            }
+            break;
+        case EXPR_OR:
+            /* `left` being true decides the whole expression: */
+            skip_label = true_label == LABEL_FALLTHROUGH ?
+                create_label() : true_label;
+            cond_codegen(e->left, skip_label, LABEL_FALLTHROUGH);
+            cond_codegen(e->right, true_label, false_label);
+            if (true_label == LABEL_FALLTHROUGH) {
+                fprintf(codegen_out, "%s:\n", label_name(skip_label));
+            }
+            break;
+        case EXPR_NOT:
+            cond_codegen(e->left, false_label, true_label);
+            break;
+        case EXPR_BOOL_LIT:
+            if (e->value && true_label != LABEL_FALLTHROUGH) {
+                fprintf(codegen_out, "JMP %s\n", label_name(true_label));
+            } else if (!e->value && false_label != LABEL_FALLTHROUGH) {
+                fprintf(codegen_out, "JMP %s\n", label_name(false_label));
+            }
+            break;
+        default:
+            /* any other boolean value (variable, call, etc.): */
+            expr_codegen(e);
+            fprintf(codegen_out, "CMPQ $0, %s\n", scratch_name(e->reg));
+            scratch_free(e->reg);
+            jump_codegen(EXPR_N_EQ, true_label, false_label);
+            break;
+    }
+}
+
+void jump_codegen(expr_t kind, int true_label, int false_label) {
+    if (true_label == LABEL_FALLTHROUGH) {
+        if (false_label == LABEL_FALLTHROUGH) return;
+        fprintf(
+            codegen_out,
+            "J%s %s\n",
+            condition_code(kind, true),
+            label_name(false_label)
+        );
+    } else {
+        fprintf(
+            codegen_out,
+            "J%s %s\n",
+            condition_code(kind, false),
+            label_name(true_label)
+        );
+        if (false_label != LABEL_FALLTHROUGH) {
+            fprintf(codegen_out, "JMP %s\n", label_name(false_label));
+        }
+    }
+}
+
+expr_t compare_codegen(expr* e) {
     expr_codegen(e->left);
     expr_codegen(e->right);
-    printf(
-        "CMPQ %s, %s\n",
-        scratch_name(e->left->reg),
-        scratch_name(e->right->reg)
-    );
-    scratch_free(e->left);
-    scratch_free(e->right);
-    printf(
-        "%s %s\n",
-        instruction,
-        label_name(true_label)
-    );
+
+    type* t = expr_typecheck(e->left);
+    bool strings = t->kind == TYPE_STRING
+        && (e->kind == EXPR_EQ || e->kind == EXPR_N_EQ);
+    type_delete(t);
+
+    if (strings) {
+        /* by their characters, rather than where they are: */
+        int saved = caller_save_codegen(
+            1 << e->left->reg | 1 << e->right->reg,
+            0
+        );
+        fprintf(codegen_out, "MOVQ %s, %%rdi\n", scratch_name(e->left->reg));
+        fprintf(codegen_out, "MOVQ %s, %%rsi\n", scratch_name(e->right->reg));
+        fprintf(codegen_out, "CALL bm_str_equal\n");
+        caller_restore_codegen(saved, 0);
+        fprintf(codegen_out, "TESTQ %%rax, %%rax\n");
+    } else {
+        fprintf(codegen_out,  /* sets flags on `left - right` */
+            "CMPQ %s, %s\n",
+            scratch_name(e->right->reg),
+            scratch_name(e->left->reg)
+        );
+    }
+    scratch_free(e->left->reg);
+    scratch_free(e->right->reg);
+
+    if (!strings) return e->kind;
+    /* (nonzero if equal) */
+    return e->kind == EXPR_EQ ? EXPR_N_EQ : EXPR_EQ;
 }
 
-void bool_val_codegen(expr* e, const char* instruction) {
-    int true_label = create_label();
+void bool_val_codegen(expr* e) {
+    expr_t kind;
+    switch (e->kind) {
+        case EXPR_EQ:       __attribute__((fallthrough));
+        case EXPR_N_EQ:     __attribute__((fallthrough));
+        case EXPR_LESS:     __attribute__((fallthrough));
+        case EXPR_L_EQ:     __attribute__((fallthrough));
+        case EXPR_GREATER:  __attribute__((fallthrough));
+        case EXPR_G_EQ:
+            kind = compare_codegen(e);
+            /* `MOVZBQ` clears the rest of the register without touching
+             * the flags `SETcc` reads: */
+            e->reg = scratch_alloc();
+            fprintf(
+                codegen_out,
+                "SET%s %s\n",
+                condition_code(kind, false),
+                scratch_byte_name(e->reg)
+            );
+            fprintf(
+                codegen_out,
+                "MOVZBQ %s, %s\n",
+                scratch_byte_name(e->reg),
+                scratch_name(e->reg)
+            );
+            break;
+        case EXPR_NOT:
+            expr_codegen(e->left);
+            fprintf(codegen_out, "XORQ $1, %s\n", scratch_name(e->left->reg));
+            e->reg = e->left->reg;
+            break;
+        case EXPR_AND:      __attribute__((fallthrough));
+        case EXPR_OR:
+            /* short-circuiting only matters if `right` could do (or trap
+             * on) something when `left` already decides the result: */
+            if (!expr_is_cheap(e->right)) {
+                bool_branch_codegen(e);
+                break;
+            }
+            bool_val_codegen(e->left);
+            bool_val_codegen(e->right);
+            fprintf(
+                codegen_out,
+                "%s %s, %s\n",
+                e->kind == EXPR_AND ? "ANDQ" : "ORQ",
+                scratch_name(e->left->reg),
+                scratch_name(e->right->reg)
+            );
+            scratch_free(e->left->reg);
+            e->reg = e->right->reg;
+            break;
+        default:
+            expr_codegen(e);
+            break;
+    }
+}
+
+void bool_branch_codegen(expr* e) {
+    int false_label = create_label();
     int done_label = create_label();
-    expr_bool_codegen(e, "instruction", true_label);
+    cond_codegen(e, LABEL_FALLTHROUGH, false_label);
     e->reg = scratch_alloc();
-    /* false branch: */
-    printf(
-        "MOVQ $0, %s\n",
+    /* true branch: */
+    fprintf(
+        codegen_out,
+        "MOVQ $1, %s\n",
         scratch_name(e->reg)
     );
-    printf(
+    fprintf(
+        codegen_out,
         "JMP %s\n",
         label_name(done_label)
     );
-    /* true branch: */
-    printf(
+    /* false branch: */
+    fprintf(
+        codegen_out,
         "%s:\n",
-        label_name(true_label)
+        label_name(false_label)
     );
-    printf(
-        "MOVQ $1, %s\n",
+    fprintf(
+        codegen_out,
+        "MOVQ $0, %s\n",
         scratch_name(e->reg)
     );
-    printf(
+    fprintf(
+        codegen_out,
         "%s:\n",
         label_name(done_label)
     );
 }
 
+bool expr_is_cheap(expr* e) {
+    if (!e) return true;
+
+    switch (e->kind) {
+        case EXPR_IDENT:    __attribute__((fallthrough));
+        case EXPR_BOOL_LIT: __attribute__((fallthrough));
+        case EXPR_CHAR_LIT: __attribute__((fallthrough));
+        case EXPR_INT_LIT:
+            return true;
+        case EXPR_ADD:      __attribute__((fallthrough));
+        case EXPR_SUB:      __attribute__((fallthrough));
+        case EXPR_MUL:      __attribute__((fallthrough));
+        case EXPR_AND:      __attribute__((fallthrough));
+        case EXPR_OR:       __attribute__((fallthrough));
+        case EXPR_NOT:      __attribute__((fallthrough));
+        case EXPR_EQ:       __attribute__((fallthrough));
+        case EXPR_N_EQ:     __attribute__((fallthrough));
+        case EXPR_LESS:     __attribute__((fallthrough));
+        case EXPR_L_EQ:     __attribute__((fallthrough));
+        case EXPR_GREATER:  __attribute__((fallthrough));
+        case EXPR_G_EQ:
+            return expr_is_cheap(e->left) && expr_is_cheap(e->right);
+        default:
+            /* calls and assignments have side effects, while division and
+             * indexing may trap */
+            return false;
+    }
+}
+
+bool is_select(cfg_node* node) {
+    cfg_branch* branch = node->value.branch;
+    cfg_node* true_branch = branch->true_branch;
+    cfg_node* false_branch = branch->false_branch;
+
+    if (
+        branch->loop
+        || true_branch->kind != CFG_BLOCK
+        || false_branch->kind != CFG_BLOCK
+        || true_branch->value.block->next != false_branch->value.block->next
+        || !expr_is_cheap(branch->condition)
+    ) return false;
+
+    /* each side may only assign a cheap value to the same variable: */
+    stmt* t = true_branch->value.block->stmt;
+    stmt* f = false_branch->value.block->stmt;
+    if (
+        !t || t->next || t->kind != STMT_EXPR
+        || t->expr->kind != EXPR_ASSIGN
+        || !expr_is_cheap(t->expr->right)
+    ) return false;
+    symbol* target = t->expr->left->symbol;
+    if (f && (
+        f->next || f->kind != STMT_EXPR
+        || f->expr->kind != EXPR_ASSIGN
+        || f->expr->left->symbol != target
+        || !expr_is_cheap(f->expr->right)
+    )) return false;
+
+    return true;
+}
+
+void select_codegen(cfg_node* node) {
+    cfg_branch* branch = node->value.branch;
+    stmt* t = branch->true_branch->value.block->stmt;
+    stmt* f = branch->false_branch->value.block->stmt;
+    symbol* target = t->expr->left->symbol;
+
+    expr_codegen(t->expr->right);
+    int result;
+    if (f) {
+        expr_codegen(f->expr->right);
+        result = f->expr->right->reg;
+    } else { /* no `else`: keep the current value */
+        result = scratch_alloc();
+        fprintf(
+            codegen_out,
+            "MOVQ %s, %s\n",
+            symbol_address(target),
+            scratch_name(result)
+        );
+    }
+
+    /* compute the condition last, since arithmetic clobbers the flags: */
+    expr* cond = branch->condition;
+    expr_t kind = cond->kind;
+    switch (cond->kind) {
+        case EXPR_EQ:       __attribute__((fallthrough));
+        case EXPR_N_EQ:     __attribute__((fallthrough));
+        case EXPR_LESS:     __attribute__((fallthrough));
+        case EXPR_L_EQ:     __attribute__((fallthrough));
+        case EXPR_GREATER:  __attribute__((fallthrough));
+        case EXPR_G_EQ:
+            kind = compare_codegen(cond);
+            break;
+        default:
+            bool_val_codegen(cond);
+            fprintf(
+                codegen_out,
+                "TESTQ %s, %s\n",
+                scratch_name(cond->reg),
+                scratch_name(cond->reg)
+            );
+            scratch_free(cond->reg);
+            kind = EXPR_N_EQ;
+            break;
+    }
+    fprintf(
+        codegen_out,
+        "CMOV%sQ %s, %s\n",
+        condition_code(kind, false),
+        scratch_name(t->expr->right->reg),
+        scratch_name(result)
+    );
+    fprintf(
+        codegen_out,
+        "MOVQ %s, %s\n",
+        scratch_name(result),
+        symbol_address(target)
+    );
+    scratch_free(t->expr->right->reg);
+    scratch_free(result);
+}
+
 void decl_codegen(decl* d) {
     if (!d) return;
 
     if (d->symbol->kind == SYMBOL_LOCAL) {
         if (d->value) {
             expr_codegen(d->value);
-            printf(
+            fprintf(
+                codegen_out,
                 "MOVQ %s, %s\n",
                 scratch_name(d->value->reg),
                 symbol_address(d->symbol)
             );
             scratch_free(d->value->reg);
+        } else if (d->symbol->type->kind == TYPE_ARRAY) {
+            /* all zeros, for good: */
+            int zeros = array_count++;
+            add_bss(array_label(zeros), 8 * d->symbol->type->size, 16);
+            int reg = scratch_alloc();
+            fprintf(
+                codegen_out,
+                "LEAQ %s(%%rip), %s\n",
+                array_label(zeros),
+                scratch_name(reg)
+            );
+            fprintf(
+                codegen_out,
+                "MOVQ %s, %s\n",
+                scratch_name(reg),
+                symbol_address(d->symbol)
+            );
+            scratch_free(reg);
+        } else if (d->symbol->type->kind == TYPE_STRING) {
+            /* (empty rather than garbage, as a global is) */
+            int reg = scratch_alloc();
+            fprintf(
+                codegen_out,
+                "LEAQ %s(%%rip), %s\n",
+                str_label(add_str("")),
+                scratch_name(reg)
+            );
+            fprintf(
+                codegen_out,
+                "MOVQ %s, %s\n",
+                scratch_name(reg),
+                symbol_address(d->symbol)
+            );
+            scratch_free(reg);
+        } else {
+            /* (zero, as a global is) */
+            fprintf(
+                codegen_out,
+                "MOVQ $0, %s\n",
+                symbol_address(d->symbol)
+            );
         }
-    } else if (d->symbol->kind == SYMBOL_GLOBAL) {
-        if (d->value) {
-            data_entry* entry = malloc(sizeof(*entry));
-            switch (d->symbol->type->kind) {
-                case TYPE_BOOLEAN:   __attribute__((fallthrough));
-                case TYPE_CHARACTER: __attribute__((fallthrough));
-                case TYPE_INTEGER:
-                    if (0 > asprintf(
-                        &entry->entry,
-                        "%s: %d\n",
-                        d->symbol->name,
-                        d->value->value
-                    )) {
-                        fprintf(
-                            stderr,
-                            "error: failed to declare global variable\n"
-                        );
-                    }
-                    break;
-                case TYPE_STRING:
-                    if (0 > asprintf(
-                        &entry->entry,
-                        "%s: db %s\n",
-                        d->symbol->name,
-                        d->value->str_value
-                    )) {
-                        fprintf(
-                            stderr,
-                            "error: failed to declare global variable\n"
-                        );
-                    }
-                    break;
-            }
-            entry->next = data;
-            data = entry;
+    }
+    /* (globals are generated from the CFG, by `global_codegen()`) */
+}
+
+void array_storage(cfg* func, int* frame_size) {
+    int count;
+    cfg_node** nodes = cfg_nodes(func->value.cfg_node, &count);
+    for (int i = 0; i < count; i++) {
+        if (nodes[i]->kind == CFG_BRANCH) {
+            array_storage_expr(nodes[i]->value.branch->condition, frame_size);
+        } else if (nodes[i]->kind == CFG_BLOCK) {
+            array_storage_stmt(nodes[i]->value.block->stmt, frame_size);
         }
     }
+    free(nodes);
+}
+
+void array_storage_stmt(stmt* s, int* frame_size) {
+    for (; s != NULL; s = s->next) {
+        switch (s->kind) {
+            case STMT_DECL:
+                array_storage_expr(s->decl->value, frame_size);
+                break;
+            case STMT_BLOCK:
+                array_storage_stmt(s->body, frame_size);
+                break;
+            default:
+                array_storage_expr(s->expr, frame_size);
+                break;
+        }
+    }
+}
+
+void array_storage_expr(expr* e, int* frame_size) {
+    if (!e) return;
+
+    if (e->kind == EXPR_ARRAY && !array_is_constant(e)) {
+        /* (the slot of its last item; see `array_init_codegen()`) */
+        e->value = *frame_size;
+        *frame_size += array_length(e);
+    }
+    array_storage_expr(e->left, frame_size);
+    array_storage_expr(e->right, frame_size);
+}
+
+void array_init_codegen(expr* e) {
+    /* Slots grow downwards from `frame_reg`, so the array starts at the slot
+     * of its last item, `e->value`. */
+    int length = array_length(e);
+    int base = -8 * (e->value + length);
+
+    bool zeros = true;
+    for (expr* item = e->left; item != NULL; item = item->right) {
+        if (is_literal(item->left) && item->left->value != 0) zeros = false;
+    }
+
+    if (zeros && length <= ARRAY_UNROLL_LIMIT) {
+        /* cleared 16 bytes at a time: */
+        fprintf(codegen_out, "PXOR %%xmm0, %%xmm0\n");
+        int offset = 0;
+        for (; offset + 16 <= 8 * length; offset += 16) {
+            fprintf(
+                codegen_out,
+                "MOVDQU %%xmm0, %d(%s)\n",
+                base + offset,
+                frame_reg
+            );
+        }
+        if (offset < 8 * length) {
+            fprintf(codegen_out, "MOVQ $0, %d(%s)\n", base + offset, frame_reg);
+        }
+    } else {
+        /* copied (or cleared) in one go: */
+        fprintf(codegen_out, "LEAQ %d(%s), %%rdi\n", base, frame_reg);
+        fprintf(codegen_out, "MOVQ $%d, %%rcx\n", length);
+        if (zeros) {
+            fprintf(codegen_out, "XORL %%eax, %%eax\n");
+            fprintf(codegen_out, "REP STOSQ\n");
+        } else {
+            int template = add_array(e, length);
+            fprintf(
+                codegen_out,
+                "LEAQ %s(%%rip), %%rsi\n",
+                array_label(template)
+            );
+            fprintf(codegen_out, "REP MOVSQ\n");
+        }
+    }
+
+    /* then the items only known now: */
+    int offset = base;
+    for (expr* item = e->left; item != NULL; item = item->right) {
+        if (!is_literal(item->left)) {
+            expr_codegen(item->left);
+            fprintf(
+                codegen_out,
+                "MOVQ %s, %d(%s)\n",
+                scratch_name(item->left->reg),
+                offset,
+                frame_reg
+            );
+            scratch_free(item->left->reg);
+        }
+        offset += 8;
+    }
+
+    e->reg = scratch_alloc();
+    fprintf(
+        codegen_out,
+        "LEAQ %d(%s), %s\n",
+        base,
+        frame_reg,
+        scratch_name(e->reg)
+    );
 }
 
 void func_codegen(cfg* func_decl) {
-    printf(".global %s\n", func_decl->symbol->name);
-    printf("%s:\n", func_decl->symbol->name);
-    printf("MOVQ %%rsp, %%rbp\n");
+    const char* name = func_decl->symbol->name;
+    int frame_size = func_decl->symbol->stack_size;
+    array_storage(func_decl, &frame_size);
+
+    /* (room for the saved registers too, below the locals) */
+    func_leaf = func_is_leaf(func_decl);
+    frame_pushed = !func_leaf || frame_size + MAX_SAVED > RED_ZONE_SLOTS;
+    frame_reg = frame_pushed ? "%rbp" : "%rsp";
+    frame_slots = frame_size;
+    tail_count = 0;
+    for (int i = 0; i < NUM_SCRATCH; i++) scratch[i].touched = false;
+
+    /* the body goes to a buffer until the registers it uses are known: */
+    char* body;
+    size_t body_size;
+    FILE* out = codegen_out;
+    codegen_out = open_memstream(&body, &body_size);
+    func_body_codegen(name, func_decl->value.cfg_node);
+    fclose(codegen_out);
+    codegen_out = out;
+
+    fprintf(codegen_out, ".global %s\n", name);
+    fprintf(codegen_out, "%s:\n", name);
+    if (frame_pushed) {
+        int saved = 0;
+        for (int i = 0; i < NUM_SCRATCH; i++) {
+            if (scratch[i].callee_saved && scratch[i].touched) saved++;
+        }
+        /* (padded to keep `%rsp` 16-byte aligned for calls) */
+        int slots = frame_size + (frame_size + saved) % 2;
+        fprintf(codegen_out, "PUSHQ %%rbp\n");
+        fprintf(codegen_out, "MOVQ %%rsp, %%rbp\n");
+        if (slots > 0) fprintf(codegen_out, "SUBQ $%d, %%rsp\n", 8 * slots);
+        for (int i = 0; i < NUM_SCRATCH; i++) {
+            if (scratch[i].callee_saved && scratch[i].touched) {
+                fprintf(codegen_out, "PUSHQ %s\n", scratch[i].name);
+            }
+        }
+    } else {
+        int slot = frame_size;
+        for (int i = 0; i < NUM_SCRATCH; i++) {
+            if (scratch[i].callee_saved && scratch[i].touched) {
+                fprintf(
+                    codegen_out,
+                    "MOVQ %s, %d(%%rsp)\n",
+                    scratch[i].name,
+                    -8 * ++slot
+                );
+            }
+        }
+    }
+    params_codegen(func_decl);
+
+    fputs(body, codegen_out);
+    free(body);
+
+    fprintf(codegen_out, "%s_epilogue:\n", name);
+    func_exit_codegen();
+    fprintf(codegen_out, "RET\n");
+
+    /* tail calls leave through exits of their own: */
+    for (int i = 0; i < tail_count; i++) {
+        fprintf(codegen_out, "%s_tail_%d:\n", name, i);
+        func_exit_codegen();
+        fprintf(codegen_out, "JMP %s\n", tail_callees[i]);
+    }
+}
+
+bool func_is_leaf(cfg* func) {
+    return !func_calls(func, expr_is_call);
+}
+
+bool func_calls(cfg* func, bool (*is_call)(expr* e)) {
+    int count;
+    cfg_node** nodes = cfg_nodes(func->value.cfg_node, &count);
+    bool calls = false;
+    for (int i = 0; i < count && !calls; i++) {
+        if (nodes[i]->kind == CFG_BLOCK) {
+            calls = stmt_calls(nodes[i]->value.block->stmt, is_call);
+        } else if (nodes[i]->kind == CFG_BRANCH) {
+            calls = expr_calls(nodes[i]->value.branch->condition, is_call);
+        }
+    }
+    free(nodes);
+    return calls;
+}
+
+bool stmt_calls(stmt* s, bool (*is_call)(expr* e)) {
+    for (; s != NULL; s = s->next) {
+        switch (s->kind) {
+            case STMT_PRINT:
+                /* (into the runtime) */
+                return true;
+            case STMT_DECL:
+                if (expr_calls(s->decl->value, is_call)) return true;
+                break;
+            default:
+                if (
+                    expr_calls(s->init_expr, is_call)
+                    || expr_calls(s->expr, is_call)
+                    || expr_calls(s->next_expr, is_call)
+                    || stmt_calls(s->body, is_call)
+                    || stmt_calls(s->else_body, is_call)
+                ) {
+                    return true;
+                }
+                break;
+        }
+    }
+    return false;
+}
+
+bool expr_calls(expr* e, bool (*is_call)(expr* e)) {
+    if (!e) return false;
+    if (is_call(e)) return true;
+    return expr_calls(e->left, is_call) || expr_calls(e->right, is_call);
+}
+
+bool expr_is_call(expr* e) {
+    switch (e->kind) {
+        case EXPR_FUN_CALL:
+            return true;
+        case EXPR_INDEX:
+            /* (a failed check calls into the runtime, which never returns,
+             * but expects the stack aligned as for any call) */
+            return e->checked;
+        case EXPR_EQ:       __attribute__((fallthrough));
+        case EXPR_N_EQ: {
+            /* strings are compared by the runtime */
+            type* t = expr_typecheck(e->left);
+            bool strings = t->kind == TYPE_STRING;
+            type_delete(t);
+            return strings;
+        }
+        default:
+            return false;
+    }
+}
+
+void params_codegen(cfg* func) {
     int i = 0;
-    param_list* p = func_decl->symbol->type->params;
-    while (p != NULL) {
+    for (
+        param_list* p = func->symbol->type->params;
+        p != NULL;
+        p = p->next, i++
+    ) {
+        const char* slot = symbol_address(p->symbol);
         if (i < 6) {
-            printf(
-                "PUSHQ %s\n",
-                ARG_REGS[i]
-            );
+            fprintf(codegen_out, "MOVQ %s, %s\n", ARG_REGS[i], slot);
+            continue;
         }
-        i++;
-        p = p->next;
+        /* the rest were pushed by the caller, just above the return
+         * address (see `args_codegen()`) */
+        fprintf(
+            codegen_out,
+            "MOVQ %d(%s), %%rax\n",
+            8 * (i - 6) + (frame_pushed ? 16 : 8),
+            frame_reg
+        );
+        fprintf(codegen_out, "MOVQ %%rax, %s\n", slot);
     }
+}
 
-    int locals = func_decl->symbol->stack_size - i;
+void func_exit_codegen() {
+    if (!frame_pushed) {
+        int slot = frame_slots;
+        for (int i = 0; i < NUM_SCRATCH; i++) {
+            if (scratch[i].callee_saved && scratch[i].touched) {
+                fprintf(
+                    codegen_out,
+                    "MOVQ %d(%%rsp), %s\n",
+                    -8 * ++slot,
+                    scratch[i].name
+                );
+            }
+        }
+        return;
+    }
 
-    printf("SUBQ $%d, %%rsp\n", locals * 8);
+    for (int i = NUM_SCRATCH - 1; i >= 0; i--) {
+        if (scratch[i].callee_saved && scratch[i].touched) {
+            fprintf(codegen_out, "POPQ %s\n", scratch[i].name);
+        }
+    }
+    fprintf(codegen_out, "MOVQ %%rbp, %%rsp\n");
+    fprintf(codegen_out, "POPQ %%rbp\n");
+}
 
-    printf("PUSHQ %%rbx\n");
-    printf("PUSHQ %%r12\n");
-    printf("PUSHQ %%r13\n");
-    printf("PUSHQ %%r14\n");
-    printf("PUSHQ %%r15\n");
+int caller_save_codegen(int dead, int stack_args) {
+    /* The scratch registers in use are exactly those holding values,
+     * which only survive the call in the callee-saved ones. `%rsp` is
+     * aligned here, and is again at the call, after padding. */
+    int saved = 0;
+    int count = 0;
+    for (int i = 0; i < NUM_SCRATCH; i++) {
+        if (
+            scratch[i].used
+            && !scratch[i].callee_saved
+            && !(dead & 1 << i)
+        ) {
+            fprintf(codegen_out, "PUSHQ %s\n", scratch[i].name);
+            saved |= 1 << i;
+            count++;
+        }
+    }
+    if ((count + stack_args) % 2) fprintf(codegen_out, "SUBQ $8, %%rsp\n");
+    return saved;
+}
+
+void caller_restore_codegen(int saved, int stack_args) {
+    /* the arguments and the padding go in one: */
+    int count = __builtin_popcount(saved);
+    int popped = 8 * (stack_args + (count + stack_args) % 2);
+    if (popped > 0) fprintf(codegen_out, "ADDQ $%d, %%rsp\n", popped);
+    for (int i = NUM_SCRATCH - 1; i >= 0; i--) {
+        if (saved & 1 << i) fprintf(codegen_out, "POPQ %s\n", scratch[i].name);
+    }
+}
+
+void tail_codegen(const char* func_name, const char* callee) {
+    tail_callees = realloc(
+        tail_callees,
+        (tail_count + 1) * sizeof(*tail_callees)
+    );
+    tail_callees[tail_count] = callee;
+    fprintf(codegen_out, "JMP %s_tail_%d\n", func_name, tail_count++);
+}
 
-    func_body_codegen(func_decl->symbol->name, func_decl->value.cfg_node);
+void func_body_codegen(const char* func_name, cfg_node* node) {
+    int count;
+    cfg_node** order = cfg_layout(node, &count);
 
-    printf("%s_epilogue:\n");
+    /* conditional moves change the shape of the graph, so decide on them
+     * before the final layout: */
+    for (int i = 0; i < count; i++) {
+        if (order[i]->kind == CFG_BRANCH) {
+            order[i]->value.branch->select = is_select(order[i]);
+        }
+    }
+    free(order);
+    order = cfg_layout(node, &count);
 
-    printf("POPQ %%r15\n");
-    printf("POPQ %%r14\n");
-    printf("POPQ %%r13\n");
-    printf("POPQ %%r12\n");
-    printf("POPQ %%rbx\n");
+    /* only nodes that are jumped to need labels: */
+    for (int i = 0; i < count; i++) {
+        cfg_node* next = i + 1 < count ? order[i + 1] : NULL;
+        cfg_node* succ[2];
+        int n = cfg_successors(order[i], succ);
+        for (int j = 0; j < n; j++) {
+            if (succ[j] != next) node_label(succ[j]);
+        }
+    }
 
-    printf("MOVQ %%rbp, %%rsp\n");
-    printf("POPQ %%rbp\n");
-    printf("RET\n");
+    for (int i = 0; i < count; i++) {
+        node_codegen(func_name, order[i], i + 1 < count ? order[i + 1] : NULL);
+    }
+    free(order);
 }
 
-void func_body_codegen(const char* func_name, cfg_node* node) {
-    if (!node) return;
+void node_codegen(const char* func_name, cfg_node* node, cfg_node* next) {
+    if (node->label >= 0) {
+        fprintf(codegen_out, "%s:\n", label_name(node->label));
+    }
+
     switch (node->kind) {
         case CFG_BLOCK:
             stmt_codegen(
                 node->value.block->stmt,
                 func_name
             );
-            func_body_codegen(func_name, node->value.block->next);
+            goto_codegen(func_name, node->value.block->next, next);
             break;
         case CFG_BRANCH:
-            expr_codegen(node->value.branch->condition);
-            printf(
-                "CMP %s, $0\n",
-                scratch_name(node->value.branch->condition->reg)
-            );
-            scratch_free(node->value.branch->condition->reg);
-            int true_label = create_label();
-            printf(
-                "JNE %s\n",
-                label_name(true_label)
-            );
-            func_body_codegen(func_name, node->value.branch->false_branch);
-            printf("%s:\n", label_name(true_label));
-            func_body_codegen(func_name, node->value.branch->true_branch);
+            cfg_branch* branch = node->value.branch;
+            if (branch->select) {
+                select_codegen(node);
+                goto_codegen(
+                    func_name,
+                    branch->true_branch->value.block->next,
+                    next
+                );
+                break;
+            }
+            /* jump straight to whichever side doesn't follow: */
+            if (branch->true_branch == next) {
+                cond_codegen(
+                    branch->condition,
+                    LABEL_FALLTHROUGH,
+                    node_label(branch->false_branch)
+                );
+            } else if (branch->false_branch == next) {
+                cond_codegen(
+                    branch->condition,
+                    node_label(branch->true_branch),
+                    LABEL_FALLTHROUGH
+                );
+            } else {
+                cond_codegen(
+                    branch->condition,
+                    node_label(branch->true_branch),
+                    node_label(branch->false_branch)
+                );
+            }
             break;
         case CFG_RETURN:
-            printf(
-                "JMP %s_epilogue\n",
-                func_name
-            );
+            goto_codegen(func_name, NULL, next);
             break;
     }
 }
 
+void goto_codegen(const char* func_name, cfg_node* target, cfg_node* next) {
+    /* nothing to do if `target` comes next anyway (with a missing target
+     * meaning the epilogue, which follows the last node) */
+    if (target == next) return;
+
+    if (target) {
+        fprintf(codegen_out, "JMP %s\n", label_name(node_label(target)));
+    } else {
+        fprintf(codegen_out, "JMP %s_epilogue\n", func_name);
+    }
+}
+
 void stmt_codegen(stmt* s, const char* func_name) {
     if (!s) return;
 
@@ -293,7 +959,7 @@ void stmt_codegen(stmt* s, const char* func_name) {
             decl_codegen(s->decl);
             break;
         case STMT_EXPR:
-            decl_codegen(s->expr);
+            expr_codegen(s->expr);
             scratch_free(s->expr->reg);
             break;
         case STMT_PRINT:
@@ -322,16 +988,29 @@ void stmt_codegen(stmt* s, const char* func_name) {
                     print_bool(s->expr->reg);
                     scratch_free(s->expr->reg);
                     break;
+                default:
+                    /* (arrays and functions print nothing) */
+                    break;
             }
             break;
         case STMT_RETURN:
+            if (is_tail_call(s->expr)) {
+                /* the callee can return straight to our caller: */
+                args_codegen(s->expr->right);
+                tail_codegen(func_name, s->expr->left->symbol->name);
+                break;
+            }
             expr_codegen(s->expr);
-            printf(
+            fprintf(
+                codegen_out,
                 "MOVQ %s, %%rax\n",
                 scratch_name(s->expr->reg)
             );
             scratch_free(s->expr->reg);
             break;
+        case STMT_VECTOR:
+            vector_codegen(s);
+            break;
         default:
             fprintf(
                 stderr,
@@ -349,8 +1028,12 @@ void expr_codegen(expr* e) {
     switch (e->kind) {
         case EXPR_IDENT:
             e->reg = scratch_alloc();
-            printf(
-                "MOVQ %s, %s\n",
+            fprintf(
+                codegen_out,
+                /* (the value of a global array is its address) */
+                e->symbol->kind == SYMBOL_GLOBAL
+                    && e->symbol->type->kind == TYPE_ARRAY ?
+                    "LEAQ %s, %s\n" : "MOVQ %s, %s\n",
                 symbol_address(e->symbol),
                 scratch_name(e->reg)
             );
@@ -359,24 +1042,27 @@ void expr_codegen(expr* e) {
         case EXPR_CHAR_LIT: __attribute__((fallthrough));
         case EXPR_INT_LIT:
             e->reg = scratch_alloc();
-            printf(
-                "MOVQ $%s, %s\n",
+            fprintf(
+                codegen_out,
+                "MOVQ $%d, %s\n",
                 e->value,
                 scratch_name(e->reg)
             );
             break;
         case EXPR_STR_LIT:
-            int str = add_str(e->str_value, false);
+            int str = add_str(e->str_value);
             e->reg = scratch_alloc();
-            printf(
-                "MOVQ %s, %s\n",
+            fprintf(
+                codegen_out,
+                "LEAQ %s(%%rip), %s\n",
                 str_label(str),
                 scratch_name(e->reg)
             );
             break;
         case EXPR_ASSIGN:
             expr_codegen(e->right);
-            printf(
+            fprintf(
+                codegen_out,
                 "MOVQ %s, %s\n",
                 scratch_name(e->right->reg),
                 symbol_address(e->left->symbol)
@@ -386,7 +1072,8 @@ void expr_codegen(expr* e) {
         case EXPR_ADD:
             expr_codegen(e->left);
             expr_codegen(e->right);
-            printf(
+            fprintf(
+                codegen_out,
                 "ADDQ %s, %s\n",
                 scratch_name(e->left->reg),
                 scratch_name(e->right->reg)
@@ -397,26 +1084,26 @@ void expr_codegen(expr* e) {
         case EXPR_SUB:
             expr_codegen(e->left);
             expr_codegen(e->right);
-            printf(
+            fprintf(codegen_out,  /* `left - right`, into `left` */
                 "SUBQ %s, %s\n",
-                scratch_name(e->left->reg),
-                scratch_name(e->right->reg)
+                scratch_name(e->right->reg),
+                scratch_name(e->left->reg)
             );
-            e->reg = e->right->reg;
-            scratch_free(e->left->reg);
+            e->reg = e->left->reg;
+            scratch_free(e->right->reg);
             break;
         case EXPR_INC:
             e->reg = scratch_alloc();
-            printf( /* load variable into register */
+            fprintf(codegen_out,  /* load variable into register */
                 "MOVQ %s, %s\n",
                 symbol_address(e->left->symbol),
                 scratch_name(e->reg)
             );
-            printf( /* increment value */
+            fprintf(codegen_out,  /* increment value */
                 "INCQ %s\n",
                 scratch_name(e->reg)
             );
-            printf( /* copy new value back to variable */
+            fprintf(codegen_out,  /* copy new value back to variable */
                 "MOVQ %s, %s\n",
                 scratch_name(e->reg),
                 symbol_address(e->left->symbol)
@@ -424,16 +1111,16 @@ void expr_codegen(expr* e) {
             break;
         case EXPR_DEC:
             e->reg = scratch_alloc();
-            printf( /* load variable into register */
+            fprintf(codegen_out,  /* load variable into register */
                 "MOVQ %s, %s\n",
                 symbol_address(e->left->symbol),
                 scratch_name(e->reg)
             );
-            printf( /* decrement value */
+            fprintf(codegen_out,  /* decrement value */
                 "DECQ %s\n",
                 scratch_name(e->reg)
             );
-            printf( /* copy new value back to variable */
+            fprintf(codegen_out,  /* copy new value back to variable */
                 "MOVQ %s, %s\n",
                 scratch_name(e->reg),
                 symbol_address(e->left->symbol)
@@ -442,157 +1129,142 @@ void expr_codegen(expr* e) {
         case EXPR_MUL:
             expr_codegen(e->left);
             expr_codegen(e->right);
-            printf( /* move `left` into `%rax` */
+            fprintf(codegen_out,  /* move `left` into `%rax` */
                 "MOVQ %s, %%rax\n",
                 scratch_name(e->left->reg)
             );
             scratch_free(e->left->reg);
-            printf( /* multiply `%rax` by `right` */
+            fprintf(codegen_out,  /* multiply `%rax` by `right` */
                 "IMUL %s\n",
                 scratch_name(e->right->reg)
             );
             scratch_free(e->right->reg);
             e->reg = scratch_alloc();
-            printf( /* move result into register of `e` */
+            fprintf(codegen_out,  /* move result into register of `e` */
                 "MOVQ %%rax, %s\n",
                 scratch_name(e->reg)
             );
             break;
         case EXPR_DIV:
+            /* (dividing by 0 is left to fault, as it would have) */
+            if (e->right->kind == EXPR_INT_LIT && e->right->value != 0) {
+                div_const_codegen(e);
+                break;
+            }
             expr_codegen(e->left);
             expr_codegen(e->right);
-            printf( /* move `left` into `%rax` */
+            fprintf(codegen_out,  /* move `left` into `%rax` */
                 "MOVQ %s, %%rax\n",
                 scratch_name(e->left->reg)
             );
             scratch_free(e->left->reg);
-            printf( /* divide `%rax` by `right` */
+            fprintf(codegen_out, "CQO\n"); /* sign-extend `%rax` into `%rdx` */
+            fprintf(codegen_out,  /* divide `%rdx:%rax` by `right` */
                 "IDIV %s\n",
                 scratch_name(e->right->reg)
             );
             scratch_free(e->right->reg);
             e->reg = scratch_alloc();
-            printf( /* move result into register of `e` */
+            fprintf(codegen_out,  /* move result into register of `e` */
                 "MOVQ %%rax, %s\n",
                 scratch_name(e->reg)
             );
             break;
         case EXPR_MOD:
+            if (e->right->kind == EXPR_INT_LIT && e->right->value != 0) {
+                div_const_codegen(e);
+                break;
+            }
             expr_codegen(e->left);
             expr_codegen(e->right);
-            printf( /* move `left` into `%rax` */
+            fprintf(codegen_out,  /* move `left` into `%rax` */
                 "MOVQ %s, %%rax\n",
                 scratch_name(e->left->reg)
             );
             scratch_free(e->left->reg);
-            printf( /* divide `%rax` by `right` */
+            fprintf(codegen_out, "CQO\n"); /* sign-extend `%rax` into `%rdx` */
+            fprintf(codegen_out,  /* divide `%rdx:%rax` by `right` */
                 "IDIV %s\n",
                 scratch_name(e->right->reg)
             );
             scratch_free(e->right->reg);
             e->reg = scratch_alloc();
-            printf( /* move `%rdx` (remainder) into `e` */
+            fprintf(codegen_out,  /* move `%rdx` (remainder) into `e` */
                 "MOVQ %%rdx, %s\n",
                 scratch_name(e->reg)
             );
             break;
-        case EXPR_EQ:
-            bool_val_codegen(e, "JE");
-            break;
-        case EXPR_N_EQ:
-            bool_val_codegen(e, "JNE");
-            break;
-        case EXPR_LESS:
-            bool_val_codegen(e, "JL");
-            break;
-        case EXPR_L_EQ:
-            bool_val_codegen(e, "JLE");
+        case EXPR_EXP:
+            exp_codegen(e);
             break;
-        case EXPR_GREATER:
-            bool_val_codegen(e, "JG");
+        case EXPR_EQ:       __attribute__((fallthrough));
+        case EXPR_N_EQ:     __attribute__((fallthrough));
+        case EXPR_LESS:     __attribute__((fallthrough));
+        case EXPR_L_EQ:     __attribute__((fallthrough));
+        case EXPR_GREATER:  __attribute__((fallthrough));
+        case EXPR_G_EQ:     __attribute__((fallthrough));
+        case EXPR_AND:      __attribute__((fallthrough));
+        case EXPR_OR:       __attribute__((fallthrough));
+        case EXPR_NOT:
+            bool_val_codegen(e);
             break;
-        case EXPR_G_EQ:
-            bool_val_codegen(e, "JGE");
-            break;
-        case EXPR_FUN_CALL:
-            expr* arg = e->right;
-            int i = 0;
-            while (arg != NULL) {
-                expr_codegen(arg);
-                if (i < 6) {
-                    printf(
-                        "MOVQ %s, %s\n",
-                        scratch_name(arg->reg),
-                        ARG_REGS[i]
-                    );
-                } else {
-                    printf(
-                        "PUSHQ %s\n",
-                        scratch_name(arg->reg)
-                    );
-                }
-                scratch_free(arg->reg);
-                
-                i++;
-                arg = arg->right;
+        case EXPR_FUN_CALL: {
+            int count = 0;
+            for (expr* arg = e->right; arg != NULL; arg = arg->right) {
+                count++;
             }
-            printf("PUSHQ %%r10\n");
-            printf("PUSHQ %%r11\n");
-
-            printf("CALL .%s\n", e->symbol->name);
+            int stack_args = count > 6 ? count - 6 : 0;
+            int saved = caller_save_codegen(0, stack_args);
 
-            printf("POPQ %%r11\n");
-            printf("POPQ %%r10\n");
+            args_codegen(e->right);
+            fprintf(codegen_out, "CALL %s\n", e->left->symbol->name);
+            caller_restore_codegen(saved, stack_args);
 
             e->reg = scratch_alloc();
-            printf(
+            fprintf(
+                codegen_out,
                 "MOVQ %%rax, %s\n",
                 scratch_name(e->reg)
             );
             break;
-        case EXPR_ARRAY:
-            printf(
-                "MOVQ $%s, %%rax\n",
-                e->symbol->type->size
-            );
-            printf(
-                "IMULQ $8\n"
-            );
+        }
+        case EXPR_ARRAY: {
+            if (!array_is_constant(e)) {
+                array_init_codegen(e);
+                break;
+            }
+            /* the copy in `.rodata` is all there needs to be: */
+            int template = add_array(e, array_length(e));
             e->reg = scratch_alloc();
-            printf( /* save soon-to-be array address to register */
-                "MOVQ %%rsp, %s\n",
+            fprintf(
+                codegen_out,
+                "LEAQ %s(%%rip), %s\n",
+                array_label(template),
                 scratch_name(e->reg)
             );
-            printf(
-                "SUBQ %%rax, %%rsp\n"
-            );
-            int pointer = scratch_alloc();
-            printf(
-                "MOVQ %s, %s\n",
-                scratch_name(e->reg),
-                scratch_name(pointer)
-            );
-            expr* item = e;
-            while (item != NULL) {
-                printf(
-                    "MOVQ $%d, (%s)\n",
-                    e->value,
-                    scratch_name(pointer)
-                );
-                printf(
-                    "SUBQ $4, %s\n",
-                    scratch_name(pointer)
-                );
-                item = item->right;
-            }
-            scratch_free(pointer);
             break;
+        }
         case EXPR_INDEX:
             expr_codegen(e->left);
+            if (e->right->kind == EXPR_INT_LIT && !e->checked) {
+                /* constant offset, as for a pointer after strength
+                 * reduction */
+                fprintf(
+                    codegen_out,
+                    "MOVQ %d(%s), %s\n",
+                    8 * e->right->value,
+                    scratch_name(e->left->reg),
+                    scratch_name(e->left->reg)
+                );
+                e->reg = e->left->reg;
+                break;
+            }
             expr_codegen(e->right);
+            if (e->checked) bounds_check_codegen(e);
             e->reg = scratch_alloc();
-            printf(
-                "MOVQ (%s, %s, $8), %s\n",
+            fprintf(
+                codegen_out,
+                "MOVQ (%s, %s, 8), %s\n",
                 scratch_name(e->left->reg),
                 scratch_name(e->right->reg),
                 scratch_name(e->reg)
@@ -600,5 +1272,287 @@ void expr_codegen(expr* e) {
             scratch_free(e->left->reg);
             scratch_free(e->right->reg);
             break;
+        case EXPR_ARG:
+            /* (argument lists are only walked by the calls and arrays
+             * holding them, never evaluated as a whole) */
+            fprintf(
+                stderr,
+                "error: internal: argument list generated as a value\n"
+            );
+            exit(1);
     }
-}
\ No newline at end of file
+}
+
+void bounds_check_codegen(expr* e) {
+    /* Compared unsigned, a negative index is past the end too. The error
+     * path never returns, so there's nothing to save for it. */
+    int length = e->left->symbol->type->size;
+    int ok = create_label();
+    fprintf(codegen_out, "CMPQ $%d, %s\n", length, scratch_name(e->right->reg));
+    fprintf(codegen_out, "JB %s\n", label_name(ok));
+    fprintf(codegen_out, "MOVQ %s, %%rdi\n", scratch_name(e->right->reg));
+    fprintf(codegen_out, "MOVQ $%d, %%rsi\n", length);
+    fprintf(codegen_out, "CALL bm_bounds_error\n");
+    fprintf(codegen_out, "%s:\n", label_name(ok));
+}
+
+void exp_codegen(expr* e) {
+    if (
+        e->right->kind == EXPR_INT_LIT
+        && e->right->value >= 0
+        && e->right->value <= EXP_UNROLL_LIMIT
+    ) {
+        exp_const_codegen(e);
+        return;
+    }
+
+    expr_codegen(e->left);
+    expr_codegen(e->right);
+    const char* base = scratch_name(e->left->reg);
+    const char* power = scratch_name(e->right->reg);
+    e->reg = scratch_alloc();
+    const char* result = scratch_name(e->reg);
+    int top = create_label();
+    int even = create_label();
+    int done = create_label();
+
+    fprintf(codegen_out, "MOVQ $1, %s\n", result);
+    fprintf(codegen_out, "TESTQ %s, %s\n", power, power);
+    fprintf(codegen_out, "JNS %s\n", label_name(top));
+    /* A negative power gives `1 / base^-power`, truncated: 0, unless the
+     * base is 1 or -1, whose powers only depend on whether the power is
+     * odd. (So there's no division by zero for a base of 0 either.) */
+    fprintf(codegen_out, "ANDQ $1, %s\n", power);
+    fprintf(codegen_out, "CMPQ $1, %s\n", base);
+    fprintf(codegen_out, "JE %s\n", label_name(top));
+    fprintf(codegen_out, "CMPQ $-1, %s\n", base);
+    fprintf(codegen_out, "JE %s\n", label_name(top));
+    fprintf(codegen_out, "XORQ %s, %s\n", result, result);
+    fprintf(codegen_out, "JMP %s\n", label_name(done));
+
+    /* each bit of the power, lowest first, multiplies in the base squared
+     * that many times: */
+    fprintf(codegen_out, "%s:\n", label_name(top));
+    fprintf(codegen_out, "TESTQ $1, %s\n", power);
+    fprintf(codegen_out, "JZ %s\n", label_name(even));
+    fprintf(codegen_out, "IMULQ %s, %s\n", base, result);
+    fprintf(codegen_out, "%s:\n", label_name(even));
+    fprintf(codegen_out, "SHRQ $1, %s\n", power);
+    fprintf(codegen_out, "JZ %s\n", label_name(done));
+    fprintf(codegen_out, "IMULQ %s, %s\n", base, base);
+    fprintf(codegen_out, "JMP %s\n", label_name(top));
+    fprintf(codegen_out, "%s:\n", label_name(done));
+
+    scratch_free(e->left->reg);
+    scratch_free(e->right->reg);
+}
+
+void exp_const_codegen(expr* e) {
+    int power = e->right->value;
+    expr_codegen(e->left);
+    int base = e->left->reg;
+
+    if (power == 0) {
+        /* (the base is still evaluated, for any call in it) */
+        fprintf(codegen_out, "MOVQ $1, %s\n", scratch_name(base));
+        e->reg = base;
+        return;
+    }
+
+    /* Bits of the power, highest first: squaring doubles the power so far,
+     * and multiplying by the base adds one. A power of 2 needs no copy of
+     * the base. */
+    int top = 31 - __builtin_clz(power);
+    int r = base;
+    if (power & (power - 1)) {
+        r = scratch_alloc();
+        fprintf(
+            codegen_out,
+            "MOVQ %s, %s\n",
+            scratch_name(base),
+            scratch_name(r)
+        );
+    }
+    for (int bit = top - 1; bit >= 0; bit--) {
+        fprintf(
+            codegen_out,
+            "IMULQ %s, %s\n",
+            scratch_name(r),
+            scratch_name(r)
+        );
+        if (power & (1 << bit)) {
+            fprintf(
+                codegen_out,
+                "IMULQ %s, %s\n",
+                scratch_name(base),
+                scratch_name(r)
+            );
+        }
+    }
+    if (r != base) scratch_free(base);
+    e->reg = r;
+}
+
+void div_const_codegen(expr* e) {
+    long long divisor = e->right->value;
+    bool mod = e->kind == EXPR_MOD;
+    unsigned long long d = divisor < 0 ? -divisor : divisor;
+
+    expr_codegen(e->left);
+    const char* x = scratch_name(e->left->reg);
+    e->reg = e->left->reg;
+
+    if (d == 1) {
+        if (mod) {
+            fprintf(codegen_out, "XORQ %s, %s\n", x, x);
+        } else if (divisor < 0) {
+            fprintf(codegen_out, "NEGQ %s\n", x);
+        }
+        return;
+    }
+
+    if ((d & (d - 1)) == 0) {
+        /* Shifting right rounds down, where division rounds toward zero,
+         * so a negative dividend gets `d - 1` added first: */
+        int k = __builtin_ctzll(d);
+        fprintf(codegen_out, "MOVQ %s, %%rax\n", x);
+        fprintf(codegen_out, "SARQ $63, %%rax\n");
+        fprintf(codegen_out, "SHRQ $%d, %%rax\n", 64 - k);
+        fprintf(codegen_out, "ADDQ %s, %%rax\n", x);
+        if (mod) {
+            /* `x - (x / d) * d`, the sign following `x` */
+            fprintf(codegen_out, "ANDQ $%lld, %%rax\n", -(long long)d);
+            fprintf(codegen_out, "SUBQ %%rax, %s\n", x);
+        } else {
+            fprintf(codegen_out, "SARQ $%d, %%rax\n", k);
+            if (divisor < 0) fprintf(codegen_out, "NEGQ %%rax\n");
+            fprintf(codegen_out, "MOVQ %%rax, %s\n", x);
+        }
+        return;
+    }
+
+    /* `x / d` is the high half of `x * magic`, shifted right and rounded
+     * toward zero (see `div_magic()`) */
+    long long magic;
+    int shift;
+    div_magic(d, &magic, &shift);
+    fprintf(codegen_out, "MOVABSQ $%lld, %%rax\n", magic);
+    fprintf(codegen_out, "IMULQ %s\n", x);
+    /* (a magic number past the largest signed one came out negative, so
+     * `x` is added back) */
+    if (magic < 0) fprintf(codegen_out, "ADDQ %s, %%rdx\n", x);
+    if (shift > 0) fprintf(codegen_out, "SARQ $%d, %%rdx\n", shift);
+    /* plus 1 if negative: */
+    fprintf(codegen_out, "MOVQ %%rdx, %%rax\n");
+    fprintf(codegen_out, "SHRQ $63, %%rax\n");
+    fprintf(codegen_out, "ADDQ %%rax, %%rdx\n");
+    if (mod) {
+        fprintf(codegen_out, "IMULQ $%llu, %%rdx, %%rdx\n", d);
+        fprintf(codegen_out, "SUBQ %%rdx, %s\n", x);
+    } else {
+        if (divisor < 0) fprintf(codegen_out, "NEGQ %%rdx\n");
+        fprintf(codegen_out, "MOVQ %%rdx, %s\n", x);
+    }
+}
+
+void div_magic(unsigned long long d, long long* magic, int* shift) {
+    /* From Hacker's Delight (10-1): the smallest `p >= 64` such that
+     * `2^p / d`, rounded up, is within the error that still truncates to
+     * the right quotient for every 64-bit dividend. */
+    const unsigned long long two63 = 1ull << 63;
+    unsigned long long anc = two63 - 1 - two63 % d;
+    unsigned long long q1 = two63 / anc;
+    unsigned long long r1 = two63 - q1 * anc;
+    unsigned long long q2 = two63 / d;
+    unsigned long long r2 = two63 - q2 * d;
+    unsigned long long delta;
+    int p = 63;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= d) {
+            q2++;
+            r2 -= d;
+        }
+        delta = d - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    *magic = (long long)(q2 + 1);
+    *shift = p - 64;
+}
+
+int args_codegen(expr* args) {
+    int count = 0;
+    for (expr* arg = args; arg != NULL; arg = arg->right) count++;
+
+    if (count <= 6) {
+        /* evaluate them all before loading any, so that calls made by
+         * later arguments don't clobber earlier ones: */
+        expr* arg = args;
+        for (int i = 0; i < count; i++, arg = arg->right) {
+            expr_codegen(arg->left);
+        }
+        arg = args;
+        for (int i = 0; i < count; i++, arg = arg->right) {
+            fprintf(
+                codegen_out,
+                "MOVQ %s, %s\n",
+                scratch_name(arg->left->reg),
+                ARG_REGS[i]
+            );
+            scratch_free(arg->left->reg);
+        }
+        return 0;
+    }
+
+    /* Too many to hold in scratch registers, so each is stored as it's
+     * evaluated (still left to right) into its slot, the first lowest.
+     * The first six are loaded from theirs and popped, which leaves the
+     * rest where the callee looks for them. */
+    fprintf(codegen_out, "SUBQ $%d, %%rsp\n", 8 * count);
+    int i = 0;
+    for (expr* arg = args; arg != NULL; arg = arg->right, i++) {
+        expr_codegen(arg->left);
+        fprintf(
+            codegen_out,
+            "MOVQ %s, %d(%%rsp)\n",
+            scratch_name(arg->left->reg),
+            8 * i
+        );
+        scratch_free(arg->left->reg);
+    }
+    for (i = 0; i < 6; i++) {
+        fprintf(codegen_out, "MOVQ %d(%%rsp), %s\n", 8 * i, ARG_REGS[i]);
+    }
+    fprintf(codegen_out, "ADDQ $%d, %%rsp\n", 8 * 6);
+    return count - 6;
+}
+
+bool is_tail_call(expr* e) {
+    if (e->kind != EXPR_FUN_CALL) return false;
+
+    /* the callee has to find all of its arguments in registers, since the
+     * stack they'd go on is about to be popped */
+    int count = 0;
+    for (expr* arg = e->right; arg != NULL; arg = arg->right) {
+        /* nor can it be handed a local array, which lives in our frame */
+        expr* value = arg->left;
+        if (
+            (value->kind == EXPR_IDENT
+                && value->symbol->kind != SYMBOL_GLOBAL
+                && value->symbol->type->kind == TYPE_ARRAY)
+            || (value->kind == EXPR_ARRAY && !array_is_constant(value))
+        ) {
+            return false;
+        }
+        count++;
+    }
+    return count <= 6;
+}
@@ -3,9 +3,14 @@
 
 extern int label_count;
 extern int str_count;
+extern int array_count;
 extern const int NUM_SCRATCH;
 extern reg scratch[];
+extern const char* frame_reg;
+extern bool func_leaf;
 extern data_entry* data;
+extern data_entry* rodata;
+extern data_entry* bss;
 
 /**********************************************************************
  *                         UTILITY FUNCTIONS                          *
@@ -17,10 +22,13 @@ const char* symbol_address(symbol* s) {
             return s->name;
         case SYMBOL_LOCAL: __attribute__((fallthrough));
         case SYMBOL_PARAM:
-            int bytes = 8 * s->which;
+            /* (the slot at `0(%rbp)` holds the caller's `%rbp`, or in a
+             * leaf function without a frame `0(%rsp)` the return
+             * address) */
+            int bytes = 8 * (s->which + 1);
             
-            const char* res;
-            if (0 > asprintf(&res, "-%d(%%rbp)", bytes)) {
+            char* res;
+            if (0 > asprintf(&res, "-%d(%s)", bytes, frame_reg)) {
                 fprintf(
                     stderr,
                     "error: failed to construct symbol address\n"
@@ -29,65 +37,238 @@ const char* symbol_address(symbol* s) {
             }
             return res;
     }
+    /* (every kind is handled above) */
+    return NULL;
 }
 
-int add_str(const char* s, bool newline) {
+int add_str(const char* s) {
     int label = str_count++;
     data_entry* entry = malloc(sizeof(*entry));
-    
+
+    /* escaped for the assembler, at most four characters per byte: */
+    size_t length = strlen(s);
+    char* escaped = malloc(4 * length + 1);
+    char* p = escaped;
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            *p++ = '\\';
+            *p++ = *s;
+        } else if (*s < ' ' || *s == 0x7F) {
+            p += sprintf(p, "\\%03o", (unsigned char)*s);
+        } else {
+            *p++ = *s;
+        }
+    }
+    *p = '\0';
+
+    /* the length goes just before the characters (see `runtime.h`): */
     if (0 > asprintf(
         &entry->entry,
-        "%s: db \"%s\"%s\n",
+        ".balign 8\n.quad %zu\n%s: .string \"%s\"\n",
+        length,
         str_label(label),
-        s,
-        newline ? ", $0xA" : ""
+        escaped
     )) {
         fprintf(
             stderr,
             "error: failed to add string to data section\n"
         );
+        return -1;
+    }
+    free(escaped);
+
+    entry->next = rodata;
+    rodata = entry;
+
+    return label;
+}
+
+const char* str_label(int label) {
+    char* res;
+    if (0 > asprintf(&res, "str%d", label)) {
+        fprintf(
+            stderr,
+            "error: failed to construct string label\n"
+        );
         return NULL;
     }
+    return res;
+}
 
-    data_entry* length = malloc(sizeof(*entry));
+int add_array(expr* array, int length) {
+    int label = array_count++;
+    array_data(array_label(label), array, length);
+    return label;
+}
+
+void array_data(const char* label, expr* array, int length) {
+    int* values = calloc(length > 0 ? length : 1, sizeof(*values));
+    /* (the labels of string items, which are pointers to their characters;
+     * NULL for the rest) */
+    const char** strings = calloc(length > 0 ? length : 1, sizeof(*strings));
+    int i = 0;
+    for (expr* item = array ? array->left : NULL; item; item = item->right) {
+        /* (items only known at runtime are stored over these) */
+        if (i < length && is_literal(item->left)) values[i] = item->left->value;
+        if (i < length && item->left->kind == EXPR_STR_LIT) {
+            strings[i] = str_label(add_str(item->left->str_value));
+        }
+        i++;
+    }
+
+    char* entry_text;
+    size_t size;
+    FILE* f = open_memstream(&entry_text, &size);
+    fprintf(f, ".balign 16\n%s:\n", label);
+
+    /* runs of the same value are written once, with a repeat count: */
+    int line = 0;
+    for (i = 0; i < length;) {
+        int run = 1;
+        while (
+            i + run < length
+            && !strings[i]
+            && !strings[i + run]
+            && values[i + run] == values[i]
+        ) run++;
+
+        if (run >= DATA_REPEAT_MIN) {
+            if (line) fprintf(f, "\n");
+            line = 0;
+            if (values[i] == 0) {
+                fprintf(f, ".zero %d\n", 8 * run);
+            } else {
+                fprintf(f, ".rept %d\n.quad %d\n.endr\n", run, values[i]);
+            }
+            i += run;
+            continue;
+        }
 
+        /* and the rest several to a line: */
+        fprintf(f, line ? ", " : ".quad ");
+        if (strings[i]) {
+            fprintf(f, "%s", strings[i]);
+        } else {
+            fprintf(f, "%d", values[i]);
+        }
+        if (++line == DATA_PER_LINE) {
+            fprintf(f, "\n");
+            line = 0;
+        }
+        i++;
+    }
+    if (line) fprintf(f, "\n");
+    fclose(f);
+    free(values);
+    free(strings);
+
+    data_entry* entry = malloc(sizeof(*entry));
+    entry->entry = entry_text;
+    entry->next = rodata;
+    rodata = entry;
+}
+
+bool array_is_zero(expr* array) {
+    for (expr* item = array->left; item != NULL; item = item->right) {
+        if (!is_literal(item->left) || item->left->value != 0) return false;
+    }
+    return true;
+}
+
+void add_bss(const char* label, int size, int align) {
+    data_entry* entry = malloc(sizeof(*entry));
     if (0 > asprintf(
-        &length->entry,
-        "%s_len: equ $-%s\n",
-        str_label(label),
-        str_label(label)
+        &entry->entry,
+        ".balign %d\n%s: .zero %d\n",
+        align,
+        label,
+        size
     )) {
         fprintf(
             stderr,
-            "error: failed to add string length to data section\n"
+            "error: failed to add `%s` to bss section\n",
+            label
+        );
+        return;
+    }
+    entry->next = bss;
+    bss = entry;
+}
+
+const char* array_label(int label) {
+    char* res;
+    if (0 > asprintf(&res, "arr%d", label)) {
+        fprintf(
+            stderr,
+            "error: failed to construct array label\n"
         );
         return NULL;
     }
+    return res;
+}
 
-    length->next = data;
-    entry->next = length;
-    data = entry;
+int array_length(expr* array) {
+    int count = 0;
+    for (expr* item = array->left; item != NULL; item = item->right) count++;
 
-    return label;
+    /* (any items not given are zero) */
+    if (array->symbol && array->symbol->type->size > count) {
+        return array->symbol->type->size;
+    }
+    return count;
 }
 
-const char* str_label(int label) {
-    const char* res;
-    if (0 > asprintf(&res, "str%d", label)) {
+bool array_is_constant(expr* array) {
+    for (expr* item = array->left; item != NULL; item = item->right) {
+        if (!is_literal(item->left) && item->left->kind != EXPR_STR_LIT) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool global_is_constant(symbol* s, expr* value) {
+    if (!value) return true;
+
+    if (s->type->kind == TYPE_ARRAY) {
+        if (value->kind != EXPR_ARRAY || !array_is_constant(value)) {
+            fprintf(
+                stderr,
+                "error: global array `%s` must hold constants\n",
+                s->name
+            );
+            return false;
+        }
+    } else if (!is_literal(value) && value->kind != EXPR_STR_LIT) {
         fprintf(
             stderr,
-            "error: failed to construct string label\n"
+            "error: global `%s` must be initialized with a constant\n",
+            s->name
         );
-        return NULL;
+        return false;
     }
-    return res;
+    return true;
+}
+
+bool is_literal(expr* e) {
+    return e->kind == EXPR_BOOL_LIT
+        || e->kind == EXPR_CHAR_LIT
+        || e->kind == EXPR_INT_LIT;
 }
 
 int scratch_alloc() {
-    for (int i = 0; i < NUM_SCRATCH; i++) {
-        if (!scratch[i].used) {
-            scratch[i].used = true;
-            return i;
+    /* A function making calls would rather keep values in callee-saved
+     * registers, saved once in its prologue, than in registers saved
+     * around every call they live across. One making none needn't save
+     * the others at all. */
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < NUM_SCRATCH; i++) {
+            bool preferred = scratch[i].callee_saved != func_leaf;
+            if (!scratch[i].used && preferred == (pass == 0)) {
+                scratch[i].used = true;
+                scratch[i].touched = true;
+                return i;
+            }
         }
     }
     fprintf(stderr, "error: could not allocate scratch register\n");
@@ -102,12 +283,16 @@ const char* scratch_name(int r) {
     return scratch[r].name;
 }
 
+const char* scratch_byte_name(int r) {
+    return scratch[r].byte_name;
+}
+
 int create_label() {
     return label_count++;
 }
 
 const char* label_name(int label) {
-    const char* res;
+    char* res;
     if (0 > asprintf(&res, ".L%d", label)) {
         fprintf(
             stderr,
@@ -116,4 +301,29 @@ const char* label_name(int label) {
         return NULL;
     }
     return res;
+}
+
+int node_label(cfg_node* node) {
+    if (node->label < 0) {
+        node->label = create_label();
+    }
+    return node->label;
+}
+
+const char* condition_code(expr_t kind, bool negate) {
+    switch (kind) {
+        case EXPR_EQ:      return negate ? "NE" : "E";
+        case EXPR_N_EQ:    return negate ? "E" : "NE";
+        case EXPR_LESS:    return negate ? "GE" : "L";
+        case EXPR_L_EQ:    return negate ? "G" : "LE";
+        case EXPR_GREATER: return negate ? "LE" : "G";
+        case EXPR_G_EQ:    return negate ? "L" : "GE";
+        default:
+            fprintf(
+                stderr,
+                "error: `%s` is not a comparison\n",
+                expr_t_str[kind]
+            );
+            return NULL;
+    }
 }
\ No newline at end of file
@@ -0,0 +1,411 @@
+#include "codegen.h"
+#include "symbol.h"
+
+extern FILE* codegen_out;
+
+/* 16 bytes (SSE2) unless `--avx2` asks for 32 */
+int vector_bytes = 16;
+/* the width registers are named at, which only differs from `vector_bytes`
+ * when AVX2 folds the upper half of a register into the lower */
+int vector_width = 16;
+
+bool vector_used[NUM_VECTOR];
+
+const char* XMM_NAMES[] = {
+    "%xmm0", "%xmm1", "%xmm2", "%xmm3",
+    "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+    "%xmm8", "%xmm9", "%xmm10", "%xmm11",
+    "%xmm12", "%xmm13", "%xmm14", "%xmm15",
+};
+
+const char* YMM_NAMES[] = {
+    "%ymm0", "%ymm1", "%ymm2", "%ymm3",
+    "%ymm4", "%ymm5", "%ymm6", "%ymm7",
+    "%ymm8", "%ymm9", "%ymm10", "%ymm11",
+    "%ymm12", "%ymm13", "%ymm14", "%ymm15",
+};
+
+/**********************************************************************
+ *                               VECTORS                              *
+ **********************************************************************/
+
+/* Every vector register is caller-saved, and nothing else keeps a value in
+ * one past a statement, so they're all free for a STMT_VECTOR. With AVX2
+ * the same instructions are used in their VEX forms, which take a separate
+ * destination. */
+
+void vector_codegen(stmt* s) {
+    symbol* index = s->init_expr->symbol;
+    expr* reduce = s->next_expr;
+    expr* value = reduce->right;
+    int lanes = vector_bytes / 8;
+    int skip = create_label();
+    vector_width = vector_bytes;
+
+    /* how many iterations are left, less one vector; with none to run (or
+     * too many to count), the loop does it all: */
+    expr_codegen(s->expr);
+    int left = s->expr->reg;
+    int i = scratch_alloc();
+    fprintf(
+        codegen_out,
+        "MOVQ %s, %s\n",
+        symbol_address(index),
+        scratch_name(i)
+    );
+    fprintf(codegen_out, "SUBQ %s, %s\n", scratch_name(i), scratch_name(left));
+    fprintf(codegen_out, "JO %s\n", label_name(skip));
+    fprintf(codegen_out, "SUBQ $%d, %s\n", lanes, scratch_name(left));
+    fprintf(codegen_out, "JL %s\n", label_name(skip));
+
+    /* what stays the same goes in every lane, then the arrays' addresses
+     * are kept at hand: */
+    vector_leaves(value, index);
+    vector_bases(value, index);
+
+    int acc = vector_alloc();
+    if (reduce->kind == EXPR_ADD || reduce->kind == EXPR_SUB) {
+        vector_op("PXOR", vector_name(acc), acc, acc);
+    } else {
+        /* (starting from the variable, so it takes part in the result) */
+        int r = scratch_alloc();
+        fprintf(
+            codegen_out,
+            "MOVQ %s, %s\n",
+            symbol_address(reduce->left->symbol),
+            scratch_name(r)
+        );
+        vector_broadcast(r, acc);
+        scratch_free(r);
+    }
+
+    int top = create_label();
+    fprintf(codegen_out, "%s:\n", label_name(top));
+    int v = vector_expr(value, index, i);
+    vector_combine(reduce->kind, v, acc);
+    vector_free(v);
+    fprintf(codegen_out, "ADDQ $%d, %s\n", lanes, scratch_name(i));
+    fprintf(codegen_out, "SUBQ $%d, %s\n", lanes, scratch_name(left));
+    fprintf(codegen_out, "JGE %s\n", label_name(top));
+
+    vector_release(value, index);
+    scratch_free(left);
+
+    /* the lanes fold into one, a half at a time (a sum being subtracted
+     * was subtracted from zero in every lane, so its lanes add up): */
+    expr_t fold = reduce->kind == EXPR_SUB ? EXPR_ADD : reduce->kind;
+    int half = vector_alloc();
+    if (vector_bytes == 32) {
+        fprintf(
+            codegen_out,
+            "VEXTRACTI128 $1, %s, %s\n",
+            vector_name(acc),
+            XMM_NAMES[half]
+        );
+        vector_width = 16;
+        vector_combine(fold, half, acc);
+    }
+    vector_width = 16;
+    vector_shuffle(0x4E, acc, half);
+    vector_combine(fold, half, acc);
+    vector_free(half);
+
+    int r = scratch_alloc();
+    fprintf(
+        codegen_out,
+        "%s %s, %s\n",
+        vector_bytes == 32 ? "VMOVQ" : "MOVQ",
+        vector_name(acc),
+        scratch_name(r)
+    );
+    vector_free(acc);
+    /* (the upper halves of the registers would otherwise slow down any SSE
+     * code that follows) */
+    if (vector_bytes == 32) fprintf(codegen_out, "VZEROUPPER\n");
+
+    fprintf(
+        codegen_out,
+        fold == EXPR_ADD ? "ADDQ %s, %s\n" : "MOVQ %s, %s\n",
+        scratch_name(r),
+        symbol_address(reduce->left->symbol)
+    );
+    scratch_free(r);
+    fprintf(
+        codegen_out,
+        "MOVQ %s, %s\n",
+        scratch_name(i),
+        symbol_address(index)
+    );
+    scratch_free(i);
+    fprintf(codegen_out, "%s:\n", label_name(skip));
+}
+
+bool vector_varies(expr* e, symbol* index) {
+    if (!e) return false;
+
+    switch (e->kind) {
+        case EXPR_INDEX:
+            return e->right->kind == EXPR_IDENT && e->right->symbol == index;
+        case EXPR_ADD:      __attribute__((fallthrough));
+        case EXPR_SUB:      __attribute__((fallthrough));
+        case EXPR_MUL:
+            return vector_varies(e->left, index)
+                || vector_varies(e->right, index);
+        default:
+            /* (`vectorize_value()` lets nothing else be computed per lane) */
+            return false;
+    }
+}
+
+void vector_leaves(expr* e, symbol* index) {
+    if (!vector_varies(e, index)) {
+        expr_codegen(e);
+        int r = vector_alloc();
+        vector_broadcast(e->reg, r);
+        scratch_free(e->reg);
+        e->reg = r;
+    } else if (e->kind != EXPR_INDEX) {
+        vector_leaves(e->left, index);
+        vector_leaves(e->right, index);
+    }
+}
+
+void vector_bases(expr* e, symbol* index) {
+    if (!vector_varies(e, index)) return;
+
+    if (e->kind == EXPR_INDEX) {
+        expr_codegen(e->left);
+    } else {
+        vector_bases(e->left, index);
+        vector_bases(e->right, index);
+    }
+}
+
+void vector_release(expr* e, symbol* index) {
+    if (!vector_varies(e, index)) {
+        vector_free(e->reg);
+    } else if (e->kind == EXPR_INDEX) {
+        scratch_free(e->left->reg);
+    } else {
+        vector_release(e->left, index);
+        vector_release(e->right, index);
+    }
+}
+
+int vector_expr(expr* e, symbol* index, int i) {
+    if (!vector_varies(e, index)) return e->reg;
+
+    if (e->kind == EXPR_INDEX) {
+        int r = vector_alloc();
+        fprintf(
+            codegen_out,
+            "%s (%s, %s, 8), %s\n",
+            vector_bytes == 32 ? "VMOVDQU" : "MOVDQU",
+            scratch_name(e->left->reg),
+            scratch_name(i),
+            vector_name(r)
+        );
+        return r;
+    }
+
+    int x = vector_expr(e->left, index, i);
+    int y = vector_expr(e->right, index, i);
+    bool own_x = vector_varies(e->left, index);
+    bool own_y = vector_varies(e->right, index);
+
+    /* the result goes over an operand computed for it, if there is one
+     * (only the second, if the operation doesn't care about order): */
+    if (!own_x && own_y && e->kind != EXPR_SUB) {
+        int t = x;
+        x = y;
+        y = t;
+        own_x = true;
+        own_y = false;
+    }
+    int dst = own_x ? x : vector_alloc();
+
+    switch (e->kind) {
+        case EXPR_ADD:
+            vector_op("PADDQ", vector_name(y), x, dst);
+            break;
+        case EXPR_SUB:
+            vector_op("PSUBQ", vector_name(y), x, dst);
+            break;
+        case EXPR_MUL:
+            vector_mul(x, y, dst);
+            break;
+        default:
+            break;
+    }
+    if (own_y) vector_free(y);
+    return dst;
+}
+
+void vector_mul(int x, int y, int dst) {
+    /* There's no multiply of 64-bit lanes before AVX-512, only of their low
+     * halves into 64 bits. With `x = xh * 2^32 + xl` (and likewise `y`),
+     * the low 64 bits of `x * y` are
+     *
+     *     xl * yl + ((xh * yl + xl * yh) << 32)
+     * */
+    int high = vector_alloc();
+    int t = vector_alloc();
+    vector_op("PSRLQ", "$32", x, high);
+    vector_op("PMULUDQ", vector_name(y), high, high);
+    vector_op("PSRLQ", "$32", y, t);
+    vector_op("PMULUDQ", vector_name(x), t, t);
+    vector_op("PADDQ", vector_name(t), high, high);
+    vector_op("PSLLQ", "$32", high, high);
+    vector_op("PMULUDQ", vector_name(y), x, dst);
+    vector_op("PADDQ", vector_name(high), dst, dst);
+    vector_free(high);
+    vector_free(t);
+}
+
+void vector_combine(expr_t kind, int v, int acc) {
+    int mask;
+    switch (kind) {
+        case EXPR_ADD:
+            vector_op("PADDQ", vector_name(v), acc, acc);
+            break;
+        case EXPR_SUB:
+            vector_op("PSUBQ", vector_name(v), acc, acc);
+            break;
+        case EXPR_LESS:
+            mask = vector_alloc();
+            vector_greater(acc, v, mask);
+            vector_select(mask, v, acc);
+            vector_free(mask);
+            break;
+        case EXPR_GREATER:
+            mask = vector_alloc();
+            vector_greater(v, acc, mask);
+            vector_select(mask, v, acc);
+            vector_free(mask);
+            break;
+        default:
+            break;
+    }
+}
+
+void vector_greater(int a, int b, int mask) {
+    if (vector_bytes == 32) {
+        fprintf(
+            codegen_out,
+            "VPCMPGTQ %s, %s, %s\n",
+            vector_name(b),
+            vector_name(a),
+            vector_name(mask)
+        );
+        return;
+    }
+
+    /* SSE2 only compares 32-bit halves. The high halves decide, unless
+     * they're equal, when the sign of `b - a` does (the low halves being
+     * unsigned, and their difference not reaching the high half): */
+    int t = vector_alloc();
+    vector_op("PSUBQ", vector_name(a), b, mask);
+    vector_op("PCMPEQD", vector_name(b), a, t);
+    vector_op("PAND", vector_name(t), mask, mask);
+    vector_op("PCMPGTD", vector_name(b), a, t);
+    vector_op("POR", vector_name(t), mask, mask);
+    /* the sign of each high half, over the whole lane: */
+    vector_op("PSRAD", "$31", mask, mask);
+    vector_shuffle(0xF5, mask, mask);
+    vector_free(t);
+}
+
+void vector_select(int mask, int v, int acc) {
+    if (vector_bytes == 32) {
+        fprintf(
+            codegen_out,
+            "VPBLENDVB %s, %s, %s, %s\n",
+            vector_name(mask),
+            vector_name(v),
+            vector_name(acc),
+            vector_name(acc)
+        );
+        return;
+    }
+
+    /* `(v & mask) | (acc & ~mask)` */
+    vector_op("PAND", vector_name(mask), v, v);
+    vector_op("PANDN", vector_name(acc), mask, mask);
+    vector_op("POR", vector_name(mask), v, acc);
+}
+
+void vector_op(const char* op, const char* src, int a, int dst) {
+    if (vector_bytes == 32) {
+        fprintf(
+            codegen_out,
+            "V%s %s, %s, %s\n",
+            op,
+            src,
+            vector_name(a),
+            vector_name(dst)
+        );
+        return;
+    }
+    if (a != dst) vector_move(a, dst);
+    fprintf(codegen_out, "%s %s, %s\n", op, src, vector_name(dst));
+}
+
+void vector_move(int src, int dst) {
+    fprintf(
+        codegen_out,
+        "%s %s, %s\n",
+        vector_bytes == 32 ? "VMOVDQA" : "MOVDQA",
+        vector_name(src),
+        vector_name(dst)
+    );
+}
+
+void vector_shuffle(int order, int src, int dst) {
+    fprintf(
+        codegen_out,
+        "%s $0x%X, %s, %s\n",
+        vector_bytes == 32 ? "VPSHUFD" : "PSHUFD",
+        order,
+        vector_name(src),
+        vector_name(dst)
+    );
+}
+
+void vector_broadcast(int r, int dst) {
+    if (vector_bytes == 32) {
+        fprintf(codegen_out, "VMOVQ %s, %s\n", scratch_name(r), XMM_NAMES[dst]);
+        fprintf(
+            codegen_out,
+            "VPBROADCASTQ %s, %s\n",
+            XMM_NAMES[dst],
+            vector_name(dst)
+        );
+        return;
+    }
+    fprintf(codegen_out, "MOVQ %s, %s\n", scratch_name(r), vector_name(dst));
+    fprintf(
+        codegen_out,
+        "PUNPCKLQDQ %s, %s\n",
+        vector_name(dst),
+        vector_name(dst)
+    );
+}
+
+int vector_alloc() {
+    for (int i = 0; i < NUM_VECTOR; i++) {
+        if (!vector_used[i]) {
+            vector_used[i] = true;
+            return i;
+        }
+    }
+    fprintf(stderr, "error: could not allocate vector register\n");
+    exit(1);
+}
+
+void vector_free(int r) {
+    vector_used[r] = false;
+}
+
+const char* vector_name(int r) {
+    return vector_width == 32 ? YMM_NAMES[r] : XMM_NAMES[r];
+}
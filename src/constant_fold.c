@@ -13,11 +13,21 @@ bool is_constant(expr* e) {
     }
 }
 
-int pow_int(int a, int b) {
-    if (b == 0) return 1;
-    if (b == 1) return a;
-    
-    return a * pow_int(a, b - 1);
+int64_t pow_int(int a, int b) {
+    /* `1 / a^-b`, truncated, for a negative power (see `exp_codegen()`) */
+    if (b < 0) {
+        if (a == 1 || a == -1) b &= 1;
+        else return 0;
+    }
+
+    /* square-and-multiply, wrapping around in 64 bits as at runtime: */
+    uint64_t base = (int64_t)a;
+    uint64_t result = 1;
+    for (; b > 0; b >>= 1) {
+        if (b & 1) result *= base;
+        base *= base;
+    }
+    return (int64_t)result;
 }
 
 decl* constant_fold_decl(decl* d) {
@@ -65,13 +75,72 @@ stmt* constant_fold_stmt(stmt* s) {
         case STMT_RETURN:
             s->expr = constant_fold_expr(s->expr);
             break;
+        case STMT_VECTOR:
+            /* (made by the optimizer, out of statements already folded) */
+            break;
     }
 
     s->next = constant_fold_stmt(s->next);
+
+    if (s->kind == STMT_PRINT) {
+        constant_fold_print(s);
+    }
     
     return s;
 }
 
+void constant_fold_print(stmt* s) {
+    /* A print list is a run of `print` statements, one per item. Items
+     * known now can be printed as one string, with one call to the
+     * runtime. (`s->next` has already been merged with what follows.) */
+    while (s->next && s->next->kind == STMT_PRINT) {
+        char* text = constant_text(s->expr);
+        char* next_text = constant_text(s->next->expr);
+        if (!text || !next_text) {
+            free(text);
+            free(next_text);
+            return;
+        }
+
+        char* joined;
+        if (0 > asprintf(&joined, "%s%s", text, next_text)) {
+            fprintf(stderr, "error: failed to join printed constants\n");
+            exit(1);
+        }
+        free(text);
+        free(next_text);
+
+        stmt* next = s->next;
+        s->expr = expr_str_lit(joined);
+        s->next = next->next;
+        free(next);
+    }
+}
+
+char* constant_text(expr* e) {
+    /* (as the runtime would print it) */
+    char* text = NULL;
+    switch (e->kind) {
+        case EXPR_STR_LIT:
+            text = strdup(e->str_value);
+            break;
+        case EXPR_INT_LIT:
+            if (0 > asprintf(&text, "%d", e->value)) text = NULL;
+            break;
+        case EXPR_BOOL_LIT:
+            text = strdup(e->value ? "1" : "0");
+            break;
+        case EXPR_CHAR_LIT:
+            /* (a NUL would end the string early) */
+            if (e->value == '\0') break;
+            if (0 > asprintf(&text, "%c", e->value)) text = NULL;
+            break;
+        default:
+            break;
+    }
+    return text;
+}
+
 expr* constant_fold_expr(expr* e) {
     if (!e) return NULL;
 
@@ -90,6 +159,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value + e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_SUB:
@@ -101,6 +172,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value - e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_MUL:
@@ -112,6 +185,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value * e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_DIV:
@@ -123,6 +198,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value / e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_EXP:
@@ -130,10 +207,17 @@ expr* constant_fold_expr(expr* e) {
             e->right = constant_fold_expr(e->right);
 
             if (is_constant(e->left) && is_constant(e->right)) {
+                int64_t power = pow_int(e->left->value, e->right->value);
+                /* unless it doesn't fit in a literal, leaving it to be
+                 * computed at runtime */
+                if (power != (int)power) return e;
+
                 e->kind = EXPR_INT_LIT;
-                e->value = pow_int(e->left->value, e->right->value);
+                e->value = power;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_MOD:
@@ -145,6 +229,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value % e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_AND:
@@ -156,6 +242,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value && e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_OR:
@@ -167,6 +255,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value || e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_EQ:
@@ -178,6 +268,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value == e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_N_EQ:
@@ -189,6 +281,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value != e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_LESS:
@@ -200,6 +294,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value < e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_L_EQ:
@@ -211,6 +307,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value <= e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_GREATER:
@@ -222,6 +320,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value > e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_G_EQ:
@@ -233,6 +333,8 @@ expr* constant_fold_expr(expr* e) {
                 e->value = e->left->value >= e->right->value;
                 free(e->left);
                 free(e->right);
+                e->left = NULL;
+                e->right = NULL;
             }
             return e;
         case EXPR_NOT:
@@ -241,8 +343,15 @@ expr* constant_fold_expr(expr* e) {
             if (is_constant(e->left)) {
                 e->kind = EXPR_BOOL_LIT;
                 e->value = !(e->left->value);
+                free(e->left);
+                e->left = NULL;
             }
             return e;
+        case EXPR_FUN_CALL: __attribute__((fallthrough));
+        case EXPR_ARG:
+            e->left = constant_fold_expr(e->left);
+            e->right = constant_fold_expr(e->right);
+            return e;
         default:
             return e;
     }
@@ -2,7 +2,11 @@
 #include "constant_fold.h"
 #include "cfg.h"
 #include "codegen.h"
+#include "object.h"
+#include "optimize.h"
+#include "vm.h"
 #include <stdio.h>
+#include <string.h>
 
 extern FILE *yyin;
 extern int yyparse();
@@ -14,23 +18,86 @@ extern void decl_resolve(decl* d);
 
 extern void decl_typecheck(decl* d);
 
+extern int vector_bytes;
+
 enum {ARG_NAME,ARG_FILE,ARG_NARGS};
 
 int main(int argc, char** argv) {
+    /* options come before the file, and are taken off the arguments: */
+    bool bounds_checks = false;
+    /* where the program goes, when not printed as assembly: */
+    const char* object_path = NULL;
+    const char* executable_path = NULL;
+    const char* runtime_path = "build/runtime.o";
+    bool check = false;
+    /* to run the program in-process instead, and say how long it took: */
+    bool run = false;
+    bool timings = false;
+    /* to interpret the program's bytecode instead of generating code, and
+     * to compile the functions it spends its time in while it runs: */
+    bool interpret = false;
+    bool tiered = false;
+    while (argc > ARG_FILE && strncmp(argv[ARG_FILE], "--", 2) == 0) {
+        if (strcmp(argv[ARG_FILE], "--bounds-check") == 0) {
+            bounds_checks = true;
+        } else if (strcmp(argv[ARG_FILE], "--avx2") == 0) {
+            /* (for loops `vectorize_program()` finds) */
+            vector_bytes = 32;
+        } else if (strcmp(argv[ARG_FILE], "--check-encoding") == 0) {
+            check = true;
+        } else if (strcmp(argv[ARG_FILE], "--run") == 0) {
+            run = true;
+        } else if (strcmp(argv[ARG_FILE], "--vm") == 0) {
+            interpret = true;
+        } else if (strcmp(argv[ARG_FILE], "--tiered") == 0) {
+            interpret = true;
+            tiered = true;
+        } else if (strcmp(argv[ARG_FILE], "--time") == 0) {
+            timings = true;
+        } else if (
+            argc > ARG_FILE + 1
+            && (strcmp(argv[ARG_FILE], "--object") == 0
+                || strcmp(argv[ARG_FILE], "--executable") == 0
+                || strcmp(argv[ARG_FILE], "--runtime") == 0)
+        ) {
+            /* (these take the next argument with them) */
+            const char* path = argv[ARG_FILE + 1];
+            switch (argv[ARG_FILE][2]) {
+                case 'o':   object_path = path;        break;
+                case 'e':   executable_path = path;    break;
+                default:    runtime_path = path;       break;
+            }
+            argv++;
+            argc--;
+        } else {
+            fprintf(stderr, "unknown option: %s\n", argv[ARG_FILE]);
+            return 1;
+        }
+        argv++;
+        argc--;
+    }
     /* verify number of arguments is correct */
     if (argc != ARG_NARGS) {
-        fprintf(stderr, "Usage: bmcc filename\n");
+        fprintf(
+            stderr,
+            "Usage: bmcc [--bounds-check] [--avx2] [--object file.o]\n"
+            "            [--executable file] [--runtime runtime.o]\n"
+            "            [--run | --vm | --tiered] [--time] [--check-encoding]\n"
+            "            filename\n"
+        );
         return 1;
     }
+    double started = run_clock();
     /* open file to parse */
     yyin = fopen(argv[ARG_FILE], "r");
     if(!yyin) {
         fprintf(stderr, "could not open file: %s\n", argv[ARG_FILE]);
         return 1;
     }
+    int status = 0;
     /* parse */
     if (yyparse()==0) {
-        printf("Parsed successfully.\n");
+        fprintf(stderr, "Parsed successfully.\n");
         
         /* resolve names */
         scope_enter();
@@ -46,10 +113,113 @@ int main(int argc, char** argv) {
         /* convert to CFG */
         cfg* cfg = cfg_construct(parser_result);
 
+        /* optimize */
+        tail_program(cfg);
+        call_node* calls = callgraph_construct(cfg);
+        inline_program(calls);
+        /* inlining leaves calls behind only where it couldn't inline, so
+         * drop functions and globals `main` no longer reaches: */
+        calls = callgraph_construct(cfg);
+        cfg = callgraph_prune(cfg, calls);
+        /* (before the loop passes, which would make indexes harder to
+         * follow) */
+        if (bounds_checks) range_program(cfg);
+        licm_program(cfg);
+        /* (after hoisting, so loops are left with less to get in the way) */
+        vectorize_program(cfg);
+        iv_program(cfg);
+        lvn_program(cfg);
+
         /* codegen */
-        codegen(cfg);
+        if (interpret) {
+            double compiled = run_clock();
+            vm_program* program = lower_program(cfg, tiered);
+            if (program && tiered) tier_create(program, cfg, runtime_path);
+            double lowered = run_clock();
+            int64_t result;
+            if (!program || !vm_run(program, &result)) {
+                status = 1;
+            } else {
+                status = result;
+            }
+            double finished = run_clock();
+            if (program) vm_destroy(program);
+            if (timings && program) {
+                fprintf(
+                    stderr,
+                    "note: compiled in %.3f ms, lowered in %.3f ms, "
+                    "ran in %.3f ms\n",
+                    compiled - started,
+                    lowered - compiled,
+                    finished - lowered
+                );
+            }
+        } else if (!object_path && !executable_path && !check && !run) {
+            codegen(cfg, stdout);
+        } else {
+            /* assembled here, rather than printed: */
+            char* text;
+            size_t size;
+            FILE* out = open_memstream(&text, &size);
+            codegen(cfg, out);
+            fclose(out);
+
+            if (check && !check_encoding(text, argv[ARG_FILE])) status = 1;
+            object* obj = NULL;
+            if (object_path || executable_path || run) {
+                obj = assemble(text, argv[ARG_FILE], NULL, NULL);
+                if (!obj) status = 1;
+            }
+            if (obj && object_path) {
+                FILE* f = fopen(object_path, "wb");
+                if (!f || !elf_write(obj, f) || fclose(f) != 0) {
+                    fprintf(stderr, "error: could not write: %s\n", object_path);
+                    status = 1;
+                }
+            }
+            if (obj && executable_path) {
+                object* runtime = elf_read(runtime_path);
+                object* objects[] = {obj, runtime};
+                if (!runtime || !link_executable(objects, 2, executable_path)) {
+                    status = 1;
+                }
+                object_destroy(runtime);
+            }
+            if (obj && run) {
+                /* (the program writes its output itself, after ours) */
+                fflush(stdout);
+                double compiled = run_clock();
+                object* runtime = elf_read(runtime_path);
+                object* objects[] = {obj, runtime};
+                run_image image;
+                if (runtime && run_load(objects, 2, &image)) {
+                    double loaded = run_clock();
+                    /* (a failed bounds check exits from here, as it would
+                     * from the executable) */
+                    status = image.main();
+                    image.flush();
+                    double finished = run_clock();
+                    run_unload(&image);
+                    if (timings) {
+                        fprintf(
+                            stderr,
+                            "note: compiled in %.3f ms, loaded in %.3f ms, "
+                            "ran in %.3f ms\n",
+                            compiled - started,
+                            loaded - compiled,
+                            finished - loaded
+                        );
+                    }
+                } else {
+                    status = 1;
+                }
+                object_destroy(runtime);
+            }
+            object_destroy(obj);
+            free(text);
+        }
     } else {
-        printf("Parse failed.\n");
+        fprintf(stderr, "Parse failed.\n");
     }
     /* close file */
     if (fclose(yyin) != 0) {
@@ -57,5 +227,5 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    return 0;
+    return status;
 }
@@ -0,0 +1,535 @@
+#include "object.h"
+#include <ctype.h>
+#include <strings.h>
+
+/**********************************************************************
+ *                               PARSING                              *
+ **********************************************************************/
+
+object* assemble(const char* text, const char* name, asm_item** items, int* count) {
+    assembler as = {0};
+    as.obj = object_create(name);
+    as.symbols = ht_create();
+    assemble_directive(&as, ".text", "");
+
+    /* (split into lines in place, so it's copied first) */
+    char* copy = strdup(text);
+    char* line = copy;
+    while (line) {
+        char* next = strchr(line, '\n');
+        if (next) *next++ = '\0';
+        as.line++;
+
+        char* start = line;
+        while (isspace((unsigned char)*start)) start++;
+        if (strncmp(start, ".rept", 5) != 0) {
+            assemble_line(&as, line);
+            line = next;
+            continue;
+        }
+
+        /* the lines up to `.endr` are assembled `times` times over: */
+        int times = atoi(start + 5);
+        char* body = next;
+        char* end = body;
+        int lines = 0;
+        while (end) {
+            char* p = end;
+            while (isspace((unsigned char)*p)) p++;
+            if (strncmp(p, ".endr", 5) == 0) break;
+            end = strchr(end, '\n');
+            if (end) end++;
+            lines++;
+        }
+        if (!end) {
+            assemble_error(&as, "`.rept` without `.endr`", "");
+            break;
+        }
+        int first = as.line;
+        for (int i = 0; i < times; i++) {
+            char* repeat = strndup(body, end - body);
+            char* r = repeat;
+            as.line = first;
+            while (r && *r) {
+                char* rest = strchr(r, '\n');
+                if (rest) *rest++ = '\0';
+                as.line++;
+                assemble_line(&as, r);
+                r = rest;
+            }
+            free(repeat);
+        }
+        as.line = first + lines + 1;
+        line = strchr(end, '\n');
+        if (line) line++;
+    }
+    free(copy);
+
+    if (as.errors == 0) {
+        assemble_layout(&as);
+        assemble_emit(&as);
+    }
+    ht_destroy(as.symbols);
+    free(as.defined_at);
+
+    if (items && as.errors == 0) {
+        *items = as.items;
+        *count = as.item_count;
+    } else {
+        for (int i = 0; i < as.item_count; i++) {
+            free(as.items[i].bytes);
+            free(as.items[i].fixups);
+            free((char*)as.items[i].text);
+        }
+        free(as.items);
+    }
+    if (as.errors > 0) {
+        object_destroy(as.obj);
+        return NULL;
+    }
+    return as.obj;
+}
+
+void assemble_line(assembler* as, char* line) {
+    char* p = line;
+    while (isspace((unsigned char)*p)) p++;
+    char* text = p;
+
+    /* labels, `name:`, perhaps followed by more on the line: */
+    for (;;) {
+        char* q = p;
+        while (isalnum((unsigned char)*q) || *q == '_' || *q == '.') q++;
+        if (q == p || *q != ':') break;
+        *q = '\0';
+        assemble_label(as, p);
+        p = q + 1;
+        while (isspace((unsigned char)*p)) p++;
+        text = p;
+    }
+    if (*p == '\0') return;
+
+    char* word = p;
+    while (*p && !isspace((unsigned char)*p)) p++;
+    if (*p) *p++ = '\0';
+    while (isspace((unsigned char)*p)) p++;
+    char* args = p;
+
+    if (*word == '.') {
+        assemble_directive(as, word, args);
+        return;
+    }
+
+    /* (`REP` is written as part of the instruction it repeats) */
+    bool rep = strcasecmp(word, "rep") == 0;
+    if (rep) {
+        word = args;
+        while (*args && !isspace((unsigned char)*args)) args++;
+        if (*args) *args++ = '\0';
+    }
+
+    /* the text is kept for messages, which the encoder would cut up: */
+    char* saved = strdup(text);
+    encoding enc;
+    if (!encode_instruction(word, args, &enc)) {
+        fprintf(stderr, "note: on line %d, `%s`\n", as->line, saved);
+        as->errors++;
+        free(saved);
+        return;
+    }
+
+    asm_item* item = assemble_item(as);
+    item->text = saved;
+    item->jump = enc.jump;
+    item->condition = enc.condition;
+    if (enc.target) item->target = strdup(enc.target);
+    item->length = enc.length + rep;
+    item->bytes = malloc(item->length + 1);
+    if (rep) item->bytes[0] = 0xF3;
+    memcpy(item->bytes + rep, enc.bytes, enc.length);
+    if (enc.has_fixup) {
+        item->fixups = malloc(sizeof(fixup));
+        item->fixups[0] = enc.fix;
+        item->fixups[0].at += rep;
+        item->fixups[0].symbol = strdup(enc.fix.symbol);
+        item->fixup_count = 1;
+    }
+}
+
+void assemble_directive(assembler* as, char* directive, char* args) {
+    char* end = args + strlen(args);
+    while (end > args && isspace((unsigned char)end[-1])) *--end = '\0';
+
+    /* sections: */
+    const char* name = NULL;
+    if (strcmp(directive, ".text") == 0) {
+        name = ".text";
+    } else if (strcmp(directive, ".data") == 0) {
+        name = ".data";
+    } else if (strcmp(directive, ".bss") == 0) {
+        name = ".bss";
+    } else if (strcmp(directive, ".section") == 0) {
+        char* comma = strchr(args, ',');
+        if (comma) *comma = '\0';
+        name = args;
+    }
+    if (name) {
+        int type = SHT_PROGBITS;
+        int flags = SHF_ALLOC;
+        if (strncmp(name, ".text", 5) == 0) {
+            flags |= SHF_EXECINSTR;
+        } else if (strncmp(name, ".data", 5) == 0) {
+            flags |= SHF_WRITE;
+        } else if (strncmp(name, ".bss", 4) == 0) {
+            type = SHT_NOBITS;
+            flags |= SHF_WRITE;
+        } else if (strncmp(name, ".note", 5) == 0) {
+            /* (only there to say something about the object) */
+            flags = 0;
+        } else if (strncmp(name, ".rodata", 7) != 0) {
+            assemble_error(as, "unknown section", name);
+            return;
+        }
+        int count = as->obj->section_count;
+        as->section = object_section(as->obj, name, type, flags);
+        if (as->obj->section_count > count) {
+            /* (relocations against local symbols go through this) */
+            int s = object_add_symbol(as->obj, name, as->section);
+            as->obj->symbols[s].is_section = true;
+            as->defined_at = realloc(
+                as->defined_at,
+                as->obj->symbol_count * sizeof(int)
+            );
+            as->defined_at[s] = -1;
+        }
+        return;
+    }
+
+    if (strcmp(directive, ".global") == 0 || strcmp(directive, ".globl") == 0) {
+        int s = assemble_symbol(as, args);
+        as->obj->symbols[s].global = true;
+    } else if (strcmp(directive, ".balign") == 0) {
+        int align = atoi(args);
+        if (align <= 0 || (align & (align - 1)) != 0) {
+            assemble_error(as, "bad alignment", args);
+            return;
+        }
+        asm_item* item = assemble_item(as);
+        item->align = align;
+        section* s = &as->obj->sections[as->section];
+        if (align > s->align) s->align = align;
+    } else if (strcmp(directive, ".quad") == 0) {
+        for (char* value = strtok(args, ", \t"); value;
+            value = strtok(NULL, ", \t")) {
+            if (*value == '-' || isdigit((unsigned char)*value)) {
+                int64_t n = strtoll(value, NULL, 0);
+                unsigned char bytes[8];
+                for (int i = 0; i < 8; i++) bytes[i] = (uint64_t)n >> (8 * i);
+                assemble_data(as, bytes, 8);
+                continue;
+            }
+            assemble_data(as, NULL, 8);
+            asm_item* item = &as->items[as->item_count - 1];
+            item->fixups = malloc(sizeof(fixup));
+            item->fixups[0] = (fixup){FIXUP_ABS64, 0, strdup(value), 0};
+            item->fixup_count = 1;
+        }
+    } else if (strcmp(directive, ".string") == 0) {
+        if (*args != '"') {
+            assemble_error(as, "expected a string", args);
+            return;
+        }
+        unsigned char* bytes = malloc(strlen(args) + 1);
+        assemble_data(as, bytes, assemble_string(args + 1, bytes));
+        free(bytes);
+    } else if (strcmp(directive, ".zero") == 0) {
+        int length = atoi(args);
+        if (length < 0) {
+            assemble_error(as, "bad length", args);
+            return;
+        }
+        assemble_data(as, NULL, length);
+    } else {
+        assemble_error(as, "unknown directive", directive);
+    }
+}
+
+void assemble_data(assembler* as, const void* bytes, int length) {
+    asm_item* item = assemble_item(as);
+    item->bytes = calloc(length + 1, 1);
+    if (bytes) memcpy(item->bytes, bytes, length);
+    item->length = length;
+}
+
+void assemble_label(assembler* as, const char* name) {
+    int s = assemble_symbol(as, name);
+    if (as->defined_at[s] >= 0) {
+        assemble_error(as, "symbol already defined", name);
+        return;
+    }
+    as->obj->symbols[s].section = as->section;
+    /* (an empty item marks the place, wherever the layout puts it) */
+    assemble_item(as);
+    as->defined_at[s] = as->item_count - 1;
+}
+
+int assemble_symbol(assembler* as, const char* name) {
+    intptr_t s = (intptr_t)ht_get(as->symbols, name);
+    if (s) return s - 1;
+
+    s = object_add_symbol(as->obj, name, SECTION_UNDEF);
+    ht_set(as->symbols, name, (void*)(s + 1));
+    as->defined_at = realloc(
+        as->defined_at,
+        as->obj->symbol_count * sizeof(int)
+    );
+    as->defined_at[s] = -1;
+    return s;
+}
+
+asm_item* assemble_item(assembler* as) {
+    if (as->item_count == as->item_capacity) {
+        as->item_capacity = as->item_capacity ? 2 * as->item_capacity : 256;
+        as->items = realloc(as->items, as->item_capacity * sizeof(asm_item));
+    }
+    asm_item* item = &as->items[as->item_count++];
+    memset(item, 0, sizeof(*item));
+    item->section = as->section;
+    item->line = as->line;
+    return item;
+}
+
+int assemble_string(const char* s, unsigned char* out) {
+    int length = 0;
+    while (*s && *s != '"') {
+        if (*s != '\\') {
+            out[length++] = *s++;
+            continue;
+        }
+        s++;
+        if (*s >= '0' && *s <= '7') {
+            int c = 0;
+            for (int i = 0; i < 3 && *s >= '0' && *s <= '7'; i++) {
+                c = 8 * c + *s++ - '0';
+            }
+            out[length++] = c;
+            continue;
+        }
+        switch (*s) {
+            case 'n':   out[length++] = '\n';   break;
+            case 't':   out[length++] = '\t';   break;
+            case 'r':   out[length++] = '\r';   break;
+            case 'b':   out[length++] = '\b';   break;
+            case 'f':   out[length++] = '\f';   break;
+            default:    out[length++] = *s;     break;
+        }
+        if (*s) s++;
+    }
+    out[length++] = '\0';
+    return length;
+}
+
+void assemble_error(assembler* as, const char* message, const char* what) {
+    fprintf(stderr, "error: line %d: %s: `%s`\n", as->line, message, what);
+    as->errors++;
+}
+
+/**********************************************************************
+ *                               LAYOUT                               *
+ **********************************************************************/
+
+void assemble_layout(assembler* as) {
+    object* obj = as->obj;
+    uint64_t* offsets = malloc(obj->section_count * sizeof(uint64_t));
+
+    bool changed = true;
+    while (changed) {
+        memset(offsets, 0, obj->section_count * sizeof(uint64_t));
+        for (int i = 0; i < as->item_count; i++) {
+            asm_item* item = &as->items[i];
+            uint64_t* offset = &offsets[item->section];
+            if (item->align) {
+                item->length = -*offset & (item->align - 1);
+            } else if (item->jump == JUMP_ALWAYS) {
+                item->length = item->far ? 5 : 2;
+            } else if (item->jump == JUMP_CONDITION) {
+                item->length = item->far ? 6 : 2;
+            }
+            item->offset = *offset;
+            *offset += item->length;
+        }
+
+        changed = false;
+        for (int i = 0; i < as->item_count; i++) {
+            asm_item* item = &as->items[i];
+            if (item->jump == JUMP_NONE || item->far) continue;
+
+            /* (only a target in the same section is known before linking) */
+            int s = assemble_symbol(as, item->target);
+            int at = as->defined_at[s];
+            if (at < 0 || as->items[at].section != item->section) {
+                item->far = true;
+                changed = true;
+                continue;
+            }
+            int64_t disp = (int64_t)as->items[at].offset
+                - (int64_t)(item->offset + 2);
+            if (!encode_fits8(disp)) {
+                item->far = true;
+                changed = true;
+            }
+        }
+    }
+
+    for (int i = 0; i < obj->section_count; i++) {
+        obj->sections[i].size = offsets[i];
+    }
+    for (int i = 0; i < obj->symbol_count; i++) {
+        if (as->defined_at[i] >= 0) {
+            obj->symbols[i].value = as->items[as->defined_at[i]].offset;
+        }
+    }
+    free(offsets);
+}
+
+bool assemble_emit(assembler* as) {
+    object* obj = as->obj;
+    for (int i = 0; i < obj->section_count; i++) {
+        section* s = &obj->sections[i];
+        if (s->type != SHT_NOBITS) s->bytes = calloc(s->size + 1, 1);
+    }
+
+    for (int i = 0; i < as->item_count; i++) {
+        asm_item* item = &as->items[i];
+        section* s = &obj->sections[item->section];
+        as->line = item->line;
+
+        if (s->type == SHT_NOBITS) {
+            for (int j = 0; j < item->length && item->bytes; j++) {
+                if (item->bytes[j] != 0 || item->fixup_count > 0) {
+                    assemble_error(as, "data in a section of zeros", s->name);
+                    break;
+                }
+            }
+            continue;
+        }
+        unsigned char* at = s->bytes + item->offset;
+
+        if (item->align) {
+            /* (padding code with `NOP`s, should it ever be run) */
+            memset(at, s->flags & SHF_EXECINSTR ? 0x90 : 0, item->length);
+            continue;
+        }
+        if (item->jump == JUMP_NONE) {
+            if (item->length > 0) memcpy(at, item->bytes, item->length);
+            for (int j = 0; j < item->fixup_count; j++) {
+                assemble_fixup(as, item, &item->fixups[j], at);
+            }
+            continue;
+        }
+
+        /* jumps, now their lengths are settled: */
+        free(item->bytes);
+        item->bytes = malloc(item->length);
+        int length = 0;
+        if (!item->far) {
+            item->bytes[length++] = item->jump == JUMP_ALWAYS
+                ? 0xEB
+                : 0x70 + item->condition;
+        } else if (item->jump == JUMP_ALWAYS) {
+            item->bytes[length++] = 0xE9;
+        } else {
+            item->bytes[length++] = 0x0F;
+            item->bytes[length++] = 0x80 + item->condition;
+        }
+        memset(item->bytes + length, 0, item->length - length);
+        memcpy(at, item->bytes, item->length);
+
+        int sym = assemble_symbol(as, item->target);
+        int target = as->defined_at[sym];
+        if (target >= 0 && as->items[target].section == item->section) {
+            int64_t disp = (int64_t)as->items[target].offset
+                - (int64_t)(item->offset + item->length);
+            for (int j = length; j < item->length; j++) {
+                at[j] = item->bytes[j] = (uint64_t)disp >> (8 * (j - length));
+            }
+        } else {
+            assemble_reloc(as, item, length, R_X86_64_PLT32, sym, -4);
+        }
+    }
+    return as->errors == 0;
+}
+
+void assemble_fixup(assembler* as, asm_item* item, fixup* f, unsigned char* at) {
+    int sym = assemble_symbol(as, f->symbol);
+    object_symbol* target = &as->obj->symbols[sym];
+    bool here = as->defined_at[sym] >= 0 && target->section == item->section;
+
+    int type;
+    switch (f->kind) {
+        case FIXUP_CALL:
+            /* (a global could be replaced by another object's, so a call
+             * to one is always left to the linker) */
+            if (here && !target->global) {
+                type = -1;
+                break;
+            }
+            type = target->section == SECTION_UNDEF || target->global
+                ? R_X86_64_PLT32
+                : R_X86_64_PC32;
+            break;
+        case FIXUP_PC32:
+            type = here ? -1 : R_X86_64_PC32;
+            break;
+        case FIXUP_ABS32S:
+            type = R_X86_64_32S;
+            break;
+        default:
+            type = R_X86_64_64;
+            break;
+    }
+
+    if (type >= 0) {
+        assemble_reloc(as, item, f->at, type, sym, f->addend);
+        return;
+    }
+    int64_t disp = (int64_t)(target->value + f->addend)
+        - (int64_t)(item->offset + f->at);
+    for (int i = 0; i < 4; i++) at[f->at + i] = (uint64_t)disp >> (8 * i);
+}
+
+void assemble_reloc(
+    assembler* as,
+    asm_item* item,
+    int at,
+    int type,
+    int sym,
+    int64_t addend
+) {
+    object* obj = as->obj;
+    object_symbol* target = &obj->symbols[sym];
+    if (as->defined_at[sym] < 0 && !target->is_section) {
+        if (strncmp(target->name, ".L", 2) == 0) {
+            assemble_error(as, "undefined label", target->name);
+            return;
+        }
+    } else if (!target->global) {
+        /* local symbols aren't seen outside the object, so it's relative
+         * to their section instead */
+        addend += target->value;
+        for (int i = 0; i < obj->symbol_count; i++) {
+            if (
+                obj->symbols[i].is_section
+                && obj->symbols[i].section == target->section
+            ) {
+                sym = i;
+                break;
+            }
+        }
+    }
+    object_add_reloc(obj, item->section, (relocation){
+        item->offset + at,
+        type,
+        sym,
+        addend,
+    });
+}
@@ -0,0 +1,203 @@
+#include "object.h"
+#include <unistd.h>
+
+/**********************************************************************
+ *                            CROSS-CHECK                             *
+ **********************************************************************/
+
+bool check_encoding(const char* text, const char* name) {
+    asm_item* items = NULL;
+    int count = 0;
+    object* ours = assemble(text, name, &items, &count);
+    if (!ours) return false;
+
+    /* `as` gets the same text, from a file of its own: */
+    char source[] = "/tmp/bmcc-check-XXXXXX.s";
+    char output[sizeof(source) + 2];
+    int fd = mkstemps(source, 2);
+    bool ok = fd >= 0;
+    if (ok) {
+        size_t length = strlen(text);
+        ok = write(fd, text, length) == (ssize_t)length;
+        close(fd);
+    }
+    object* theirs = NULL;
+    if (ok) {
+        snprintf(output, sizeof(output), "%.*s.o",
+            (int)strlen(source) - 2, source);
+        char command[3 * sizeof(source) + 16];
+        snprintf(command, sizeof(command), "as --64 %s -o %s", source, output);
+        ok = system(command) == 0;
+        if (ok) theirs = elf_read(output);
+        ok = theirs != NULL;
+        unlink(output);
+    }
+    if (fd >= 0) unlink(source);
+    if (!ok) {
+        fprintf(stderr, "error: could not assemble `%s` with `as`\n", name);
+        object_destroy(ours);
+        return false;
+    }
+
+    for (int i = 0; i < ours->section_count; i++) {
+        ok = check_section(ours, theirs, i, items, count) && ok;
+    }
+    for (int i = 0; i < theirs->section_count; i++) {
+        section* s = &theirs->sections[i];
+        bool found = false;
+        for (int j = 0; j < ours->section_count; j++) {
+            if (strcmp(ours->sections[j].name, s->name) == 0) found = true;
+        }
+        if (!found && s->size > 0) {
+            fprintf(stderr, "error: `%s` is missing\n", s->name);
+            ok = false;
+        }
+    }
+    if (ok) {
+        fprintf(stderr, "note: the encoding of `%s` matches `as`\n", name);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free(items[i].bytes);
+        free(items[i].fixups);
+        free((char*)items[i].text);
+    }
+    free(items);
+    object_destroy(ours);
+    object_destroy(theirs);
+    return ok;
+}
+
+bool check_section(object* ours, object* theirs, int s, asm_item* items, int count) {
+    section* a = &ours->sections[s];
+    section* b = NULL;
+    for (int i = 0; i < theirs->section_count; i++) {
+        if (strcmp(theirs->sections[i].name, a->name) == 0) {
+            b = &theirs->sections[i];
+        }
+    }
+    if (!b) {
+        if (a->size == 0) return true;
+        fprintf(stderr, "error: `as` has no `%s`\n", a->name);
+        return false;
+    }
+
+    if (a->type != b->type || a->flags != b->flags) {
+        fprintf(stderr, "error: `%s` is of a different type\n", a->name);
+        return false;
+    }
+    if (a->size != b->size) {
+        fprintf(
+            stderr,
+            "error: `%s` is %lu bytes, where `as` makes it %lu\n",
+            a->name,
+            (unsigned long)a->size,
+            (unsigned long)b->size
+        );
+    }
+
+    /* the first difference in the contents, by the line it comes from: */
+    uint64_t size = a->size < b->size ? a->size : b->size;
+    for (uint64_t i = 0; a->bytes && b->bytes && i < size; i++) {
+        if (a->bytes[i] == b->bytes[i]) continue;
+
+        asm_item* item = check_item(items, count, s, i);
+        fprintf(
+            stderr,
+            "error: `%s`+%#lx differs from `as`",
+            a->name,
+            (unsigned long)i
+        );
+        if (item) {
+            fprintf(stderr, " on line %d", item->line);
+            if (item->text) fprintf(stderr, ", `%s`", item->text);
+            fprintf(stderr, ":\n  ours:");
+            for (int j = 0; j < item->length; j++) {
+                fprintf(stderr, " %02x", a->bytes[item->offset + j]);
+            }
+            fprintf(stderr, "\n  as:  ");
+            for (int j = 0; j < item->length && item->offset + j < size; j++) {
+                fprintf(stderr, " %02x", b->bytes[item->offset + j]);
+            }
+        }
+        fprintf(stderr, "\n");
+        return false;
+    }
+    if (a->size != b->size) return false;
+
+    /* relocations, by what they refer to rather than how: */
+    if (a->reloc_count != b->reloc_count) {
+        fprintf(
+            stderr,
+            "error: `%s` has %d relocations, where `as` makes %d\n",
+            a->name,
+            a->reloc_count,
+            b->reloc_count
+        );
+        return false;
+    }
+    for (int i = 0; i < a->reloc_count; i++) {
+        relocation* ra = &a->relocs[i];
+        relocation* rb = NULL;
+        for (int j = 0; j < b->reloc_count; j++) {
+            if (b->relocs[j].offset == ra->offset) rb = &b->relocs[j];
+        }
+        const char* name_a;
+        const char* name_b = NULL;
+        int64_t offset_a;
+        int64_t offset_b = 0;
+        check_target(ours, ra, &name_a, &offset_a);
+        if (rb) check_target(theirs, rb, &name_b, &offset_b);
+        if (
+            rb
+            && rb->type == ra->type
+            && strcmp(name_a, name_b) == 0
+            && offset_a == offset_b
+        ) {
+            continue;
+        }
+
+        asm_item* item = check_item(items, count, s, ra->offset);
+        fprintf(
+            stderr,
+            "error: relocation at `%s`+%#lx differs from `as`",
+            a->name,
+            (unsigned long)ra->offset
+        );
+        if (item) fprintf(stderr, " on line %d", item->line);
+        fprintf(stderr, ":\n  ours: type %d, `%s`%+ld\n", ra->type, name_a,
+            (long)offset_a);
+        if (rb) {
+            fprintf(stderr, "  as:   type %d, `%s`%+ld\n", rb->type, name_b,
+                (long)offset_b);
+        }
+        return false;
+    }
+    return true;
+}
+
+void check_target(object* obj, relocation* r, const char** name, int64_t* offset) {
+    object_symbol* sym = &obj->symbols[r->symbol];
+    *offset = r->addend;
+    if (sym->global || sym->section < 0) {
+        *name = sym->name;
+    } else {
+        *name = obj->sections[sym->section].name;
+        *offset += sym->value;
+    }
+}
+
+asm_item* check_item(asm_item* items, int count, int s, uint64_t offset) {
+    for (int i = 0; i < count; i++) {
+        asm_item* item = &items[i];
+        if (
+            item->section == s
+            && item->length > 0
+            && offset >= item->offset
+            && offset < item->offset + item->length
+        ) {
+            return item;
+        }
+    }
+    return NULL;
+}
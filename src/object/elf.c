@@ -0,0 +1,394 @@
+#include "object.h"
+
+/**********************************************************************
+ *                               OBJECTS                              *
+ **********************************************************************/
+
+object* object_create(const char* name) {
+    object* obj = calloc(1, sizeof(*obj));
+    obj->name = name;
+    return obj;
+}
+
+void object_destroy(object* obj) {
+    if (!obj) return;
+    for (int i = 0; i < obj->section_count; i++) {
+        free(obj->sections[i].name);
+        free(obj->sections[i].bytes);
+        free(obj->sections[i].relocs);
+    }
+    for (int i = 0; i < obj->symbol_count; i++) free(obj->symbols[i].name);
+    free(obj->sections);
+    free(obj->symbols);
+    free(obj);
+}
+
+int object_section(object* obj, const char* name, int type, int flags) {
+    for (int i = 0; i < obj->section_count; i++) {
+        if (strcmp(obj->sections[i].name, name) == 0) return i;
+    }
+    obj->sections = realloc(
+        obj->sections,
+        (obj->section_count + 1) * sizeof(section)
+    );
+    section* s = &obj->sections[obj->section_count];
+    memset(s, 0, sizeof(*s));
+    s->name = strdup(name);
+    s->type = type;
+    s->flags = flags;
+    s->align = 1;
+    return obj->section_count++;
+}
+
+int object_add_symbol(object* obj, const char* name, int section) {
+    obj->symbols = realloc(
+        obj->symbols,
+        (obj->symbol_count + 1) * sizeof(object_symbol)
+    );
+    object_symbol* sym = &obj->symbols[obj->symbol_count];
+    memset(sym, 0, sizeof(*sym));
+    sym->name = strdup(name);
+    sym->section = section;
+    return obj->symbol_count++;
+}
+
+void object_add_reloc(object* obj, int s, relocation r) {
+    section* sec = &obj->sections[s];
+    sec->relocs = realloc(
+        sec->relocs,
+        (sec->reloc_count + 1) * sizeof(relocation)
+    );
+    sec->relocs[sec->reloc_count++] = r;
+}
+
+void object_append(object* obj, int s, const void* bytes, uint64_t length) {
+    section* sec = &obj->sections[s];
+    if (sec->type != SHT_NOBITS) {
+        sec->bytes = realloc(sec->bytes, sec->size + length);
+        if (bytes) {
+            memcpy(sec->bytes + sec->size, bytes, length);
+        } else {
+            memset(sec->bytes + sec->size, 0, length);
+        }
+    }
+    sec->size += length;
+}
+
+/**********************************************************************
+ *                               WRITING                              *
+ **********************************************************************/
+
+/* The sections of the object come first (after the null section), then
+ * `.rela` sections for those with relocations, then the symbols and the
+ * names. Local symbols have to come before global ones, and labels
+ * starting `.L` are left out, as the GNU assembler does. */
+
+bool elf_write(object* obj, FILE* out) {
+    int count = obj->section_count;
+
+    /* names of sections and symbols (each starting with a NUL): */
+    char* shstrtab;
+    size_t shstrtab_size;
+    FILE* names = open_memstream(&shstrtab, &shstrtab_size);
+    fputc('\0', names);
+    char* strtab;
+    size_t strtab_size;
+    FILE* symbol_names = open_memstream(&strtab, &strtab_size);
+    fputc('\0', symbol_names);
+
+    /* symbols, locals first, with their new indexes: */
+    int* index = calloc(obj->symbol_count + 1, sizeof(int));
+    Elf64_Sym* symtab = calloc(obj->symbol_count + 1, sizeof(Elf64_Sym));
+    int symbols = 1;
+    int first_global = 0;
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) first_global = symbols;
+        for (int i = 0; i < obj->symbol_count; i++) {
+            object_symbol* sym = &obj->symbols[i];
+            bool global = sym->global || sym->section == SECTION_UNDEF;
+            if (global != (pass == 1)) continue;
+            if (!global && !sym->is_section
+                && strncmp(sym->name, ".L", 2) == 0) {
+                continue;
+            }
+
+            Elf64_Sym* out_sym = &symtab[symbols];
+            if (sym->is_section) {
+                out_sym->st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+            } else {
+                fflush(symbol_names);
+                out_sym->st_name = strtab_size;
+                fputs(sym->name, symbol_names);
+                fputc('\0', symbol_names);
+                out_sym->st_info = ELF64_ST_INFO(
+                    global ? STB_GLOBAL : STB_LOCAL,
+                    STT_NOTYPE
+                );
+            }
+            out_sym->st_shndx = sym->section == SECTION_UNDEF ? SHN_UNDEF
+                : sym->section == SECTION_ABS ? SHN_ABS
+                : sym->section + 1;
+            out_sym->st_value = sym->value;
+            index[i] = symbols++;
+        }
+    }
+    fclose(symbol_names);
+
+    /* section headers, and where each section's contents go: */
+    int relas = 0;
+    for (int i = 0; i < count; i++) relas += obj->sections[i].reloc_count > 0;
+    int shnum = 1 + count + relas + 3;
+    Elf64_Shdr* shdrs = calloc(shnum, sizeof(Elf64_Shdr));
+    int symtab_index = 1 + count + relas;
+    uint64_t offset = sizeof(Elf64_Ehdr);
+
+    for (int i = 0; i < count; i++) {
+        section* s = &obj->sections[i];
+        Elf64_Shdr* sh = &shdrs[1 + i];
+        fflush(names);
+        sh->sh_name = shstrtab_size;
+        fputs(s->name, names);
+        fputc('\0', names);
+        sh->sh_type = s->type;
+        sh->sh_flags = s->flags;
+        sh->sh_addralign = s->align;
+        offset = (offset + s->align - 1) & -(uint64_t)s->align;
+        sh->sh_offset = offset;
+        sh->sh_size = s->size;
+        if (s->type != SHT_NOBITS) offset += s->size;
+    }
+    int rela = 1 + count;
+    for (int i = 0; i < count; i++) {
+        section* s = &obj->sections[i];
+        if (s->reloc_count == 0) continue;
+        Elf64_Shdr* sh = &shdrs[rela++];
+        fflush(names);
+        sh->sh_name = shstrtab_size;
+        fprintf(names, ".rela%s", s->name);
+        fputc('\0', names);
+        sh->sh_type = SHT_RELA;
+        sh->sh_flags = SHF_INFO_LINK;
+        sh->sh_link = symtab_index;
+        sh->sh_info = 1 + i;
+        sh->sh_addralign = 8;
+        sh->sh_entsize = sizeof(Elf64_Rela);
+        offset = (offset + 7) & -8ull;
+        sh->sh_offset = offset;
+        sh->sh_size = s->reloc_count * sizeof(Elf64_Rela);
+        offset += sh->sh_size;
+    }
+
+    Elf64_Shdr* sh = &shdrs[symtab_index];
+    const char* tables[] = {".symtab", ".strtab", ".shstrtab"};
+    for (int i = 0; i < 3; i++) {
+        fflush(names);
+        sh[i].sh_name = shstrtab_size;
+        fputs(tables[i], names);
+        fputc('\0', names);
+    }
+    fclose(names);
+    sh[0].sh_type = SHT_SYMTAB;
+    sh[0].sh_link = symtab_index + 1;
+    sh[0].sh_info = first_global;
+    sh[0].sh_addralign = 8;
+    sh[0].sh_entsize = sizeof(Elf64_Sym);
+    offset = (offset + 7) & -8ull;
+    sh[0].sh_offset = offset;
+    sh[0].sh_size = symbols * sizeof(Elf64_Sym);
+    offset += sh[0].sh_size;
+    sh[1].sh_type = SHT_STRTAB;
+    sh[1].sh_addralign = 1;
+    sh[1].sh_offset = offset;
+    sh[1].sh_size = strtab_size;
+    offset += strtab_size;
+    sh[2].sh_type = SHT_STRTAB;
+    sh[2].sh_addralign = 1;
+    sh[2].sh_offset = offset;
+    sh[2].sh_size = shstrtab_size;
+    offset += shstrtab_size;
+    offset = (offset + 7) & -8ull;
+
+    Elf64_Ehdr header = {
+        .e_ident = {
+            ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3,
+            ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV,
+        },
+        .e_type = ET_REL,
+        .e_machine = EM_X86_64,
+        .e_version = EV_CURRENT,
+        .e_shoff = offset,
+        .e_ehsize = sizeof(Elf64_Ehdr),
+        .e_shentsize = sizeof(Elf64_Shdr),
+        .e_shnum = shnum,
+        .e_shstrndx = shnum - 1,
+    };
+
+    /* everything is written in order, padded out to its offset: */
+    uint64_t at = 0;
+    fwrite(&header, sizeof(header), 1, out);
+    at += sizeof(header);
+    for (int i = 1; i < shnum; i++) {
+        if (shdrs[i].sh_type == SHT_NOBITS) continue;
+        for (; at < shdrs[i].sh_offset; at++) fputc('\0', out);
+
+        if (i <= count) {
+            section* s = &obj->sections[i - 1];
+            if (s->size > 0) fwrite(s->bytes, 1, s->size, out);
+        } else if (i < symtab_index) {
+            section* s = &obj->sections[shdrs[i].sh_info - 1];
+            for (int j = 0; j < s->reloc_count; j++) {
+                relocation* r = &s->relocs[j];
+                Elf64_Rela entry = {
+                    .r_offset = r->offset,
+                    .r_info = ELF64_R_INFO(index[r->symbol], r->type),
+                    .r_addend = r->addend,
+                };
+                fwrite(&entry, sizeof(entry), 1, out);
+            }
+        } else if (i == symtab_index) {
+            fwrite(symtab, sizeof(Elf64_Sym), symbols, out);
+        } else if (i == symtab_index + 1) {
+            fwrite(strtab, 1, strtab_size, out);
+        } else {
+            fwrite(shstrtab, 1, shstrtab_size, out);
+        }
+        at += shdrs[i].sh_size;
+    }
+    for (; at < offset; at++) fputc('\0', out);
+    fwrite(shdrs, sizeof(Elf64_Shdr), shnum, out);
+
+    free(index);
+    free(symtab);
+    free(shdrs);
+    free(strtab);
+    free(shstrtab);
+    return !ferror(out);
+}
+
+/**********************************************************************
+ *                               READING                              *
+ **********************************************************************/
+
+object* elf_read(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "error: could not open object: %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char* file = malloc(size > 0 ? size : 1);
+    bool read = size > 0 && fread(file, 1, size, f) == (size_t)size;
+    fclose(f);
+
+    Elf64_Ehdr* header = (Elf64_Ehdr*)file;
+    if (
+        !read
+        || (size_t)size < sizeof(Elf64_Ehdr)
+        || memcmp(header->e_ident, ELFMAG, SELFMAG) != 0
+        || header->e_ident[EI_CLASS] != ELFCLASS64
+        || header->e_type != ET_REL
+        || header->e_machine != EM_X86_64
+        || header->e_shoff + header->e_shnum * sizeof(Elf64_Shdr)
+            > (uint64_t)size
+    ) {
+        fprintf(stderr, "error: not an x86-64 ELF object: %s\n", path);
+        free(file);
+        return NULL;
+    }
+    Elf64_Shdr* shdrs = (Elf64_Shdr*)(file + header->e_shoff);
+    const char* shstrtab = (char*)file + shdrs[header->e_shstrndx].sh_offset;
+
+    /* sections with contents (or room for them) keep their place, less
+     * the null section: */
+    object* obj = object_create(path);
+    int* index = malloc(header->e_shnum * sizeof(int));
+    Elf64_Shdr* symtab = NULL;
+    for (int i = 0; i < header->e_shnum; i++) {
+        Elf64_Shdr* sh = &shdrs[i];
+        index[i] = -1;
+        if (sh->sh_type == SHT_SYMTAB) symtab = sh;
+        if (
+            i == 0
+            || sh->sh_type == SHT_SYMTAB
+            || sh->sh_type == SHT_STRTAB
+            || sh->sh_type == SHT_RELA
+            || sh->sh_type == SHT_REL
+        ) {
+            continue;
+        }
+        index[i] = object_section(
+            obj,
+            shstrtab + sh->sh_name,
+            sh->sh_type,
+            sh->sh_flags
+        );
+        section* s = &obj->sections[index[i]];
+        if (index[i] != obj->section_count - 1) {
+            fprintf(stderr, "error: %s: section `%s` appears twice\n",
+                path, s->name);
+            object_destroy(obj);
+            obj = NULL;
+            goto done;
+        }
+        s->align = sh->sh_addralign ? sh->sh_addralign : 1;
+        object_append(obj, index[i],
+            sh->sh_type == SHT_NOBITS ? NULL : file + sh->sh_offset,
+            sh->sh_size);
+    }
+
+    /* symbols, in the same order, less the null symbol: */
+    if (symtab) {
+        Elf64_Sym* syms = (Elf64_Sym*)(file + symtab->sh_offset);
+        const char* strtab = (char*)file + shdrs[symtab->sh_link].sh_offset;
+        int count = symtab->sh_size / sizeof(Elf64_Sym);
+        for (int i = 1; i < count; i++) {
+            Elf64_Sym* sym = &syms[i];
+            int s;
+            if (sym->st_shndx == SHN_UNDEF) {
+                s = SECTION_UNDEF;
+            } else if (sym->st_shndx == SHN_ABS) {
+                s = SECTION_ABS;
+            } else if (sym->st_shndx < header->e_shnum
+                && index[sym->st_shndx] >= 0) {
+                s = index[sym->st_shndx];
+            } else {
+                fprintf(stderr, "error: %s: symbol `%s` has no section\n",
+                    path, strtab + sym->st_name);
+                object_destroy(obj);
+                obj = NULL;
+                goto done;
+            }
+            bool is_section = ELF64_ST_TYPE(sym->st_info) == STT_SECTION;
+            int n = object_add_symbol(
+                obj,
+                is_section ? obj->sections[s].name : strtab + sym->st_name,
+                s
+            );
+            obj->symbols[n].value = sym->st_value;
+            obj->symbols[n].global = ELF64_ST_BIND(sym->st_info) != STB_LOCAL;
+            obj->symbols[n].is_section = is_section;
+        }
+    }
+
+    for (int i = 0; i < header->e_shnum; i++) {
+        Elf64_Shdr* sh = &shdrs[i];
+        if (sh->sh_type != SHT_RELA || index[sh->sh_info] < 0) continue;
+        Elf64_Rela* relas = (Elf64_Rela*)(file + sh->sh_offset);
+        int count = sh->sh_size / sizeof(Elf64_Rela);
+        for (int j = 0; j < count; j++) {
+            object_add_reloc(obj, index[sh->sh_info], (relocation){
+                relas[j].r_offset,
+                ELF64_R_TYPE(relas[j].r_info),
+                ELF64_R_SYM(relas[j].r_info) - 1,
+                relas[j].r_addend,
+            });
+        }
+    }
+
+done:
+    free(index);
+    free(file);
+    return obj;
+}
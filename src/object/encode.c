@@ -0,0 +1,725 @@
+#include "object.h"
+#include <ctype.h>
+
+const char* REG64_NAMES[] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15",
+};
+
+const char* REG32_NAMES[] = {
+    "eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi",
+    "r8d", "r9d", "r10d", "r11d", "r12d", "r13d", "r14d", "r15d",
+};
+
+const char* REG8_NAMES[] = {
+    "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
+    "r8b", "r9b", "r10b", "r11b", "r12b", "r13b", "r14b", "r15b",
+};
+
+/* by condition code, the suffixes of `Jcc`, `SETcc` and `CMOVcc` (with
+ * their synonyms after the first) */
+const char* CONDITION_NAMES[16][3] = {
+    {"o"},              {"no"},
+    {"b", "c", "nae"},  {"ae", "nb", "nc"},
+    {"e", "z"},         {"ne", "nz"},
+    {"be", "na"},       {"a", "nbe"},
+    {"s"},              {"ns"},
+    {"p", "pe"},        {"np", "po"},
+    {"l", "nge"},       {"ge", "nl"},
+    {"le", "ng"},       {"g", "nle"},
+};
+
+/* the instructions taking a size suffix, without it */
+const char* SUFFIXED[] = {
+    "add", "or", "and", "sub", "xor", "cmp", "mov", "movabs", "lea", "test",
+    "imul", "not", "neg", "mul", "idiv", "inc", "dec", "shl", "shr", "sar",
+    "push", "pop", NULL,
+};
+
+/* the `/digit` of `ADD`, `OR`, `AND`, `SUB`, `XOR` and `CMP`, whose opcodes
+ * are all `8 * digit` plus the form */
+const char* ALU_NAMES[] = {
+    "add", "or", NULL, NULL, "and", "sub", "xor", "cmp",
+};
+
+typedef struct {
+    const char* name;
+    int opcode;
+    /* the `/digit` of the immediate form of a shift, or -1 */
+    int digit;
+} sse_op;
+
+/* packed integer operations of SSE2, and their AVX2 forms (after a `V`) */
+const sse_op SSE_OPS[] = {
+    {"paddq", 0xD4, -1},
+    {"psubq", 0xFB, -1},
+    {"pmuludq", 0xF4, -1},
+    {"pand", 0xDB, -1},
+    {"pandn", 0xDF, -1},
+    {"por", 0xEB, -1},
+    {"pxor", 0xEF, -1},
+    {"pcmpeqd", 0x76, -1},
+    {"pcmpgtd", 0x66, -1},
+    {"punpcklqdq", 0x6C, -1},
+    {"psrlq", 0x73, 2},
+    {"psllq", 0x73, 6},
+    {"psrad", 0x72, 4},
+    {NULL, 0, 0},
+};
+
+/**********************************************************************
+ *                             INSTRUCTIONS                           *
+ **********************************************************************/
+
+/* Every form codegen generates, with the encodings the GNU assembler picks
+ * where there's a choice (the store form of `MOV` and ALU instructions
+ * between registers, `D1` for shifts by 1, the accumulator forms of
+ * immediates too big for a byte). */
+
+bool encode_instruction(const char* mnemonic, char* args, encoding* enc) {
+    memset(enc, 0, sizeof(*enc));
+
+    char name[32];
+    size_t length = strlen(mnemonic);
+    if (length >= sizeof(name)) length = sizeof(name) - 1;
+    for (size_t i = 0; i < length; i++) {
+        name[i] = tolower((unsigned char)mnemonic[i]);
+    }
+    name[length] = '\0';
+
+    operand ops[4];
+    int count = encode_operands(args, ops, 4);
+    if (count < 0) return false;
+    operand* src = &ops[0];
+    operand* dst = &ops[count > 0 ? count - 1 : 0];
+
+    /* (the size suffix is left off, the operands giving the size) */
+    if (length > 1 && (name[length - 1] == 'q' || name[length - 1] == 'l')) {
+        char last = name[length - 1];
+        name[length - 1] = '\0';
+        bool known = strncmp(name, "cmov", 4) == 0
+            && encode_condition(name + 4) >= 0;
+        for (int i = 0; SUFFIXED[i]; i++) {
+            if (strcmp(name, SUFFIXED[i]) == 0) known = true;
+        }
+        if (known) {
+            length--;
+        } else {
+            name[length - 1] = last;
+        }
+    }
+    /* a bare symbol is an absolute address, except to jumps and calls */
+    if (name[0] != 'j' && strcmp(name, "call") != 0) {
+        for (int i = 0; i < count; i++) {
+            if (ops[i].kind == OPERAND_LABEL) ops[i].kind = OPERAND_MEM;
+        }
+    }
+
+    /* no operands: */
+    if (count == 0) {
+        if (strcmp(name, "ret") == 0) {
+            encode_byte(enc, 0xC3);
+        } else if (strcmp(name, "cqo") == 0) {
+            encode_byte(enc, 0x48);
+            encode_byte(enc, 0x99);
+        } else if (strcmp(name, "movsq") == 0) {
+            encode_byte(enc, 0x48);
+            encode_byte(enc, 0xA5);
+        } else if (strcmp(name, "stosq") == 0) {
+            encode_byte(enc, 0x48);
+            encode_byte(enc, 0xAB);
+        } else if (strcmp(name, "vzeroupper") == 0) {
+            encode_byte(enc, 0xC5);
+            encode_byte(enc, 0xF8);
+            encode_byte(enc, 0x77);
+        } else {
+            goto unknown;
+        }
+        return true;
+    }
+
+    /* jumps and calls: */
+    if (
+        count == 1
+        && src->kind == OPERAND_LABEL
+        && (name[0] == 'j' || strcmp(name, "call") == 0)
+    ) {
+        if (strcmp(name, "call") == 0) {
+            encode_byte(enc, 0xE8);
+            enc->has_fixup = true;
+            enc->fix = (fixup){FIXUP_CALL, enc->length, src->symbol, -4};
+            encode_imm(enc, 0, 4);
+        } else if (strcmp(name, "jmp") == 0) {
+            enc->jump = JUMP_ALWAYS;
+            enc->target = src->symbol;
+        } else {
+            int cc = encode_condition(name + 1);
+            if (cc < 0) goto unknown;
+            enc->jump = JUMP_CONDITION;
+            enc->condition = cc;
+            enc->target = src->symbol;
+        }
+        return true;
+    }
+
+    /* general-purpose instructions: */
+    for (int digit = 0; digit < 8; digit++) {
+        if (!ALU_NAMES[digit] || strcmp(name, ALU_NAMES[digit]) != 0) continue;
+        if (count != 2) goto unknown;
+        bool w = dst->size != 4;
+        if (src->kind == OPERAND_IMM) {
+            if (encode_fits8(src->value)) {
+                encode_op(enc, 0, w, (unsigned char[]){0x83}, 1, digit, dst, 1);
+                encode_imm(enc, src->value, 1);
+            } else if (dst->kind == OPERAND_REG && dst->reg == 0) {
+                encode_rex(enc, w, 0, NULL);
+                encode_byte(enc, 8 * digit + 5);
+                encode_imm(enc, src->value, 4);
+            } else {
+                encode_op(enc, 0, w, (unsigned char[]){0x81}, 1, digit, dst, 4);
+                encode_imm(enc, src->value, 4);
+            }
+        } else if (src->kind == OPERAND_REG) {
+            unsigned char op = 8 * digit + 1;
+            encode_op(enc, 0, w, &op, 1, src->reg, dst, 0);
+        } else {
+            unsigned char op = 8 * digit + 3;
+            encode_op(enc, 0, w, &op, 1, dst->reg, src, 0);
+        }
+        return true;
+    }
+
+    if (strcmp(name, "mov") == 0 && count == 2) {
+        if (src->kind == OPERAND_IMM) {
+            if (encode_fits32(src->value)) {
+                encode_op(enc, 0, true, (unsigned char[]){0xC7}, 1, 0, dst, 4);
+                encode_imm(enc, src->value, 4);
+                return true;
+            }
+            if (dst->kind != OPERAND_REG) goto unknown;
+            encode_rex(enc, true, 0, dst);
+            encode_byte(enc, 0xB8 + (dst->reg & 7));
+            encode_imm(enc, src->value, 8);
+        } else if (src->kind == OPERAND_REG && dst->kind == OPERAND_VECTOR) {
+            encode_op(enc, 0x66, true, (unsigned char[]){0x0F, 0x6E}, 2,
+                dst->reg, src, 0);
+        } else if (src->kind == OPERAND_VECTOR && dst->kind == OPERAND_REG) {
+            encode_op(enc, 0x66, true, (unsigned char[]){0x0F, 0x7E}, 2,
+                src->reg, dst, 0);
+        } else if (src->kind == OPERAND_REG) {
+            encode_op(enc, 0, true, (unsigned char[]){0x89}, 1, src->reg, dst, 0);
+        } else {
+            encode_op(enc, 0, true, (unsigned char[]){0x8B}, 1, dst->reg, src, 0);
+        }
+        return true;
+    }
+    if (strcmp(name, "movabs") == 0 && count == 2) {
+        encode_rex(enc, true, 0, dst);
+        encode_byte(enc, 0xB8 + (dst->reg & 7));
+        encode_imm(enc, src->value, 8);
+        return true;
+    }
+    if (strcmp(name, "lea") == 0 && count == 2) {
+        encode_op(enc, 0, true, (unsigned char[]){0x8D}, 1, dst->reg, src, 0);
+        return true;
+    }
+    if (strcmp(name, "test") == 0 && count == 2) {
+        if (src->kind != OPERAND_IMM) {
+            encode_op(enc, 0, true, (unsigned char[]){0x85}, 1, src->reg, dst, 0);
+        } else if (dst->kind == OPERAND_REG && dst->reg == 0) {
+            encode_rex(enc, true, 0, NULL);
+            encode_byte(enc, 0xA9);
+            encode_imm(enc, src->value, 4);
+        } else {
+            encode_op(enc, 0, true, (unsigned char[]){0xF7}, 1, 0, dst, 4);
+            encode_imm(enc, src->value, 4);
+        }
+        return true;
+    }
+    if (strcmp(name, "imul") == 0) {
+        if (count == 1) {
+            encode_op(enc, 0, true, (unsigned char[]){0xF7}, 1, 5, src, 0);
+        } else if (count == 2) {
+            encode_op(enc, 0, true, (unsigned char[]){0x0F, 0xAF}, 2,
+                dst->reg, src, 0);
+        } else if (encode_fits8(src->value)) {
+            encode_op(enc, 0, true, (unsigned char[]){0x6B}, 1,
+                dst->reg, &ops[1], 1);
+            encode_imm(enc, src->value, 1);
+        } else {
+            encode_op(enc, 0, true, (unsigned char[]){0x69}, 1,
+                dst->reg, &ops[1], 4);
+            encode_imm(enc, src->value, 4);
+        }
+        return true;
+    }
+
+    /* `F7 /digit` and `FF /digit` on one operand: */
+    const char* unary[] = {"not", "neg", "mul", "idiv", "inc", "dec"};
+    const int unary_ops[][2] = {
+        {0xF7, 2}, {0xF7, 3}, {0xF7, 4}, {0xF7, 7}, {0xFF, 0}, {0xFF, 1},
+    };
+    for (int i = 0; i < 6; i++) {
+        if (strcmp(name, unary[i]) != 0) continue;
+        if (count != 1) goto unknown;
+        unsigned char op = unary_ops[i][0];
+        encode_op(enc, 0, true, &op, 1, unary_ops[i][1], src, 0);
+        return true;
+    }
+
+    const char* shifts[] = {"shl", "shr", "sar"};
+    const int shift_digits[] = {4, 5, 7};
+    for (int i = 0; i < 3; i++) {
+        if (strcmp(name, shifts[i]) != 0) continue;
+        if (count != 2) goto unknown;
+        if (src->kind == OPERAND_REG) {
+            encode_op(enc, 0, true, (unsigned char[]){0xD3}, 1,
+                shift_digits[i], dst, 0);
+        } else if (src->value == 1) {
+            encode_op(enc, 0, true, (unsigned char[]){0xD1}, 1,
+                shift_digits[i], dst, 0);
+        } else {
+            encode_op(enc, 0, true, (unsigned char[]){0xC1}, 1,
+                shift_digits[i], dst, 1);
+            encode_imm(enc, src->value, 1);
+        }
+        return true;
+    }
+
+    if (
+        (strcmp(name, "push") == 0 || strcmp(name, "pop") == 0)
+        && count == 1
+        && src->kind == OPERAND_REG
+    ) {
+        if (src->reg >= 8) encode_byte(enc, 0x41);
+        encode_byte(enc, (name[1] == 'u' ? 0x50 : 0x58) + (src->reg & 7));
+        return true;
+    }
+    if (strcmp(name, "movzbq") == 0 && count == 2) {
+        encode_op(enc, 0, true, (unsigned char[]){0x0F, 0xB6}, 2,
+            dst->reg, src, 0);
+        return true;
+    }
+    if (strncmp(name, "set", 3) == 0 && count == 1) {
+        int cc = encode_condition(name + 3);
+        if (cc < 0) goto unknown;
+        unsigned char op[] = {0x0F, 0x90 + cc};
+        encode_op(enc, 0, false, op, 2, 0, src, 0);
+        return true;
+    }
+    if (strncmp(name, "cmov", 4) == 0 && count == 2) {
+        int cc = encode_condition(name + 4);
+        if (cc < 0) goto unknown;
+        unsigned char op[] = {0x0F, 0x40 + cc};
+        encode_op(enc, 0, true, op, 2, dst->reg, src, 0);
+        return true;
+    }
+
+    /* vector instructions: */
+    bool vex = name[0] == 'v';
+    const char* base = vex ? name + 1 : name;
+    bool wide = dst->kind == OPERAND_VECTOR && dst->size == 32;
+
+    for (const sse_op* op = SSE_OPS; op->name; op++) {
+        if (strcmp(base, op->name) != 0) continue;
+        if (op->digit >= 0) {
+            /* by an immediate, `$n, src[, dst]` */
+            if (vex && count == 3) {
+                encode_vex(enc, 1, 1, false, wide, dst->reg, op->opcode,
+                    op->digit, &ops[1], 1);
+            } else if (!vex && count == 2) {
+                unsigned char code[] = {0x0F, op->opcode};
+                encode_op(enc, 0x66, false, code, 2, op->digit, dst, 1);
+            } else {
+                goto unknown;
+            }
+            encode_imm(enc, src->value, 1);
+        } else if (vex && count == 3) {
+            encode_vex(enc, 1, 1, false, wide, ops[1].reg, op->opcode,
+                dst->reg, src, 0);
+        } else if (!vex && count == 2) {
+            unsigned char code[] = {0x0F, op->opcode};
+            encode_op(enc, 0x66, false, code, 2, dst->reg, src, 0);
+        } else {
+            goto unknown;
+        }
+        return true;
+    }
+
+    if (
+        (strcmp(base, "movdqa") == 0 || strcmp(base, "movdqu") == 0)
+        && count == 2
+    ) {
+        int pp = base[5] == 'a' ? 1 : 2;
+        int prefix = base[5] == 'a' ? 0x66 : 0xF3;
+        /* loads (and moves between registers) are `6F`, stores `7F`; as
+         * VEX can't extend the register in ModRM.rm in two bytes, a move
+         * from a high register to a low one is written as a store */
+        bool store = dst->kind == OPERAND_MEM
+            || (vex && src->reg >= 8 && dst->reg < 8
+                && dst->kind == OPERAND_VECTOR && src->kind == OPERAND_VECTOR);
+        operand* reg = store ? src : dst;
+        operand* rm = store ? dst : src;
+        wide = reg->size == 32;
+        if (vex) {
+            encode_vex(enc, pp, 1, false, wide, 0, store ? 0x7F : 0x6F,
+                reg->reg, rm, 0);
+        } else {
+            unsigned char code[] = {0x0F, store ? 0x7F : 0x6F};
+            encode_op(enc, prefix, false, code, 2, reg->reg, rm, 0);
+        }
+        return true;
+    }
+    if (strcmp(base, "pshufd") == 0 && count == 3) {
+        if (vex) {
+            encode_vex(enc, 1, 1, false, wide, 0, 0x70, dst->reg, &ops[1], 1);
+        } else {
+            encode_op(enc, 0x66, false, (unsigned char[]){0x0F, 0x70}, 2,
+                dst->reg, &ops[1], 1);
+        }
+        encode_imm(enc, src->value, 1);
+        return true;
+    }
+
+    if (!vex) goto unknown;
+    if (strcmp(name, "vmovq") == 0 && count == 2) {
+        if (dst->kind == OPERAND_VECTOR) {
+            encode_vex(enc, 1, 1, true, false, 0, 0x6E, dst->reg, src, 0);
+        } else {
+            encode_vex(enc, 1, 1, true, false, 0, 0x7E, src->reg, dst, 0);
+        }
+        return true;
+    }
+    if (strcmp(name, "vpcmpgtq") == 0 && count == 3) {
+        encode_vex(enc, 1, 2, false, wide, ops[1].reg, 0x37, dst->reg, src, 0);
+        return true;
+    }
+    if (strcmp(name, "vpblendvb") == 0 && count == 4) {
+        /* (the mask register goes in the top of a trailing byte) */
+        encode_vex(enc, 1, 3, false, wide, ops[2].reg, 0x4C,
+            dst->reg, &ops[1], 1);
+        encode_imm(enc, src->reg << 4, 1);
+        return true;
+    }
+    if (strcmp(name, "vpbroadcastq") == 0 && count == 2) {
+        encode_vex(enc, 1, 2, false, wide, 0, 0x59, dst->reg, src, 0);
+        return true;
+    }
+    if (strcmp(name, "vextracti128") == 0 && count == 3) {
+        encode_vex(enc, 1, 3, false, true, 0, 0x39, ops[1].reg, dst, 1);
+        encode_imm(enc, src->value, 1);
+        return true;
+    }
+
+unknown:
+    fprintf(stderr, "error: can't encode `%s` with these operands\n", mnemonic);
+    return false;
+}
+
+/**********************************************************************
+ *                              OPERANDS                              *
+ **********************************************************************/
+
+int encode_operands(char* args, operand* ops, int max) {
+    int count = 0;
+    char* p = args;
+    while (*p == ' ' || *p == '\t') p++;
+    if (*p == '\0') return 0;
+
+    /* (split in place, symbols being left where they are) */
+    while (*p) {
+        char* text = p;
+        int depth = 0;
+        while (*p && (depth > 0 || *p != ',')) {
+            if (*p == '(') depth++;
+            if (*p == ')') depth--;
+            p++;
+        }
+        if (*p == ',') *p++ = '\0';
+
+        if (count == max || !encode_operand(text, &ops[count])) {
+            fprintf(stderr, "error: can't read operand `%s`\n", text);
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+bool encode_operand(char* text, operand* op) {
+    memset(op, 0, sizeof(*op));
+    op->base = -1;
+    op->index = -1;
+
+    /* (without surrounding spaces) */
+    while (*text == ' ' || *text == '\t') text++;
+    char* end = text + strlen(text);
+    while (end > text && (end[-1] == ' ' || end[-1] == '\t')) *--end = '\0';
+    if (*text == '\0') return false;
+
+    if (*text == '%') {
+        bool vector;
+        op->reg = encode_register(text + 1, &op->size, &vector);
+        op->kind = vector ? OPERAND_VECTOR : OPERAND_REG;
+        return op->reg >= 0;
+    }
+    if (*text == '$') {
+        op->kind = OPERAND_IMM;
+        char* rest;
+        op->value = strtoll(text + 1, &rest, 0);
+        return *rest == '\0' && rest != text + 1;
+    }
+
+    /* a displacement (number or symbol), then `(base, index, scale)`: */
+    char* paren = strchr(text, '(');
+    if (paren) {
+        *paren = '\0';
+        char* e = paren;
+        while (e > text && (e[-1] == ' ' || e[-1] == '\t')) *--e = '\0';
+    }
+    if (*text == '-' || isdigit((unsigned char)*text)) {
+        char* rest;
+        op->value = strtoll(text, &rest, 0);
+        if (*rest != '\0') return false;
+    } else if (*text) {
+        op->symbol = text;
+    }
+
+    if (!paren) {
+        /* a bare symbol is a jump target, or an absolute address */
+        op->kind = op->symbol ? OPERAND_LABEL : OPERAND_MEM;
+        return true;
+    }
+    op->kind = OPERAND_MEM;
+
+    char* close = strchr(paren + 1, ')');
+    if (!close) return false;
+    *close = '\0';
+    char* parts[3] = {paren + 1, NULL, NULL};
+    int count = 1;
+    for (char* p = paren + 1; *p && count < 3; p++) {
+        if (*p == ',') {
+            *p = '\0';
+            parts[count++] = p + 1;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        while (*parts[i] == ' ') parts[i]++;
+        char* e = parts[i] + strlen(parts[i]);
+        while (e > parts[i] && e[-1] == ' ') *--e = '\0';
+    }
+
+    int size;
+    bool vector;
+    if (*parts[0]) {
+        if (parts[0][0] != '%') return false;
+        if (strcmp(parts[0], "%rip") == 0) {
+            op->rip = true;
+        } else {
+            op->base = encode_register(parts[0] + 1, &size, &vector);
+            if (op->base < 0 || size != 8) return false;
+        }
+    }
+    if (count > 1) {
+        if (parts[1][0] != '%') return false;
+        op->index = encode_register(parts[1] + 1, &size, &vector);
+        if (op->index < 0 || size != 8 || op->index == 4) return false;
+        op->scale = count > 2 ? atoi(parts[2]) : 1;
+        if (op->scale != 1 && op->scale != 2 && op->scale != 4
+            && op->scale != 8) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int encode_register(const char* name, int* size, bool* vector) {
+    char lower[8];
+    size_t length = strlen(name);
+    if (length >= sizeof(lower)) return -1;
+    for (size_t i = 0; i <= length; i++) {
+        lower[i] = tolower((unsigned char)name[i]);
+    }
+
+    *vector = false;
+    for (int i = 0; i < 16; i++) {
+        *size = 8;
+        if (strcmp(lower, REG64_NAMES[i]) == 0) return i;
+        *size = 4;
+        if (strcmp(lower, REG32_NAMES[i]) == 0) return i;
+        *size = 1;
+        if (strcmp(lower, REG8_NAMES[i]) == 0) return i;
+    }
+
+    if (strncmp(lower, "xmm", 3) == 0 || strncmp(lower, "ymm", 3) == 0) {
+        char* rest;
+        long n = strtol(lower + 3, &rest, 10);
+        if (*rest != '\0' || rest == lower + 3 || n < 0 || n > 15) return -1;
+        *vector = true;
+        *size = lower[0] == 'y' ? 32 : 16;
+        return n;
+    }
+    return -1;
+}
+
+int encode_condition(const char* cc) {
+    for (int i = 0; i < 16; i++) {
+        for (int j = 0; j < 3 && CONDITION_NAMES[i][j]; j++) {
+            if (strcmp(cc, CONDITION_NAMES[i][j]) == 0) return i;
+        }
+    }
+    return -1;
+}
+
+/**********************************************************************
+ *                              ENCODING                              *
+ **********************************************************************/
+
+void encode_byte(encoding* enc, int byte) {
+    enc->bytes[enc->length++] = byte;
+}
+
+void encode_imm(encoding* enc, int64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+        encode_byte(enc, (uint64_t)value >> (8 * i) & 0xFF);
+    }
+}
+
+void encode_rex(encoding* enc, bool w, int reg, operand* rm) {
+    int rex = 0;
+    if (w) rex |= 8;
+    if (reg >= 8) rex |= 4;
+    if (rm && rm->kind == OPERAND_MEM) {
+        if (rm->index >= 8) rex |= 2;
+        if (rm->base >= 8) rex |= 1;
+    } else if (rm && rm->reg >= 8) {
+        rex |= 1;
+    }
+    /* (`%spl` through `%dil` only exist with one) */
+    bool byte_reg = rm && rm->kind == OPERAND_REG && rm->size == 1
+        && rm->reg >= 4 && rm->reg < 8;
+    if (rex || byte_reg) encode_byte(enc, 0x40 | rex);
+}
+
+void encode_modrm(encoding* enc, int reg, operand* rm, int trailing) {
+    reg &= 7;
+    if (rm->kind != OPERAND_MEM) {
+        encode_byte(enc, 0xC0 | reg << 3 | (rm->reg & 7));
+        return;
+    }
+
+    if (rm->rip) {
+        encode_byte(enc, reg << 3 | 5);
+        if (rm->symbol) {
+            enc->has_fixup = true;
+            enc->fix = (fixup){
+                FIXUP_PC32,
+                enc->length,
+                rm->symbol,
+                rm->value - 4 - trailing,
+            };
+            encode_imm(enc, 0, 4);
+        } else {
+            encode_imm(enc, rm->value, 4);
+        }
+        return;
+    }
+
+    /* the displacement is left out if it's 0 (unless the base is `%rbp`
+     * or `%r13`, whose encodings without one mean something else), and a
+     * byte if it fits */
+    int mod;
+    if (rm->base < 0) {
+        mod = 0;
+    } else if (rm->symbol || !encode_fits8(rm->value)) {
+        mod = 2;
+    } else if (rm->value != 0 || (rm->base & 7) == 5) {
+        mod = 1;
+    } else {
+        mod = 0;
+    }
+
+    if (rm->index < 0 && rm->base >= 0 && (rm->base & 7) != 4) {
+        encode_byte(enc, mod << 6 | reg << 3 | (rm->base & 7));
+    } else {
+        /* a SIB byte, for an index, a base of `%rsp` or `%r12`, or an
+         * absolute address (with neither) */
+        int scale = rm->scale == 8 ? 3 : rm->scale == 4 ? 2
+            : rm->scale == 2 ? 1 : 0;
+        int index = rm->index >= 0 ? rm->index & 7 : 4;
+        int base = rm->base >= 0 ? rm->base & 7 : 5;
+        encode_byte(enc, mod << 6 | reg << 3 | 4);
+        encode_byte(enc, scale << 6 | index << 3 | base);
+    }
+
+    if (mod == 1) {
+        encode_imm(enc, rm->value, 1);
+    } else if (mod == 2 || rm->base < 0) {
+        if (rm->symbol) {
+            enc->has_fixup = true;
+            enc->fix = (fixup){
+                FIXUP_ABS32S,
+                enc->length,
+                rm->symbol,
+                rm->value,
+            };
+            encode_imm(enc, 0, 4);
+        } else {
+            encode_imm(enc, rm->value, 4);
+        }
+    }
+}
+
+void encode_op(
+    encoding* enc,
+    int prefix,
+    bool w,
+    const unsigned char* opcode,
+    int length,
+    int reg,
+    operand* rm,
+    int trailing
+) {
+    if (prefix) encode_byte(enc, prefix);
+    encode_rex(enc, w, reg, rm);
+    for (int i = 0; i < length; i++) encode_byte(enc, opcode[i]);
+    encode_modrm(enc, reg, rm, trailing);
+}
+
+void encode_vex(
+    encoding* enc,
+    int pp,
+    int map,
+    bool w,
+    bool wide,
+    int vvvv,
+    int opcode,
+    int reg,
+    operand* rm,
+    int trailing
+) {
+    /* (the register bits are inverted) */
+    bool r = reg >= 8;
+    bool x = rm->kind == OPERAND_MEM && rm->index >= 8;
+    bool b = rm->kind == OPERAND_MEM ? rm->base >= 8 : rm->reg >= 8;
+    int tail = (~vvvv & 0xF) << 3 | wide << 2 | pp;
+
+    if (map == 1 && !w && !x && !b) {
+        encode_byte(enc, 0xC5);
+        encode_byte(enc, !r << 7 | tail);
+    } else {
+        encode_byte(enc, 0xC4);
+        encode_byte(enc, !r << 7 | !x << 6 | !b << 5 | map);
+        encode_byte(enc, w << 7 | tail);
+    }
+    encode_byte(enc, opcode);
+    encode_modrm(enc, reg, rm, trailing);
+}
+
+bool encode_fits8(int64_t value) {
+    return value >= INT8_MIN && value <= INT8_MAX;
+}
+
+bool encode_fits32(int64_t value) {
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
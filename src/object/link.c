@@ -0,0 +1,307 @@
+#include "object.h"
+#include <sys/stat.h>
+
+/**********************************************************************
+ *                               LINKING                              *
+ **********************************************************************/
+
+/* The executable is laid out as the segments of `segment_t`: code (after
+ * the headers, which are loaded with it), read-only data, then data with
+ * the zeros of `.bss` after it, each starting on a page of its own so it
+ * can be mapped with its own permissions. Addresses are fixed, so nothing
+ * is left to do at load time. */
+
+bool link_executable(object** objects, int count, const char* path) {
+    uint64_t sizes[NUM_SEGMENTS];
+    uint64_t aligns[NUM_SEGMENTS];
+    link_layout(objects, count, sizes, aligns);
+
+    /* the segments' places in the file (and in memory, `LINK_BASE` on):
+     * `.bss` has none in the file, and follows data in memory */
+    int phnum = 1;
+    for (int segment = 0; segment < SEGMENT_BSS; segment++) {
+        phnum += segment == SEGMENT_DATA
+            ? sizes[SEGMENT_DATA] + sizes[SEGMENT_BSS] > 0
+            : sizes[segment] > 0;
+    }
+    uint64_t headers = sizeof(Elf64_Ehdr) + phnum * sizeof(Elf64_Phdr);
+    uint64_t starts[NUM_SEGMENTS];
+    starts[SEGMENT_TEXT] = (headers + aligns[SEGMENT_TEXT] - 1)
+        & -aligns[SEGMENT_TEXT];
+    uint64_t end = starts[SEGMENT_TEXT] + sizes[SEGMENT_TEXT];
+    for (int segment = SEGMENT_RODATA; segment <= SEGMENT_DATA; segment++) {
+        end = (end + LINK_PAGE - 1) & -(uint64_t)LINK_PAGE;
+        starts[segment] = end;
+        end += sizes[segment];
+    }
+    starts[SEGMENT_BSS] = (end + aligns[SEGMENT_BSS] - 1)
+        & -aligns[SEGMENT_BSS];
+
+    uint64_t addresses[NUM_SEGMENTS];
+    for (int i = 0; i < NUM_SEGMENTS; i++) {
+        addresses[i] = LINK_BASE + starts[i];
+    }
+    link_place(objects, count, addresses);
+    ht* globals = link_resolve(objects, count);
+    uint64_t* entry = globals ? ht_get(globals, "_start") : NULL;
+    if (globals && !entry) {
+        fprintf(stderr, "error: no `_start` to begin the program at\n");
+    }
+    if (!entry) {
+        link_free(globals);
+        return false;
+    }
+
+    /* the file, with the segments' contents at their offsets: */
+    uint64_t file_size = starts[SEGMENT_DATA] + sizes[SEGMENT_DATA];
+    unsigned char* file = calloc(file_size, 1);
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < objects[i]->section_count; j++) {
+            section* s = &objects[i]->sections[j];
+            int segment = link_segment(s);
+            if (segment < 0 || segment == SEGMENT_BSS || s->size == 0) {
+                continue;
+            }
+            memcpy(file + (s->address - LINK_BASE), s->bytes, s->size);
+        }
+    }
+
+    Elf64_Ehdr* header = (Elf64_Ehdr*)file;
+    *header = (Elf64_Ehdr){
+        .e_ident = {
+            ELFMAG0, ELFMAG1, ELFMAG2, ELFMAG3,
+            ELFCLASS64, ELFDATA2LSB, EV_CURRENT, ELFOSABI_SYSV,
+        },
+        .e_type = ET_EXEC,
+        .e_machine = EM_X86_64,
+        .e_version = EV_CURRENT,
+        .e_entry = *entry,
+        .e_phoff = sizeof(Elf64_Ehdr),
+        .e_ehsize = sizeof(Elf64_Ehdr),
+        .e_phentsize = sizeof(Elf64_Phdr),
+        .e_phnum = phnum,
+    };
+    Elf64_Phdr* phdr = (Elf64_Phdr*)(file + sizeof(Elf64_Ehdr));
+    const int flags[] = {PF_R | PF_X, PF_R, PF_R | PF_W};
+    for (int segment = 0; segment < SEGMENT_BSS; segment++) {
+        uint64_t memory = sizes[segment];
+        uint64_t start = starts[segment];
+        if (segment == SEGMENT_TEXT) {
+            /* (the headers are loaded along with the code) */
+            memory += start;
+            start = 0;
+        } else if (segment == SEGMENT_DATA) {
+            memory = starts[SEGMENT_BSS] + sizes[SEGMENT_BSS] - start;
+        }
+        if (memory == 0) continue;
+        *phdr++ = (Elf64_Phdr){
+            .p_type = PT_LOAD,
+            .p_flags = flags[segment],
+            .p_offset = start,
+            .p_vaddr = LINK_BASE + start,
+            .p_paddr = LINK_BASE + start,
+            .p_filesz = segment == SEGMENT_TEXT ? memory : sizes[segment],
+            .p_memsz = memory,
+            .p_align = LINK_PAGE,
+        };
+    }
+    /* (the stack needn't be executable) */
+    *phdr = (Elf64_Phdr){
+        .p_type = PT_GNU_STACK,
+        .p_flags = PF_R | PF_W,
+        .p_align = 16,
+    };
+
+    FILE* out = fopen(path, "wb");
+    bool ok = out != NULL;
+    if (!out) {
+        fprintf(stderr, "error: could not open output file: %s\n", path);
+    } else {
+        ok = fwrite(file, 1, file_size, out) == file_size;
+        ok = fclose(out) == 0 && ok;
+        if (!ok) fprintf(stderr, "error: could not write: %s\n", path);
+        chmod(path, 0755);
+    }
+
+    free(file);
+    link_free(globals);
+    return ok;
+}
+
+void link_layout(
+    object** objects,
+    int count,
+    uint64_t* sizes,
+    uint64_t* aligns
+) {
+    for (int segment = 0; segment < NUM_SEGMENTS; segment++) {
+        sizes[segment] = 0;
+        aligns[segment] = 1;
+        for (int i = 0; i < count; i++) {
+            for (int j = 0; j < objects[i]->section_count; j++) {
+                section* s = &objects[i]->sections[j];
+                if (link_segment(s) != segment) continue;
+                sizes[segment] = (sizes[segment] + s->align - 1)
+                    & -(uint64_t)s->align;
+                s->address = sizes[segment];
+                sizes[segment] += s->size;
+                if ((uint64_t)s->align > aligns[segment]) {
+                    aligns[segment] = s->align;
+                }
+            }
+        }
+    }
+}
+
+void link_place(object** objects, int count, const uint64_t* addresses) {
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < objects[i]->section_count; j++) {
+            section* s = &objects[i]->sections[j];
+            int segment = link_segment(s);
+            if (segment >= 0) s->address += addresses[segment];
+        }
+    }
+}
+
+ht* link_resolve(object** objects, int count) {
+    /* every global symbol, by name: */
+    ht* globals = ht_create();
+    bool ok = true;
+    for (int i = 0; i < count; i++) {
+        object* obj = objects[i];
+        for (int j = 0; j < obj->symbol_count; j++) {
+            object_symbol* sym = &obj->symbols[j];
+            if (!sym->global || sym->section == SECTION_UNDEF) continue;
+            if (ht_get(globals, sym->name)) {
+                fprintf(
+                    stderr,
+                    "error: %s: `%s` is defined more than once\n",
+                    obj->name,
+                    sym->name
+                );
+                ok = false;
+                continue;
+            }
+            uint64_t* address = malloc(sizeof(*address));
+            link_address(globals, obj, j, address);
+            ht_set(globals, sym->name, address);
+        }
+    }
+
+    for (int i = 0; i < count && ok; i++) {
+        for (int j = 0; j < objects[i]->section_count; j++) {
+            section* s = &objects[i]->sections[j];
+            if (link_segment(s) >= 0) {
+                ok = link_relocate(globals, objects[i], s) && ok;
+            }
+        }
+    }
+    if (!ok) {
+        link_free(globals);
+        return NULL;
+    }
+    return globals;
+}
+
+void link_free(ht* globals) {
+    if (!globals) return;
+    ht_iter it = ht_iterate(globals);
+    while (ht_next(&it)) free(it.value);
+    ht_destroy(globals);
+}
+
+int link_segment(section* s) {
+    if (!(s->flags & SHF_ALLOC) || strcmp(s->name, ".eh_frame") == 0) {
+        return -1;
+    }
+    if (s->type != SHT_PROGBITS && s->type != SHT_NOBITS) return -1;
+
+    if (s->flags & SHF_EXECINSTR) return SEGMENT_TEXT;
+    if (!(s->flags & SHF_WRITE)) return SEGMENT_RODATA;
+    return s->type == SHT_NOBITS ? SEGMENT_BSS : SEGMENT_DATA;
+}
+
+bool link_address(ht* globals, object* obj, int i, uint64_t* address) {
+    object_symbol* sym = &obj->symbols[i];
+    if (sym->section == SECTION_ABS) {
+        *address = sym->value;
+        return true;
+    }
+    if (sym->section != SECTION_UNDEF) {
+        *address = obj->sections[sym->section].address + sym->value;
+        return true;
+    }
+    uint64_t* global = ht_get(globals, sym->name);
+    if (!global) {
+        fprintf(
+            stderr,
+            "error: %s: undefined reference to `%s`\n",
+            obj->name,
+            sym->name
+        );
+        return false;
+    }
+    *address = *global;
+    return true;
+}
+
+bool link_relocate(ht* globals, object* obj, section* s) {
+    bool ok = true;
+    for (int i = 0; i < s->reloc_count; i++) {
+        relocation* r = &s->relocs[i];
+        uint64_t target;
+        if (!link_address(globals, obj, r->symbol, &target)) {
+            ok = false;
+            continue;
+        }
+        uint64_t value = target + r->addend;
+        uint64_t place = s->address + r->offset;
+
+        /* (without shared libraries, a call through the PLT goes straight
+         * to the function) */
+        int bytes = 4;
+        bool fits;
+        switch (r->type) {
+            case R_X86_64_64:
+                bytes = 8;
+                fits = true;
+                break;
+            case R_X86_64_PC32:     __attribute__((fallthrough));
+            case R_X86_64_PLT32:
+                value -= place;
+                fits = encode_fits32(value);
+                break;
+            case R_X86_64_32:
+                fits = value <= UINT32_MAX;
+                break;
+            case R_X86_64_32S:
+                fits = encode_fits32(value);
+                break;
+            default:
+                fprintf(
+                    stderr,
+                    "error: %s: unsupported relocation type %d in `%s`\n",
+                    obj->name,
+                    r->type,
+                    s->name
+                );
+                ok = false;
+                continue;
+        }
+        if (!fits || r->offset + bytes > s->size || !s->bytes) {
+            fprintf(
+                stderr,
+                "error: %s: relocation at `%s`+%#lx is out of range\n",
+                obj->name,
+                s->name,
+                (unsigned long)r->offset
+            );
+            ok = false;
+            continue;
+        }
+        for (int j = 0; j < bytes; j++) {
+            s->bytes[r->offset + j] = value >> (8 * j);
+        }
+    }
+    return ok;
+}
@@ -0,0 +1,119 @@
+#include "object.h"
+#include <sys/mman.h>
+#include <time.h>
+
+/**********************************************************************
+ *                               RUNNING                              *
+ **********************************************************************/
+
+/* The segments are laid out as in an executable, each on pages of its own,
+ * but in one mapping wherever the kernel puts it. The mapping is writable
+ * while the sections are copied in, after which code is made read-only and
+ * executable, and read-only data read-only: no page is ever both writable
+ * and executable. */
+
+bool run_load(object** objects, int count, run_image* image) {
+    ht* globals = run_link(objects, count, image);
+    if (!globals) return false;
+    uint64_t* main = ht_get(globals, "main");
+    uint64_t* flush = ht_get(globals, "bm_flush");
+    if (!main || !flush) {
+        fprintf(
+            stderr,
+            "error: no `%s` to run\n",
+            main ? "bm_flush" : "main"
+        );
+        link_free(globals);
+        run_unload(image);
+        return false;
+    }
+    image->main = (long (*)(void))(uintptr_t)*main;
+    image->flush = (void (*)(void))(uintptr_t)*flush;
+    link_free(globals);
+    return true;
+}
+
+ht* run_link(object** objects, int count, run_image* image) {
+    uint64_t sizes[NUM_SEGMENTS];
+    uint64_t aligns[NUM_SEGMENTS];
+    link_layout(objects, count, sizes, aligns);
+
+    uint64_t starts[NUM_SEGMENTS];
+    uint64_t end = 0;
+    for (int segment = 0; segment <= SEGMENT_DATA; segment++) {
+        end = (end + LINK_PAGE - 1) & -(uint64_t)LINK_PAGE;
+        starts[segment] = end;
+        end += sizes[segment];
+    }
+    starts[SEGMENT_BSS] = (end + aligns[SEGMENT_BSS] - 1)
+        & -aligns[SEGMENT_BSS];
+    end = starts[SEGMENT_BSS] + sizes[SEGMENT_BSS];
+    image->size = (end + LINK_PAGE - 1) & -(uint64_t)LINK_PAGE;
+
+    /* (anonymous, so `.bss` and the gaps between sections are zeros) */
+    void* memory = mmap(
+        NULL,
+        image->size,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT,
+        -1,
+        0
+    );
+    if (memory == MAP_FAILED) {
+        fprintf(stderr, "error: could not map memory to run the program in\n");
+        return NULL;
+    }
+    image->memory = memory;
+
+    uint64_t addresses[NUM_SEGMENTS];
+    for (int i = 0; i < NUM_SEGMENTS; i++) {
+        addresses[i] = (uintptr_t)image->memory + starts[i];
+    }
+    link_place(objects, count, addresses);
+    ht* globals = link_resolve(objects, count);
+    if (!globals) {
+        run_unload(image);
+        return NULL;
+    }
+    image->main = NULL;
+    image->flush = NULL;
+
+    for (int i = 0; i < count; i++) {
+        for (int j = 0; j < objects[i]->section_count; j++) {
+            section* s = &objects[i]->sections[j];
+            int segment = link_segment(s);
+            if (segment < 0 || segment == SEGMENT_BSS || s->size == 0) {
+                continue;
+            }
+            memcpy((void*)(uintptr_t)s->address, s->bytes, s->size);
+        }
+    }
+
+    const int protections[] = {PROT_READ | PROT_EXEC, PROT_READ};
+    for (int segment = SEGMENT_TEXT; segment <= SEGMENT_RODATA; segment++) {
+        if (sizes[segment] == 0) continue;
+        if (mprotect(
+            image->memory + starts[segment],
+            (sizes[segment] + LINK_PAGE - 1) & -(uint64_t)LINK_PAGE,
+            protections[segment]
+        ) != 0) {
+            fprintf(stderr, "error: could not protect the program's memory\n");
+            link_free(globals);
+            run_unload(image);
+            return NULL;
+        }
+    }
+    return globals;
+}
+
+void run_unload(run_image* image) {
+    munmap(image->memory, image->size);
+    image->memory = NULL;
+    image->size = 0;
+}
+
+double run_clock(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
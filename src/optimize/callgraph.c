@@ -0,0 +1,173 @@
+#include "optimize.h"
+
+/**********************************************************************
+ *                            CONSTRUCTION                            *
+ **********************************************************************/
+
+call_node* callgraph_construct(cfg* program) {
+    ht* funcs = ht_create();
+    call_node* graph = NULL;
+    call_node** tail = &graph;
+
+    /* a node for every function first, so calls can refer to them: */
+    for (cfg* c = program; c != NULL; c = c->next) {
+        if (c->kind != FUNC) continue;
+
+        call_node* node = malloc(sizeof(*node));
+        node->symbol = c->symbol;
+        node->func = c;
+        node->calls = NULL;
+        node->globals = NULL;
+        node->num_callers = 0;
+        node->reachable = false;
+        node->next = NULL;
+
+        ht_set(funcs, c->symbol->name, node);
+        *tail = node;
+        tail = &node->next;
+    }
+
+    for (call_node* node = graph; node != NULL; node = node->next) {
+        int count;
+        cfg_node** body = cfg_nodes(node->func->value.cfg_node, &count);
+        for (int i = 0; i < count; i++) {
+            switch (body[i]->kind) {
+                case CFG_BLOCK:
+                    callgraph_stmt(funcs, node, body[i]->value.block->stmt);
+                    break;
+                case CFG_BRANCH:
+                    callgraph_expr(
+                        funcs,
+                        node,
+                        body[i]->value.branch->condition
+                    );
+                    break;
+                case CFG_RETURN:
+                    break;
+            }
+        }
+        free(body);
+    }
+
+    ht_destroy(funcs);
+    return graph;
+}
+
+void callgraph_stmt(ht* funcs, call_node* caller, stmt* s) {
+    if (!s) return;
+
+    switch (s->kind) {
+        case STMT_DECL:
+            callgraph_expr(funcs, caller, s->decl->value);
+            break;
+        case STMT_BLOCK:
+            callgraph_stmt(funcs, caller, s->body);
+            break;
+        default:
+            callgraph_expr(funcs, caller, s->expr);
+            break;
+    }
+
+    callgraph_stmt(funcs, caller, s->next);
+}
+
+void callgraph_expr(ht* funcs, call_node* caller, expr* e) {
+    if (!e) return;
+
+    if (e->kind == EXPR_FUN_CALL) {
+        /* functions without a body have no node, and nothing to keep: */
+        call_node* callee = ht_get(funcs, e->left->name);
+        if (callee) {
+            call_edge* edge = malloc(sizeof(*edge));
+            edge->callee = callee;
+            edge->site = e;
+            edge->next = caller->calls;
+            caller->calls = edge;
+            callee->num_callers++;
+        }
+        /* arguments: */
+        callgraph_expr(funcs, caller, e->right);
+        return;
+    }
+
+    if (
+        e->kind == EXPR_IDENT
+        && e->symbol
+        && e->symbol->kind == SYMBOL_GLOBAL
+    ) {
+        global_use* use = malloc(sizeof(*use));
+        use->symbol = e->symbol;
+        use->next = caller->globals;
+        caller->globals = use;
+    }
+
+    callgraph_expr(funcs, caller, e->left);
+    callgraph_expr(funcs, caller, e->right);
+}
+
+void callgraph_reach(call_node* node) {
+    if (node->reachable) return;
+
+    node->reachable = true;
+    for (call_edge* edge = node->calls; edge != NULL; edge = edge->next) {
+        callgraph_reach(edge->callee);
+    }
+}
+
+/**********************************************************************
+ *                      DEAD FUNCTION ELIMINATION                     *
+ **********************************************************************/
+
+cfg* callgraph_prune(cfg* program, call_node* graph) {
+    bool has_main = false;
+    for (call_node* node = graph; node != NULL; node = node->next) {
+        if (
+            strcmp(node->symbol->name, "main") == 0
+            || strcmp(node->symbol->name, "_start") == 0
+        ) {
+            callgraph_reach(node);
+            has_main = true;
+        }
+    }
+    if (!has_main) return program;
+
+    /* globals are kept if any function that is kept uses them: */
+    ht* used = ht_create();
+    for (call_node* node = graph; node != NULL; node = node->next) {
+        if (!node->reachable) continue;
+        for (global_use* use = node->globals; use != NULL; use = use->next) {
+            ht_set(used, use->symbol->name, use->symbol);
+        }
+    }
+
+    ht* reachable = ht_create();
+    for (call_node* node = graph; node != NULL; node = node->next) {
+        if (node->reachable) ht_set(reachable, node->symbol->name, node);
+    }
+
+    cfg** link = &program;
+    while (*link != NULL) {
+        cfg* c = *link;
+        if (c->kind == FUNC && !ht_get(reachable, c->symbol->name)) {
+            fprintf(
+                stderr,
+                "note: removed unreachable function `%s`\n",
+                c->symbol->name
+            );
+            *link = c->next;
+        } else if (c->kind == VAR && !ht_get(used, c->symbol->name)) {
+            fprintf(
+                stderr,
+                "note: removed unused global `%s`\n",
+                c->symbol->name
+            );
+            *link = c->next;
+        } else {
+            link = &c->next;
+        }
+    }
+
+    ht_destroy(used);
+    ht_destroy(reachable);
+    return program;
+}
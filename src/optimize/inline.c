@@ -0,0 +1,515 @@
+#include "optimize.h"
+
+/**********************************************************************
+ *                              ORDERING                              *
+ **********************************************************************/
+
+void inline_program(call_node* graph) {
+    int num_funcs = 0;
+    for (call_node* node = graph; node != NULL; node = node->next) {
+        node->scc = -1;
+        node->index = -1;
+        node->on_stack = false;
+        num_funcs++;
+    }
+
+    call_node** stack = malloc(sizeof(*stack) * (num_funcs + 1));
+    int depth = 0;
+    int index = 0;
+    for (call_node* node = graph; node != NULL; node = node->next) {
+        if (node->index < 0) inline_scc(node, &stack, &depth, &index);
+    }
+    free(stack);
+}
+
+void inline_scc(call_node* node, call_node*** stack, int* depth, int* index) {
+    /* Tarjan's algorithm, which completes each component only after every
+     * component it calls into, giving the bottom-up order we want */
+    node->index = node->lowlink = (*index)++;
+    (*stack)[(*depth)++] = node;
+    node->on_stack = true;
+
+    for (call_edge* edge = node->calls; edge != NULL; edge = edge->next) {
+        call_node* callee = edge->callee;
+        if (callee->index < 0) {
+            inline_scc(callee, stack, depth, index);
+            if (callee->lowlink < node->lowlink) node->lowlink = callee->lowlink;
+        } else if (callee->on_stack && callee->index < node->lowlink) {
+            node->lowlink = callee->index;
+        }
+    }
+
+    if (node->lowlink != node->index) return;
+
+    /* `node` is the root of a component; pop it off the stack: */
+    int first = *depth;
+    do {
+        first--;
+        (*stack)[first]->on_stack = false;
+        (*stack)[first]->scc = node->index;
+    } while ((*stack)[first] != node);
+
+    ht* funcs = ht_create();
+    for (int i = first; i < *depth; i++) {
+        for (call_edge* e = (*stack)[i]->calls; e != NULL; e = e->next) {
+            ht_set(funcs, e->callee->symbol->name, e->callee);
+        }
+    }
+    for (int i = first; i < *depth; i++) {
+        inline_func((*stack)[i], funcs);
+    }
+    ht_destroy(funcs);
+
+    *depth = first;
+}
+
+void inline_func(call_node* caller, ht* funcs) {
+    int count;
+    cfg_node** nodes = cfg_nodes(caller->func->value.cfg_node, &count);
+
+    for (int i = 0; i < count; i++) {
+        cfg_node* node = nodes[i];
+        if (node->kind == CFG_BRANCH) {
+            inline_exprs(caller, funcs, node->value.branch->condition);
+        }
+        /* the rest of a split block may have more calls to inline: */
+        while (node && node->kind == CFG_BLOCK) {
+            node = inline_block(caller, funcs, node);
+        }
+    }
+    free(nodes);
+}
+
+/**********************************************************************
+ *                             COST MODEL                             *
+ **********************************************************************/
+
+int inline_size(cfg_node* entry) {
+    int count;
+    cfg_node** nodes = cfg_nodes(entry, &count);
+
+    int size = count;
+    for (int i = 0; i < count; i++) {
+        if (nodes[i]->kind == CFG_BLOCK) {
+            size += inline_stmt_size(nodes[i]->value.block->stmt);
+        } else if (nodes[i]->kind == CFG_BRANCH) {
+            size += inline_expr_size(nodes[i]->value.branch->condition);
+        }
+    }
+    free(nodes);
+    return size;
+}
+
+int inline_stmt_size(stmt* s) {
+    if (!s) return 0;
+
+    int size = 1 + inline_stmt_size(s->next);
+    switch (s->kind) {
+        case STMT_DECL:
+            return size + inline_expr_size(s->decl->value);
+        case STMT_BLOCK:
+            return size + inline_stmt_size(s->body);
+        default:
+            return size + inline_expr_size(s->expr);
+    }
+}
+
+int inline_expr_size(expr* e) {
+    if (!e) return 0;
+    return 1 + inline_expr_size(e->left) + inline_expr_size(e->right);
+}
+
+call_node* inline_candidate(call_node* caller, ht* funcs, expr* call) {
+    call_node* callee = ht_get(funcs, call->left->name);
+    /* no body, or recursion: */
+    if (!callee || callee->scc == caller->scc) return NULL;
+
+    int size = inline_size(callee->func->value.cfg_node);
+    if (size <= INLINE_TINY) return callee;
+    if (callee->num_callers == 1 && size <= INLINE_SINGLE_CALLER) return callee;
+    return NULL;
+}
+
+/**********************************************************************
+ *                         EXPRESSION INLINING                        *
+ **********************************************************************/
+
+void inline_exprs(call_node* caller, ht* funcs, expr* e) {
+    if (!e) return;
+
+    inline_exprs(caller, funcs, e->left);
+    inline_exprs(caller, funcs, e->right);
+
+    if (e->kind == EXPR_FUN_CALL) {
+        call_node* callee = inline_candidate(caller, funcs, e);
+        if (callee && inline_expr_call(e, callee)) {
+            fprintf(
+                stderr,
+                "note: inlined `%s` into `%s`\n",
+                callee->symbol->name,
+                caller->symbol->name
+            );
+        }
+    }
+}
+
+bool inline_expr_call(expr* call, call_node* callee) {
+    cfg_node* entry = callee->func->value.cfg_node;
+    if (entry->kind != CFG_BLOCK) return false;
+    stmt* ret = entry->value.block->stmt;
+    if (!ret || ret->kind != STMT_RETURN || ret->next) return false;
+
+    /* arguments are substituted where the parameters are used, so they
+     * must be safe to evaluate in a different place and number of times */
+    bool pure = expr_is_pure(ret->expr);
+    ht* args = ht_create();
+    param_list* param = callee->symbol->type->params;
+    bool ok = true;
+    for (expr* arg = call->right; param && arg; arg = arg->right) {
+        expr* value = arg->left;
+        bool assigned = false;
+        int uses = inline_param_uses(ret->expr, param->symbol, &assigned);
+        bool leaf = value->kind == EXPR_IDENT || value->kind >= EXPR_BOOL_LIT;
+        if (
+            assigned
+            || (!leaf && (uses > 1 || !pure || !expr_is_pure(value)))
+            || (!pure && value->kind == EXPR_IDENT
+                && value->symbol->kind == SYMBOL_GLOBAL)
+        ) {
+            ok = false;
+            break;
+        }
+        ht_set(args, ptr_key(param->symbol), value);
+        param = param->next;
+    }
+
+    if (ok) {
+        expr* body = inline_substitute(ret->expr, args);
+        *call = *body;
+        free(body);
+    }
+    ht_destroy(args);
+    return ok;
+}
+
+expr* inline_substitute(expr* e, ht* args) {
+    if (!e) return NULL;
+
+    /* (arguments belong to the caller, so substituting into them copies
+     * them without changing anything) */
+    expr* arg = e->kind == EXPR_IDENT && e->symbol ?
+        ht_get(args, ptr_key(e->symbol)) : NULL;
+    if (arg) return inline_substitute(arg, args);
+
+    expr* copy = malloc(sizeof(*copy));
+    *copy = *e;
+    copy->left = inline_substitute(copy->left, args);
+    copy->right = inline_substitute(copy->right, args);
+    return copy;
+}
+
+int inline_param_uses(expr* e, symbol* param, bool* assigned) {
+    if (!e) return 0;
+
+    if (
+        (e->kind == EXPR_ASSIGN || e->kind == EXPR_INC || e->kind == EXPR_DEC)
+        && e->left->symbol == param
+    ) {
+        *assigned = true;
+    }
+
+    int uses = e->kind == EXPR_IDENT && e->symbol == param ? 1 : 0;
+    return uses
+        + inline_param_uses(e->left, param, assigned)
+        + inline_param_uses(e->right, param, assigned);
+}
+
+/**********************************************************************
+ *                           BLOCK INLINING                           *
+ **********************************************************************/
+
+cfg_node* inline_block(call_node* caller, ht* funcs, cfg_node* block) {
+    stmt* prev = NULL;
+    for (stmt* s = block->value.block->stmt; s != NULL; prev = s, s = s->next) {
+        inline_exprs(
+            caller,
+            funcs,
+            s->kind == STMT_DECL ? s->decl->value : s->expr
+        );
+
+        expr* call = inline_first_call(s);
+        if (!call) continue;
+        call_node* callee = inline_candidate(caller, funcs, call);
+        if (!callee) continue;
+
+        symbol* func = caller->func->symbol;
+        ht* symbols = ht_create();
+
+        /* the call's value goes through a new local, unless unused: */
+        symbol* result = NULL;
+        bool whole = s->kind == STMT_EXPR && s->expr == call;
+        if (!whole) {
+            result = inline_local(
+                func,
+                callee->symbol->type->subtype,
+                callee->symbol->name
+            );
+        }
+
+        /* the rest of the statements continue after the inlined body: */
+        cfg_node* rest = cfg_block_node(whole ? s->next : s);
+        rest->value.block->next = block->value.block->next;
+
+        /* evaluate the arguments into the new parameters: */
+        stmt* args = NULL;
+        stmt** tail = &args;
+        param_list* param = callee->symbol->type->params;
+        for (expr* arg = call->right; param && arg; arg = arg->right) {
+            expr* target = expr_ident(param->name);
+            target->symbol = inline_symbol(param->symbol, func, symbols);
+            *tail = stmt_expr(expr_binary(EXPR_ASSIGN, target, arg->left), NULL);
+            tail = &(*tail)->next;
+            param = param->next;
+        }
+        *tail = NULL;
+
+        if (prev) {
+            prev->next = args;
+        } else {
+            block->value.block->stmt = args;
+        }
+        block->value.block->next = inline_clone(
+            callee,
+            func,
+            symbols,
+            result,
+            rest
+        );
+        ht_destroy(symbols);
+
+        if (result) {
+            /* the call itself becomes a use of its result: */
+            call->kind = EXPR_IDENT;
+            call->name = (char*)result->name;
+            call->symbol = result;
+            call->left = NULL;
+            call->right = NULL;
+        }
+
+        fprintf(
+            stderr,
+            "note: inlined `%s` into `%s`\n",
+            callee->symbol->name,
+            caller->symbol->name
+        );
+        return rest;
+    }
+    return NULL;
+}
+
+expr* inline_first_call(stmt* s) {
+    expr* e;
+    switch (s->kind) {
+        case STMT_DECL:
+            e = s->decl->value;
+            break;
+        case STMT_EXPR:     __attribute__((fallthrough));
+        case STMT_PRINT:    __attribute__((fallthrough));
+        case STMT_RETURN:
+            e = s->expr;
+            break;
+        default:
+            return NULL;
+    }
+
+    bool safe = true;
+    expr* call = inline_find_call(e, &safe, false);
+    return safe ? call : NULL;
+}
+
+expr* inline_find_call(expr* e, bool* safe, bool conditional) {
+    if (!e) return NULL;
+
+    /* Walks `e` in the order codegen evaluates it. Moving the call ahead of
+     * whatever is evaluated before it is only safe if none of that has side
+     * effects or reads globals the call might change, and the call is sure
+     * to happen. */
+    expr* call;
+    switch (e->kind) {
+        case EXPR_FUN_CALL:
+            call = inline_find_call(e->right, safe, conditional);
+            if (call) return call;
+            if (conditional) *safe = false;
+            return e;
+        case EXPR_ASSIGN:
+            return inline_find_call(e->right, safe, conditional);
+        case EXPR_AND:      __attribute__((fallthrough));
+        case EXPR_OR:
+            call = inline_find_call(e->left, safe, conditional);
+            if (call) return call;
+            return inline_find_call(e->right, safe, true);
+        case EXPR_INC:      __attribute__((fallthrough));
+        case EXPR_DEC:      __attribute__((fallthrough));
+        case EXPR_ARRAY:
+            *safe = false;
+            return NULL;
+        case EXPR_IDENT:
+            if (e->symbol && e->symbol->kind == SYMBOL_GLOBAL) *safe = false;
+            __attribute__((fallthrough));
+        default:
+            call = inline_find_call(e->left, safe, conditional);
+            if (call) return call;
+            return inline_find_call(e->right, safe, conditional);
+    }
+}
+
+cfg_node* inline_clone(
+    call_node* callee,
+    symbol* caller,
+    ht* symbols,
+    symbol* result,
+    cfg_node* rest
+) {
+    int count;
+    cfg_node** nodes = cfg_nodes(callee->func->value.cfg_node, &count);
+
+    ht* clones = ht_create();
+    for (int i = 0; i < count; i++) {
+        /* returning means carrying on with the rest of the caller: */
+        cfg_node* clone = nodes[i]->kind == CFG_BRANCH ?
+            cfg_branch_node(NULL) : cfg_block_node(NULL);
+        ht_set(clones, ptr_key(nodes[i]), clone);
+    }
+
+    for (int i = 0; i < count; i++) {
+        cfg_node* node = nodes[i];
+        cfg_node* clone = ht_get(clones, ptr_key(node));
+        switch (node->kind) {
+            case CFG_BLOCK:
+                clone->value.block->stmt = inline_clone_stmt(
+                    node->value.block->stmt,
+                    caller,
+                    symbols,
+                    result
+                );
+                clone->value.block->next = node->value.block->next ?
+                    ht_get(clones, ptr_key(node->value.block->next)) : rest;
+                break;
+            case CFG_BRANCH:
+                clone->value.branch->condition = inline_clone_expr(
+                    node->value.branch->condition,
+                    caller,
+                    symbols
+                );
+                clone->value.branch->loop = node->value.branch->loop;
+                cfg_set_true(
+                    clone,
+                    ht_get(clones, ptr_key(node->value.branch->true_branch))
+                );
+                cfg_set_false(
+                    clone,
+                    ht_get(clones, ptr_key(node->value.branch->false_branch))
+                );
+                break;
+            case CFG_RETURN:
+                clone->value.block->next = rest;
+                break;
+        }
+    }
+
+    cfg_node* entry = ht_get(clones, ptr_key(nodes[0]));
+    ht_destroy(clones);
+    free(nodes);
+    return entry;
+}
+
+stmt* inline_clone_stmt(stmt* s, symbol* caller, ht* symbols, symbol* result) {
+    if (!s) return NULL;
+
+    stmt* next = inline_clone_stmt(s->next, caller, symbols, result);
+    stmt* copy;
+    switch (s->kind) {
+        case STMT_DECL: {
+            decl* d = decl_variable(
+                s->decl->name,
+                s->decl->type,
+                inline_clone_expr(s->decl->value, caller, symbols),
+                NULL
+            );
+            d->symbol = inline_symbol(s->decl->symbol, caller, symbols);
+            copy = stmt_decl(d, next);
+            break;
+        }
+        case STMT_BLOCK:
+            copy = stmt_block(
+                inline_clone_stmt(s->body, caller, symbols, result),
+                next
+            );
+            break;
+        case STMT_RETURN: {
+            /* hand the value back through the result instead: */
+            expr* value = inline_clone_expr(s->expr, caller, symbols);
+            if (result) {
+                expr* target = expr_ident((char*)result->name);
+                target->symbol = result;
+                copy = stmt_expr(
+                    expr_binary(EXPR_ASSIGN, target, value),
+                    next
+                );
+            } else if (value && !expr_is_pure(value)) {
+                copy = stmt_expr(value, next);
+            } else {
+                copy = next;
+            }
+            break;
+        }
+        default:
+            copy = stmt_create(
+                s->kind,
+                NULL,
+                NULL,
+                inline_clone_expr(s->expr, caller, symbols),
+                NULL,
+                NULL,
+                NULL,
+                next
+            );
+            break;
+    }
+    return copy;
+}
+
+expr* inline_clone_expr(expr* e, symbol* caller, ht* symbols) {
+    if (!e) return NULL;
+
+    expr* copy = malloc(sizeof(*copy));
+    *copy = *e;
+    copy->left = inline_clone_expr(e->left, caller, symbols);
+    copy->right = inline_clone_expr(e->right, caller, symbols);
+    if (e->symbol && e->symbol->kind != SYMBOL_GLOBAL) {
+        copy->symbol = inline_symbol(e->symbol, caller, symbols);
+    }
+    return copy;
+}
+
+symbol* inline_symbol(symbol* s, symbol* caller, ht* symbols) {
+    symbol* local = ht_get(symbols, ptr_key(s));
+    if (!local) {
+        local = inline_local(caller, s->type, s->name);
+        ht_set(symbols, ptr_key(s), local);
+    }
+    return local;
+}
+
+symbol* inline_local(symbol* caller, type* type, const char* name) {
+    symbol* local = symbol_create(SYMBOL_LOCAL, type, (char*)name);
+    local->which = caller->stack_size++;
+    return local;
+}
+
+const char* ptr_key(const void* p) {
+    /* only needs to live until `ht_set()` copies it or `ht_get()` returns */
+    static char key[2 * sizeof(p) + 3];
+    snprintf(key, sizeof(key), "%p", p);
+    return key;
+}
@@ -0,0 +1,494 @@
+#include "optimize.h"
+
+/**********************************************************************
+ *                        INDUCTION VARIABLES                         *
+ **********************************************************************/
+
+void iv_program(cfg* program) {
+    for (cfg* p = program; p != NULL; p = p->next) {
+        if (p->kind == FUNC) iv_func(p);
+    }
+}
+
+void iv_func(cfg* func) {
+    int count;
+    cfg_node** nodes = cfg_nodes(func->value.cfg_node, &count);
+
+    loop* loops = NULL;
+    licm_find_loops(
+        func->value.cfg_node,
+        ++cfg_pass_count,
+        nodes,
+        count,
+        &loops
+    );
+    free(nodes);
+
+    int number = 0;
+    for (loop* l = loops; l != NULL; l = l->next) {
+        iv_loop(func, l, loops, ++number);
+    }
+
+    for (loop* l = loops; l != NULL;) {
+        loop* next = l->next;
+        ht_destroy(l->body);
+        free(l);
+        l = next;
+    }
+}
+
+void iv_loop(cfg* func, loop* l, loop* loops, int number) {
+    int count;
+    cfg_node** nodes = licm_body(func, l, &count);
+
+    /* what the loop writes, and how often: */
+    ht* writes = ht_create();
+    bool calls = false;
+    for (int i = 0; i < count; i++) {
+        if (nodes[i]->kind == CFG_BLOCK) {
+            iv_writes_stmt(nodes[i]->value.block->stmt, writes, &calls);
+        } else if (nodes[i]->kind == CFG_BRANCH) {
+            iv_writes_expr(nodes[i]->value.branch->condition, writes, &calls);
+        }
+    }
+    licm_state invariant = {
+        .func = func,
+        .written = writes,
+        .calls = calls,
+    };
+
+    /* Basic induction variables are locals the loop changes in exactly one
+     * place, by a statement of its own adding a constant to them. */
+    iv_state state = {
+        .func = func,
+        .invariant = &invariant,
+        .derived = NULL,
+    };
+    for (int i = 0; i < count; i++) {
+        if (nodes[i]->kind != CFG_BLOCK) continue;
+
+        for (stmt* s = nodes[i]->value.block->stmt; s != NULL; s = s->next) {
+            int step;
+            symbol* base = iv_basic(s, &step);
+            if (!base || (intptr_t)ht_get(writes, ptr_key(base)) != 1) {
+                continue;
+            }
+
+            state.base = base;
+            state.step = step;
+            state.update = s;
+            state.derived = NULL;
+            for (int j = 0; j < count; j++) iv_reduce_node(nodes[j], &state);
+            if (!state.derived) continue;
+
+            iv_finish(l, loops, nodes, count, &state, number);
+        }
+    }
+
+    ht_destroy(writes);
+    free(nodes);
+}
+
+symbol* iv_basic(stmt* s, int* step) {
+    if (s->kind != STMT_EXPR) return NULL;
+
+    expr* e = s->expr;
+    symbol* base = e->left ? e->left->symbol : NULL;
+    if (!base || base->kind == SYMBOL_GLOBAL) return NULL;
+    if (base->type->kind != TYPE_INTEGER) return NULL;
+
+    switch (e->kind) {
+        case EXPR_INC:
+            *step = 1;
+            return base;
+        case EXPR_DEC:
+            *step = -1;
+            return base;
+        case EXPR_ASSIGN: {
+            /* `i = i + c`, `i = c + i`, or `i = i - c` */
+            expr* r = e->right;
+            if (r->kind != EXPR_ADD && r->kind != EXPR_SUB) return NULL;
+            if (!r->left) return NULL;
+            expr* other;
+            if (r->left->kind == EXPR_IDENT && r->left->symbol == base) {
+                other = r->right;
+            } else if (
+                r->kind == EXPR_ADD
+                && r->right->kind == EXPR_IDENT
+                && r->right->symbol == base
+            ) {
+                other = r->left;
+            } else {
+                return NULL;
+            }
+            if (other->kind != EXPR_INT_LIT) return NULL;
+            *step = r->kind == EXPR_ADD ? other->value : -other->value;
+            return base;
+        }
+        default:
+            return NULL;
+    }
+}
+
+void iv_writes_stmt(stmt* s, ht* writes, bool* calls) {
+    if (!s) return;
+
+    switch (s->kind) {
+        case STMT_DECL:
+            iv_write(writes, s->decl->symbol);
+            iv_writes_expr(s->decl->value, writes, calls);
+            break;
+        case STMT_BLOCK:
+            iv_writes_stmt(s->body, writes, calls);
+            break;
+        case STMT_VECTOR:
+            iv_write(writes, s->init_expr->symbol);
+            iv_write(writes, s->next_expr->left->symbol);
+            break;
+        default:
+            iv_writes_expr(s->expr, writes, calls);
+            break;
+    }
+    iv_writes_stmt(s->next, writes, calls);
+}
+
+void iv_writes_expr(expr* e, ht* writes, bool* calls) {
+    if (!e) return;
+
+    switch (e->kind) {
+        case EXPR_ASSIGN:   __attribute__((fallthrough));
+        case EXPR_INC:      __attribute__((fallthrough));
+        case EXPR_DEC:
+            iv_write(writes, e->left->symbol);
+            break;
+        case EXPR_FUN_CALL:
+            *calls = true;
+            break;
+        default:
+            break;
+    }
+    iv_writes_expr(e->left, writes, calls);
+    iv_writes_expr(e->right, writes, calls);
+}
+
+void iv_write(ht* writes, symbol* s) {
+    intptr_t n = (intptr_t)ht_get(writes, ptr_key(s));
+    ht_set(writes, ptr_key(s), (void*)(n + 1));
+}
+
+/**********************************************************************
+ *                         STRENGTH REDUCTION                         *
+ **********************************************************************/
+
+void iv_reduce_node(cfg_node* node, iv_state* state) {
+    if (node->kind == CFG_BRANCH) {
+        iv_reduce(node->value.branch->condition, state);
+        return;
+    }
+    if (node->kind != CFG_BLOCK) return;
+
+    for (stmt* s = node->value.block->stmt; s != NULL; s = s->next) {
+        /* (the update reads the variable, but is the one place it's
+         * allowed to, and the derived variables' own updates follow it) */
+        if (s == state->update) continue;
+        iv_reduce_stmt(s, state);
+    }
+}
+
+void iv_reduce_stmt(stmt* s, iv_state* state) {
+    switch (s->kind) {
+        case STMT_DECL:
+            iv_reduce(s->decl->value, state);
+            break;
+        case STMT_BLOCK:
+            for (stmt* p = s->body; p != NULL; p = p->next) {
+                iv_reduce_stmt(p, state);
+            }
+            break;
+        case STMT_VECTOR:
+            /* (codegen steps through the arrays itself) */
+            break;
+        default:
+            iv_reduce(s->expr, state);
+            break;
+    }
+}
+
+void iv_reduce(expr* e, iv_state* state) {
+    if (!e) return;
+
+    /* (a checked index needs the array and index to check, not a pointer) */
+    if (
+        e->kind == EXPR_INDEX
+        && !e->checked
+        && e->left->kind == EXPR_IDENT
+        && licm_invariant(e->left, state->invariant)
+        && iv_is_base(e->right, state)
+    ) {
+        /* `a[i]` is `*p` for `p` stepping through `a` alongside `i`, or
+         * `p[0]` (which needs no scaling) since `p` keeps the array type */
+        derived* d = iv_derive(state, e->left->symbol, 8);
+        e->left = tail_ident(d->symbol);
+        e->right = expr_int_lit(0);
+        return;
+    }
+
+    if (e->kind == EXPR_MUL && e->left) {
+        expr* scale = NULL;
+        if (iv_is_base(e->left, state)) scale = e->right;
+        if (iv_is_base(e->right, state)) scale = e->left;
+        if (scale && scale->kind == EXPR_INT_LIT) {
+            /* `i * k` steps by `k` times as much as `i` does */
+            derived* d = iv_derive(state, NULL, scale->value);
+            e->kind = EXPR_IDENT;
+            e->name = (char*)d->symbol->name;
+            e->symbol = d->symbol;
+            e->left = NULL;
+            e->right = NULL;
+            return;
+        }
+    }
+
+    iv_reduce(e->left, state);
+    iv_reduce(e->right, state);
+}
+
+bool iv_is_base(expr* e, iv_state* state) {
+    return e && e->kind == EXPR_IDENT && e->symbol == state->base;
+}
+
+derived* iv_derive(iv_state* state, symbol* array, int scale) {
+    for (derived* d = state->derived; d != NULL; d = d->next) {
+        if (d->array == array && d->scale == scale) return d;
+    }
+
+    derived* d = malloc(sizeof(*d));
+    d->array = array;
+    d->scale = scale;
+    d->symbol = inline_local(
+        state->func->symbol,
+        array ? array->type : type_create(TYPE_INTEGER, 0, 0, 0),
+        array ? array->name : state->base->name
+    );
+    d->next = state->derived;
+    state->derived = d;
+    return d;
+}
+
+expr* iv_value(derived* d, expr* base) {
+    /* what `d` is when the basic variable is `base`: */
+    expr* scaled = expr_binary(EXPR_MUL, base, expr_int_lit(d->scale));
+    if (!d->array) return scaled;
+    return expr_binary(EXPR_ADD, tail_ident(d->array), scaled);
+}
+
+void iv_finish(
+    loop* l,
+    loop* loops,
+    cfg_node** nodes,
+    int count,
+    iv_state* state,
+    int number
+) {
+    cfg* func = state->func;
+    cfg_node* preheader = licm_preheader(func, l, loops);
+    stmt** init = &preheader->value.block->stmt;
+
+    /* start each derived variable off from the basic one's value on entry,
+     * and step it right after the basic one: */
+    for (derived* d = state->derived; d != NULL; d = d->next) {
+        *init = stmt_expr(
+            expr_binary(
+                EXPR_ASSIGN,
+                tail_ident(d->symbol),
+                iv_value(d, tail_ident(state->base))
+            ),
+            NULL
+        );
+        init = &(*init)->next;
+
+        stmt* update = state->update;
+        update->next = stmt_expr(
+            expr_binary(
+                EXPR_ASSIGN,
+                tail_ident(d->symbol),
+                expr_binary(
+                    EXPR_ADD,
+                    tail_ident(d->symbol),
+                    expr_int_lit(d->scale * state->step)
+                )
+            ),
+            update->next
+        );
+
+        fprintf(stderr, "note: strength-reduced `");
+        fprint_expr(stderr, iv_value(d, tail_ident(state->base)));
+        fprintf(
+            stderr,
+            "` to a running %s in loop %d of `%s`\n",
+            d->array ? "pointer" : "sum",
+            number,
+            func->symbol->name
+        );
+    }
+
+    if (!iv_replace_test(l, state, init)) return;
+    fprintf(
+        stderr,
+        "note: replaced the test of `%s` in loop %d of `%s`\n",
+        state->base->name,
+        number,
+        func->symbol->name
+    );
+
+    /* the basic variable can go if nothing else wants its value: */
+    for (int i = 0; i < count; i++) {
+        if (iv_reads_node(nodes[i], state)) return;
+    }
+    int pass = ++cfg_pass_count;
+    for (int i = 0; i < count; i++) {
+        cfg_node* succ[2];
+        int n = cfg_successors(nodes[i], succ);
+        for (int j = 0; j < n; j++) {
+            /* (wherever the loop exits to) */
+            if (
+                succ[j] && !ht_get(l->body, ptr_key(succ[j]))
+                && iv_live(succ[j], pass, state)
+            ) {
+                return;
+            }
+        }
+    }
+
+    /* the first derived update follows it, so take that one's place: */
+    *state->update = *state->update->next;
+    fprintf(
+        stderr,
+        "note: eliminated induction variable `%s` from loop %d of `%s`\n",
+        state->base->name,
+        number,
+        func->symbol->name
+    );
+}
+
+bool iv_replace_test(loop* l, iv_state* state, stmt** init) {
+    if (l->header->kind != CFG_BRANCH) return false;
+
+    expr* cond = l->header->value.branch->condition;
+    switch (cond->kind) {
+        case EXPR_EQ:       __attribute__((fallthrough));
+        case EXPR_N_EQ:     __attribute__((fallthrough));
+        case EXPR_LESS:     __attribute__((fallthrough));
+        case EXPR_L_EQ:     __attribute__((fallthrough));
+        case EXPR_GREATER:  __attribute__((fallthrough));
+        case EXPR_G_EQ:
+            break;
+        default:
+            return false;
+    }
+
+    expr** var;
+    expr** limit;
+    if (iv_is_base(cond->left, state)) {
+        var = &cond->left;
+        limit = &cond->right;
+    } else if (iv_is_base(cond->right, state)) {
+        var = &cond->right;
+        limit = &cond->left;
+    } else {
+        return false;
+    }
+    if (!licm_invariant(*limit, state->invariant)) return false;
+
+    /* Scaling both sides by the same positive amount keeps the comparison
+     * the same, so test a derived variable against the limit scaled the
+     * same way (worked out once, before the loop) instead. Pointers come
+     * first: the point is usually to leave nothing but the pointer. */
+    derived* by = NULL;
+    for (derived* d = state->derived; d != NULL; d = d->next) {
+        if (d->scale > 0 && (!by || (d->array && !by->array))) by = d;
+    }
+    if (!by) return false;
+
+    symbol* end = inline_local(
+        state->func->symbol,
+        by->symbol->type,
+        "limit"
+    );
+    *init = stmt_expr(
+        expr_binary(EXPR_ASSIGN, tail_ident(end), iv_value(by, *limit)),
+        NULL
+    );
+
+    *var = tail_ident(by->symbol);
+    *limit = tail_ident(end);
+    return true;
+}
+
+bool iv_reads_node(cfg_node* node, iv_state* state) {
+    if (node->kind == CFG_BRANCH) {
+        return iv_reads(node->value.branch->condition, state->base);
+    }
+    if (node->kind != CFG_BLOCK) return false;
+
+    for (stmt* s = node->value.block->stmt; s != NULL; s = s->next) {
+        if (s == state->update) continue;
+        if (iv_reads_stmt(s, state->base)) return true;
+    }
+    return false;
+}
+
+bool iv_reads_stmt(stmt* s, symbol* base) {
+    switch (s->kind) {
+        case STMT_DECL:
+            return iv_reads(s->decl->value, base);
+        case STMT_BLOCK:
+            for (stmt* p = s->body; p != NULL; p = p->next) {
+                if (iv_reads_stmt(p, base)) return true;
+            }
+            return false;
+        case STMT_VECTOR:
+            return iv_reads(s->init_expr, base)
+                || iv_reads(s->expr, base)
+                || iv_reads(s->next_expr, base);
+        default:
+            return iv_reads(s->expr, base);
+    }
+}
+
+bool iv_reads(expr* e, symbol* base) {
+    if (!e) return false;
+    /* (writing it isn't reading it) */
+    if (e->kind == EXPR_ASSIGN) return iv_reads(e->right, base);
+    if (e->kind == EXPR_IDENT) return e->symbol == base;
+    return iv_reads(e->left, base) || iv_reads(e->right, base);
+}
+
+bool iv_live(cfg_node* node, int pass, iv_state* state) {
+    /* true if the variable's value may be read from `node` on, before
+     * anything assigns it a new one */
+    if (!node || node->mark == pass) return false;
+    node->mark = pass;
+
+    if (node->kind == CFG_BRANCH) {
+        if (iv_reads(node->value.branch->condition, state->base)) return true;
+    } else if (node->kind == CFG_BLOCK) {
+        for (stmt* s = node->value.block->stmt; s != NULL; s = s->next) {
+            if (iv_reads_stmt(s, state->base)) return true;
+            if (
+                s->kind == STMT_EXPR
+                && s->expr->kind == EXPR_ASSIGN
+                && s->expr->left->symbol == state->base
+            ) {
+                return false;
+            }
+        }
+    }
+
+    cfg_node* succ[2];
+    int n = cfg_successors(node, succ);
+    for (int i = 0; i < n; i++) {
+        if (iv_live(succ[i], pass, state)) return true;
+    }
+    return false;
+}
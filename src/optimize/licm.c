@@ -0,0 +1,384 @@
+#include "optimize.h"
+
+/**********************************************************************
+ *                               LOOPS                                *
+ **********************************************************************/
+
+void licm_program(cfg* program) {
+    for (cfg* p = program; p != NULL; p = p->next) {
+        if (p->kind == FUNC) licm_func(p);
+    }
+}
+
+void licm_func(cfg* func) {
+    int count;
+    cfg_node** nodes = cfg_nodes(func->value.cfg_node, &count);
+
+    loop* loops = NULL;
+    licm_find_loops(
+        func->value.cfg_node,
+        ++cfg_pass_count,
+        nodes,
+        count,
+        &loops
+    );
+
+    /* inner loops first, so what they hoist can carry on out of the loops
+     * around them; an inner loop is always smaller than one containing it */
+    int num_loops = 0;
+    for (loop* l = loops; l != NULL; l = l->next) num_loops++;
+    loop** order = malloc(sizeof(*order) * (num_loops + 1));
+    int i = 0;
+    for (loop* l = loops; l != NULL; l = l->next) order[i++] = l;
+    for (int j = 1; j < num_loops; j++) {
+        for (int k = j; k > 0 && order[k]->size < order[k - 1]->size; k--) {
+            loop* tmp = order[k];
+            order[k] = order[k - 1];
+            order[k - 1] = tmp;
+        }
+    }
+
+    for (int j = 0; j < num_loops; j++) {
+        licm_loop(func, order[j], loops, j + 1);
+    }
+
+    for (loop* l = loops; l != NULL;) {
+        loop* next = l->next;
+        ht_destroy(l->body);
+        free(l);
+        l = next;
+    }
+    free(order);
+    free(nodes);
+}
+
+void licm_find_loops(
+    cfg_node* node,
+    int pass,
+    cfg_node** nodes,
+    int count,
+    loop** loops
+) {
+    if (!node || node->mark == pass) return;
+
+    node->mark = pass;
+    node->on_stack = true;
+
+    cfg_node* succ[2];
+    int n = cfg_successors(node, succ);
+    for (int i = 0; i < n; i++) {
+        if (succ[i] && succ[i]->on_stack) {
+            /* a back edge, closing a loop headed by `succ[i]` */
+            licm_add_loop(loops, succ[i], node, nodes, count);
+        } else {
+            licm_find_loops(succ[i], pass, nodes, count, loops);
+        }
+    }
+
+    node->on_stack = false;
+}
+
+void licm_add_loop(
+    loop** loops,
+    cfg_node* header,
+    cfg_node* latch,
+    cfg_node** nodes,
+    int count
+) {
+    /* several back edges to the same header make up one loop: */
+    loop* l = *loops;
+    while (l && l->header != header) l = l->next;
+    if (!l) {
+        l = malloc(sizeof(*l));
+        l->header = header;
+        l->body = ht_create();
+        l->size = 1;
+        l->preheader = NULL;
+        ht_set(l->body, ptr_key(header), header);
+        l->next = *loops;
+        *loops = l;
+    }
+    if (!ht_get(l->body, ptr_key(latch))) {
+        ht_set(l->body, ptr_key(latch), latch);
+        l->size++;
+    }
+
+    /* The natural loop is everything that can reach the back edge without
+     * going through the header: grow it backwards until nothing changes. */
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 0; i < count; i++) {
+            if (ht_get(l->body, ptr_key(nodes[i]))) continue;
+
+            cfg_node* succ[2];
+            int n = cfg_successors(nodes[i], succ);
+            for (int j = 0; j < n; j++) {
+                if (
+                    succ[j] && succ[j] != header
+                    && ht_get(l->body, ptr_key(succ[j]))
+                ) {
+                    ht_set(l->body, ptr_key(nodes[i]), nodes[i]);
+                    l->size++;
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/**********************************************************************
+ *                               HOISTING                             *
+ **********************************************************************/
+
+void licm_loop(cfg* func, loop* l, loop* loops, int number) {
+    ht* written = ht_create();
+    bool calls = false;
+
+    int count;
+    cfg_node** nodes = licm_body(func, l, &count);
+    for (int i = 0; i < count; i++) {
+        if (nodes[i]->kind == CFG_BLOCK) {
+            licm_writes_stmt(nodes[i]->value.block->stmt, written, &calls);
+        } else if (nodes[i]->kind == CFG_BRANCH) {
+            licm_writes_expr(nodes[i]->value.branch->condition, written, &calls);
+        }
+    }
+
+    licm_state state = {
+        .func = func,
+        .written = written,
+        .calls = calls,
+        .hoisted = NULL,
+        .tail = NULL,
+    };
+    state.tail = &state.hoisted;
+    for (int i = 0; i < count; i++) {
+        if (nodes[i]->kind == CFG_BLOCK) {
+            licm_hoist_stmt(nodes[i]->value.block->stmt, &state);
+        } else if (nodes[i]->kind == CFG_BRANCH) {
+            licm_hoist(nodes[i]->value.branch->condition, &state);
+        }
+    }
+    free(nodes);
+    ht_destroy(written);
+
+    if (!state.hoisted) return;
+
+    cfg_node* preheader = licm_preheader(func, l, loops);
+    preheader->value.block->stmt = state.hoisted;
+
+    for (stmt* s = state.hoisted; s != NULL; s = s->next) {
+        fprintf(stderr, "note: hoisted `");
+        fprint_expr(stderr, s->expr->right);
+        fprintf(
+            stderr,
+            "` out of loop %d in `%s`\n",
+            number,
+            func->symbol->name
+        );
+    }
+}
+
+cfg_node** licm_body(cfg* func, loop* l, int* count) {
+    /* (in graph order rather than the table's, to keep output stable) */
+    int num_nodes;
+    cfg_node** nodes = cfg_nodes(func->value.cfg_node, &num_nodes);
+
+    *count = 0;
+    for (int i = 0; i < num_nodes; i++) {
+        if (ht_get(l->body, ptr_key(nodes[i]))) nodes[(*count)++] = nodes[i];
+    }
+    return nodes;
+}
+
+cfg_node* licm_preheader(cfg* func, loop* l, loop* loops) {
+    cfg_node* preheader = cfg_block_node(NULL);
+    preheader->value.block->next = l->header;
+
+    /* every way into the loop from outside now goes through here: */
+    int count;
+    cfg_node** nodes = cfg_nodes(func->value.cfg_node, &count);
+    for (int i = 0; i < count; i++) {
+        cfg_node* node = nodes[i];
+        if (ht_get(l->body, ptr_key(node))) continue;
+
+        if (node->kind == CFG_BLOCK) {
+            if (node->value.block->next == l->header) {
+                node->value.block->next = preheader;
+            }
+        } else if (node->kind == CFG_BRANCH) {
+            cfg_branch* branch = node->value.branch;
+            if (branch->true_branch == l->header) {
+                branch->true_branch = preheader;
+            }
+            if (branch->false_branch == l->header) {
+                branch->false_branch = preheader;
+            }
+        }
+    }
+    free(nodes);
+    if (func->value.cfg_node == l->header) {
+        func->value.cfg_node = preheader;
+    }
+
+    /* and belongs to the loops around this one: */
+    for (loop* outer = loops; outer != NULL; outer = outer->next) {
+        if (outer != l && ht_get(outer->body, ptr_key(l->header))) {
+            ht_set(outer->body, ptr_key(preheader), preheader);
+            outer->size++;
+        }
+    }
+
+    l->preheader = preheader;
+    return preheader;
+}
+
+void licm_writes_stmt(stmt* s, ht* written, bool* calls) {
+    if (!s) return;
+
+    switch (s->kind) {
+        case STMT_DECL:
+            /* (declared again on each iteration) */
+            ht_set(written, ptr_key(s->decl->symbol), s->decl->symbol);
+            licm_writes_expr(s->decl->value, written, calls);
+            break;
+        case STMT_BLOCK:
+            licm_writes_stmt(s->body, written, calls);
+            break;
+        case STMT_VECTOR: {
+            symbol* index = s->init_expr->symbol;
+            symbol* acc = s->next_expr->left->symbol;
+            ht_set(written, ptr_key(index), index);
+            ht_set(written, ptr_key(acc), acc);
+            break;
+        }
+        default:
+            licm_writes_expr(s->expr, written, calls);
+            break;
+    }
+    licm_writes_stmt(s->next, written, calls);
+}
+
+void licm_writes_expr(expr* e, ht* written, bool* calls) {
+    if (!e) return;
+
+    switch (e->kind) {
+        case EXPR_ASSIGN:   __attribute__((fallthrough));
+        case EXPR_INC:      __attribute__((fallthrough));
+        case EXPR_DEC:
+            ht_set(written, ptr_key(e->left->symbol), e->left->symbol);
+            break;
+        case EXPR_FUN_CALL:
+            *calls = true;
+            break;
+        default:
+            break;
+    }
+    licm_writes_expr(e->left, written, calls);
+    licm_writes_expr(e->right, written, calls);
+}
+
+bool licm_invariant(expr* e, licm_state* state) {
+    if (!e) return true;
+
+    switch (e->kind) {
+        case EXPR_BOOL_LIT:     __attribute__((fallthrough));
+        case EXPR_CHAR_LIT:     __attribute__((fallthrough));
+        case EXPR_INT_LIT:
+            return true;
+        case EXPR_IDENT:
+            /* a call may change any global */
+            if (e->symbol->kind == SYMBOL_GLOBAL && state->calls) return false;
+            return !ht_get(state->written, ptr_key(e->symbol));
+        case EXPR_ADD:          __attribute__((fallthrough));
+        case EXPR_SUB:          __attribute__((fallthrough));
+        case EXPR_MUL:          __attribute__((fallthrough));
+        case EXPR_AND:          __attribute__((fallthrough));
+        case EXPR_OR:           __attribute__((fallthrough));
+        case EXPR_EQ:           __attribute__((fallthrough));
+        case EXPR_N_EQ:         __attribute__((fallthrough));
+        case EXPR_LESS:         __attribute__((fallthrough));
+        case EXPR_L_EQ:         __attribute__((fallthrough));
+        case EXPR_GREATER:      __attribute__((fallthrough));
+        case EXPR_G_EQ:         __attribute__((fallthrough));
+        case EXPR_NOT:
+            return licm_invariant(e->left, state)
+                && licm_invariant(e->right, state);
+        default:
+            /* Anything else either has side effects, or could fault (like
+             * division by zero) if evaluated ahead of the test guarding it.
+             * Hoisted code runs even when the loop body never does. */
+            return false;
+    }
+}
+
+void licm_hoist_stmt(stmt* s, licm_state* state) {
+    if (!s) return;
+
+    switch (s->kind) {
+        case STMT_DECL:
+            licm_hoist(s->decl->value, state);
+            break;
+        case STMT_BLOCK:
+            licm_hoist_stmt(s->body, state);
+            break;
+        default:
+            licm_hoist(s->expr, state);
+            break;
+    }
+    licm_hoist_stmt(s->next, state);
+}
+
+void licm_hoist(expr* e, licm_state* state) {
+    if (!e) return;
+
+    switch (e->kind) {
+        case EXPR_IDENT:        __attribute__((fallthrough));
+        case EXPR_BOOL_LIT:     __attribute__((fallthrough));
+        case EXPR_CHAR_LIT:     __attribute__((fallthrough));
+        case EXPR_INT_LIT:      __attribute__((fallthrough));
+        case EXPR_STR_LIT:
+            /* already as cheap as loading it from a temporary */
+            return;
+        case EXPR_ASSIGN:       __attribute__((fallthrough));
+        case EXPR_INC:          __attribute__((fallthrough));
+        case EXPR_DEC:
+            /* the target stays */
+            licm_hoist(e->right, state);
+            return;
+        default:
+            break;
+    }
+
+    if (!licm_invariant(e, state)) {
+        licm_hoist(e->left, state);
+        licm_hoist(e->right, state);
+        return;
+    }
+
+    /* compute it once before the loop, and use the result inside: */
+    bool boolean = e->kind != EXPR_ADD
+        && e->kind != EXPR_SUB
+        && e->kind != EXPR_MUL;
+    symbol* temp = inline_local(
+        state->func->symbol,
+        type_create(boolean ? TYPE_BOOLEAN : TYPE_INTEGER, 0, 0, 0),
+        "invariant"
+    );
+
+    expr* value = malloc(sizeof(*value));
+    *value = *e;
+    *state->tail = stmt_expr(
+        expr_binary(EXPR_ASSIGN, tail_ident(temp), value),
+        NULL
+    );
+    state->tail = &(*state->tail)->next;
+
+    e->kind = EXPR_IDENT;
+    e->name = (char*)temp->name;
+    e->symbol = temp;
+    e->left = NULL;
+    e->right = NULL;
+}
@@ -0,0 +1,233 @@
+#include "optimize.h"
+
+/**********************************************************************
+ *                       LOCAL VALUE NUMBERING                        *
+ **********************************************************************/
+
+void lvn_program(cfg* program) {
+    for (cfg* p = program; p != NULL; p = p->next) {
+        if (p->kind == FUNC) lvn_func(p);
+    }
+}
+
+void lvn_func(cfg* func) {
+    int count;
+    cfg_node** nodes = cfg_nodes(func->value.cfg_node, &count);
+
+    for (int i = 0; i < count; i++) {
+        if (nodes[i]->kind != CFG_BLOCK) continue;
+
+        /* nothing is known on entry to a block: */
+        lvn_state state = {
+            .func = func,
+            .vars = ht_create(),
+            .exprs = ht_create(),
+            .next_vn = 1,
+        };
+        for (stmt* s = nodes[i]->value.block->stmt; s != NULL; s = s->next) {
+            lvn_stmt(s, &state);
+        }
+        lvn_clear(state.vars);
+        lvn_clear(state.exprs);
+    }
+    free(nodes);
+}
+
+void lvn_clear(ht* table) {
+    ht_iter it = ht_iterate(table);
+    while (ht_next(&it)) free(it.value);
+    ht_destroy(table);
+}
+
+void lvn_stmt(stmt* s, lvn_state* state) {
+    switch (s->kind) {
+        case STMT_DECL:
+            lvn_expr(s->decl->value, state, false);
+            lvn_assign(s->decl->symbol, state);
+            break;
+        case STMT_BLOCK:
+            for (stmt* p = s->body; p != NULL; p = p->next) {
+                lvn_stmt(p, state);
+            }
+            break;
+        case STMT_VECTOR:
+            /* (the values are for codegen to load a vector at a time, not
+             * to share with anything) */
+            lvn_expr(s->expr, state, false);
+            lvn_assign(s->init_expr->symbol, state);
+            lvn_assign(s->next_expr->left->symbol, state);
+            break;
+        default:
+            lvn_expr(s->expr, state, false);
+            break;
+    }
+}
+
+int lvn_expr(expr* e, lvn_state* state, bool conditional) {
+    if (!e) return 0;
+
+    char key[64];
+    switch (e->kind) {
+        case EXPR_BOOL_LIT:     __attribute__((fallthrough));
+        case EXPR_CHAR_LIT:     __attribute__((fallthrough));
+        case EXPR_INT_LIT:
+            snprintf(key, sizeof(key), "%d:%d", e->kind, e->value);
+            return lvn_number(key, NULL, state, false)->vn;
+        case EXPR_STR_LIT:
+            snprintf(key, sizeof(key), "%d:%p", e->kind, (void*)e->str_value);
+            return lvn_number(key, NULL, state, false)->vn;
+        case EXPR_IDENT:
+            return lvn_var(e->symbol, state)->vn;
+        case EXPR_ASSIGN:
+            lvn_expr(e->right, state, conditional);
+            return lvn_assign(e->left->symbol, state);
+        case EXPR_INC:          __attribute__((fallthrough));
+        case EXPR_DEC:
+            lvn_expr(e->left, state, conditional);
+            return lvn_assign(e->left->symbol, state);
+        case EXPR_FUN_CALL: {
+            lvn_expr(e->right, state, conditional);
+            /* the callee may have changed any global: */
+            ht_iter it = ht_iterate(state->vars);
+            while (ht_next(&it)) {
+                lvn_value* var = it.value;
+                if (var->symbol->kind == SYMBOL_GLOBAL) {
+                    var->vn = state->next_vn++;
+                }
+            }
+            return state->next_vn++;
+        }
+        case EXPR_ARG:          __attribute__((fallthrough));
+        case EXPR_ARRAY:
+            lvn_expr(e->left, state, conditional);
+            lvn_expr(e->right, state, conditional);
+            return state->next_vn++;
+        default:
+            break;
+    }
+
+    /* The right side of `&&` and `||` doesn't always run, so nothing in it
+     * can be what later code reuses. */
+    int left = lvn_expr(e->left, state, conditional);
+    int right = lvn_expr(
+        e->right,
+        state,
+        conditional || e->kind == EXPR_AND || e->kind == EXPR_OR
+    );
+    if (
+        (e->kind == EXPR_ADD || e->kind == EXPR_MUL
+            || e->kind == EXPR_EQ || e->kind == EXPR_N_EQ)
+        && left > right
+    ) {
+        /* (commutative, so either order is the same value) */
+        int tmp = left;
+        left = right;
+        right = tmp;
+    }
+    snprintf(key, sizeof(key), "%d:%d:%d", e->kind, left, right);
+
+    lvn_value* value = ht_get(state->exprs, key);
+    if (!value) return lvn_number(key, e, state, conditional)->vn;
+    if (!value->first) return value->vn;
+
+    /* seen before: keep the first result in a temporary the first time
+     * it's needed again, and use that from then on */
+    if (!value->symbol) {
+        expr* first = value->first;
+        value->symbol = inline_local(
+            state->func->symbol,
+            lvn_type(first),
+            "value"
+        );
+        fprintf(stderr, "note: reusing `");
+        fprint_expr(stderr, first);
+        fprintf(stderr, "` in `%s`\n", state->func->symbol->name);
+
+        expr* copy = malloc(sizeof(*copy));
+        *copy = *first;
+        first->kind = EXPR_ASSIGN;
+        first->left = tail_ident(value->symbol);
+        first->right = copy;
+    }
+    e->kind = EXPR_IDENT;
+    e->name = (char*)value->symbol->name;
+    e->symbol = value->symbol;
+    e->left = NULL;
+    e->right = NULL;
+    return value->vn;
+}
+
+lvn_value* lvn_number(
+    const char* key,
+    expr* first,
+    lvn_state* state,
+    bool conditional
+) {
+    lvn_value* value = ht_get(state->exprs, key);
+    if (value) return value;
+
+    value = malloc(sizeof(*value));
+    value->vn = state->next_vn++;
+    value->first = conditional ? NULL : first;
+    value->symbol = NULL;
+    if (!conditional) ht_set(state->exprs, key, value);
+    return value;
+}
+
+lvn_value* lvn_var(symbol* s, lvn_state* state) {
+    lvn_value* var = ht_get(state->vars, ptr_key(s));
+    if (!var) {
+        var = malloc(sizeof(*var));
+        var->vn = state->next_vn++;
+        var->first = NULL;
+        var->symbol = s;
+        ht_set(state->vars, ptr_key(s), var);
+    }
+    return var;
+}
+
+int lvn_assign(symbol* s, lvn_state* state) {
+    /* a new value, so nothing computed from the old one matches it */
+    lvn_value* var = lvn_var(s, state);
+    var->vn = state->next_vn++;
+    return var->vn;
+}
+
+type* lvn_type(expr* e) {
+    switch (e->kind) {
+        case EXPR_AND:          __attribute__((fallthrough));
+        case EXPR_OR:           __attribute__((fallthrough));
+        case EXPR_NOT:          __attribute__((fallthrough));
+        case EXPR_EQ:           __attribute__((fallthrough));
+        case EXPR_N_EQ:         __attribute__((fallthrough));
+        case EXPR_LESS:         __attribute__((fallthrough));
+        case EXPR_L_EQ:         __attribute__((fallthrough));
+        case EXPR_GREATER:      __attribute__((fallthrough));
+        case EXPR_G_EQ:         __attribute__((fallthrough));
+        case EXPR_BOOL_LIT:
+            return type_create(TYPE_BOOLEAN, 0, 0, 0);
+        case EXPR_CHAR_LIT:
+            return type_create(TYPE_CHARACTER, 0, 0, 0);
+        case EXPR_STR_LIT:
+            return type_create(TYPE_STRING, 0, 0, 0);
+        case EXPR_INT_LIT:
+            return type_create(TYPE_INTEGER, 0, 0, 0);
+        case EXPR_IDENT:
+            return e->symbol->type;
+        case EXPR_ASSIGN:
+            return lvn_type(e->left);
+        case EXPR_INDEX:            __attribute__((fallthrough));
+        case EXPR_FUN_CALL:
+            return lvn_type(e->left)->subtype;
+        default: {
+            /* arithmetic, where a pointer stepped by strength reduction
+             * stays a pointer (with the array's type), whichever side of
+             * it the pointer is on */
+            type* left = e->left ? lvn_type(e->left) : NULL;
+            if (left && (left->kind == TYPE_ARRAY || !e->right)) return left;
+            return e->right ?
+                lvn_type(e->right) :
+                type_create(TYPE_INTEGER, 0, 0, 0);
+        }
+    }
+}
@@ -0,0 +1,564 @@
+#include "optimize.h"
+
+/**********************************************************************
+ *                        VALUE RANGE ANALYSIS                        *
+ **********************************************************************/
+
+void range_program(cfg* program) {
+    for (cfg* p = program; p != NULL; p = p->next) {
+        if (p->kind == FUNC) range_func(p);
+    }
+}
+
+void range_func(cfg* func) {
+    int count;
+    free(cfg_nodes(func->value.cfg_node, &count));
+    if (count == 0) return;
+
+    /* nodes are run in reverse postorder, which puts every node after
+     * those leading to it, except along the edges going back around loops */
+    cfg_node** nodes = malloc(count * sizeof(*nodes));
+    int first = count;
+    range_order(func->value.cfg_node, ++cfg_pass_count, nodes, &first);
+
+    range_state state = {
+        .func = func,
+        .vars = ht_create(),
+        .count = 0,
+        .nodes = ht_create(),
+        .in = calloc(count, sizeof(range*)),
+        .header = calloc(count, sizeof(bool)),
+        .grown = calloc(count, sizeof(int)),
+        .widen = true,
+        .edges = 0,
+        .mark = false,
+    };
+    int* index = malloc(count * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        index[i] = i;
+        ht_set(state.nodes, ptr_key(nodes[i]), &index[i]);
+        if (nodes[i]->kind == CFG_BRANCH) {
+            range_vars_expr(nodes[i]->value.branch->condition, &state);
+        } else if (nodes[i]->kind == CFG_BLOCK) {
+            range_vars_stmt(nodes[i]->value.block->stmt, &state);
+        }
+    }
+    /* every loop has an edge going back to its header, so widening at
+     * those is enough to stop any of them going around forever: */
+    for (int i = 0; i < count; i++) {
+        cfg_node* succ[2];
+        int n = cfg_successors(nodes[i], succ);
+        for (int j = 0; j < n; j++) {
+            if (!succ[j]) continue;
+            int target = *(int*)ht_get(state.nodes, ptr_key(succ[j]));
+            if (target <= i) state.header[target] = true;
+        }
+    }
+
+    /* nothing is known about anything on entry: */
+    state.in[0] = range_copy(NULL, state.count);
+
+    /* run every reached node until nothing grows any more, widening what
+     * keeps growing at a header (as a loop counter would, once per
+     * iteration): */
+    do {
+        state.changed = false;
+        for (int i = 0; i < count; i++) {
+            state.current = i;
+            if (state.in[i]) range_node(nodes[i], state.in[i], &state);
+        }
+    } while (state.changed);
+
+    /* Widening overshoots: `i` in `for (i = 0; i < 10; i++)` is anything
+     * from 0 up at the loop test. Running every node again on what the
+     * nodes before it now give (and the last round's ranges along edges
+     * going back) gives ranges no wider, and often narrower, that still
+     * hold; here `i` is in [0, 10] again, and 10 after the loop. */
+    state.widen = false;
+    for (int round = 0; round < RANGE_NARROW; round++) {
+        range** in = state.in;
+        state.in = calloc(count, sizeof(range*));
+        state.in[0] = range_copy(NULL, state.count);
+        state.edges = -1;
+        for (int i = 0; i < count; i++) {
+            state.current = i;
+            if (in[i]) range_node(nodes[i], in[i], &state);
+        }
+        state.edges = 1;
+        for (int i = 0; i < count; i++) {
+            state.current = i;
+            if (state.in[i]) range_node(nodes[i], state.in[i], &state);
+        }
+        for (int i = 0; i < count; i++) free(in[i]);
+        free(in);
+    }
+
+    /* finally, decide on each index (checking every one of those in code
+     * that's never reached, as if nothing were known there): */
+    state.mark = true;
+    for (int i = 0; i < count; i++) {
+        range* vars = range_copy(state.in[i], state.count);
+        range_node(nodes[i], vars, &state);
+        free(vars);
+    }
+
+    for (int i = 0; i < count; i++) free(state.in[i]);
+    free(state.in);
+    free(state.header);
+    free(state.grown);
+    free(index);
+    ht_iter it = ht_iterate(state.vars);
+    while (ht_next(&it)) free(it.value);
+    ht_destroy(state.vars);
+    ht_destroy(state.nodes);
+    free(nodes);
+}
+
+void range_order(cfg_node* node, int pass, cfg_node** order, int* first) {
+    if (!node || node->mark == pass) return;
+
+    node->mark = pass;
+    cfg_node* succ[2];
+    int n = cfg_successors(node, succ);
+    /* (the false side first, so that the true side comes first) */
+    for (int i = n - 1; i >= 0; i--) range_order(succ[i], pass, order, first);
+    order[--*first] = node;
+}
+
+void range_vars_stmt(stmt* s, range_state* state) {
+    for (; s != NULL; s = s->next) {
+        switch (s->kind) {
+            case STMT_DECL:
+                range_slot(s->decl->symbol, state);
+                range_vars_expr(s->decl->value, state);
+                break;
+            case STMT_BLOCK:
+                range_vars_stmt(s->body, state);
+                break;
+            default:
+                range_vars_expr(s->expr, state);
+                break;
+        }
+    }
+}
+
+void range_vars_expr(expr* e, range_state* state) {
+    if (!e) return;
+
+    if (e->kind == EXPR_IDENT) range_slot(e->symbol, state);
+    range_vars_expr(e->left, state);
+    range_vars_expr(e->right, state);
+}
+
+int range_slot(symbol* s, range_state* state) {
+    /* (a call can change any global, so those aren't worth tracking) */
+    if (
+        !s
+        || s->kind == SYMBOL_GLOBAL
+        || s->type->kind != TYPE_INTEGER
+    ) {
+        return -1;
+    }
+
+    int* slot = ht_get(state->vars, ptr_key(s));
+    if (!slot) {
+        /* slots are only handed out before any ranges exist */
+        if (state->in && state->in[0]) return -1;
+        slot = malloc(sizeof(*slot));
+        *slot = state->count++;
+        ht_set(state->vars, ptr_key(s), slot);
+    }
+    return *slot;
+}
+
+void range_node(cfg_node* node, range* vars, range_state* state) {
+    if (node->kind == CFG_RETURN) return;
+
+    range* out = range_copy(vars, state->count);
+    if (node->kind == CFG_BLOCK) {
+        range_stmt(node->value.block->stmt, out, state);
+        range_send(node->value.block->next, out, state);
+        free(out);
+        return;
+    }
+
+    /* each side of a branch knows which way the condition went: */
+    expr* cond = node->value.branch->condition;
+    range_expr(cond, out, state);
+    range* taken = range_copy(out, state->count);
+    if (range_refine(cond, true, taken, state)) {
+        range_send(node->value.branch->true_branch, taken, state);
+    }
+    if (range_refine(cond, false, out, state)) {
+        range_send(node->value.branch->false_branch, out, state);
+    }
+    free(taken);
+    free(out);
+}
+
+void range_send(cfg_node* target, range* vars, range_state* state) {
+    /* (the epilogue, or only deciding on checks) */
+    if (!target || state->mark) return;
+
+    int i = *(int*)ht_get(state->nodes, ptr_key(target));
+    if (state->edges < 0 && i > state->current) return;
+    if (state->edges > 0 && i <= state->current) return;
+    range* in = state->in[i];
+    if (!in) {
+        state->in[i] = range_copy(vars, state->count);
+        state->changed = true;
+        return;
+    }
+
+    bool grew = false;
+    bool widen = state->widen
+        && state->header[i]
+        && state->grown[i] >= RANGE_WIDEN;
+    for (int v = 0; v < state->count; v++) {
+        range joined = range_join(in[v], vars[v]);
+        if (joined.lo < in[v].lo) {
+            in[v].lo = widen ? LLONG_MIN : joined.lo;
+            grew = true;
+        }
+        if (joined.hi > in[v].hi) {
+            in[v].hi = widen ? LLONG_MAX : joined.hi;
+            grew = true;
+        }
+    }
+    if (grew) {
+        state->grown[i]++;
+        state->changed = true;
+    }
+}
+
+void range_stmt(stmt* s, range* vars, range_state* state) {
+    for (; s != NULL; s = s->next) {
+        switch (s->kind) {
+            case STMT_DECL: {
+                range r = range_expr(s->decl->value, vars, state);
+                int slot = range_slot(s->decl->symbol, state);
+                /* (without a value, a local holds whatever was there) */
+                if (slot >= 0) vars[slot] = s->decl->value ? r : range_full();
+                break;
+            }
+            case STMT_BLOCK:
+                range_stmt(s->body, vars, state);
+                break;
+            default:
+                range_expr(s->expr, vars, state);
+                break;
+        }
+    }
+}
+
+range range_expr(expr* e, range* vars, range_state* state) {
+    if (!e) return range_full();
+
+    switch (e->kind) {
+        case EXPR_BOOL_LIT:     __attribute__((fallthrough));
+        case EXPR_CHAR_LIT:     __attribute__((fallthrough));
+        case EXPR_INT_LIT:
+            return (range){e->value, e->value};
+        case EXPR_IDENT: {
+            int slot = range_slot(e->symbol, state);
+            return slot >= 0 ? vars[slot] : range_full();
+        }
+        case EXPR_ASSIGN: {
+            range r = range_expr(e->right, vars, state);
+            int slot = range_slot(e->left->symbol, state);
+            if (slot >= 0) vars[slot] = r;
+            return r;
+        }
+        case EXPR_INC:          __attribute__((fallthrough));
+        case EXPR_DEC: {
+            int slot = range_slot(e->left->symbol, state);
+            if (slot < 0) return range_full();
+            range step = {1, 1};
+            vars[slot] = e->kind == EXPR_INC ?
+                range_add(vars[slot], step) : range_sub(vars[slot], step);
+            return vars[slot];
+        }
+        case EXPR_AND:          __attribute__((fallthrough));
+        case EXPR_OR: {
+            /* the right side may or may not run: */
+            range_expr(e->left, vars, state);
+            range* right = range_copy(vars, state->count);
+            range_expr(e->right, right, state);
+            for (int v = 0; v < state->count; v++) {
+                vars[v] = range_join(vars[v], right[v]);
+            }
+            free(right);
+            return (range){0, 1};
+        }
+        case EXPR_INDEX: {
+            range_expr(e->left, vars, state);
+            range r = range_expr(e->right, vars, state);
+            if (state->mark) range_check(e, r, state);
+            return range_full();
+        }
+        default:
+            break;
+    }
+
+    /* otherwise, operands are evaluated left to right: */
+    range left = range_expr(e->left, vars, state);
+    range right = range_expr(e->right, vars, state);
+    switch (e->kind) {
+        case EXPR_ADD:
+            return range_add(left, right);
+        case EXPR_SUB:
+            return range_sub(left, right);
+        case EXPR_MUL:
+            return range_mul(left, right);
+        case EXPR_DIV:
+            return range_div(left, right);
+        case EXPR_MOD:
+            return range_mod(left, right);
+        case EXPR_EQ:           __attribute__((fallthrough));
+        case EXPR_N_EQ:         __attribute__((fallthrough));
+        case EXPR_LESS:         __attribute__((fallthrough));
+        case EXPR_L_EQ:         __attribute__((fallthrough));
+        case EXPR_GREATER:      __attribute__((fallthrough));
+        case EXPR_G_EQ:         __attribute__((fallthrough));
+        case EXPR_NOT:
+            return (range){0, 1};
+        default:
+            /* calls, powers, arrays, strings */
+            return range_full();
+    }
+}
+
+bool range_refine(expr* cond, bool sense, range* vars, range_state* state) {
+    /* Only conditions without side effects: otherwise what's compared may
+     * not be what the variables hold afterwards. */
+    if (!expr_is_pure(cond)) return true;
+
+    switch (cond->kind) {
+        case EXPR_NOT:
+            return range_refine(cond->left, !sense, vars, state);
+        case EXPR_AND:          __attribute__((fallthrough));
+        case EXPR_OR: {
+            /* `a && b` being true means both are, as `a || b` being false
+             * means neither is; otherwise it's one of two ways: */
+            if (sense == (cond->kind == EXPR_AND)) {
+                return range_refine(cond->left, sense, vars, state)
+                    && range_refine(cond->right, sense, vars, state);
+            }
+            range* other = range_copy(vars, state->count);
+            bool first = range_refine(cond->left, sense, vars, state);
+            bool second = range_refine(cond->left, !sense, other, state)
+                && range_refine(cond->right, sense, other, state);
+            for (int v = 0; v < state->count; v++) {
+                if (!first) vars[v] = other[v];
+                else if (second) vars[v] = range_join(vars[v], other[v]);
+            }
+            free(other);
+            return first || second;
+        }
+        case EXPR_EQ:           __attribute__((fallthrough));
+        case EXPR_N_EQ:         __attribute__((fallthrough));
+        case EXPR_LESS:         __attribute__((fallthrough));
+        case EXPR_L_EQ:         __attribute__((fallthrough));
+        case EXPR_GREATER:      __attribute__((fallthrough));
+        case EXPR_G_EQ:
+            break;
+        default:
+            return true;
+    }
+
+    /* the comparison that holds, and the same one seen from the right: */
+    expr_t op = cond->kind;
+    if (!sense) {
+        switch (op) {
+            case EXPR_EQ:       op = EXPR_N_EQ;     break;
+            case EXPR_N_EQ:     op = EXPR_EQ;       break;
+            case EXPR_LESS:     op = EXPR_G_EQ;     break;
+            case EXPR_L_EQ:     op = EXPR_GREATER;  break;
+            case EXPR_GREATER:  op = EXPR_L_EQ;     break;
+            default:            op = EXPR_LESS;     break;
+        }
+    }
+    expr_t swapped;
+    switch (op) {
+        case EXPR_LESS:     swapped = EXPR_GREATER; break;
+        case EXPR_L_EQ:     swapped = EXPR_G_EQ;    break;
+        case EXPR_GREATER:  swapped = EXPR_LESS;    break;
+        case EXPR_G_EQ:     swapped = EXPR_L_EQ;    break;
+        default:            swapped = op;           break;
+    }
+
+    /* (evaluated again only for their ranges, not to decide on indexes) */
+    bool mark = state->mark;
+    state->mark = false;
+    range left = range_expr(cond->left, vars, state);
+    range right = range_expr(cond->right, vars, state);
+    state->mark = mark;
+
+    return range_constrain(cond->left, op, right, vars, state)
+        && range_constrain(cond->right, swapped, left, vars, state);
+}
+
+bool range_constrain(
+    expr* e,
+    expr_t op,
+    range r,
+    range* vars,
+    range_state* state
+) {
+    if (e->kind != EXPR_IDENT) return true;
+    int slot = range_slot(e->symbol, state);
+    if (slot < 0) return true;
+
+    range* v = &vars[slot];
+    switch (op) {
+        case EXPR_LESS:
+            if (r.hi == LLONG_MIN) return false;
+            if (r.hi - 1 < v->hi) v->hi = r.hi - 1;
+            break;
+        case EXPR_L_EQ:
+            if (r.hi < v->hi) v->hi = r.hi;
+            break;
+        case EXPR_GREATER:
+            if (r.lo == LLONG_MAX) return false;
+            if (r.lo + 1 > v->lo) v->lo = r.lo + 1;
+            break;
+        case EXPR_G_EQ:
+            if (r.lo > v->lo) v->lo = r.lo;
+            break;
+        case EXPR_EQ:
+            if (r.lo > v->lo) v->lo = r.lo;
+            if (r.hi < v->hi) v->hi = r.hi;
+            break;
+        case EXPR_N_EQ:
+            /* only a single value that's at one end can be taken off */
+            if (r.lo != r.hi) break;
+            if (v->lo == r.lo) {
+                if (v->lo == LLONG_MAX) return false;
+                v->lo++;
+            } else if (v->hi == r.hi) {
+                if (v->hi == LLONG_MIN) return false;
+                v->hi--;
+            }
+            break;
+        default:
+            break;
+    }
+    return v->lo <= v->hi;
+}
+
+void range_check(expr* index, range r, range_state* state) {
+    expr* array = index->left;
+    const char* func = state->func->symbol->name;
+    if (
+        array->kind != EXPR_IDENT
+        || array->symbol->type->kind != TYPE_ARRAY
+        || array->symbol->type->size <= 0
+    ) {
+        /* (like parameters, which are declared as `array []`) */
+        index->checked = false;
+        fprintf(stderr, "note: cannot check `");
+        fprint_expr(stderr, index);
+        fprintf(stderr, "` in `%s`, not knowing the length of `", func);
+        fprint_expr(stderr, array);
+        fprintf(stderr, "`\n");
+        return;
+    }
+
+    long long length = array->symbol->type->size;
+    if (r.lo >= 0 && r.hi < length) {
+        index->checked = false;
+        fprintf(stderr, "note: removed bounds check of `");
+        fprint_expr(stderr, index);
+        fprintf(stderr, "` in `%s`\n", func);
+        return;
+    }
+
+    index->checked = true;
+    if (r.lo >= length || r.hi < 0) {
+        fprintf(stderr, "warning: `");
+        fprint_expr(stderr, index);
+        fprintf(
+            stderr,
+            "` in `%s` is always out of bounds (length %lld)\n",
+            func,
+            length
+        );
+    }
+}
+
+range range_full() {
+    return (range){LLONG_MIN, LLONG_MAX};
+}
+
+range range_join(range a, range b) {
+    return (range){
+        a.lo < b.lo ? a.lo : b.lo,
+        a.hi > b.hi ? a.hi : b.hi,
+    };
+}
+
+/* Arithmetic wraps around at 64 bits, so a result that could overflow
+ * could be anything at all. */
+
+range range_add(range a, range b) {
+    range r;
+    if (
+        __builtin_add_overflow(a.lo, b.lo, &r.lo)
+        || __builtin_add_overflow(a.hi, b.hi, &r.hi)
+    ) {
+        return range_full();
+    }
+    return r;
+}
+
+range range_sub(range a, range b) {
+    range r;
+    if (
+        __builtin_sub_overflow(a.lo, b.hi, &r.lo)
+        || __builtin_sub_overflow(a.hi, b.lo, &r.hi)
+    ) {
+        return range_full();
+    }
+    return r;
+}
+
+range range_mul(range a, range b) {
+    long long products[4];
+    if (
+        __builtin_mul_overflow(a.lo, b.lo, &products[0])
+        || __builtin_mul_overflow(a.lo, b.hi, &products[1])
+        || __builtin_mul_overflow(a.hi, b.lo, &products[2])
+        || __builtin_mul_overflow(a.hi, b.hi, &products[3])
+    ) {
+        return range_full();
+    }
+    range r = {products[0], products[0]};
+    for (int i = 1; i < 4; i++) {
+        r = range_join(r, (range){products[i], products[i]});
+    }
+    return r;
+}
+
+range range_div(range a, range b) {
+    /* only by a positive constant, which keeps the order of values */
+    if (b.lo != b.hi || b.lo <= 0) return range_full();
+    return (range){a.lo / b.lo, a.hi / b.lo};
+}
+
+range range_mod(range a, range b) {
+    /* only by a positive constant; the remainder takes the sign of `a` */
+    if (b.lo != b.hi || b.lo <= 0) return range_full();
+    long long max = b.lo - 1;
+    if (a.lo >= 0) return (range){0, a.hi < max ? a.hi : max};
+    if (a.hi <= 0) return (range){a.lo > -max ? a.lo : -max, 0};
+    return (range){-max, max};
+}
+
+range* range_copy(range* vars, int count) {
+    /* (at least one, since `malloc(0)` may give NULL) */
+    range* copy = malloc((count > 0 ? count : 1) * sizeof(range));
+    for (int v = 0; v < count; v++) {
+        copy[v] = vars ? vars[v] : range_full();
+    }
+    return copy;
+}
@@ -0,0 +1,236 @@
+#include "optimize.h"
+
+/**********************************************************************
+ *                           TAIL RECURSION                           *
+ **********************************************************************/
+
+void tail_program(cfg* program) {
+    for (cfg* p = program; p != NULL; p = p->next) {
+        if (p->kind == FUNC) tail_func(p);
+    }
+}
+
+void tail_func(cfg* func) {
+    int count;
+    cfg_node** nodes = cfg_nodes(func->value.cfg_node, &count);
+
+    /* find every `return` and what it does with recursion: */
+    int num_returns = 0;
+    tail_return* returns = malloc(sizeof(*returns) * count);
+    bool any_tail = false;
+    bool any_acc = false;
+    expr_t op = EXPR_ADD;
+    bool same_op = true;
+    for (int i = 0; i < count; i++) {
+        if (nodes[i]->kind != CFG_BLOCK) continue;
+
+        stmt* prev = NULL;
+        stmt* s = nodes[i]->value.block->stmt;
+        while (s && s->next) {
+            prev = s;
+            s = s->next;
+        }
+        if (!s || s->kind != STMT_RETURN) continue;
+
+        tail_return* r = &returns[num_returns++];
+        r->block = nodes[i];
+        r->prev = prev;
+        r->ret = s;
+        r->kind = tail_classify(func, s->expr, &r->call, &r->rest);
+        if (r->kind == TAIL_CALL) any_tail = true;
+        if (r->kind == TAIL_ACCUMULATE) {
+            if (any_acc && s->expr->kind != op) same_op = false;
+            op = s->expr->kind;
+            any_acc = true;
+        }
+    }
+    free(nodes);
+
+    /* An accumulator only works if every recursive step combines with it
+     * the same way. With one, each `return e` becomes `return acc op e`,
+     * and each `return x op f(...)` folds `x` into it and carries on. */
+    symbol* acc = NULL;
+    if (any_acc && same_op) {
+        acc = inline_local(
+            func->symbol,
+            func->symbol->type->subtype,
+            "accumulator"
+        );
+    }
+    if (!any_tail && !acc) {
+        free(returns);
+        return;
+    }
+
+    cfg_node* loop = func->value.cfg_node;
+    if (acc) {
+        /* start from the operation's identity, outside the loop: */
+        cfg_node* init = cfg_block_node(stmt_expr(
+            expr_binary(
+                EXPR_ASSIGN,
+                tail_ident(acc),
+                expr_int_lit(op == EXPR_MUL ? 1 : 0)
+            ),
+            NULL
+        ));
+        init->value.block->next = loop;
+        func->value.cfg_node = init;
+    }
+
+    for (int i = 0; i < num_returns; i++) {
+        tail_return* r = &returns[i];
+        stmt* replace;
+        if (r->kind == TAIL_CALL || (r->kind == TAIL_ACCUMULATE && acc)) {
+            replace = tail_assign_params(func, r->call->right);
+            if (r->kind == TAIL_ACCUMULATE) {
+                replace = stmt_expr(
+                    expr_binary(
+                        EXPR_ASSIGN,
+                        tail_ident(acc),
+                        expr_binary(op, tail_ident(acc), r->rest)
+                    ),
+                    replace
+                );
+            }
+            r->block->value.block->next = loop;
+        } else if (acc) {
+            r->ret->expr = expr_binary(op, tail_ident(acc), r->ret->expr);
+            continue;
+        } else {
+            continue;
+        }
+
+        if (r->prev) {
+            r->prev->next = replace;
+        } else {
+            r->block->value.block->stmt = replace;
+        }
+    }
+    free(returns);
+
+    if (acc) {
+        fprintf(
+            stderr,
+            "note: introduced an accumulator for the recursion in `%s`\n",
+            func->symbol->name
+        );
+    }
+    fprintf(
+        stderr,
+        "note: turned tail recursion in `%s` into a loop\n",
+        func->symbol->name
+    );
+}
+
+tail_t tail_classify(cfg* func, expr* e, expr** call, expr** rest) {
+    if (!e) return TAIL_NONE;
+
+    if (e->kind == EXPR_FUN_CALL && tail_is_self(func, e)) {
+        *call = e;
+        return TAIL_CALL;
+    }
+
+    if (
+        (e->kind == EXPR_ADD || e->kind == EXPR_MUL)
+        && func->symbol->type->subtype->kind == TYPE_INTEGER
+    ) {
+        /* `x op f(...)` or `f(...) op x`, where `x` doesn't recurse */
+        expr* l = e->left;
+        expr* r = e->right;
+        if (
+            l && l->kind == EXPR_FUN_CALL && tail_is_self(func, l)
+            && !tail_calls_self(func, r)
+            /* `x` is evaluated before the call once it's accumulated, so
+             * nothing the call does may affect it */
+            && tail_is_local(r)
+        ) {
+            *call = l;
+            *rest = r;
+            return TAIL_ACCUMULATE;
+        }
+        if (
+            r && r->kind == EXPR_FUN_CALL && tail_is_self(func, r)
+            && !tail_calls_self(func, l)
+        ) {
+            *call = r;
+            *rest = l;
+            return TAIL_ACCUMULATE;
+        }
+    }
+
+    return tail_calls_self(func, e) ? TAIL_BLOCKED : TAIL_NONE;
+}
+
+bool tail_is_self(cfg* func, expr* call) {
+    return strcmp(call->left->name, func->symbol->name) == 0;
+}
+
+bool tail_calls_self(cfg* func, expr* e) {
+    if (!e) return false;
+    if (e->kind == EXPR_FUN_CALL && tail_is_self(func, e)) return true;
+    return tail_calls_self(func, e->left) || tail_calls_self(func, e->right);
+}
+
+bool tail_is_local(expr* e) {
+    if (!e) return true;
+    if (!expr_is_pure(e)) return false;
+    if (e->kind == EXPR_IDENT && e->symbol->kind == SYMBOL_GLOBAL) return false;
+    return tail_is_local(e->left) && tail_is_local(e->right);
+}
+
+stmt* tail_assign_params(cfg* func, expr* args) {
+    /* All arguments are evaluated before any parameter changes. A
+     * parameter can be assigned directly if no later argument reads it;
+     * otherwise its value waits in a temporary until the end. */
+    stmt* head = NULL;
+    stmt** tail = &head;
+    stmt* deferred = NULL;
+    stmt** deferred_tail = &deferred;
+
+    param_list* param = func->symbol->type->params;
+    for (expr* arg = args; param && arg; arg = arg->right) {
+        expr* value = arg->left;
+        if (value->kind == EXPR_IDENT && value->symbol == param->symbol) {
+            /* passed along unchanged */
+            param = param->next;
+            continue;
+        }
+
+        bool read_later = false;
+        for (expr* later = arg->right; later; later = later->right) {
+            if (tail_reads(later->left, param->symbol)) read_later = true;
+        }
+
+        expr* target = tail_ident(param->symbol);
+        if (read_later) {
+            symbol* temp = inline_local(func->symbol, param->type, param->name);
+            *tail = stmt_expr(
+                expr_binary(EXPR_ASSIGN, tail_ident(temp), value),
+                NULL
+            );
+            *deferred_tail = stmt_expr(
+                expr_binary(EXPR_ASSIGN, target, tail_ident(temp)),
+                NULL
+            );
+            deferred_tail = &(*deferred_tail)->next;
+        } else {
+            *tail = stmt_expr(expr_binary(EXPR_ASSIGN, target, value), NULL);
+        }
+        tail = &(*tail)->next;
+        param = param->next;
+    }
+    *tail = deferred;
+    return head;
+}
+
+bool tail_reads(expr* e, symbol* s) {
+    if (!e) return false;
+    if (e->kind == EXPR_IDENT && e->symbol == s) return true;
+    return tail_reads(e->left, s) || tail_reads(e->right, s);
+}
+
+expr* tail_ident(symbol* s) {
+    expr* e = expr_ident((char*)s->name);
+    e->symbol = s;
+    return e;
+}
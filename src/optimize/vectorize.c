@@ -0,0 +1,360 @@
+#include "optimize.h"
+
+/**********************************************************************
+ *                           VECTORIZATION                            *
+ **********************************************************************/
+
+void vectorize_program(cfg* program) {
+    for (cfg* p = program; p != NULL; p = p->next) {
+        if (p->kind == FUNC) vectorize_func(p);
+    }
+}
+
+void vectorize_func(cfg* func) {
+    int count;
+    cfg_node** nodes = cfg_nodes(func->value.cfg_node, &count);
+
+    loop* loops = NULL;
+    licm_find_loops(
+        func->value.cfg_node,
+        ++cfg_pass_count,
+        nodes,
+        count,
+        &loops
+    );
+    free(nodes);
+
+    int number = 0;
+    for (loop* l = loops; l != NULL; l = l->next) {
+        vectorize_loop(func, l, loops, ++number);
+    }
+
+    for (loop* l = loops; l != NULL;) {
+        loop* next = l->next;
+        ht_destroy(l->body);
+        free(l);
+        l = next;
+    }
+}
+
+bool vectorize_loop(cfg* func, loop* l, loop* loops, int number) {
+    cfg_node* header = l->header;
+    if (header->kind != CFG_BRANCH || !header->value.branch->loop) {
+        return false;
+    }
+    /* (leaving the loop through its test, and nowhere else) */
+    if (ht_get(l->body, ptr_key(header->value.branch->false_branch))) {
+        return false;
+    }
+
+    int count;
+    cfg_node** nodes = licm_body(func, l, &count);
+
+    /* what the loop writes, and the one block going back to the header: */
+    ht* written = ht_create();
+    bool calls = false;
+    cfg_node* latch = NULL;
+    int latches = 0;
+    for (int i = 0; i < count; i++) {
+        if (nodes[i]->kind == CFG_BLOCK) {
+            licm_writes_stmt(nodes[i]->value.block->stmt, written, &calls);
+            if (nodes[i]->value.block->next == header) {
+                latch = nodes[i];
+                latches++;
+            }
+        } else if (nodes[i]->kind == CFG_BRANCH) {
+            licm_writes_expr(nodes[i]->value.branch->condition, written, &calls);
+        }
+    }
+    licm_state invariant = {
+        .func = func,
+        .written = written,
+        .calls = calls,
+    };
+
+    stmt* vector = NULL;
+    if (latches == 1 && !calls) {
+        vector = vectorize_match(header, latch, count, &invariant);
+    }
+    ht_destroy(written);
+    free(nodes);
+    if (!vector) return false;
+
+    /* the vectors go first, and the loop picks up where they left off: */
+    cfg_node* preheader = licm_preheader(func, l, loops);
+    preheader->value.block->stmt = vector;
+
+    expr* reduce = vector->next_expr;
+    fprintf(
+        stderr,
+        "note: vectorized loop %d of `%s`, ",
+        number,
+        func->symbol->name
+    );
+    switch (reduce->kind) {
+        case EXPR_LESS:     fprintf(stderr, "the minimum of `");   break;
+        case EXPR_GREATER:  fprintf(stderr, "the maximum of `");   break;
+        default:            fprintf(stderr, "the sum of `");       break;
+    }
+    fprint_expr(stderr, reduce->right);
+    fprintf(stderr, "` in `%s`\n", reduce->left->symbol->name);
+    return true;
+}
+
+stmt* vectorize_match(
+    cfg_node* header,
+    cfg_node* latch,
+    int count,
+    licm_state* invariant
+) {
+    /* the update of the index ends the loop: */
+    stmt* update = latch->value.block->stmt;
+    if (!update) return NULL;
+    stmt* before = NULL;
+    while (update->next) {
+        before = update;
+        update = update->next;
+    }
+    int step;
+    symbol* index = iv_basic(update, &step);
+    if (!index || step != 1) return NULL;
+
+    expr* reduce;
+    cfg_node* body = header->value.branch->true_branch;
+    if (count == 2 && body == latch) {
+        /* `s = s + value; i++` */
+        if (!before || before != latch->value.block->stmt) return NULL;
+        reduce = vectorize_sum(before, index, invariant);
+    } else if (count == 5 && body->kind == CFG_BRANCH) {
+        /* `if (value < m) m = value;` then `i++` on its own */
+        if (before) return NULL;
+        reduce = vectorize_extreme(body, latch, index, invariant);
+    } else {
+        return NULL;
+    }
+    if (!reduce) return NULL;
+
+    expr* limit = vectorize_limit(
+        header->value.branch->condition,
+        index,
+        invariant
+    );
+    if (!limit) return NULL;
+
+    return stmt_create(
+        STMT_VECTOR,
+        NULL,
+        tail_ident(index),
+        limit,
+        reduce,
+        NULL,
+        NULL,
+        NULL
+    );
+}
+
+expr* vectorize_sum(stmt* s, symbol* index, licm_state* invariant) {
+    if (s->kind != STMT_EXPR || s->expr->kind != EXPR_ASSIGN) return NULL;
+
+    symbol* acc = s->expr->left->symbol;
+    expr* r = s->expr->right;
+    if (r->kind != EXPR_ADD && r->kind != EXPR_SUB) return NULL;
+    if (!r->left) return NULL;
+
+    /* `s + value`, `value + s`, or `s - value` */
+    expr* value;
+    if (r->left->kind == EXPR_IDENT && r->left->symbol == acc) {
+        value = r->right;
+    } else if (
+        r->kind == EXPR_ADD
+        && r->right->kind == EXPR_IDENT
+        && r->right->symbol == acc
+    ) {
+        value = r->left;
+    } else {
+        return NULL;
+    }
+
+    int loads = 0;
+    int size = 0;
+    if (
+        acc->kind == SYMBOL_GLOBAL
+        || acc->type->kind != TYPE_INTEGER
+        || acc == index
+        || !vectorize_value(value, index, invariant, &loads, &size)
+        || loads == 0
+    ) {
+        return NULL;
+    }
+    return expr_binary(r->kind, tail_ident(acc), vectorize_copy(value));
+}
+
+expr* vectorize_extreme(
+    cfg_node* body,
+    cfg_node* latch,
+    symbol* index,
+    licm_state* invariant
+) {
+    /* the `if` keeps the new value when the test holds, and does nothing
+     * otherwise, either way going on to the update: */
+    cfg_branch* branch = body->value.branch;
+    cfg_node* keep = branch->true_branch;
+    cfg_node* skip = branch->false_branch;
+    if (
+        keep->kind != CFG_BLOCK
+        || skip->kind != CFG_BLOCK
+        || keep->value.block->next != latch
+        || skip->value.block->next != latch
+        || skip->value.block->stmt
+    ) {
+        return NULL;
+    }
+    stmt* s = keep->value.block->stmt;
+    if (
+        !s
+        || s->next
+        || s->kind != STMT_EXPR
+        || s->expr->kind != EXPR_ASSIGN
+    ) {
+        return NULL;
+    }
+    symbol* acc = s->expr->left->symbol;
+
+    /* `value < m` or `m > value` keeps a minimum, and the other way around a
+     * maximum; with integers, whether equal values are taken changes
+     * nothing */
+    expr* cond = branch->condition;
+    expr* value;
+    bool less;
+    switch (cond->kind) {
+        case EXPR_LESS:     __attribute__((fallthrough));
+        case EXPR_L_EQ:
+            less = true;
+            break;
+        case EXPR_GREATER:  __attribute__((fallthrough));
+        case EXPR_G_EQ:
+            less = false;
+            break;
+        default:
+            return NULL;
+    }
+    if (cond->right->kind == EXPR_IDENT && cond->right->symbol == acc) {
+        value = cond->left;
+    } else if (cond->left->kind == EXPR_IDENT && cond->left->symbol == acc) {
+        value = cond->right;
+        less = !less;
+    } else {
+        return NULL;
+    }
+
+    int loads = 0;
+    int size = 0;
+    if (
+        acc->kind == SYMBOL_GLOBAL
+        || acc->type->kind != TYPE_INTEGER
+        || acc == index
+        || !vectorize_same(value, s->expr->right)
+        || !vectorize_value(value, index, invariant, &loads, &size)
+        || loads == 0
+    ) {
+        return NULL;
+    }
+    return expr_binary(
+        less ? EXPR_LESS : EXPR_GREATER,
+        tail_ident(acc),
+        vectorize_copy(value)
+    );
+}
+
+expr* vectorize_limit(expr* cond, symbol* index, licm_state* invariant) {
+    /* `i < n`, `i <= n`, `n > i`, or `n >= i`, with `n` the same throughout
+     * (stopping short of `n + 1` for `<=`, which is fine even if that wraps
+     * around: no vectors run then, leaving everything to the loop) */
+    expr* limit;
+    bool inclusive;
+    switch (cond->kind) {
+        case EXPR_LESS:     __attribute__((fallthrough));
+        case EXPR_L_EQ:
+            if (cond->left->kind != EXPR_IDENT) return NULL;
+            if (cond->left->symbol != index) return NULL;
+            limit = cond->right;
+            inclusive = cond->kind == EXPR_L_EQ;
+            break;
+        case EXPR_GREATER:  __attribute__((fallthrough));
+        case EXPR_G_EQ:
+            if (cond->right->kind != EXPR_IDENT) return NULL;
+            if (cond->right->symbol != index) return NULL;
+            limit = cond->left;
+            inclusive = cond->kind == EXPR_G_EQ;
+            break;
+        default:
+            return NULL;
+    }
+    if (!licm_invariant(limit, invariant)) return NULL;
+
+    limit = vectorize_copy(limit);
+    if (inclusive) limit = expr_binary(EXPR_ADD, limit, expr_int_lit(1));
+    return limit;
+}
+
+bool vectorize_value(
+    expr* e,
+    symbol* index,
+    licm_state* invariant,
+    int* loads,
+    int* size
+) {
+    if (!e) return true;
+    if (++*size > VECTORIZE_MAX_SIZE) return false;
+
+    switch (e->kind) {
+        case EXPR_INDEX:
+            /* `x[i]`, for an array the loop leaves alone */
+            return e->left->kind == EXPR_IDENT
+                && e->left->symbol->type->kind == TYPE_ARRAY
+                && licm_invariant(e->left, invariant)
+                && e->right->kind == EXPR_IDENT
+                && e->right->symbol == index
+                && !e->checked
+                && ++*loads <= VECTORIZE_MAX_LOADS;
+        case EXPR_ADD:          __attribute__((fallthrough));
+        case EXPR_SUB:          __attribute__((fallthrough));
+        case EXPR_MUL:
+            /* (computed once and copied to every lane, if it can be) */
+            if (licm_invariant(e, invariant)) return true;
+            return vectorize_value(e->left, index, invariant, loads, size)
+                && vectorize_value(e->right, index, invariant, loads, size);
+        default:
+            /* anything else has to be the same on every iteration */
+            return licm_invariant(e, invariant);
+    }
+}
+
+bool vectorize_same(expr* a, expr* b) {
+    if (!a || !b) return a == b;
+    if (a->kind != b->kind) return false;
+
+    switch (a->kind) {
+        case EXPR_IDENT:
+            return a->symbol == b->symbol;
+        case EXPR_BOOL_LIT:     __attribute__((fallthrough));
+        case EXPR_CHAR_LIT:     __attribute__((fallthrough));
+        case EXPR_INT_LIT:
+            return a->value == b->value;
+        case EXPR_STR_LIT:
+            return a->str_value == b->str_value;
+        default:
+            return vectorize_same(a->left, b->left)
+                && vectorize_same(a->right, b->right);
+    }
+}
+
+expr* vectorize_copy(expr* e) {
+    if (!e) return NULL;
+
+    expr* copy = malloc(sizeof(*copy));
+    *copy = *e;
+    copy->left = vectorize_copy(e->left);
+    copy->right = vectorize_copy(e->right);
+    return copy;
+}
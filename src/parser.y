@@ -5,6 +5,8 @@
 decl* parser_result = 0;
 
 extern int yylineno;
+extern int yylex();
+int yyerror(char* s);
 %}
 
 %union {
@@ -109,6 +111,8 @@ decl        : id TOKEN_COLON data_type TOKEN_OP_ASSIGN expr TOKEN_SEMICOLON
                 { $$ = decl_function($1->name, $3, $5, 0); }
             | id TOKEN_COLON array_decl TOKEN_OP_ASSIGN expr TOKEN_SEMICOLON
                 { $$ = decl_variable($1->name, $3, $5, 0); }
+            | id TOKEN_COLON array_decl TOKEN_SEMICOLON
+                { $$ = decl_variable($1->name, $3, 0, 0); }
             | id TOKEN_COLON type TOKEN_SEMICOLON
                 { $$ = decl_prototype($1->name, $3, 0); }
             ;
@@ -225,10 +229,10 @@ args_list   : arg TOKEN_COMMA args_list
                 { $$ = 0; }
             ;
 
-arg         : id
-                { $$ = $1; }
-            | literal
-                { $$ = $1; }
+/* each argument wraps its expression in `left`, chaining to the next
+ * argument through `right` */
+arg         : expr
+                { $$ = expr_binary(EXPR_ARG, $1, 0); }
             ;
 
 literal     : TOKEN_LIT_CHAR
@@ -244,13 +248,11 @@ literal     : TOKEN_LIT_CHAR
             ;
 
 array       : TOKEN_CURLY_LEFT item item_list TOKEN_CURLY_RIGHT
-                { $$ = $2; $2->kind = EXPR_ARRAY; $2->right = $3; }
+                { $$ = expr_unary(EXPR_ARRAY, expr_binary(EXPR_ARG, $2, $3)); }
             ;
 
-item_list   : item TOKEN_COMMA item_list
-                { $$ = $1; $1->right = $3; }
-            | item
-                { $$ = $1; }
+item_list   : TOKEN_COMMA item item_list
+                { $$ = expr_binary(EXPR_ARG, $2, $3); }
             | /* epsilon */
                 { $$ = 0; }
             ;
@@ -311,6 +313,6 @@ print_item  : expr
 %%
 
 int yyerror(char* s) {
-    printf("[error] line %d: %s\n", yylineno, s);
+    fprintf(stderr, "[error] line %d: %s\n", yylineno, s);
     return 1;
 }
@@ -0,0 +1,263 @@
+#include "runtime.h"
+
+#define SYS_WRITE 1
+#define SYS_EXIT_GROUP 231
+#define EINTR 4
+#define STDOUT 1
+#define STDERR 2
+
+char bm_buffer[BM_BUFFER_SIZE];
+long bm_used = 0;
+
+/* "00", "01", ... "99", to convert numbers two digits at a time */
+const char bm_digit_pairs[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+/* the smallest number with `i + 1` digits, for `bm_count_digits()` */
+const unsigned long bm_powers_of_10[] = {
+    0,
+    10ul,
+    100ul,
+    1000ul,
+    10000ul,
+    100000ul,
+    1000000ul,
+    10000000ul,
+    100000000ul,
+    1000000000ul,
+    10000000000ul,
+    100000000000ul,
+    1000000000000ul,
+    10000000000000ul,
+    100000000000000ul,
+    1000000000000000ul,
+    10000000000000000ul,
+    100000000000000000ul,
+    1000000000000000000ul,
+    10000000000000000000ul,
+};
+
+/**********************************************************************
+ *                            ENTRY POINT                             *
+ **********************************************************************/
+
+/* The kernel starts the process with `%rsp` 16-byte aligned. `main()`'s
+ * return value becomes the exit status, once its output is written. */
+__asm__(
+    ".text\n"
+    ".globl _start\n"
+    "_start:\n"
+    "    XORL %ebp, %ebp\n"
+    "    ANDQ $-16, %rsp\n"
+    "    CALL main\n"
+    "    MOVQ %rax, %rdi\n"
+    "    CALL bm_exit\n"
+    "    HLT\n"
+);
+
+/**********************************************************************
+ *                            SYSTEM CALLS                            *
+ **********************************************************************/
+
+long bm_write(int fd, const char* s, long length) {
+    long res;
+    __asm__ volatile (
+        "SYSCALL"
+        : "=a" (res)
+        : "a" (SYS_WRITE), "D" ((long)fd), "S" (s), "d" (length)
+        : "rcx", "r11", "memory"
+    );
+    return res;
+}
+
+void bm_write_all(int fd, const char* s, long length) {
+    while (length > 0) {
+        long written = bm_write(fd, s, length);
+        if (written == -EINTR) continue;
+        /* (nowhere to report an error to; the output is lost) */
+        if (written <= 0) return;
+        s += written;
+        length -= written;
+    }
+}
+
+BM_ENTRY void bm_flush(void) {
+    bm_write_all(STDOUT, bm_buffer, bm_used);
+    bm_used = 0;
+}
+
+BM_ENTRY void bm_exit(long code) {
+    bm_flush();
+    __asm__ volatile (
+        "SYSCALL"
+        :
+        : "a" (SYS_EXIT_GROUP), "D" (code)
+        : "rcx", "r11", "memory"
+    );
+    __builtin_unreachable();
+}
+
+/**********************************************************************
+ *                               PRINT                                *
+ **********************************************************************/
+
+BM_ENTRY void bm_print_bytes(const char* s, long length) {
+    if (length > BM_BUFFER_SIZE - bm_used) {
+        bm_flush();
+        /* too big to buffer at all, so skip the copy: */
+        if (length > BM_BUFFER_SIZE) {
+            bm_write_all(STDOUT, s, length);
+            return;
+        }
+    }
+    bm_copy(bm_buffer + bm_used, s, length);
+    bm_used += length;
+}
+
+BM_ENTRY void bm_print_int(long n) {
+    /* room for the longest number, so digits go straight into the buffer: */
+    if (BM_BUFFER_SIZE - bm_used < BM_INT_MAX_LENGTH) bm_flush();
+
+    char* out = bm_buffer + bm_used;
+    /* (negated as unsigned, so the most negative value works too) */
+    unsigned long value = n < 0 ? -(unsigned long)n : (unsigned long)n;
+    if (n < 0) *out++ = '-';
+
+    /* digits are produced backwards, two at a time, from the end: */
+    int length = bm_count_digits(value);
+    char* p = out + length;
+    while (value >= 100) {
+        unsigned long quotient = bm_div100(value);
+        unsigned long pair = 2 * (value - 100 * quotient);
+        p -= 2;
+        p[0] = bm_digit_pairs[pair];
+        p[1] = bm_digit_pairs[pair + 1];
+        value = quotient;
+    }
+    if (value >= 10) {
+        p -= 2;
+        p[0] = bm_digit_pairs[2 * value];
+        p[1] = bm_digit_pairs[2 * value + 1];
+    } else {
+        *--p = '0' + value;
+    }
+
+    bm_used = out + length - bm_buffer;
+}
+
+int bm_count_digits(unsigned long n) {
+    /* log10(n) from log2(n), as `bits * 1233 / 4096` (1233 / 4096 being
+     * just over log10(2)), which is exact or one short: */
+    int bits = 64 - __builtin_clzl(n | 1);
+    int length = (bits * 1233 >> 12) + 1;
+    return length - (n < bm_powers_of_10[length - 1]);
+}
+
+unsigned long bm_div100(unsigned long n) {
+    /* `n / 100` as `(n / 4) * (2^66 / 25) / 2^66`, with the reciprocal
+     * rounded up: a multiply and shifts, where `DIV` takes dozens of
+     * cycles */
+    return (unsigned long)(((unsigned __int128)(n >> 2)
+        * 0x28F5C28F5C28F5C3ull) >> 66);
+}
+
+BM_ENTRY void bm_print_char(long c) {
+    if (bm_used == BM_BUFFER_SIZE) bm_flush();
+    bm_buffer[bm_used++] = (char)c;
+}
+
+BM_ENTRY void bm_print_bool(long b) {
+    bm_print_char(b ? '1' : '0');
+}
+
+/**********************************************************************
+ *                               ERRORS                               *
+ **********************************************************************/
+
+BM_ENTRY void bm_bounds_error(long index, long length) {
+    bm_flush();
+    /* the message is put together in the (now empty) buffer, but written
+     * to stderr: */
+    static const char message[] = "error: index ";
+    static const char middle[] = " is out of bounds of an array of length ";
+    bm_print_bytes(message, sizeof(message) - 1);
+    bm_print_int(index);
+    bm_print_bytes(middle, sizeof(middle) - 1);
+    bm_print_int(length);
+    bm_print_char('\n');
+    bm_write_all(STDERR, bm_buffer, bm_used);
+    bm_used = 0;
+    bm_exit(1);
+}
+
+/**********************************************************************
+ *                              STRINGS                               *
+ **********************************************************************/
+
+void bm_copy(char* dest, const char* src, long length) {
+    long i = 0;
+    for (; i + BM_VECTOR_SIZE <= length; i += BM_VECTOR_SIZE) {
+        bm_vector_store(dest + i, bm_vector_load(src + i));
+    }
+    for (; i < length; i++) dest[i] = src[i];
+}
+
+BM_ENTRY long bm_str_equal(const char* a, const char* b) {
+    if (a == b) return 1;
+
+    long length = BM_STR_LENGTH(a);
+    if (length != BM_STR_LENGTH(b)) return 0;
+
+    long i = 0;
+    for (; i + BM_VECTOR_SIZE <= length; i += BM_VECTOR_SIZE) {
+        if (!bm_vector_equal(
+            bm_vector_load(a + i),
+            bm_vector_load(b + i)
+        )) return 0;
+    }
+    for (; i < length; i++) {
+        if (a[i] != b[i]) return 0;
+    }
+    return 1;
+}
+
+#ifdef __AVX2__
+
+bm_vector bm_vector_load(const char* p) {
+    return _mm256_loadu_si256((const __m256i*)p);
+}
+
+void bm_vector_store(char* p, bm_vector v) {
+    _mm256_storeu_si256((__m256i*)p, v);
+}
+
+bool bm_vector_equal(bm_vector a, bm_vector b) {
+    /* (one mask bit per byte, set where the bytes match) */
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, b)) == -1;
+}
+
+#else
+
+bm_vector bm_vector_load(const char* p) {
+    return _mm_loadu_si128((const __m128i*)p);
+}
+
+void bm_vector_store(char* p, bm_vector v) {
+    _mm_storeu_si128((__m128i*)p, v);
+}
+
+bool bm_vector_equal(bm_vector a, bm_vector b) {
+    /* (one mask bit per byte, set where the bytes match) */
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) == 0xFFFF;
+}
+
+#endif
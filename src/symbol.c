@@ -6,13 +6,15 @@
  */
 
 stack* symbol_stack = NULL;
-bool main_exists = false;
 
 symbol* symbol_create(symbol_t kind, type* type, char* name) {
     symbol* s = malloc(sizeof(*s));
     s->kind = kind;
     s->type = type;
     s->name = name;
+    s->which = 0;
+    s->stack_size = 0;
+    s->prototype = false;
     return s;
 }
 
@@ -94,7 +96,8 @@ symbol* scope_lookup_current(const char* name) {
 void decl_resolve(decl* d) {
     if (!d) return;
 
-    if (scope_lookup_current(d->name) != NULL) {
+    symbol* prev = scope_lookup_current(d->name);
+    if (prev != NULL && !(prev->prototype && d->code)) {
         fprintf(
             stderr,
             "error: attempt to re-declare identifier `%s` in same scope ",
@@ -110,22 +113,13 @@ void decl_resolve(decl* d) {
 
         expr_resolve(d->value);
 
-        if (d->type == TYPE_ARRAY) {
+        /* (an array literal takes its length from the declaration) */
+        if (d->value && d->value->kind == EXPR_ARRAY) {
             d->value->symbol = d->symbol;
         }
         
         if (d->code) {
-            if (d->name == "main") {
-                if (d->type->subtype == "integer") {
-                    main_exists = true;
-                    d->name = "_start";
-                } else {
-                    fprintf(
-                        stderr,
-                        "error: expected `main` to return type `integer`\n"
-                    );
-                }
-            }
+            /* (`main` keeps its name: the runtime's `_start` calls it) */
             scope_bind(d->name, d->symbol);
 
             scope_enter();
@@ -133,6 +127,7 @@ void decl_resolve(decl* d) {
             stmt_resolve(d->code);
             scope_exit();
         } else {
+            d->symbol->prototype = d->type->kind == TYPE_FUNCTION;
             scope_bind(d->name, d->symbol);
         }
     }
@@ -152,8 +147,6 @@ void expr_resolve(expr* e) {
                 e->name
             );
         }
-        /* in case the IDENT is a function call argument: */
-        expr_resolve(e->right);
     } else if (e->kind == EXPR_FUN_CALL) {
         e->left->symbol = scope_lookup(e->left->name);
         if (e->left->symbol == NULL) {
@@ -219,6 +212,9 @@ void stmt_resolve(stmt* s) {
             stmt_resolve(s->body);
             scope_exit();
             break;
+        case STMT_VECTOR:
+            /* (made by the optimizer, out of statements already resolved) */
+            break;
     }
 
     stmt_resolve(s->next);
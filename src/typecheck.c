@@ -41,12 +41,9 @@ type* type_copy(type* t) {
 
     type* copy = malloc(sizeof(*copy));
     copy->kind = t->kind;
-    if (t->subtype) {
-        copy->subtype = type_copy(t->subtype);
-    }
-    if (t->params) {
-        copy->params = param_list_copy(t->params);
-    }
+    copy->subtype = type_copy(t->subtype);
+    copy->params = param_list_copy(t->params);
+    copy->size = t->size;
     return copy;
 }
 
@@ -78,7 +75,7 @@ void param_list_delete(param_list* p) {
         param_list_delete(p->next);
     }
     type_delete(p->type);
-    free(p->name);
+    /* the name is shared with the original list (see `param_list_copy()`) */
     free(p);
 }
 
@@ -100,11 +97,24 @@ void decl_typecheck(decl* d) {
                 type_t_str[t->kind]
             );
         }
-        type_delete(t);
-
-        if (d->symbol->kind == SYMBOL_LOCAL) {
-            d->symbol->which = which_counter++;
+        if (
+            t->kind == TYPE_ARRAY
+            && d->symbol->type->kind == TYPE_ARRAY
+            && t->size > d->symbol->type->size
+        ) {
+            fprintf(
+                stderr,
+                "error: %d items given for `%s`, which holds %d\n",
+                t->size,
+                d->symbol->name,
+                d->symbol->type->size
+            );
         }
+        type_delete(t);
+    }
+    /* (uninitialized locals need a slot too) */
+    if (d->symbol && d->symbol->kind == SYMBOL_LOCAL) {
+        d->symbol->which = which_counter++;
     }
     if (d->code) {
         /* make return type of function available for checking */
@@ -185,6 +195,9 @@ void stmt_typecheck(stmt* s) {
             t = expr_typecheck(s->expr);
             type_delete(t);
             break;
+        case STMT_VECTOR:
+            /* (made by the optimizer, out of statements already checked) */
+            break;
     }
 
     stmt_typecheck(s->next);
@@ -196,7 +209,7 @@ type* expr_typecheck(expr* e) {
     type* left = expr_typecheck(e->left);
     type* right = expr_typecheck(e->right);
 
-    type* result;
+    type* result = NULL;
 
     switch (e->kind) {
         case EXPR_AND:      __attribute__((fallthrough));
@@ -234,21 +247,25 @@ type* expr_typecheck(expr* e) {
             }
             result = type_create(TYPE_BOOLEAN, 0, 0, 0);
             break;
-        case EXPR_ARRAY:
-            struct expr* item_p = e->right;
-            while (item_p) {
-                if (expr_typecheck(item_p) != left) {
+        case EXPR_ARRAY: {
+            /* (`left` is the type of the first item; see `EXPR_ARG`) */
+            int count = 0;
+            for (expr* item = e->left; item != NULL; item = item->right) {
+                type* t = expr_typecheck(item->left);
+                if (!type_equals(t, left)) {
                     fprintf(
                         stderr,
                         "error: item of type `%s` in array, expected `%s`\n",
-                        type_t_str[item_p->symbol->type->kind],
+                        type_t_str[t->kind],
                         type_t_str[left->kind]
                     );
                 }
-                item_p = item_p->right;
+                type_delete(t);
+                count++;
             }
-            result = type_create(TYPE_ARRAY, left, 0, e->symbol->type->size);
+            result = type_create(TYPE_ARRAY, type_copy(left), 0, count);
             break;
+        }
         case EXPR_CHAR_LIT:
             result = type_create(TYPE_CHARACTER, 0, 0, 0);
             break;
@@ -261,6 +278,9 @@ type* expr_typecheck(expr* e) {
         case EXPR_IDENT:
             result = type_copy(e->symbol->type);
             break;
+        case EXPR_ARG:
+            result = type_copy(left);
+            break;
         case EXPR_INDEX:
             if (left->kind == TYPE_ARRAY) {
                 if (right->kind != TYPE_INTEGER) {
@@ -418,7 +438,7 @@ type* expr_typecheck(expr* e) {
             param_list* param_p = left->params;
 
             while (arg_p && param_p) {
-                struct type* arg_type = expr_typecheck(arg_p);
+                struct type* arg_type = expr_typecheck(arg_p->left);
                 if (!type_equals(arg_type, param_p->type)) {
                     fprintf(
                         stderr,
@@ -0,0 +1,892 @@
+#include "vm.h"
+#include "codegen.h"
+#include "optimize.h"
+#include "symbol.h"
+#include <sys/mman.h>
+
+/**********************************************************************
+ *                              LOWERING                              *
+ **********************************************************************/
+
+vm_program* lower_program(cfg* program, bool counters) {
+    vm_program* p = calloc(1, sizeof(*p));
+    p->globals = ht_create();
+    lower_state state = {
+        .program = p,
+        .funcs = ht_create(),
+        .globals = p->globals,
+        .counters = counters,
+        .ok = true,
+    };
+
+    /* every function has its place before any is lowered, so calls can
+     * refer to those lowered after them: */
+    int count = 0;
+    for (cfg* c = program; c != NULL; c = c->next) {
+        if (c->kind == FUNC) count++;
+    }
+    p->funcs = calloc(count > 0 ? count : 1, sizeof(*p->funcs));
+    for (cfg* c = program; c != NULL; c = c->next) {
+        if (c->kind != FUNC) continue;
+        vm_func* f = &p->funcs[p->func_count++];
+        f->name = c->symbol->name;
+        for (param_list* q = c->symbol->type->params; q; q = q->next) {
+            f->params++;
+        }
+        f->budget = TIER_THRESHOLD;
+        ht_set(state.funcs, f->name, f);
+    }
+
+    /* (globals all go in one mapping, so it's sized first) */
+    for (cfg* c = program; c != NULL; c = c->next) {
+        if (c->kind == VAR) p->statics_size += lower_global_size(c);
+    }
+    p->statics = mmap(
+        NULL,
+        p->statics_size > 0 ? p->statics_size : 1,
+        PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT,
+        -1,
+        0
+    );
+    if (p->statics == MAP_FAILED) {
+        fprintf(stderr, "error: could not map memory for globals\n");
+        p->statics = NULL;
+        ht_destroy(state.funcs);
+        vm_destroy(p);
+        return NULL;
+    }
+    for (cfg* c = program; c != NULL; c = c->next) {
+        if (c->kind == VAR) lower_global(&state, c);
+    }
+    for (cfg* c = program; c != NULL; c = c->next) {
+        if (c->kind == FUNC) lower_func(&state, c);
+    }
+
+    p->main = ht_get(state.funcs, "main");
+    if (!p->main) {
+        fprintf(stderr, "error: no `main()` to run\n");
+        state.ok = false;
+    }
+    ht_destroy(state.funcs);
+    free(state.labels);
+    if (!state.ok) {
+        vm_destroy(p);
+        return NULL;
+    }
+    return p;
+}
+
+size_t lower_global_size(cfg* global) {
+    symbol* s = global->symbol;
+    expr* value = global->value.exp;
+    switch (s->type->kind) {
+        case TYPE_BOOLEAN:   __attribute__((fallthrough));
+        case TYPE_CHARACTER: __attribute__((fallthrough));
+        case TYPE_INTEGER:   __attribute__((fallthrough));
+        case TYPE_STRING:
+            return sizeof(int64_t);
+        case TYPE_ARRAY:
+            return sizeof(int64_t) * (
+                value && value->kind == EXPR_ARRAY ?
+                    array_length(value) :
+                    s->type->size
+            );
+        default:
+            return 0;
+    }
+}
+
+void lower_global(lower_state* state, cfg* global) {
+    symbol* s = global->symbol;
+    expr* value = global->value.exp;
+    if (!global_is_constant(s, value)) {
+        state->ok = false;
+        return;
+    }
+
+    /* the address of a global array is its first item, and otherwise of
+     * the word holding its value */
+    int64_t* address;
+    switch (s->type->kind) {
+        case TYPE_BOOLEAN:   __attribute__((fallthrough));
+        case TYPE_CHARACTER: __attribute__((fallthrough));
+        case TYPE_INTEGER:
+            address = lower_static(state->program, sizeof(*address));
+            *address = value ? value->value : 0;
+            break;
+        case TYPE_STRING:
+            /* (one without a value is empty rather than NULL) */
+            address = lower_static(state->program, sizeof(*address));
+            *address = (intptr_t)lower_string(
+                state->program,
+                value ? value->str_value : ""
+            );
+            break;
+        case TYPE_ARRAY: {
+            int length = value ? array_length(value) : s->type->size;
+            address = lower_static(state->program, 8 * length);
+            lower_items(state->program, address, value, length);
+            break;
+        }
+        default:
+            return;
+    }
+    ht_set(state->globals, s->name, address);
+}
+
+void lower_func(lower_state* state, cfg* func) {
+    vm_func* f = ht_get(state->funcs, func->symbol->name);
+    state->func = f;
+    state->nodes = ht_create();
+    state->arrays = ht_create();
+    state->label_count = 0;
+    state->barrier = 0;
+
+    /* (a conditional move is codegen's choice; here both sides of every
+     * branch are lowered as they are, and the choice is put back after) */
+    int node_count;
+    cfg_node** nodes = cfg_nodes(func->value.cfg_node, &node_count);
+    bool* selects = malloc((node_count > 0 ? node_count : 1) * sizeof(bool));
+    for (int i = 0; i < node_count; i++) {
+        if (nodes[i]->kind == CFG_BRANCH) {
+            selects[i] = nodes[i]->value.branch->select;
+            nodes[i]->value.branch->select = false;
+        }
+    }
+    int count;
+    cfg_node** order = cfg_layout(func->value.cfg_node, &count);
+    /* (every node gets its label up front, for jumps back to it) */
+    for (int i = 0; i < count; i++) lower_node_label(state, order[i]);
+    state->loops = ht_create();
+    if (state->counters) {
+        lower_loops(state, order, count);
+        lower_emit(state, VM_COUNT, VM_CALLS, 0, (intptr_t)f);
+    }
+
+    state->temp_base = func->symbol->stack_size;
+    for (int i = 0; i < count; i++) {
+        if (order[i]->kind == CFG_BRANCH) {
+            lower_arrays_expr(state, order[i]->value.branch->condition);
+        } else if (order[i]->kind == CFG_BLOCK) {
+            lower_arrays_stmt(state, order[i]->value.block->stmt);
+        }
+    }
+    state->temps = state->temp_base;
+    f->size = state->temp_base;
+
+    for (int i = 0; i < count; i++) {
+        lower_node(state, order[i], i + 1 < count ? order[i + 1] : NULL);
+    }
+    /* (falling off the end returns 0) */
+    lower_emit(state, VM_RETI, 0, 0, 0);
+
+    for (int i = 0; i < f->length; i++) {
+        if (vm_is_jump(f->code[i].op)) {
+            f->code[i].c = state->labels[f->code[i].c];
+        }
+    }
+
+    for (int i = 0; i < node_count; i++) {
+        if (nodes[i]->kind == CFG_BRANCH) {
+            nodes[i]->value.branch->select = selects[i];
+        }
+    }
+    free(selects);
+    free(nodes);
+    free(order);
+    ht_destroy(state->loops);
+    ht_iter it = ht_iterate(state->nodes);
+    while (ht_next(&it)) free(it.value);
+    ht_destroy(state->nodes);
+    it = ht_iterate(state->arrays);
+    while (ht_next(&it)) free(it.value);
+    ht_destroy(state->arrays);
+}
+
+void lower_loops(lower_state* state, cfg_node** order, int count) {
+    /* (labels were made in the order nodes are laid out in) */
+    for (int i = 0; i < count; i++) {
+        cfg_node* next[2] = {NULL, NULL};
+        if (order[i]->kind == CFG_BLOCK) {
+            next[0] = order[i]->value.block->next;
+        } else if (order[i]->kind == CFG_BRANCH) {
+            next[0] = order[i]->value.branch->true_branch;
+            next[1] = order[i]->value.branch->false_branch;
+        }
+        for (int j = 0; j < 2; j++) {
+            if (next[j] && lower_node_label(state, next[j]) <= i) {
+                ht_set(state->loops, ptr_key(next[j]), next[j]);
+            }
+        }
+    }
+}
+
+void lower_arrays_stmt(lower_state* state, stmt* s) {
+    for (; s != NULL; s = s->next) {
+        switch (s->kind) {
+            case STMT_DECL:
+                lower_arrays_expr(state, s->decl->value);
+                break;
+            case STMT_BLOCK:
+                lower_arrays_stmt(state, s->body);
+                break;
+            default:
+                lower_arrays_expr(state, s->expr);
+                break;
+        }
+    }
+}
+
+void lower_arrays_expr(lower_state* state, expr* e) {
+    if (!e) return;
+
+    if (e->kind == EXPR_ARRAY && !array_is_constant(e)) {
+        int* first = malloc(sizeof(*first));
+        *first = state->temp_base;
+        state->temp_base += array_length(e);
+        ht_set(state->arrays, ptr_key(e), first);
+    }
+    lower_arrays_expr(state, e->left);
+    lower_arrays_expr(state, e->right);
+}
+
+void lower_node(lower_state* state, cfg_node* node, cfg_node* next) {
+    int* label = ht_get(state->nodes, ptr_key(node));
+    if (label) lower_bind(state, *label);
+    state->temps = state->temp_base;
+    if (ht_get(state->loops, ptr_key(node))) {
+        lower_emit(state, VM_COUNT, VM_TRIPS, 0, (intptr_t)state->func);
+    }
+
+    switch (node->kind) {
+        case CFG_BLOCK: {
+            stmt* s = node->value.block->stmt;
+            lower_stmt(state, s);
+            /* (nothing follows a `return`) */
+            while (s && s->next) s = s->next;
+            if (!s || s->kind != STMT_RETURN) {
+                lower_goto(state, node->value.block->next, next);
+            }
+            break;
+        }
+        case CFG_BRANCH: {
+            cfg_branch* branch = node->value.branch;
+            /* jump straight to whichever side doesn't follow: */
+            int true_label = branch->true_branch == next ?
+                LOWER_FALLTHROUGH :
+                lower_node_label(state, branch->true_branch);
+            int false_label = branch->false_branch == next
+                && true_label != LOWER_FALLTHROUGH ?
+                LOWER_FALLTHROUGH :
+                lower_node_label(state, branch->false_branch);
+            lower_cond(state, branch->condition, true_label, false_label);
+            break;
+        }
+        case CFG_RETURN:
+            lower_goto(state, NULL, next);
+            break;
+    }
+}
+
+void lower_goto(lower_state* state, cfg_node* target, cfg_node* next) {
+    /* nothing to do if `target` comes next anyway (with a missing target
+     * meaning the end of the function, which follows the last node) */
+    if (target == next) return;
+
+    if (target) {
+        lower_emit(state, VM_JMP, 0, 0, lower_node_label(state, target));
+    } else {
+        lower_emit(state, VM_RETI, 0, 0, 0);
+    }
+}
+
+void lower_stmt(lower_state* state, stmt* s) {
+    for (; s != NULL; s = s->next) {
+        /* values never outlive the statement computing them */
+        state->temps = state->temp_base;
+
+        switch (s->kind) {
+            case STMT_BLOCK:
+                lower_stmt(state, s->body);
+                break;
+            case STMT_DECL: {
+                decl* d = s->decl;
+                if (d->symbol->kind != SYMBOL_LOCAL) break;
+                int r = lower_local(d->symbol);
+                if (d->value) {
+                    lower_into(state, d->value, r);
+                } else if (d->symbol->type->kind == TYPE_ARRAY) {
+                    /* all zeros, for good: */
+                    lower_emit(state, VM_LOADI, r, 0, (intptr_t)lower_alloc(
+                        state->program,
+                        8 * d->symbol->type->size
+                    ));
+                } else if (d->symbol->type->kind == TYPE_STRING) {
+                    /* (empty rather than NULL, as a global is) */
+                    lower_emit(state, VM_LOADI, r, 0, (intptr_t)lower_string(
+                        state->program,
+                        ""
+                    ));
+                } else {
+                    /* (zero, as a global is) */
+                    lower_emit(state, VM_LOADI, r, 0, 0);
+                }
+                break;
+            }
+            case STMT_EXPR:
+                lower_release(state, lower_expr(state, s->expr));
+                break;
+            case STMT_PRINT:
+                lower_print(state, s->expr);
+                break;
+            case STMT_RETURN:
+                if (!s->expr) {
+                    lower_emit(state, VM_RETI, 0, 0, 0);
+                } else if (is_tail_call(s->expr)) {
+                    /* the callee can return straight to our caller: */
+                    lower_call(state, s->expr, true);
+                } else {
+                    lower_emit(state, VM_RET, lower_expr(state, s->expr), 0, 0);
+                }
+                break;
+            case STMT_VECTOR:
+                /* (the loop after it runs every iteration just as well) */
+                break;
+            default:
+                fprintf(
+                    stderr,
+                    "error: invalid `stmt` type in CFG\n"
+                );
+                state->ok = false;
+                break;
+        }
+    }
+}
+
+void lower_print(lower_state* state, expr* e) {
+    type* t = expr_typecheck(e);
+    vm_op_t op;
+    switch (t->kind) {
+        case TYPE_STRING:    op = VM_PRINTS;   break;
+        case TYPE_CHARACTER: op = VM_PRINTC;   break;
+        case TYPE_BOOLEAN:   op = VM_PRINTB;   break;
+        default:             op = VM_PRINTI;   break;
+    }
+    type_delete(t);
+    int r = lower_expr(state, e);
+    lower_emit(state, op, r, 0, 0);
+    lower_release(state, r);
+}
+
+int lower_expr(lower_state* state, expr* e) {
+    int r;
+    int left;
+    int right;
+    int64_t* global;
+
+    switch (e->kind) {
+        case EXPR_IDENT:
+            if (e->symbol->kind != SYMBOL_GLOBAL) {
+                return lower_local(e->symbol);
+            }
+            global = ht_get(state->globals, e->symbol->name);
+            r = lower_temp(state);
+            /* (the value of a global array is its address) */
+            lower_emit(
+                state,
+                e->symbol->type->kind == TYPE_ARRAY ? VM_LOADI : VM_LOADG,
+                r,
+                0,
+                (intptr_t)global
+            );
+            return r;
+        case EXPR_BOOL_LIT: __attribute__((fallthrough));
+        case EXPR_CHAR_LIT: __attribute__((fallthrough));
+        case EXPR_INT_LIT:
+            r = lower_temp(state);
+            lower_emit(state, VM_LOADI, r, 0, e->value);
+            return r;
+        case EXPR_STR_LIT:
+            r = lower_temp(state);
+            lower_emit(
+                state,
+                VM_LOADI,
+                r,
+                0,
+                (intptr_t)lower_string(state->program, e->str_value)
+            );
+            return r;
+        case EXPR_ASSIGN:
+            if (e->left->symbol->kind != SYMBOL_GLOBAL) {
+                r = lower_local(e->left->symbol);
+                lower_into(state, e->right, r);
+                return r;
+            }
+            r = lower_expr(state, e->right);
+            global = ht_get(state->globals, e->left->symbol->name);
+            lower_emit(state, VM_STOREG, r, 0, (intptr_t)global);
+            return r;
+        case EXPR_INC:      __attribute__((fallthrough));
+        case EXPR_DEC: {
+            /* (the value is the variable's new one) */
+            int step = e->kind == EXPR_INC ? 1 : -1;
+            if (e->left->symbol->kind != SYMBOL_GLOBAL) {
+                r = lower_local(e->left->symbol);
+                lower_emit(state, VM_ADDI, r, r, step);
+                return r;
+            }
+            global = ht_get(state->globals, e->left->symbol->name);
+            r = lower_temp(state);
+            lower_emit(state, VM_LOADG, r, 0, (intptr_t)global);
+            lower_emit(state, VM_ADDI, r, r, step);
+            lower_emit(state, VM_STOREG, r, 0, (intptr_t)global);
+            return r;
+        }
+        case EXPR_ADD:      __attribute__((fallthrough));
+        case EXPR_SUB:      __attribute__((fallthrough));
+        case EXPR_MUL:
+            /* a constant can go in the instruction: */
+            if (lower_is_small(e->right)) {
+                left = lower_expr(state, e->left);
+                lower_release(state, left);
+                r = lower_temp(state);
+                lower_emit(
+                    state,
+                    e->kind == EXPR_MUL ? VM_MULI : VM_ADDI,
+                    r,
+                    left,
+                    e->kind == EXPR_SUB ?
+                        -(int64_t)e->right->value : e->right->value
+                );
+                return r;
+            }
+            __attribute__((fallthrough));
+        case EXPR_DIV:      __attribute__((fallthrough));
+        case EXPR_MOD:      __attribute__((fallthrough));
+        case EXPR_EXP: {
+            static const vm_op_t ops[] = {
+                [EXPR_ADD] = VM_ADD,
+                [EXPR_SUB] = VM_SUB,
+                [EXPR_MUL] = VM_MUL,
+                [EXPR_EXP] = VM_EXP,
+                [EXPR_DIV] = VM_DIV,
+                [EXPR_MOD] = VM_MOD,
+            };
+            lower_operands(state, e, &left, &right);
+            lower_release(state, right);
+            lower_release(state, left);
+            r = lower_temp(state);
+            lower_emit(state, ops[e->kind], r, left, right);
+            return r;
+        }
+        case EXPR_EQ:       __attribute__((fallthrough));
+        case EXPR_N_EQ:     __attribute__((fallthrough));
+        case EXPR_LESS:     __attribute__((fallthrough));
+        case EXPR_L_EQ:     __attribute__((fallthrough));
+        case EXPR_GREATER:  __attribute__((fallthrough));
+        case EXPR_G_EQ: {
+            type* t = expr_typecheck(e->left);
+            bool strings = t->kind == TYPE_STRING
+                && (e->kind == EXPR_EQ || e->kind == EXPR_N_EQ);
+            type_delete(t);
+
+            lower_operands(state, e, &left, &right);
+            lower_release(state, right);
+            lower_release(state, left);
+            r = lower_temp(state);
+            if (strings) {
+                /* by their characters, rather than where they are: */
+                lower_emit(state, VM_STREQ, r, left, right);
+                if (e->kind == EXPR_N_EQ) lower_emit(state, VM_NOT, r, r, 0);
+            } else {
+                lower_emit(state, VM_EQ + (e->kind - EXPR_EQ), r, left, right);
+            }
+            return r;
+        }
+        case EXPR_AND:      __attribute__((fallthrough));
+        case EXPR_OR:
+            /* short-circuiting only matters if `right` could do (or trap
+             * on) something when `left` already decides the result: */
+            if (expr_is_cheap(e->right)) {
+                lower_operands(state, e, &left, &right);
+                lower_release(state, right);
+                lower_release(state, left);
+                r = lower_temp(state);
+                lower_emit(
+                    state,
+                    e->kind == EXPR_AND ? VM_AND : VM_OR,
+                    r,
+                    left,
+                    right
+                );
+                return r;
+            }
+            int false_label = lower_label(state);
+            int done_label = lower_label(state);
+            lower_cond(state, e, LOWER_FALLTHROUGH, false_label);
+            r = lower_temp(state);
+            lower_emit(state, VM_LOADI, r, 0, 1);
+            lower_emit(state, VM_JMP, 0, 0, done_label);
+            lower_bind(state, false_label);
+            lower_emit(state, VM_LOADI, r, 0, 0);
+            lower_bind(state, done_label);
+            return r;
+        case EXPR_NOT:
+            left = lower_expr(state, e->left);
+            lower_release(state, left);
+            r = lower_temp(state);
+            lower_emit(state, VM_NOT, r, left, 0);
+            return r;
+        case EXPR_FUN_CALL:
+            return lower_call(state, e, false);
+        case EXPR_ARRAY:
+            if (!array_is_constant(e)) return lower_array(state, e);
+            /* (never changed, so one copy does for every evaluation) */
+            r = lower_temp(state);
+            lower_emit(state, VM_LOADI, r, 0, (intptr_t)lower_constant_array(
+                state->program,
+                e,
+                array_length(e)
+            ));
+            return r;
+        case EXPR_INDEX:
+            if (lower_is_small(e->right) && !e->checked) {
+                /* constant offset, as for a pointer after strength
+                 * reduction */
+                left = lower_expr(state, e->left);
+                lower_release(state, left);
+                r = lower_temp(state);
+                lower_emit(state, VM_INDEXI, r, left, e->right->value);
+                return r;
+            }
+            lower_operands(state, e, &left, &right);
+            if (e->checked) {
+                lower_emit(
+                    state,
+                    VM_CHECK,
+                    right,
+                    0,
+                    e->left->symbol->type->size
+                );
+            }
+            lower_release(state, right);
+            lower_release(state, left);
+            r = lower_temp(state);
+            lower_emit(state, VM_INDEX, r, left, right);
+            return r;
+        default:
+            fprintf(
+                stderr,
+                "error: invalid `expr` type `%s` in CFG\n",
+                expr_t_str[e->kind]
+            );
+            state->ok = false;
+            return lower_temp(state);
+    }
+}
+
+void lower_into(lower_state* state, expr* e, int dest) {
+    vm_func* f = state->func;
+    int first = f->length;
+    int r = lower_expr(state, e);
+    if (r == dest) return;
+
+    /* The instruction computing a temporary can put it in `dest` instead,
+     * if it was the last one and nothing jumps past it. */
+    int last = f->length - 1;
+    if (
+        r >= state->temp_base
+        && last >= first
+        && last >= state->barrier
+        && vm_is_pure(f->code[last].op)
+        && f->code[last].a == r
+    ) {
+        f->code[last].a = dest;
+    } else {
+        lower_emit(state, VM_MOVE, dest, r, 0);
+    }
+    lower_release(state, r);
+}
+
+void lower_operands(lower_state* state, expr* e, int* left, int* right) {
+    *left = lower_expr(state, e->left);
+    if (*left < state->temp_base && !expr_is_pure(e->right)) {
+        int r = lower_temp(state);
+        lower_emit(state, VM_MOVE, r, *left, 0);
+        *left = r;
+    }
+    *right = lower_expr(state, e->right);
+}
+
+int lower_call(lower_state* state, expr* e, bool tail) {
+    vm_func* callee = ht_get(state->funcs, e->left->symbol->name);
+    if (!callee) {
+        fprintf(
+            stderr,
+            "error: `%s` has no body to run\n",
+            e->left->symbol->name
+        );
+        state->ok = false;
+    }
+
+    /* The arguments go in the registers at the top of the frame, which
+     * become the callee's parameters. Calls made by later arguments put
+     * their frames above them. */
+    int base = state->temps;
+    int count = 0;
+    for (expr* arg = e->right; arg != NULL; arg = arg->right) count++;
+    state->temps = base + (count > 0 ? count : 1);
+    if (state->temps > state->func->size) state->func->size = state->temps;
+    int i = 0;
+    for (expr* arg = e->right; arg != NULL; arg = arg->right) {
+        lower_into(state, arg->left, base + i++);
+        /* (whatever the argument took above them is free again) */
+        state->temps = base + count;
+    }
+
+    if (tail) {
+        lower_emit(state, VM_TAILCALL, base, count, (intptr_t)callee);
+        return base;
+    }
+    lower_emit(state, VM_CALL, base, 0, (intptr_t)callee);
+    /* (the result is left where the callee's frame began) */
+    state->temps = base + 1;
+    return base;
+}
+
+int lower_array(lower_state* state, expr* e) {
+    int* first = ht_get(state->arrays, ptr_key(e));
+    if (!first) {
+        fprintf(stderr, "error: array has no registers in the frame\n");
+        state->ok = false;
+        return lower_temp(state);
+    }
+
+    int length = array_length(e);
+    int i = 0;
+    for (expr* item = e->left; item != NULL && i < length; item = item->right) {
+        lower_into(state, item->left, *first + i++);
+    }
+    /* (any items not given are zero) */
+    for (; i < length; i++) lower_emit(state, VM_LOADI, *first + i, 0, 0);
+
+    int r = lower_temp(state);
+    lower_emit(state, VM_FRAME, r, *first, 0);
+    return r;
+}
+
+void lower_cond(lower_state* state, expr* e, int true_label, int false_label) {
+    int skip_label;
+    int left;
+    int right;
+
+    switch (e->kind) {
+        case EXPR_EQ:       __attribute__((fallthrough));
+        case EXPR_N_EQ:     __attribute__((fallthrough));
+        case EXPR_LESS:     __attribute__((fallthrough));
+        case EXPR_L_EQ:     __attribute__((fallthrough));
+        case EXPR_GREATER:  __attribute__((fallthrough));
+        case EXPR_G_EQ: {
+            type* t = expr_typecheck(e->left);
+            bool strings = t->kind == TYPE_STRING;
+            type_delete(t);
+            if (strings) break;
+
+            /* compared with the constant in the instruction, if there is
+             * one: */
+            bool immediate = lower_is_small(e->right);
+            if (immediate) {
+                left = lower_expr(state, e->left);
+                right = e->right->value;
+            } else {
+                lower_operands(state, e, &left, &right);
+                lower_release(state, right);
+            }
+            lower_release(state, left);
+            lower_jump(
+                state,
+                e->kind,
+                left,
+                right,
+                immediate,
+                true_label,
+                false_label
+            );
+            return;
+        }
+        case EXPR_AND:
+            /* `left` being false decides the whole expression: */
+            skip_label = false_label == LOWER_FALLTHROUGH ?
+                lower_label(state) : false_label;
+            lower_cond(state, e->left, LOWER_FALLTHROUGH, skip_label);
+            lower_cond(state, e->right, true_label, false_label);
+            if (false_label == LOWER_FALLTHROUGH) lower_bind(state, skip_label);
+            return;
+        case EXPR_OR:
+            /* `left` being true decides the whole expression: */
+            skip_label = true_label == LOWER_FALLTHROUGH ?
+                lower_label(state) : true_label;
+            lower_cond(state, e->left, skip_label, LOWER_FALLTHROUGH);
+            lower_cond(state, e->right, true_label, false_label);
+            if (true_label == LOWER_FALLTHROUGH) lower_bind(state, skip_label);
+            return;
+        case EXPR_NOT:
+            lower_cond(state, e->left, false_label, true_label);
+            return;
+        case EXPR_BOOL_LIT:
+            if (e->value && true_label != LOWER_FALLTHROUGH) {
+                lower_emit(state, VM_JMP, 0, 0, true_label);
+            } else if (!e->value && false_label != LOWER_FALLTHROUGH) {
+                lower_emit(state, VM_JMP, 0, 0, false_label);
+            }
+            return;
+        default:
+            break;
+    }
+
+    /* any other boolean value (variable, call, string comparison, etc.): */
+    int r = lower_expr(state, e);
+    lower_release(state, r);
+    lower_jump(state, EXPR_N_EQ, r, 0, true, true_label, false_label);
+}
+
+void lower_jump(
+    lower_state* state,
+    expr_t kind,
+    int a,
+    int b,
+    bool immediate,
+    int true_label,
+    int false_label
+) {
+    vm_op_t first = immediate ? VM_JEQI : VM_JEQ;
+    if (true_label == LOWER_FALLTHROUGH) {
+        if (false_label == LOWER_FALLTHROUGH) return;
+        lower_emit(
+            state,
+            first + (lower_negate(kind) - EXPR_EQ),
+            a,
+            b,
+            false_label
+        );
+    } else {
+        lower_emit(state, first + (kind - EXPR_EQ), a, b, true_label);
+        if (false_label != LOWER_FALLTHROUGH) {
+            lower_emit(state, VM_JMP, 0, 0, false_label);
+        }
+    }
+}
+
+expr_t lower_negate(expr_t kind) {
+    switch (kind) {
+        case EXPR_EQ:       return EXPR_N_EQ;
+        case EXPR_N_EQ:     return EXPR_EQ;
+        case EXPR_LESS:     return EXPR_G_EQ;
+        case EXPR_L_EQ:     return EXPR_GREATER;
+        case EXPR_GREATER:  return EXPR_L_EQ;
+        default:            return EXPR_LESS;
+    }
+}
+
+bool lower_is_small(expr* e) {
+    /* (literals are `int`s, so every one fits) */
+    return is_literal(e);
+}
+
+int lower_emit(lower_state* state, vm_op_t op, int a, int b, int64_t c) {
+    vm_func* f = state->func;
+    if (f->length == f->capacity) {
+        f->capacity = f->capacity ? 2 * f->capacity : 64;
+        f->code = realloc(f->code, f->capacity * sizeof(*f->code));
+    }
+    f->code[f->length] = (vm_instr){ .op = op, .a = a, .b = b, .c = c };
+    return f->length++;
+}
+
+int lower_temp(lower_state* state) {
+    int r = state->temps++;
+    if (state->temps > state->func->size) state->func->size = state->temps;
+    return r;
+}
+
+void lower_release(lower_state* state, int r) {
+    /* Temporaries are freed in the reverse of the order they're taken
+     * in; any that aren't stay taken until the statement ends. */
+    if (r >= state->temp_base && r == state->temps - 1) state->temps--;
+}
+
+int lower_label(lower_state* state) {
+    state->labels = realloc(
+        state->labels,
+        (state->label_count + 1) * sizeof(*state->labels)
+    );
+    state->labels[state->label_count] = -1;
+    return state->label_count++;
+}
+
+void lower_bind(lower_state* state, int label) {
+    state->labels[label] = state->func->length;
+    state->barrier = state->func->length;
+}
+
+int lower_node_label(lower_state* state, cfg_node* node) {
+    int* label = ht_get(state->nodes, ptr_key(node));
+    if (!label) {
+        label = malloc(sizeof(*label));
+        *label = lower_label(state);
+        ht_set(state->nodes, ptr_key(node), label);
+    }
+    return *label;
+}
+
+int lower_local(symbol* s) {
+    return s->which;
+}
+
+void* lower_alloc(vm_program* program, size_t size) {
+    program->blocks = realloc(
+        program->blocks,
+        (program->block_count + 1) * sizeof(*program->blocks)
+    );
+    void* block = calloc(size > 0 ? size : 1, 1);
+    program->blocks[program->block_count++] = block;
+    return block;
+}
+
+void* lower_static(vm_program* program, size_t size) {
+    /* (sized by `lower_global_size()`, in words) */
+    void* block = program->statics + program->statics_used;
+    program->statics_used += size;
+    return block;
+}
+
+const char* lower_string(vm_program* program, const char* s) {
+    size_t length = strlen(s);
+    int64_t* block = lower_alloc(program, sizeof(*block) + length + 1);
+    block[0] = length;
+    memcpy(block + 1, s, length);
+    return (const char*)(block + 1);
+}
+
+int64_t* lower_constant_array(vm_program* program, expr* array, int length) {
+    int64_t* items = lower_alloc(program, 8 * length);
+    lower_items(program, items, array, length);
+    return items;
+}
+
+void lower_items(
+    vm_program* program,
+    int64_t* items,
+    expr* array,
+    int length
+) {
+    int i = 0;
+    for (expr* item = array ? array->left : NULL; item; item = item->right) {
+        if (i < length && is_literal(item->left)) items[i] = item->left->value;
+        if (i < length && item->left->kind == EXPR_STR_LIT) {
+            items[i] = (intptr_t)lower_string(program, item->left->str_value);
+        }
+        i++;
+    }
+}
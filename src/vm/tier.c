@@ -0,0 +1,246 @@
+#include "vm.h"
+#include "codegen.h"
+#include <sched.h>
+
+/**********************************************************************
+ *                              TIERING                               *
+ **********************************************************************/
+
+/* Compiled code shares the interpreter's globals, being linked against
+ * their addresses, and any other values it's given are laid out as it
+ * would lay them out itself. Each unit is linked with a copy of the
+ * runtime, whose output buffer is written out after calls that print, as
+ * the interpreter's is before them, so output stays in order. */
+
+tier_state* tier_create(
+    vm_program* vm,
+    cfg* program,
+    const char* runtime_path
+) {
+    tier_state* tier = calloc(1, sizeof(*tier));
+    tier->program = program;
+    tier->graph = callgraph_construct(program);
+    tier->funcs = ht_create();
+    for (call_node* node = tier->graph; node != NULL; node = node->next) {
+        ht_set(tier->funcs, node->symbol->name, node);
+    }
+    tier->runtime_path = runtime_path;
+    tier->vm = vm;
+    atomic_init(&tier->done, false);
+    vm->tier = tier;
+    return tier;
+}
+
+void tier_destroy(tier_state* tier) {
+    if (tier->pending) {
+        pthread_join(tier->thread, NULL);
+        if (tier->result) {
+            run_unload(&tier->result->image);
+            free(tier->result);
+        }
+    }
+    for (int i = 0; i < tier->unit_count; i++) {
+        run_unload(&tier->units[i]->image);
+        free(tier->units[i]);
+    }
+    free(tier->units);
+    ht_destroy(tier->funcs);
+    free(tier);
+}
+
+void tier_count(vm_program* program, vm_func* f, const void* const* handlers) {
+    tier_state* tier = program->tier;
+    if (tier && tier->pending && atomic_load(&tier->done)) {
+        tier_finish(program, handlers);
+    }
+    /* (done with, if that was `f`) */
+    if (f->budget > 0) return;
+
+    if (!tier || f == program->main) {
+        f->budget = INT64_MAX;
+        return;
+    }
+    if (f->params > TIER_MAX_PARAMS) {
+        fprintf(
+            stderr,
+            "note: `%s` is hot, but takes too many arguments to be called "
+            "compiled\n",
+            f->name
+        );
+        f->budget = INT64_MAX;
+        return;
+    }
+    /* (if something else is compiling, `f` waits its turn) */
+    f->budget = TIER_POLL;
+    if (!tier->pending && !tier_start(tier, f)) f->budget = INT64_MAX;
+}
+
+bool tier_start(tier_state* tier, vm_func* f) {
+    tier->pending = f;
+    memcpy(tier->counts, f->counts, sizeof(tier->counts));
+    atomic_store(&tier->done, false);
+    if (pthread_create(&tier->thread, NULL, tier_compile, tier) != 0) {
+        fprintf(stderr, "error: could not start compiling `%s`\n", f->name);
+        tier->pending = NULL;
+        return false;
+    }
+    /* (with a processor to spare this does nothing, and with none it lets
+     * the compile start now, rather than once the program is preempted) */
+    sched_yield();
+    return true;
+}
+
+void* tier_compile(void* arg) {
+    tier_state* tier = arg;
+    double started = run_clock();
+    tier->result = tier_unit_compile(tier, tier->pending, &tier->result_count);
+    tier->result_time = run_clock() - started;
+    atomic_store(&tier->done, true);
+    return NULL;
+}
+
+tier_unit* tier_unit_compile(tier_state* tier, vm_func* f, int* count) {
+    /* everything `f` can call, in the order of the program (as copies, so
+     * the program's own list is left as it is): */
+    for (call_node* node = tier->graph; node != NULL; node = node->next) {
+        node->reachable = false;
+    }
+    callgraph_reach(ht_get(tier->funcs, f->name));
+    tier_unit* unit = calloc(1, sizeof(*unit));
+    cfg* funcs = NULL;
+    cfg** tail = &funcs;
+    bool has_main = false;
+    *count = 0;
+    for (call_node* node = tier->graph; node != NULL; node = node->next) {
+        if (!node->reachable) continue;
+        cfg* copy = malloc(sizeof(*copy));
+        *copy = *node->func;
+        copy->next = NULL;
+        *tail = copy;
+        tail = &copy->next;
+        (*count)++;
+        unit->prints = unit->prints || tier_prints(node->func);
+        has_main = has_main || strcmp(node->symbol->name, "main") == 0;
+    }
+
+    /* (assembled here, rather than printed, as for `--run`) */
+    char* text;
+    size_t size;
+    FILE* out = open_memstream(&text, &size);
+    codegen(funcs, out);
+    fclose(out);
+    while (funcs) {
+        cfg* next = funcs->next;
+        free(funcs);
+        funcs = next;
+    }
+
+    object* obj = assemble(text, f->name, NULL, NULL);
+    free(text);
+    object* runtime = obj ? elf_read(tier->runtime_path) : NULL;
+    object* externs = tier_externs(tier, has_main);
+    object* objects[] = {obj, runtime, externs};
+    ht* symbols = runtime ? run_link(objects, 3, &unit->image) : NULL;
+    uint64_t* code = symbols ? ht_get(symbols, f->name) : NULL;
+    uint64_t* flush = symbols ? ht_get(symbols, "bm_flush") : NULL;
+    if (code && flush) {
+        unit->code = (tier_code)(uintptr_t)*code;
+        unit->image.flush = (void (*)(void))(uintptr_t)*flush;
+    } else {
+        if (symbols) run_unload(&unit->image);
+        free(unit);
+        unit = NULL;
+    }
+    link_free(symbols);
+    object_destroy(obj);
+    object_destroy(runtime);
+    object_destroy(externs);
+    return unit;
+}
+
+object* tier_externs(tier_state* tier, bool has_main) {
+    object* obj = object_create("globals");
+    ht_iter it = ht_iterate(tier->vm->globals);
+    while (ht_next(&it)) {
+        int i = object_add_symbol(obj, it.key, SECTION_ABS);
+        obj->symbols[i].value = (uintptr_t)it.value;
+        obj->symbols[i].global = true;
+    }
+    if (!has_main) {
+        int i = object_add_symbol(obj, "main", SECTION_ABS);
+        obj->symbols[i].global = true;
+    }
+    return obj;
+}
+
+void tier_finish(vm_program* program, const void* const* handlers) {
+    tier_state* tier = program->tier;
+    pthread_join(tier->thread, NULL);
+    vm_func* f = tier->pending;
+    tier_unit* unit = tier->result;
+    tier->pending = NULL;
+    tier->result = NULL;
+    /* (whether or not it could be compiled, it's not tried again) */
+    f->budget = INT64_MAX;
+    if (!unit) {
+        fprintf(
+            stderr,
+            "note: could not compile `%s`, which stays interpreted\n",
+            f->name
+        );
+        return;
+    }
+
+    tier->units = realloc(
+        tier->units,
+        (tier->unit_count + 1) * sizeof(*tier->units)
+    );
+    tier->units[tier->unit_count++] = unit;
+    f->native = unit->code;
+    f->unit = unit;
+    tier_patch(program, f, handlers);
+    fprintf(
+        stderr,
+        "note: tiered up `%s` after %ld calls and %ld loop trips "
+        "(compiled with %d other function%s in %.3f ms)\n",
+        f->name,
+        (long)tier->counts[VM_CALLS],
+        (long)tier->counts[VM_TRIPS],
+        tier->result_count - 1,
+        tier->result_count == 2 ? "" : "s",
+        tier->result_time
+    );
+}
+
+void tier_patch(vm_program* program, vm_func* f, const void* const* handlers) {
+    for (int i = 0; i < program->func_count; i++) {
+        vm_func* g = &program->funcs[i];
+        for (int j = 0; j < g->length; j++) {
+            vm_instr* instr = &g->code[j];
+            if (instr->c != (intptr_t)f) continue;
+            if (instr->handler == handlers[VM_CALL]) {
+                instr->handler = handlers[VM_NATIVE];
+            } else if (instr->handler == handlers[VM_TAILCALL]) {
+                instr->handler = handlers[VM_TAILNATIVE];
+            }
+        }
+    }
+}
+
+int64_t tier_call(const vm_func* f, const int64_t* args) {
+    long a[TIER_MAX_PARAMS] = {0};
+    for (int i = 0; i < f->params; i++) a[i] = args[i];
+    if (f->unit->prints) vm_flush();
+    int64_t result = f->native(a[0], a[1], a[2], a[3], a[4], a[5]);
+    if (f->unit->prints) f->unit->image.flush();
+    return result;
+}
+
+bool tier_prints(cfg* func) {
+    return func_calls(func, tier_prints_expr);
+}
+
+bool tier_prints_expr(expr* e) {
+    /* (a failed check prints its error through the runtime's buffer) */
+    return e->kind == EXPR_INDEX && e->checked;
+}
@@ -0,0 +1,297 @@
+#include "vm.h"
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+char vm_buffer[VM_BUFFER_SIZE];
+long vm_used = 0;
+
+/**********************************************************************
+ *                            INTERPRETER                             *
+ **********************************************************************/
+
+/* Each instruction's code ends by jumping straight to the next one's,
+ * rather than going back around a loop to a `switch`, so that the
+ * processor predicts each of those jumps on its own. */
+#define DISPATCH()  goto *pc->handler
+#define NEXT()      do { pc++; DISPATCH(); } while (0)
+#define JUMP() \
+    do { pc = (const vm_instr*)(intptr_t)pc->c; DISPATCH(); } while (0)
+
+#define A   r[pc->a]
+#define B   r[pc->b]
+#define C   r[pc->c]
+#define ITEMS(x)    ((const int64_t*)(intptr_t)(x))
+/* (arithmetic wraps around, as in generated code) */
+#define WRAP(x, op, y) ((int64_t)((uint64_t)(x) op (uint64_t)(y)))
+
+bool vm_run(vm_program* program, int64_t* result) {
+    static const void* const handlers[] = {
+        #define X(a, b) &&a,
+            X_VM_OP
+        #undef X
+    };
+    if (!program->threaded) vm_thread(program, handlers);
+
+    int64_t* stack = malloc(VM_STACK_SIZE * sizeof(*stack));
+    vm_frame* frames = malloc(VM_MAX_DEPTH * sizeof(*frames));
+    int64_t* stack_end = stack + VM_STACK_SIZE;
+    vm_frame* frames_end = frames + VM_MAX_DEPTH;
+
+    bool ok = true;
+    vm_frame* frame = frames;
+    int64_t* r = stack;
+    const vm_instr* pc = program->main->code;
+    if (r + program->main->size > stack_end) goto overflow;
+    DISPATCH();
+
+VM_MOVE:    A = B;                              NEXT();
+VM_LOADI:   A = pc->c;                          NEXT();
+VM_LOADG:   A = *ITEMS(pc->c);                  NEXT();
+VM_STOREG:  *(int64_t*)(intptr_t)pc->c = A;     NEXT();
+VM_FRAME:   A = (intptr_t)&B;                   NEXT();
+
+VM_ADD:     A = WRAP(B, +, C);                  NEXT();
+VM_SUB:     A = WRAP(B, -, C);                  NEXT();
+VM_MUL:     A = WRAP(B, *, C);                  NEXT();
+VM_DIV:
+    if (C == 0) goto divide_error;
+    /* (the one quotient that doesn't fit wraps around) */
+    A = C == -1 ? WRAP(0, -, B) : B / C;
+    NEXT();
+VM_MOD:
+    if (C == 0) goto divide_error;
+    A = C == -1 ? 0 : B % C;
+    NEXT();
+VM_EXP:     A = vm_exp(B, C);                   NEXT();
+VM_AND:     A = B & C;                          NEXT();
+VM_OR:      A = B | C;                          NEXT();
+VM_ADDI:    A = WRAP(B, +, pc->c);              NEXT();
+VM_MULI:    A = WRAP(B, *, pc->c);              NEXT();
+VM_NOT:     A = B ^ 1;                          NEXT();
+
+VM_EQ:      A = B == C;                         NEXT();
+VM_NE:      A = B != C;                         NEXT();
+VM_LT:      A = B < C;                          NEXT();
+VM_LE:      A = B <= C;                         NEXT();
+VM_GT:      A = B > C;                          NEXT();
+VM_GE:      A = B >= C;                         NEXT();
+VM_STREQ:
+    A = vm_str_equal((const char*)(intptr_t)B, (const char*)(intptr_t)C);
+    NEXT();
+
+VM_INDEX:   A = ITEMS(B)[C];                    NEXT();
+VM_INDEXI:  A = ITEMS(B)[pc->c];                NEXT();
+VM_CHECK:
+    /* (compared unsigned, a negative index is past the end too) */
+    if ((uint64_t)A >= (uint64_t)pc->c) goto bounds_error;
+    NEXT();
+
+VM_JMP:     JUMP();
+VM_JEQ:     if (A == B) JUMP();                 NEXT();
+VM_JNE:     if (A != B) JUMP();                 NEXT();
+VM_JLT:     if (A < B) JUMP();                  NEXT();
+VM_JLE:     if (A <= B) JUMP();                 NEXT();
+VM_JGT:     if (A > B) JUMP();                  NEXT();
+VM_JGE:     if (A >= B) JUMP();                 NEXT();
+VM_JEQI:    if (A == pc->b) JUMP();             NEXT();
+VM_JNEI:    if (A != pc->b) JUMP();             NEXT();
+VM_JLTI:    if (A < pc->b) JUMP();              NEXT();
+VM_JLEI:    if (A <= pc->b) JUMP();             NEXT();
+VM_JGTI:    if (A > pc->b) JUMP();              NEXT();
+VM_JGEI:    if (A >= pc->b) JUMP();             NEXT();
+
+VM_CALL: {
+    const vm_func* callee = (const vm_func*)(intptr_t)pc->c;
+    int64_t* fp = r + pc->a;
+    if (frame == frames_end || fp + callee->size > stack_end) goto overflow;
+    *frame++ = (vm_frame){ .pc = pc + 1, .fp = r };
+    r = fp;
+    pc = callee->code;
+    DISPATCH();
+}
+VM_TAILCALL: {
+    const vm_func* callee = (const vm_func*)(intptr_t)pc->c;
+    if (r + callee->size > stack_end) goto overflow;
+    memmove(r, &A, pc->b * sizeof(*r));
+    pc = callee->code;
+    DISPATCH();
+}
+VM_RET:
+    /* (where the caller finds it, in the register the frame began at) */
+    r[0] = A;
+    goto leave;
+VM_RETI:
+    r[0] = pc->c;
+leave:
+    if (frame == frames) {
+        *result = r[0];
+        goto done;
+    }
+    frame--;
+    r = frame->fp;
+    pc = frame->pc;
+    DISPATCH();
+
+VM_NATIVE:
+    A = tier_call((const vm_func*)(intptr_t)pc->c, &A);
+    NEXT();
+VM_TAILNATIVE:
+    r[0] = tier_call((const vm_func*)(intptr_t)pc->c, &A);
+    goto leave;
+VM_COUNT: {
+    vm_func* f = (vm_func*)(intptr_t)pc->c;
+    f->counts[pc->a]++;
+    if (--f->budget <= 0) tier_count(program, f, handlers);
+    NEXT();
+}
+
+VM_PRINTI:  vm_print_int(A);                    NEXT();
+VM_PRINTC:  vm_print_char(A);                   NEXT();
+VM_PRINTB:  vm_print_char(A ? '1' : '0');       NEXT();
+VM_PRINTS: {
+    vm_print_bytes((const char*)(intptr_t)A, ITEMS(A)[-1]);
+    NEXT();
+}
+
+bounds_error:
+    vm_flush();
+    fprintf(
+        stderr,
+        "error: index %ld is out of bounds of an array of length %ld\n",
+        (long)A,
+        (long)pc->c
+    );
+    ok = false;
+    goto done;
+divide_error:
+    vm_flush();
+    fprintf(stderr, "error: division by zero\n");
+    ok = false;
+    goto done;
+overflow:
+    vm_flush();
+    fprintf(stderr, "error: stack overflow\n");
+    ok = false;
+done:
+    vm_flush();
+    free(stack);
+    free(frames);
+    return ok;
+}
+
+void vm_thread(vm_program* program, const void* const* handlers) {
+    for (int i = 0; i < program->func_count; i++) {
+        vm_func* f = &program->funcs[i];
+        for (int j = 0; j < f->length; j++) {
+            vm_instr* instr = &f->code[j];
+            if (vm_is_jump(instr->op)) {
+                instr->c = (intptr_t)&f->code[instr->c];
+            }
+            instr->handler = handlers[instr->op];
+        }
+    }
+    program->threaded = true;
+}
+
+bool vm_is_jump(vm_op_t op) {
+    return op >= VM_JMP && op <= VM_JGEI;
+}
+
+bool vm_is_pure(vm_op_t op) {
+    return op >= VM_MOVE && op <= VM_INDEXI && op != VM_STOREG;
+}
+
+void vm_destroy(vm_program* program) {
+    /* (first, as compiled code refers to the rest) */
+    if (program->tier) tier_destroy(program->tier);
+    for (int i = 0; i < program->func_count; i++) {
+        free(program->funcs[i].code);
+    }
+    free(program->funcs);
+    for (int i = 0; i < program->block_count; i++) {
+        free(program->blocks[i]);
+    }
+    free(program->blocks);
+    if (program->statics) {
+        munmap(
+            program->statics,
+            program->statics_size > 0 ? program->statics_size : 1
+        );
+    }
+    ht_destroy(program->globals);
+    free(program);
+}
+
+int64_t vm_exp(int64_t base, int64_t power) {
+    /* A negative power gives `1 / base^-power`, truncated: 0, unless the
+     * base is 1 or -1, whose powers only depend on whether the power is
+     * odd. */
+    if (power < 0) {
+        if (base == 1) return 1;
+        if (base == -1) return power & 1 ? -1 : 1;
+        return 0;
+    }
+    uint64_t result = 1;
+    uint64_t square = base;
+    for (; power != 0; power >>= 1) {
+        if (power & 1) result *= square;
+        square *= square;
+    }
+    return result;
+}
+
+bool vm_str_equal(const char* a, const char* b) {
+    int64_t length = ((const int64_t*)a)[-1];
+    return length == ((const int64_t*)b)[-1] && memcmp(a, b, length) == 0;
+}
+
+/**********************************************************************
+ *                               PRINT                                *
+ **********************************************************************/
+
+/* Output is buffered as the runtime buffers it, so a program makes about
+ * as many `write` calls on the VM as compiled. */
+
+void vm_flush() {
+    const char* s = vm_buffer;
+    while (vm_used > 0) {
+        ssize_t written = write(STDOUT_FILENO, s, vm_used);
+        if (written < 0 && errno == EINTR) continue;
+        /* (nowhere to report an error to; the output is lost) */
+        if (written <= 0) break;
+        s += written;
+        vm_used -= written;
+    }
+    vm_used = 0;
+}
+
+void vm_print_bytes(const char* s, long length) {
+    while (length > 0) {
+        if (vm_used == VM_BUFFER_SIZE) vm_flush();
+        long n = VM_BUFFER_SIZE - vm_used;
+        if (n > length) n = length;
+        memcpy(vm_buffer + vm_used, s, n);
+        vm_used += n;
+        s += n;
+        length -= n;
+    }
+}
+
+void vm_print_int(int64_t n) {
+    /* the digits, last first, at the end of a buffer of their own: */
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    uint64_t magnitude = n < 0 ? -(uint64_t)n : (uint64_t)n;
+    do {
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (n < 0) vm_print_char('-');
+    vm_print_bytes(p, digits + sizeof(digits) - p);
+}
+
+void vm_print_char(char c) {
+    if (vm_used == VM_BUFFER_SIZE) vm_flush();
+    vm_buffer[vm_used++] = c;
+}